@@ -13,6 +13,23 @@
 #define MM_ACCESS (0x1 << 10)
 #define MM_ACCESS_PERMISSION (0x01 << 6)  // TODO: Not sure what this means
 
+// AP[2:1] = 0b11: read-only for both EL1 and EL0. Writing to a page with this
+// set causes a permission fault.
+#define MM_ACCESS_PERMISSION_RO (0x03 << 6)
+
+// Checks and clears write access for EL0 in a page descriptor (AP[2:1] = 0b01
+// is read/write for EL0, 0b11 is read-only).
+#define pte_write(pte) \
+    (((pte) & MM_ACCESS_PERMISSION_RO) == MM_ACCESS_PERMISSION)
+#define pte_wrprotect(pte) ((pte) | MM_ACCESS_PERMISSION_RO)
+
+// Unprivileged execute never: EL0 can't execute from the page.
+#define MM_UXN (0x1UL << 54)
+
+// Bits 47:12 of a descriptor hold the output address (the upper attributes,
+// such as MM_UXN, start at bit 52).
+#define MM_ADDR_MASK 0x0000fffffffff000UL
+
 /*
  * Memory region attributes (more info on page 2609 of the AArch64 ref manual).
  *
@@ -46,6 +63,10 @@
 #define MMU_DEVICE_FLAGS (MM_TYPE_BLOCK | (MT_DEVICE_nGnRnE << 2) | MM_ACCESS)
 #define MMU_PTE_FLAGS \
     (MM_TYPE_PAGE | (MT_NORMAL_NC << 2) | MM_ACCESS | MM_ACCESS_PERMISSION)
+// Kernel only (no MM_ACCESS_PERMISSION: EL0 can't touch it).
+#define MMU_PTE_FLAGS_KERNEL (MM_TYPE_PAGE | (MT_NORMAL_NC << 2) | MM_ACCESS)
+#define MMU_PTE_FLAGS_RO \
+    (MM_TYPE_PAGE | (MT_NORMAL_NC << 2) | MM_ACCESS | MM_ACCESS_PERMISSION_RO)
 
 // Used for the Translation Control Register
 #define TCR_T0SZ (64 - 48)
@@ -26,6 +26,19 @@
 #define HCR_RW (1 << 31)
 #define HCR_VALUE HCR_RW
 
+// ***************************************
+// CNTHCTL_EL2, Counter-timer Hypervisor Control register, Page 2158 of
+// AArch64-Reference-Manual.
+// ***************************************
+
+#define CNTHCTL_EL1PCTEN (1 << 0)  // EL1 can read the physical counter
+#define CNTHCTL_EL1PCEN (1 << 1)   // EL1 can use the physical timer
+#define CNTHCTL_VALUE (CNTHCTL_EL1PCTEN | CNTHCTL_EL1PCEN)
+
+// CNTV_CTL_EL0, Counter-timer Virtual Timer Control register.
+#define CNTV_CTL_ENABLE (1 << 0)
+#define CNTV_CTL_IMASK (1 << 1)
+
 // ***************************************
 // SCR_EL3, Secure Configuration Register (EL3), Page 2648 of
 // AArch64-Reference-Manual.
@@ -51,7 +64,22 @@
 // ***************************************
 
 #define ESR_ELx_EC_SHIFT 26
+#define ESR_ELx_EC_MASK 0x3f
+#define ESR_ELx_EC_FP_ASIMD 0x07  // Access to FP/SIMD trapped by CPACR_EL1
 #define ESR_ELx_EC_SVC64 0x15
+#define ESR_ELx_EC_IABT_LOW 0x20  // Instruction abort from EL0
 #define ESR_ELx_EC_DABT_LOW 0x24
 
+// Data aborts: set if the access was a write.
+#define ESR_ELx_WNR (1 << 6)
+
+// ***************************************
+// CPACR_EL1, Architectural Feature Access Control Register. Page 2411 of
+// AArch64-Reference-Manual.
+// ***************************************
+
+// FPEN (bits 21:20) controls access to FP/SIMD registers.
+#define CPACR_EL1_FPEN_TRAP_EL0 (1 << 20)  // Trap at EL0, allow at EL1
+#define CPACR_EL1_FPEN_NO_TRAP (3 << 20)   // Allow at EL0 and EL1
+
 #endif
\ No newline at end of file
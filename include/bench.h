@@ -0,0 +1,11 @@
+#ifndef _BENCH_H
+#define _BENCH_H
+
+// Micro-benchmarks that can be run at boot (see kernel_main).
+void printf_bench(void);
+
+// Need a running system (they sleep), so they're console commands.
+void blk_bench(void);
+void dma_bench(void);
+
+#endif /*_BENCH_H */
@@ -0,0 +1,58 @@
+#ifndef _BLKDEV_H
+#define _BLKDEV_H
+
+#include "list.h"
+#include "sched.h"
+#include "spinlock.h"
+
+// Size of a block (a sector of the SD card). Block numbers and counts are in
+// these units.
+#define BLOCK_SIZE 512
+
+// Longest name of a block device, including the NUL.
+#define BDEV_NAME_LEN 16
+
+struct block_device;
+
+// What a driver does for the block layer. read transfers count consecutive
+// blocks, starting at block, into bufs (one BLOCK_SIZE buffer per block, so
+// that the buffer cache doesn't need them to be contiguous). Returns 0 or -1.
+// The block layer never has two requests in flight on the same device, and
+// count is never more than max_blocks.
+struct block_device_operations {
+    int (*read)(struct block_device *bdev, unsigned long block,
+                unsigned int count, char **bufs);
+};
+
+struct block_device {
+    char name[BDEV_NAME_LEN];
+    unsigned long nr_blocks;
+    unsigned int max_blocks;
+    const struct block_device_operations *ops;
+    void *private_data;
+
+    // A task doing I/O on the device sets busy. The others sleep on wait.
+    // Drivers may take milliseconds per request, so this isn't a spinlock.
+    spinlock_t lock;
+    int busy;
+    struct wait_queue_head wait;
+
+    // Read-ahead state of the buffer cache (see buffer.c). Protected by the
+    // buffer cache lock.
+    unsigned long ra_next;
+    unsigned int ra_window;
+
+    // Statistics.
+    unsigned long requests;
+    unsigned long blocks;
+
+    struct list_head list;
+};
+
+int register_blkdev(struct block_device *bdev);
+struct block_device *lookup_bdev(const char *name);
+int blkdev_read(struct block_device *bdev, unsigned long block,
+                unsigned int count, char **bufs);
+void blkdev_stats_dump(void);
+
+#endif /*_BLKDEV_H */
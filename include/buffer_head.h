@@ -0,0 +1,45 @@
+#ifndef _BUFFER_HEAD_H
+#define _BUFFER_HEAD_H
+
+#include "list.h"
+
+// Number of blocks that the buffer cache holds.
+#define NR_BUFFERS 512
+
+// Buckets of the hash table that finds a block in the cache (a power of 2).
+#define BUFFER_HASH_SIZE 128
+
+// Read-ahead: when a task reads blocks in order, a miss reads the next
+// blocks in the same request. The window starts at BUFFER_RA_MIN blocks and
+// doubles with every sequential miss up to BUFFER_RA_MAX.
+#define BUFFER_RA_MIN 4
+#define BUFFER_RA_MAX 64
+
+// b_state bits.
+#define BH_Uptodate 0x1  // b_data holds the block.
+#define BH_Lock 0x2      // The block is being read.
+
+struct block_device;
+
+// A block in the cache. bread returns it with a reference, and the data stays
+// valid until brelse. Buffers without references are on the LRU list, and the
+// least recently used one is reused when a block that isn't cached is read.
+struct buffer_head {
+    struct block_device *b_bdev;
+    unsigned long b_blocknr;
+    char *b_data;
+    int b_count;
+    unsigned int b_state;
+
+    struct list_head b_hash;
+    struct list_head b_lru;
+};
+
+int buffer_init(void);
+struct buffer_head *bread(struct block_device *bdev, unsigned long block);
+void brelse(struct buffer_head *bh);
+void invalidate_bdev(struct block_device *bdev);
+void buffer_set_readahead(int enabled);
+void buffer_stats_dump(void);
+
+#endif /*_BUFFER_HEAD_H */
@@ -0,0 +1,13 @@
+#ifndef _CONSOLE_H
+#define _CONSOLE_H
+
+// Size of the buffer between the UART IRQ and the console work (a power of
+// 2). Characters that arrive while it's full are dropped.
+#define CONSOLE_BUF_SIZE 128
+
+// Longest command line (including the NUL).
+#define CONSOLE_LINE_MAX 64
+
+int console_init(void);
+
+#endif /*_CONSOLE_H */
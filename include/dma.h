@@ -0,0 +1,86 @@
+#ifndef _DMA_H
+#define _DMA_H
+
+#include "mm.h"
+#include "sched.h"
+
+// Channels the kernel may use (bits 0 - 14). The firmware keeps some of them
+// for the VideoCore; 2, 4 and 5 are full channels (wide transfers and no 64KB
+// limit) that it leaves alone.
+#define DMA_CHANNEL_MASK 0x0034
+#define DMA_MAX_CHANNELS 15
+
+// Most bytes in a control block (TXFR_LEN has 30 bits on a full channel).
+// Longer copies are split into a chain.
+#define DMA_MAX_LEN (1UL << 29)
+
+// Control blocks per channel: the channel's page of them.
+#define DMA_MAX_CBS (PAGE_SIZE / sizeof(struct dma_cb))
+
+// What the engine reads to do a transfer. Addresses are bus addresses (see
+// dma_bus_addr), and nextconbk links the next block of a chain (0 ends it).
+// Control blocks must be 32-byte aligned.
+struct dma_cb {
+    unsigned int ti;
+    unsigned int source_ad;
+    unsigned int dest_ad;
+    unsigned int txfr_len;
+    unsigned int stride;
+    unsigned int nextconbk;
+    unsigned int reserved[2];
+} __attribute__((aligned(32)));
+
+struct dma_chan;
+
+// Called from the completion interrupt, with IRQs disabled. error is set if
+// the engine reported one.
+typedef void (*dma_callback_t)(struct dma_chan *chan, int error, void *data);
+
+struct dma_chan {
+    int id;
+    unsigned long base;
+    int in_use;
+
+    // A page of control blocks for the owner of the channel.
+    struct dma_cb *cbs;
+
+    // Completion of the transfers started with DMA_TI_INTEN in their last
+    // block: the interrupt sets done (and error) and wakes wait up. The timer
+    // of dma_wait sets timed_out if it doesn't come.
+    int done;
+    int error;
+    int timed_out;
+    struct wait_queue_head wait;
+    dma_callback_t callback;
+    void *callback_data;
+
+    // Statistics.
+    unsigned long transfers;
+    unsigned long bytes;
+    unsigned long errors;
+};
+
+int dma_init(void);
+struct dma_chan *dma_request_channel(void);
+void dma_release_channel(struct dma_chan *chan);
+void dma_set_callback(struct dma_chan *chan, dma_callback_t fn, void *data);
+
+unsigned int dma_bus_addr(unsigned long pa);
+unsigned int dma_cb_bus_addr(struct dma_cb *cb);
+int dma_prep_memcpy(struct dma_chan *chan, int first, unsigned long dst,
+                    unsigned long src, unsigned long len);
+void dma_prep_mem_to_dev(struct dma_chan *chan, int i, unsigned long src,
+                         unsigned long reg, unsigned long len, int dreq);
+void dma_start(struct dma_chan *chan, int first, int nr, int irq);
+int dma_busy(struct dma_chan *chan);
+int dma_poll(struct dma_chan *chan);
+int dma_wait(struct dma_chan *chan);
+
+int dma_copy_page(unsigned long dst, unsigned long src);
+int dma_zero_page(unsigned long page);
+int dma_copy_pages(const unsigned long *dst, const unsigned long *src,
+                   int nr);
+void dma_set_page_ops(int enabled);
+void dma_stats_dump(void);
+
+#endif /*_DMA_H */
@@ -0,0 +1,53 @@
+#ifndef _ELF_H
+#define _ELF_H
+
+// The subset of the ELF64 format that exec needs (see the System V ABI and the
+// ELF for the Arm 64-bit Architecture supplement).
+
+#define EI_NIDENT 16
+#define EI_CLASS 4
+#define EI_DATA 5
+
+#define ELFMAG "\177ELF"
+#define SELFMAG 4
+#define ELFCLASS64 2
+#define ELFDATA2LSB 1
+
+#define ET_EXEC 2
+#define EM_AARCH64 183
+
+// Program header types and flags.
+#define PT_LOAD 1
+#define PF_X 0x1
+#define PF_W 0x2
+#define PF_R 0x4
+
+typedef struct {
+    unsigned char e_ident[EI_NIDENT];
+    unsigned short e_type;
+    unsigned short e_machine;
+    unsigned int e_version;
+    unsigned long e_entry;
+    unsigned long e_phoff;
+    unsigned long e_shoff;
+    unsigned int e_flags;
+    unsigned short e_ehsize;
+    unsigned short e_phentsize;
+    unsigned short e_phnum;
+    unsigned short e_shentsize;
+    unsigned short e_shnum;
+    unsigned short e_shstrndx;
+} Elf64_Ehdr;
+
+typedef struct {
+    unsigned int p_type;
+    unsigned int p_flags;
+    unsigned long p_offset;
+    unsigned long p_vaddr;
+    unsigned long p_paddr;
+    unsigned long p_filesz;
+    unsigned long p_memsz;
+    unsigned long p_align;
+} Elf64_Phdr;
+
+#endif /*_ELF_H */
@@ -0,0 +1,6 @@
+#ifndef _EMMC_H
+#define _EMMC_H
+
+int emmc_init(void);
+
+#endif /*_EMMC_H */
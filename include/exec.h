@@ -0,0 +1,16 @@
+#ifndef _EXEC_H
+#define _EXEC_H
+
+#include "mm.h"
+#include "vdso.h"
+
+// Layout of a user address space. Programs are linked at 0x10000 (see
+// user/user.ld) and the stack ends right below the vDSO page, so the segments
+// of a program must end below USER_STACK_TOP - USER_STACK_SIZE. The stack pages
+// are only allocated when touched.
+#define USER_STACK_TOP VDSO_DATA_ADDR
+#define USER_STACK_SIZE (16 * PAGE_SIZE)
+
+int do_exec(const char *path);
+
+#endif /*_EXEC_H */
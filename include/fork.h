@@ -2,6 +2,7 @@
 #define _FORK_H
 
 #include "sched.h"
+#include "sys.h"
 
 // PSR bits
 #define PSR_MODE_EL0t 0x00000000  // Make sure we return to EL0 level
@@ -12,10 +13,12 @@
 #define PSR_MODE_EL3t 0x0000000c
 #define PSR_MODE_EL3h 0x0000000d
 
+void fork_init(void);
 int copy_process(unsigned long clone_flags, unsigned long fn,
-                 unsigned long arg);
-int move_to_user_mode(unsigned long start, unsigned long size,
-                      unsigned long pc);
+                 unsigned long arg, unsigned long stack);
+struct mm_struct *mm_alloc(void);
+void mmget(struct mm_struct *mm);
+void mmput(struct mm_struct *mm);
 struct pt_regs *task_pt_regs(struct task_struct *tsk);
 
 // Order here is very important! This needs to mimic the same way that
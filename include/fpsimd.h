@@ -0,0 +1,33 @@
+#ifndef _FPSIMD_H
+#define _FPSIMD_H
+
+// Offsets into struct fpsimd_state used by fpsimd.S.
+#define FPSIMD_FPSR (16 * 32)
+#define FPSIMD_FPCR (16 * 32 + 4)
+
+#ifndef __ASSEMBLER__
+
+// FP/SIMD registers of a task: q0 - q31 (128 bits each), fpsr and fpcr. The
+// kernel is built with -mgeneral-regs-only, so these registers only ever hold
+// user state.
+struct fpsimd_state {
+    unsigned long vregs[64] __attribute__((aligned(16)));
+    unsigned int fpsr;
+    unsigned int fpcr;
+};
+
+struct task_struct;
+
+void fpsimd_init(void);
+void fpsimd_thread_switch(struct task_struct *next);
+void fpsimd_fork(struct task_struct *child);
+void fpsimd_exit(struct task_struct *tsk);
+void fpsimd_flush_thread(void);
+void do_fpsimd_acc(void);
+
+// Implemented in fpsimd.S
+void fpsimd_save_state(struct fpsimd_state *state);
+void fpsimd_load_state(struct fpsimd_state *state);
+
+#endif
+#endif /*_FPSIMD_H */
@@ -0,0 +1,61 @@
+#ifndef _FS_H
+#define _FS_H
+
+// Max number of open files per task (the size of its fd table).
+#define NR_OPEN 16
+
+// f_mode bits.
+#define FMODE_READ 0x1
+#define FMODE_WRITE 0x2
+
+struct file;
+
+// What a kind of file (e.g. a pipe) does on read/write and when its last
+// reference goes away. buf is a user pointer. read and write return the number
+// of bytes transferred or -1. llseek moves f_pos (whence is one of SEEK_*) and
+// returns the new position or -1. fault returns the (physical) page at page
+// offset pgoff of the file with a new reference, or 0; files without it can't
+// be mmapped. A missing operation makes the syscall fail.
+struct file_operations {
+    long (*read)(struct file *file, char *buf, unsigned long count);
+    long (*write)(struct file *file, const char *buf, unsigned long count);
+    long (*llseek)(struct file *file, long offset, int whence);
+    unsigned long (*fault)(struct file *file, unsigned long pgoff);
+    void (*release)(struct file *file);
+};
+
+// An open file. Every fd that refers to it (e.g. the copy that a child gets on
+// fork) holds a reference, and so do a syscall while it uses it and the VMAs
+// that map it.
+// f_pos is where the next read starts, for files that have positions. It
+// isn't locked: tasks that read the same open file at the same time may get
+// the same bytes.
+struct file {
+    int f_count;
+    unsigned int f_mode;
+    unsigned long f_pos;
+    const struct file_operations *f_op;
+    void *private_data;
+};
+
+void files_init(void);
+struct file *alloc_file(const struct file_operations *f_op,
+                        unsigned int f_mode, void *private_data);
+void get_file(struct file *file);
+void fput(struct file *file);
+
+// The fd table of the current task. Threads (CLONE_VM) get a copy of it too,
+// just like forked children, so only the task itself ever changes its table.
+int fd_install(struct file *file);
+struct file *fget(int fd);
+int close_fd(int fd);
+
+struct task_struct;
+void dup_fds(struct task_struct *p);
+void exit_files(struct task_struct *p);
+
+long vfs_read(struct file *file, char *buf, unsigned long count);
+long vfs_write(struct file *file, const char *buf, unsigned long count);
+long vfs_llseek(struct file *file, long offset, int whence);
+
+#endif /*_FS_H */
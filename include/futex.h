@@ -0,0 +1,20 @@
+#ifndef _FUTEX_H
+#define _FUTEX_H
+
+// Futexes let user space build locks that only enter the kernel when they are
+// contended: the lock is a 32-bit word in user memory that is updated with
+// atomics, and FUTEX_WAIT/FUTEX_WAKE (see sys.h) are only used to sleep until
+// it changes and to wake up sleepers.
+//
+// Waiters are keyed by the physical address of the word, so the same word seen
+// through different mappings (or by different threads) is the same futex.
+// They are hashed into FUTEX_HASH_SIZE buckets, each with its own lock.
+
+#define FUTEX_HASH_BITS 6
+#define FUTEX_HASH_SIZE (1 << FUTEX_HASH_BITS)
+
+void futex_init(void);
+int futex_wait(unsigned int *uaddr, unsigned int val);
+int futex_wake(unsigned int *uaddr, int nr_wake);
+
+#endif /*_FUTEX_H */
@@ -0,0 +1,31 @@
+#ifndef _HRTIMER_H
+#define _HRTIMER_H
+
+// Maximum number of hrtimers queued at the same time on a CPU.
+#define HRTIMER_HEAP_SIZE 64
+
+// High resolution timer. expires is an absolute value of the generic counter
+// (cntvct_el0), so the resolution is one counter cycle instead of a tick.
+// function runs from the timer interrupt (with IRQs disabled). Like timer_list,
+// the struct is owned by the caller and must stay valid until it fires or is
+// cancelled.
+//
+// hrtimers are per CPU: they must be started and cancelled on the same CPU.
+struct hrtimer {
+    unsigned long expires;
+    void (*function)(struct hrtimer *);
+    // Position in the heap of the CPU, or -1 when not queued.
+    int index;
+};
+
+void hrtimer_init(struct hrtimer *timer, void (*function)(struct hrtimer *));
+int hrtimer_start(struct hrtimer *timer, unsigned long expires);
+int hrtimer_cancel(struct hrtimer *timer);
+
+static inline int hrtimer_queued(const struct hrtimer *timer) {
+    return timer->index >= 0;
+}
+
+long hrtimer_nanosleep(unsigned long ns);
+
+#endif /*_HRTIMER_H */
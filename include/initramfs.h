@@ -0,0 +1,30 @@
+#ifndef _INITRAMFS_H
+#define _INITRAMFS_H
+
+// The initramfs is a newc cpio archive linked into the kernel image (see
+// src/initramfs.S and scripts/mkinitramfs.py). It is read-only: files are
+// used in place and, except for the last partial page of a file, never copied
+// out of the archive.
+
+struct file;
+
+// A regular file in the archive. data is a kernel virtual address and, for
+// files built by mkinitramfs.py, page aligned.
+struct initramfs_file {
+    const char *data;
+    unsigned long size;
+    unsigned long mode;
+};
+
+// Looks up path (leading slashes are ignored). Returns 0 and fills file if it
+// names a regular file, -1 otherwise.
+int initramfs_lookup(const char *path, struct initramfs_file *file);
+
+// Opens the regular file path for reading (see sys_open). Returns a file with
+// one reference, or 0.
+struct file *initramfs_open(const char *path);
+
+extern char initramfs_start[];
+extern char initramfs_end[];
+
+#endif /*_INITRAMFS_H */
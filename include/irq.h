@@ -1,10 +1,44 @@
 #ifndef _IRQ_H
 #define _IRQ_H
 
-void enable_interrupt_controller(void);
+// IRQ numbers used by request_irq. GPU IRQs 0 - 63 map to the bits of
+// IRQ_PENDING_1 (0 - 31) and IRQ_PENDING_2 (32 - 63). The ARM specific IRQs
+// in bits 0 - 7 of IRQ_BASIC_PENDING come after them, followed by the sources
+// of the local (per-core) controller (see peripherals/local.h).
+#define IRQ_SYSTEM_TIMER_1 1
+#define IRQ_DMA(n) (16 + (n))  // Channels 0 - 10
+#define IRQ_UART 57
+#define IRQ_ARM_BASE 64
+#define IRQ_LOCAL_BASE (IRQ_ARM_BASE + 8)
+#define IRQ_LOCAL_CNTV (IRQ_LOCAL_BASE + 3)
+#define NR_IRQS (IRQ_LOCAL_BASE + 12)
+
+// Number of buckets in the latency histograms. Bucket n counts the handlers
+// that finished between 2^(n-1) and 2^n - 1 generic counter ticks after the
+// interrupt was taken (bucket 0: less than a tick). The last bucket also
+// counts everything above it.
+#define IRQ_HIST_BUCKETS 16
+
+#ifndef __ASSEMBLER__
+
+typedef void (*irq_handler_t)(int irq, void *data);
+
+struct irq_stat {
+    unsigned long count;
+    unsigned long hist[IRQ_HIST_BUCKETS];
+};
+
+void irq_init(void);
+int request_irq(int irq, irq_handler_t handler, void *data);
+void free_irq(int irq);
+void irq_stats_dump(void);
 
 void irq_vector_init(void);
 void enable_irq(void);
 void disable_irq(void);
+unsigned long local_irq_save(void);
+void local_irq_restore(unsigned long flags);
+unsigned long irqs_disabled(void);
 
-#endif /*_IRQ_H */
\ No newline at end of file
+#endif
+#endif /*_IRQ_H */
@@ -0,0 +1,42 @@
+#ifndef _KSTACK_H
+#define _KSTACK_H
+
+// Kernel stacks are THREAD_SIZE bytes. The size can be changed at build time
+// (e.g. -DTHREAD_SIZE_ORDER=2 for 16KB stacks).
+#ifndef THREAD_SIZE_ORDER
+#define THREAD_SIZE_ORDER 1
+#endif
+
+// 12 = PAGE_SHIFT
+#define THREAD_SHIFT (12 + THREAD_SIZE_ORDER)
+#define THREAD_SIZE (1 << THREAD_SHIFT)
+
+// Every CPU handles its interrupts on a stack of its own (see el1_irq).
+#define IRQ_STACK_SIZE THREAD_SIZE
+
+// Small per-CPU stack used only to report a kernel stack overflow.
+#define OVERFLOW_STACK_SIZE 1024
+
+// Task and IRQ stacks are mapped page by page in their own area of the kernel
+// address space: the second PGD entry, VA_START + (1 << PGD_SHIFT). Every stack
+// gets a slot of 2 * THREAD_SIZE bytes, aligned to its size. The stack is the
+// upper half and the lower half is never mapped, so running off the bottom of
+// a stack faults instead of silently overwriting whatever is below.
+//
+// It also means that an address in this area with bit THREAD_SHIFT clear is in
+// a guard page, which is what el1_sync checks before saving any register.
+#define KSTACK_AREA_START 0xffff008000000000
+#define KSTACK_AREA_BIT 39  // PGD_SHIFT. Set for all the addresses in the area.
+#define KSTACK_SLOT_SIZE (2 * THREAD_SIZE)
+#define NR_KSTACK_SLOTS 128
+
+#ifndef __ASSEMBLER__
+
+unsigned long alloc_kernel_stack(void);
+void free_kernel_stack(unsigned long stack);
+unsigned long stack_usage(unsigned long stack, unsigned long size);
+int irq_stack_init(void);
+void stack_watermark_dump(void);
+
+#endif
+#endif /*_KSTACK_H */
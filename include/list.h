@@ -0,0 +1,73 @@
+#ifndef _LIST_H
+#define _LIST_H
+
+// Intrusive circular doubly-linked list (same idea as the Linux one). The
+// list_head is embedded in the struct that we want to link, so adding and
+// removing never allocates, and removing an element only needs the element
+// itself (O(1)).
+struct list_head {
+    struct list_head *next;
+    struct list_head *prev;
+};
+
+#define LIST_HEAD_INIT(name) \
+    { &(name), &(name) }
+
+// Gets the struct that contains the member pointed by ptr.
+#define container_of(ptr, type, member) \
+    ((type *)((char *)(ptr) - __builtin_offsetof(type, member)))
+
+#define list_entry(ptr, type, member) container_of(ptr, type, member)
+
+static inline void INIT_LIST_HEAD(struct list_head *list) {
+    list->next = list;
+    list->prev = list;
+}
+
+static inline void __list_add(struct list_head *new, struct list_head *prev,
+                              struct list_head *next) {
+    next->prev = new;
+    new->next = next;
+    new->prev = prev;
+    prev->next = new;
+}
+
+// Adds new right after head.
+static inline void list_add(struct list_head *new, struct list_head *head) {
+    __list_add(new, head, head->next);
+}
+
+// Adds new right before head (at the end of the list).
+static inline void list_add_tail(struct list_head *new,
+                                 struct list_head *head) {
+    __list_add(new, head->prev, head);
+}
+
+// Removes entry and leaves it pointing to itself, so list_empty(entry) tells
+// whether it's linked somewhere.
+static inline void list_del_init(struct list_head *entry) {
+    entry->next->prev = entry->prev;
+    entry->prev->next = entry->next;
+    INIT_LIST_HEAD(entry);
+}
+
+static inline int list_empty(const struct list_head *head) {
+    return head->next == head;
+}
+
+// Moves all the entries of list to head (which must be empty) and leaves list
+// empty.
+static inline void list_replace_init(struct list_head *list,
+                                     struct list_head *head) {
+    if (list_empty(list)) {
+        INIT_LIST_HEAD(head);
+        return;
+    }
+    head->next = list->next;
+    head->prev = list->prev;
+    head->next->prev = head;
+    head->prev->next = head;
+    INIT_LIST_HEAD(list);
+}
+
+#endif /*_LIST_H */
@@ -72,7 +72,17 @@
 // 4MB the kernel is at address 0, and the stack grows downward so we
 // need to make sure that the stack doesn't overwrite the kernel.
 #define LOW_MEMORY (2 * SECTION_SIZE)
-#define HIGH_MEMORY DEVICE_BASE
+
+// The kernel log (see printk.c) lives at the top of RAM, right below the
+// devices. The page allocator doesn't hand it out and boot doesn't clear it,
+// so whatever was logged before a hang can still be read after a reset. It
+// holds one page of headers plus a ring of LOG_BUF_SIZE bytes per CPU (4 =
+// NR_CPUS).
+#define LOG_BUF_SIZE (2 * PAGE_SIZE)
+#define LOG_AREA_SIZE (PAGE_SIZE + 4 * LOG_BUF_SIZE)
+#define LOG_AREA_START (DEVICE_BASE - LOG_AREA_SIZE)
+
+#define HIGH_MEMORY LOG_AREA_START
 
 // 16KB
 #define STACK_SIZE (16384)
@@ -96,27 +106,62 @@
 #define PUD_SHIFT (PAGE_SHIFT + 2 * TABLE_SHIFT)
 #define PMD_SHIFT (PAGE_SHIFT + TABLE_SHIFT)
 
-// We have a PGD, PUD and the Block. Each takes 1 page.
-#define PG_DIR_SIZE (3 * PAGE_SIZE)
+// We have a PGD, PUD and the Block (PMD) for the first 1GB, plus a second PMD
+// for the ARM local peripherals. Each takes 1 page.
+#define PG_DIR_SIZE (4 * PAGE_SIZE)
 
 // 1 for PGD, 1 for PUD, one for the actual Block. Note that the PMD is not used
 // in this calculation because we're using Section mapping.
 #define PGDIR_SIZE (3 * PAGE_SIZE)
 
+// mmap places its areas in [MMAP_BASE, MMAP_END), well above the program and
+// its stack (see exec.h). All of it is covered by the same PUD entry.
+#define MMAP_BASE 0x10000000
+#define MMAP_END 0x40000000
+
+#define PAGE_ALIGN(addr) (((addr) + PAGE_SIZE - 1) & PAGE_MASK)
+
+// Why a page fault happened (for handle_mm_fault). Reads have neither.
+#define FAULT_FLAG_WRITE 0x1
+#define FAULT_FLAG_EXEC 0x2
+
 #ifndef __ASSEMBLER__
 
 unsigned long get_free_page();
+void get_page(unsigned long p);
+unsigned int page_count(unsigned long p);
 void free_page(unsigned long p);
 void memzero(unsigned long src, unsigned long n);
 unsigned long memcpy(unsigned long dst, unsigned long src, unsigned long n);
 
 unsigned long allocate_kernel_page();
-unsigned long allocate_user_page(struct task_struct *task, unsigned long va);
-int copy_virt_memory(struct task_struct *dst);
-int map_page(struct task_struct *task, unsigned long va, unsigned long page);
+int map_kernel_page(unsigned long va, unsigned long page, unsigned long flags);
+unsigned long unmap_kernel_page(unsigned long va);
+int copy_virt_memory(struct mm_struct *dst, struct mm_struct *src);
+int map_page(struct mm_struct *mm, unsigned long va, unsigned long page);
+int map_user_page(struct mm_struct *mm, unsigned long va, unsigned long page,
+                  unsigned long flags);
+int map_page_prot(struct mm_struct *mm, unsigned long va, unsigned long page,
+                  unsigned long flags);
+unsigned long user_virt_to_phys(struct mm_struct *mm, unsigned long va,
+                                unsigned long *pte);
 unsigned long map_table(unsigned long *, unsigned long shift, unsigned long va,
                         int *new_table);
-void map_table_entry(unsigned long *table, unsigned long va, unsigned long pa);
+void map_table_entry(unsigned long *table, unsigned long va, unsigned long pa,
+                     unsigned long flags);
+struct vm_area_struct *find_vma(struct mm_struct *mm, unsigned long va);
+int handle_mm_fault(struct mm_struct *mm, unsigned long addr,
+                    unsigned long fault_flags);
+unsigned long loan_user_page(struct mm_struct *mm, unsigned long va);
+void zap_user_range(struct mm_struct *mm, unsigned long start,
+                    unsigned long end);
+int remap_user_page(struct mm_struct *mm, unsigned long va,
+                    unsigned long page);
+void exit_mmap(struct mm_struct *mm);
+
+long do_mmap(unsigned long addr, unsigned long len, unsigned long prot,
+             unsigned long flags, struct file *file, unsigned long offset);
+int do_munmap(struct mm_struct *mm, unsigned long start, unsigned long len);
 int do_mem_abort(unsigned long addr, unsigned long esr);
 
 extern unsigned long pg_dir;
@@ -0,0 +1,34 @@
+#ifndef _PAGEMAP_H
+#define _PAGEMAP_H
+
+// Buckets of the hash table that finds a page in the page cache (a power of
+// 2).
+#define PAGE_CACHE_HASH_SIZE 64
+
+struct address_space;
+
+// What a filesystem does for the page cache. readpage returns a page
+// (physical address) with the data at page index of the file and a reference
+// for the caller, or 0 if index is past the end of the file or there's no
+// memory. The part of the page after the end of the file must be zero.
+struct address_space_operations {
+    unsigned long (*readpage)(struct address_space *mapping,
+                              unsigned long index);
+};
+
+// The cached pages of a file. Every open file and every mapping of the same
+// file go through the same address_space, so they all share its pages.
+struct address_space {
+    const struct address_space_operations *a_ops;
+    void *host;
+    unsigned long nrpages;
+};
+
+void page_cache_init(void);
+unsigned long find_get_page(struct address_space *mapping,
+                            unsigned long index);
+unsigned long read_cache_page(struct address_space *mapping,
+                              unsigned long index);
+void page_cache_stats_dump(void);
+
+#endif /*_PAGEMAP_H */
@@ -0,0 +1,46 @@
+#ifndef _PERCPU_H
+#define _PERCPU_H
+
+// Number of cores on the board.
+#define NR_CPUS 4
+
+#ifndef __ASSEMBLER__
+
+// Per-CPU variables. DEFINE_PER_CPU puts the variable in the .data.percpu
+// section, which is CPU 0's copy. The linker script reserves NR_CPUS - 1 more
+// copies right after it and percpu_init fills them in. Each CPU keeps the
+// offset from CPU 0's copy to its own in tpidr_el1, so accessing this CPU's
+// copy is a register read plus an add (no need to look up the CPU id).
+//
+// Example:
+//   static DEFINE_PER_CPU(unsigned long, counter);
+//   this_cpu(counter)++;
+#define DEFINE_PER_CPU(type, name) \
+    __attribute__((section(".data.percpu"))) __typeof__(type) name
+
+#define DECLARE_PER_CPU(type, name) extern __typeof__(type) name
+
+static inline unsigned long __my_cpu_offset(void) {
+    unsigned long offset;
+    // volatile: the value changes if the task moves to another CPU.
+    asm volatile("mrs %0, tpidr_el1" : "=r"(offset));
+    return offset;
+}
+
+extern char percpu_begin[];
+extern char percpu_end[];
+
+#define per_cpu_offset(cpu) ((cpu) * (percpu_end - percpu_begin))
+
+#define per_cpu_ptr(ptr, cpu) \
+    ((__typeof__(ptr))((unsigned long)(ptr) + per_cpu_offset(cpu)))
+#define this_cpu_ptr(ptr) \
+    ((__typeof__(ptr))((unsigned long)(ptr) + __my_cpu_offset()))
+
+#define per_cpu(name, cpu) (*per_cpu_ptr(&(name), cpu))
+#define this_cpu(name) (*this_cpu_ptr(&(name)))
+
+void percpu_init(void);
+
+#endif
+#endif /*_PERCPU_H */
@@ -0,0 +1,58 @@
+#ifndef _P_DMA_H
+#define _P_DMA_H
+
+#include "peripherals/base.h"
+
+// The DMA controller. Channels 0 - 14 have their registers 0x100 bytes apart,
+// and the global registers come after them. See the BCM2835 ARM Peripherals
+// manual, page 38.
+#define DMA_BASE (PBASE + 0x00007000)
+#define DMA_CHAN_BASE(n) (DMA_BASE + (n) * 0x100)
+
+#define DMA_CS 0x00
+#define DMA_CONBLK_AD 0x04
+#define DMA_TI 0x08
+#define DMA_SOURCE_AD 0x0C
+#define DMA_DEST_AD 0x10
+#define DMA_TXFR_LEN 0x14
+#define DMA_STRIDE 0x18
+#define DMA_NEXTCONBK 0x1C
+#define DMA_DEBUG 0x20
+
+#define DMA_INT_STATUS (DMA_BASE + 0xFE0)
+#define DMA_ENABLE (DMA_BASE + 0xFF0)
+
+// DMA_CS (page 47).
+#define DMA_CS_ACTIVE (1 << 0)
+#define DMA_CS_END (1 << 1)
+#define DMA_CS_INT (1 << 2)
+#define DMA_CS_ERROR (1 << 8)
+#define DMA_CS_WAIT_FOR_OUTSTANDING_WRITES (1 << 28)
+#define DMA_CS_ABORT (1 << 30)
+#define DMA_CS_RESET (1 << 31)
+
+// DMA_TI and the ti field of a control block (page 50).
+#define DMA_TI_INTEN (1 << 0)
+#define DMA_TI_WAIT_RESP (1 << 3)
+#define DMA_TI_DEST_INC (1 << 4)
+#define DMA_TI_DEST_WIDTH (1 << 5)  // 128-bit writes
+#define DMA_TI_DEST_DREQ (1 << 6)
+#define DMA_TI_SRC_INC (1 << 8)
+#define DMA_TI_SRC_WIDTH (1 << 9)   // 128-bit reads
+#define DMA_TI_BURST_LENGTH(n) ((n) << 12)
+#define DMA_TI_PERMAP(n) ((n) << 16)
+
+// Peripherals that pace a transfer with DREQ (DMA_TI_PERMAP, page 61).
+#define DMA_DREQ_UART_TX 12
+
+// DMA_DEBUG: writing a 1 clears these error bits (page 55).
+#define DMA_DEBUG_ERRORS 0x7
+
+// The DMA engine sees memory and the peripherals through the VideoCore bus.
+// RAM is aliased at 0xC0000000 (the alias that bypasses the VideoCore L2
+// cache, which the ARM doesn't go through either), and the peripherals at
+// 0x7E000000 instead of DEVICE_BASE (page 6).
+#define DMA_BUS_RAM 0xC0000000
+#define DMA_BUS_PERIPHERALS 0x7E000000
+
+#endif /*_P_DMA_H */
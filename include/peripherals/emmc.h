@@ -0,0 +1,73 @@
+#ifndef _P_EMMC_H
+#define _P_EMMC_H
+
+#include "peripherals/base.h"
+
+// The Arasan SD host controller (an SDHCI) that the SD card slot is wired to.
+// See the BCM2835 ARM Peripherals manual, page 65.
+#define EMMC_BASE (PBASE + 0x00300000)
+
+#define EMMC_ARG2 (EMMC_BASE + 0x00)
+#define EMMC_BLKSIZECNT (EMMC_BASE + 0x04)
+#define EMMC_ARG1 (EMMC_BASE + 0x08)
+#define EMMC_CMDTM (EMMC_BASE + 0x0C)
+#define EMMC_RESP0 (EMMC_BASE + 0x10)
+#define EMMC_RESP1 (EMMC_BASE + 0x14)
+#define EMMC_RESP2 (EMMC_BASE + 0x18)
+#define EMMC_RESP3 (EMMC_BASE + 0x1C)
+#define EMMC_DATA (EMMC_BASE + 0x20)
+#define EMMC_STATUS (EMMC_BASE + 0x24)
+#define EMMC_CONTROL0 (EMMC_BASE + 0x28)
+#define EMMC_CONTROL1 (EMMC_BASE + 0x2C)
+#define EMMC_INTERRUPT (EMMC_BASE + 0x30)
+#define EMMC_IRPT_MASK (EMMC_BASE + 0x34)
+#define EMMC_IRPT_EN (EMMC_BASE + 0x38)
+#define EMMC_CONTROL2 (EMMC_BASE + 0x3C)
+#define EMMC_SLOTISR_VER (EMMC_BASE + 0xFC)
+
+// EMMC_CMDTM: the command index and how the controller should run it.
+#define CMDTM_INDEX(n) ((n) << 24)
+#define CMDTM_ISDATA (1 << 21)
+#define CMDTM_IXCHK_EN (1 << 20)
+#define CMDTM_CRCCHK_EN (1 << 19)
+#define CMDTM_RSPNS_NONE (0 << 16)
+#define CMDTM_RSPNS_136 (1 << 16)
+#define CMDTM_RSPNS_48 (2 << 16)
+#define CMDTM_RSPNS_48_BUSY (3 << 16)
+#define CMDTM_MULTI_BLOCK (1 << 5)
+#define CMDTM_DAT_DIR_READ (1 << 4)
+#define CMDTM_AUTO_CMD12 (1 << 2)
+#define CMDTM_BLKCNT_EN (1 << 1)
+
+// EMMC_STATUS
+#define STATUS_CMD_INHIBIT (1 << 0)
+#define STATUS_DAT_INHIBIT (1 << 1)
+
+// EMMC_CONTROL0
+#define CONTROL0_HCTL_DWIDTH (1 << 1)
+
+// EMMC_CONTROL1. The clock divider is split in CLK_FREQ8 (the low 8 bits) and
+// CLK_FREQ_MS2 (the 2 high bits).
+#define CONTROL1_CLK_INTLEN (1 << 0)
+#define CONTROL1_CLK_STABLE (1 << 1)
+#define CONTROL1_CLK_EN (1 << 2)
+#define CONTROL1_CLK_FREQ_MASK 0xFFC0
+#define CONTROL1_DATA_TOUNIT_MAX (0xE << 16)
+#define CONTROL1_SRST_HC (1 << 24)
+
+// EMMC_INTERRUPT, EMMC_IRPT_MASK and EMMC_IRPT_EN. Writing a 1 to a bit of
+// EMMC_INTERRUPT clears it.
+#define INT_CMD_DONE (1 << 0)
+#define INT_DATA_DONE (1 << 1)
+#define INT_READ_RDY (1 << 5)
+#define INT_ERR (1 << 15)
+#define INT_ERROR_MASK 0xFFFF8000
+
+// EMMC_SLOTISR_VER: the SDHCI version is in bits 16 - 23 (2 for 3.0).
+#define SLOTISR_VER_SDVERSION(v) (((v) >> 16) & 0xFF)
+#define SDHCI_SPEC_300 2
+
+// Frequency of the clock that feeds the controller (set by the firmware).
+#define EMMC_BASE_CLOCK 41666666UL
+
+#endif /*_P_EMMC_H */
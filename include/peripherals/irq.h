@@ -27,6 +27,18 @@
 #define DISABLE_IRQS_2 (PBASE + 0x0000B220)
 #define DISABLE_BASIC_IRQS (PBASE + 0x0000B224)
 
+// Bits 8 and 9 of IRQ_BASIC_PENDING tell us that there is at least one bit set
+// in IRQ_PENDING_1 and IRQ_PENDING_2 respectively. Bits 10 - 20 are shortcuts
+// for a few GPU IRQs (7, 9, 10, 18, 19 from bank 1 and 53 - 57, 62 from bank
+// 2). Those are not reflected in bits 8 and 9, so we check them too before
+// deciding that we don't need to read a pending register.
+// BCM2837-ARM-Peripherals.-.Revised.-.V2-1.pdf (page 113)
+#define BASIC_PENDING_1 (1 << 8)
+#define BASIC_PENDING_2 (1 << 9)
+#define BASIC_SHORTCUTS_1 (0x1f << 10)
+#define BASIC_SHORTCUTS_2 (0x3f << 15)
+#define BASIC_ARM_IRQS 0xff
+
 #define SYSTEM_TIMER_IRQ_0 (1 << 0)  // Reserved and used by the GPU
 #define SYSTEM_TIMER_IRQ_1 (1 << 1)  // We use this one
 #define SYSTEM_TIMER_IRQ_2 (1 << 2)  // Reserved and used by the GPU
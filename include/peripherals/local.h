@@ -0,0 +1,31 @@
+#ifndef _P_LOCAL_H
+#define _P_LOCAL_H
+
+#include "mm.h"
+
+// The ARM local peripherals (per-core timer and mailbox interrupt routing) are
+// not part of the BCM peripherals. They live right after the 1GB of RAM and
+// get their own mapping in boot.S.
+// See: QA7_rev3.4.pdf (BCM2836 ARM-local peripherals)
+#define LOCAL_PERIPHERALS_BASE 0x40000000
+#define LBASE (VA_START + LOCAL_PERIPHERALS_BASE)
+
+// Routes the GPU interrupts to one of the cores (bits 0-1). We leave it at 0.
+#define GPU_INT_ROUTING (LBASE + 0x0000000C)
+
+// Per-core generic timer interrupt control. Setting bit n routes timer n (see
+// the LOCAL_IRQ_CNT* bits below) to the IRQ of that core.
+#define CORE_TIMER_IRQCNTL(core) (LBASE + 0x00000040 + 4 * (core))
+
+// Per-core interrupt source. Tells us which local sources are pending for the
+// core. The bits follow the LOCAL_IRQ_* numbers below.
+#define CORE_IRQ_SOURCE(core) (LBASE + 0x00000060 + 4 * (core))
+
+#define LOCAL_IRQ_CNTPS 0   // Secure physical timer
+#define LOCAL_IRQ_CNTPNS 1  // Non-secure physical timer
+#define LOCAL_IRQ_CNTHP 2   // Hypervisor physical timer
+#define LOCAL_IRQ_CNTV 3    // Virtual timer
+#define LOCAL_IRQ_GPU 8     // Something pending in the GPU controller
+#define LOCAL_IRQ_COUNT 12
+
+#endif /*_P_LOCAL_H */
@@ -26,6 +26,16 @@
 #define UART_ITOP   (UART_BASE+0x88)
 #define UART_TDR    (UART_BASE+0x8C)
 
+// Interrupt bits of UART_IMSC, UART_MIS and UART_ICR (page 188). RX fires
+// when the receive FIFO reaches its trigger level and RT (receive timeout)
+// when there's something in it but nothing new arrived for a while, which is
+// what delivers single keystrokes.
+#define UART_INT_RX (1 << 4)
+#define UART_INT_RT (1 << 6)
+
+// UART_DMACR: the transmit FIFO asks for data with a DREQ (page 190).
+#define UART_DMACR_TXDMAE (1 << 1)
+
 // 48MHz
 #define UARTCLK (48000000)
 
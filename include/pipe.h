@@ -0,0 +1,51 @@
+#ifndef _PIPE_H
+#define _PIPE_H
+
+#include "fs.h"
+#include "sched.h"
+#include "spinlock.h"
+
+// Number of pages a pipe can hold (a power of 2). Writers block once they are
+// all in use, readers block while there are none.
+#define PIPE_BUFFERS 16
+
+// The page of a pipe_buffer was lent by the writer (see loan_user_page), so it
+// can't be appended to.
+#define PIPE_BUF_FLAG_LOANED 0x1
+// A writer is copying data to the end of the page without the pipe's lock, so
+// the reader must not free it even if it reads everything else.
+#define PIPE_BUF_FLAG_APPENDING 0x2
+
+// Bytes [offset, offset + len) of the (physical) page are data that hasn't been
+// read yet. The pipe holds a reference to the page.
+struct pipe_buffer {
+    unsigned long page;
+    unsigned int offset;
+    unsigned int len;
+    unsigned int flags;
+};
+
+// A ring of pipe_buffers. head is where the next buffer is added, tail the
+// buffer being read. Both only increase; the slot is the index modulo
+// PIPE_BUFFERS.
+struct pipe_inode_info {
+    // Protects everything below. It's dropped while copying (see
+    // pipe_begin).
+    spinlock_t lock;
+    // Readers wait here for data and writers for space.
+    struct wait_queue_head wait;
+    unsigned int head;
+    unsigned int tail;
+    struct pipe_buffer bufs[PIPE_BUFFERS];
+    // Number of open files for each end.
+    int readers;
+    int writers;
+    // Set while a read (write) is in progress. One of each runs at a time, so
+    // the data of a read or a write is never interleaved with another one.
+    int reading;
+    int writing;
+};
+
+int do_pipe(int *fds);
+
+#endif /*_PIPE_H */
@@ -82,6 +82,14 @@ Without variadic macros this is the best we can do to wrap these
 fucnction. If it is a problem just give up the macros and use the
 functions directly or rename them.
 
+PiOS changes: the formatter no longer calls putf once per character. It
+formats into a buffer and hands whole runs of characters to a
+'write(p, str, len)' function (see tfp_vformat), so the console is set up
+with init_printf(NULL, uart_write). The 'l' modifier is always supported
+(64-bit '%ld', '%lu', '%lx') and so is '%p'. snprintf and vsnprintf are
+available for bounded formatting. tfp_format with a per-character putf is
+kept for compatibility.
+
 For further details see source code.
 
 regs Kusti, 23.10.2004
@@ -92,14 +100,24 @@ regs Kusti, 23.10.2004
 
 #include <stdarg.h>
 
-void init_printf(void *putp, void (*putf)(void *, char));
+// Receives runs of len formatted characters (not NUL-terminated).
+typedef void (*writef)(void *p, const char *s, unsigned long len);
+
+void init_printf(void *writep, writef write);
+
+int tfp_vformat(void *writep, writef write, char *buf, unsigned long size,
+                const char *fmt, va_list va);
 
 void tfp_printf(char *fmt, ...);
 void tfp_sprintf(char *s, char *fmt, ...);
+int tfp_snprintf(char *s, unsigned long size, const char *fmt, ...);
+int tfp_vsnprintf(char *s, unsigned long size, const char *fmt, va_list va);
 
 void tfp_format(void *putp, void (*putf)(void *, char), char *fmt, va_list va);
 
 #define printf tfp_printf
 #define sprintf tfp_sprintf
+#define snprintf tfp_snprintf
+#define vsnprintf tfp_vsnprintf
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,33 @@
+#ifndef _PRINTK_H
+#define _PRINTK_H
+
+#include <stdarg.h>
+
+// Log levels. Like in Linux, they're prepended to the format string:
+//   printk(KERN_WARNING "Unknown pending irq: %d\r\n", irq);
+// Messages without a level get LOGLEVEL_DEFAULT.
+#define KERN_EMERG "<0>"
+#define KERN_ALERT "<1>"
+#define KERN_CRIT "<2>"
+#define KERN_ERR "<3>"
+#define KERN_WARNING "<4>"
+#define KERN_NOTICE "<5>"
+#define KERN_INFO "<6>"
+#define KERN_DEBUG "<7>"
+
+#define LOGLEVEL_DEFAULT 4
+
+// Longest message that printk stores. Longer ones are truncated.
+#define LOG_LINE_MAX 128
+
+// Only messages with a level lower than this one are written to the console
+// (all of them are kept in the buffer).
+extern int console_loglevel;
+
+void log_init(void);
+int printk(const char *fmt, ...);
+int vprintk(const char *fmt, va_list va);
+void log_flush(void);
+void log_panic_flush(void);
+
+#endif /*_PRINTK_H */
@@ -0,0 +1,19 @@
+#ifndef _RUSAGE_H
+#define _RUSAGE_H
+
+#include "sys.h"
+
+struct task_struct;
+
+// Called from entry.S (with IRQs disabled) when the current task enters the
+// kernel from EL0 and right before it returns there. esr is the syndrome of a
+// synchronous exception, or 0 for an IRQ.
+void account_user_exit(unsigned long esr);
+void account_user_enter(void);
+
+void account_task_switch(struct task_struct *prev, struct task_struct *next);
+
+int do_getrusage(int who, struct rusage *ru);
+void task_usage_dump(void);
+
+#endif /*_RUSAGE_H */
@@ -5,7 +5,14 @@
 
 #ifndef __ASSEMBLER__
 
-#define THREAD_SIZE 4096
+#include "fpsimd.h"
+#include "fs.h"
+#include "spinlock.h"
+#include "sys.h"
+
+// The kernel stack of a task is THREAD_SIZE bytes (see kstack.h); the
+// task_struct comes from a slab cache (see fork_init).
+#include "kstack.h"
 
 // Max number of tasks.
 #define NR_TASKS 64
@@ -15,12 +22,28 @@
 
 #define TASK_RUNNING 0
 #define TASK_ZOMBIE 1
+// The task is blocked (on a wait queue or a timer) and won't be picked by
+// _schedule until someone calls wake_up_process on it.
+#define TASK_SLEEPING 2
 
 #define PF_KTHREAD 0x00000002
+// The idle task of a CPU (see cpu_idle). The init task is CPU 0's.
+#define PF_IDLE 0x00000004
+
+// Time slice of SCHED_RR tasks, in timer ticks.
+#define RR_TIMESLICE 1
+
+// Priority (weight) of the init task, inherited by everyone else unless they
+// change it with setpriority.
+#define DEF_PRIORITY 15
 
 extern struct task_struct *current;
 extern struct task_struct *task[NR_TASKS];
 extern int nr_tasks;
+extern spinlock_t tasklist_lock;
+
+// Number of timer ticks in which the CPU had nothing to run but its idle task.
+extern unsigned long idle_jiffies;
 
 // We don't save registers x0 - x18 because we switch CPU context via a function
 // call. ARM conventions say that, when calling a function, registers x0 - x18
@@ -47,12 +70,55 @@ struct user_page {
     unsigned long virt_addr;
 };
 
-#define MAX_PROCESS_PAGES 16
+// Pages (user_pages and kernel_pages) a process can own. Enough for a small
+// program plus a few shared memory areas (see mmap).
+#define MAX_PROCESS_PAGES 64
+
+// VMA permissions (vm_flags).
+#define VM_READ 0x1
+#define VM_WRITE 0x2
+#define VM_EXEC 0x4
+// Writes are seen by every mm that maps the same pages (MAP_SHARED). Without
+// it, the area is private: written pages are copies.
+#define VM_SHARED 0x8
+
+struct file;
+
+// A range of user addresses [vm_start, vm_end) (page aligned) that the task is
+// allowed to touch. Nothing is mapped up front: pages are mapped when the task
+// first touches them (see handle_mm_fault). A file backed area takes its first
+// file_size bytes from file_data (a kernel virtual address, e.g. a program in
+// the initramfs) and the rest is zero filled. Anonymous areas (the stack) have
+// file_data = 0.
+//
+// Areas created by mmap may map a file instead (vm_file, e.g. a shared memory
+// object), starting at its page vm_pgoff. The file's fault operation provides
+// the pages and the area holds a reference to the file.
+struct vm_area_struct {
+    unsigned long vm_start;
+    unsigned long vm_end;
+    unsigned long vm_flags;
+    unsigned long file_data;
+    unsigned long file_size;
+    struct file *vm_file;
+    unsigned long vm_pgoff;
+};
+
+#define MAX_VMAS 8
 
+// An address space. Threads created with CLONE_VM share one, so it lives
+// outside of the task_struct and is refcounted (see mm_alloc/mmput in fork.c).
 struct mm_struct {
     // Pointer to the pgd of this task (Physical address).
     unsigned long pgd;
 
+    // Number of tasks using this mm. Updated atomically.
+    int users;
+
+    // Protects the page tables, user_pages, kernel_pages and the VMAs, since
+    // threads of the mm can fault on different CPUs at the same time.
+    spinlock_t page_table_lock;
+
     // We kee track of the user pages to make it easy to copy them when the task
     // calls fork.
     int user_pages_count;
@@ -62,6 +128,28 @@ struct mm_struct {
     // able to free them whe we're done. These pages are for PGD/PUD/...
     int kernel_pages_count;
     unsigned long kernel_pages[MAX_PROCESS_PAGES];
+
+    // Set up by exec. Sorted by address.
+    int nr_vmas;
+    struct vm_area_struct vmas[MAX_VMAS];
+
+    // Physical address of the read-only vDSO data page (see vdso.h).
+    unsigned long vdso_page;
+};
+
+// Resource usage of a task (see rusage.c). Times are in generic counter
+// cycles. timestamp is when the running task was last charged: time since
+// then goes to utime if it's in user space and to stime otherwise.
+struct task_acct {
+    unsigned long utime;
+    unsigned long stime;
+    unsigned long timestamp;
+    // Context switches: voluntary when the task went to sleep, involuntary
+    // when it was preempted.
+    unsigned long nvcsw;
+    unsigned long nivcsw;
+    unsigned long faults;
+    unsigned long syscalls;
 };
 
 struct task_struct {
@@ -70,13 +158,11 @@ struct task_struct {
     // Holds the task state (TASK_RUNNING/etc).
     long state;
 
-    // holds how many ticks are left for the task to run. When it reaches 0, its
-    // time slice is up and another task is scheduled.
+    // SCHED_RR tasks only: how many ticks are left in the time slice.
     long counter;
 
-    // This is the time slice to give the task every time it's scheduled (after
-    // the time slice reaches 0). This helps determine the priority of the task
-    // because the more priority, the larger its time slice.
+    // Weight of a SCHED_NORMAL task (PRIO_MIN - PRIO_MAX): its share of the
+    // CPU is proportional to it (see sched_fair.c).
     long priority;
 
     // Indicates if the current task is preemptable or not. It may not be
@@ -88,26 +174,125 @@ struct task_struct {
     // Custom field added by me
     int pid;
 
+    // pid of the process the task belongs to. Threads (CLONE_VM) share the
+    // tgid of their creator; everyone else has tgid == pid.
+    int tgid;
+
+    // tgid of the process that created the task. pids are never reused, so
+    // the parents of a task can always be looked up (see sys.c).
+    int ppid;
+
     unsigned long flags;
 
-    struct mm_struct mm;
+    // Lowest address of the kernel stack (THREAD_SIZE bytes, see kstack.h). 0
+    // for the init task, which runs on the boot stack.
+    unsigned long stack;
+
+    // User address space, shared by the threads of a process. 0 for kernel
+    // threads.
+    struct mm_struct *mm;
+
+    // Saved FP/SIMD registers. Only up to date when the task is not the
+    // FP/SIMD owner of a CPU (see fpsimd.c).
+    struct fpsimd_state fpsimd_state;
+
+    // Open files, indexed by fd (see fs.h). Kept across exec.
+    struct file *files[NR_OPEN];
+
+    // Scheduling class (SCHED_NORMAL, SCHED_FIFO or SCHED_RR, see
+    // sched_setscheduler). Real-time tasks always run before normal ones, the
+    // highest rt_priority first. Among real-time tasks of the same priority,
+    // the one with the lowest rt_seq runs first: it's the order in which they
+    // were queued (a task goes to the back when it wakes up, yields or uses up
+    // its SCHED_RR slice). SCHED_RR tasks use counter for their slice.
+    int policy;
+    int rt_priority;
+    unsigned long rt_seq;
+
+    // SCHED_NORMAL tasks (see sched_fair.c). vruntime is the weighted time the
+    // task ran, in generic counter cycles. exec_start is when it was last
+    // switched in or charged. on_rq is set while the task is in the heap of
+    // runnable tasks (at rq_index). The running task is never in it.
+    unsigned long vruntime;
+    unsigned long exec_start;
+    int on_rq;
+    int rq_index;
+
+    struct task_acct acct;
+};
+
+static inline int rt_task(struct task_struct *p) {
+    return p->policy != SCHED_NORMAL;
+}
+
+static inline int is_idle_task(struct task_struct *p) {
+    return p->flags & PF_IDLE;
+}
+
+// A task waiting for something to happen. Entries usually live on the stack of
+// the sleeping task.
+struct wait_queue_entry {
+    struct task_struct *task;
+    struct wait_queue_entry *next;
+};
+
+struct wait_queue_head {
+    spinlock_t lock;
+    struct wait_queue_entry *head;
 };
 
+#define WAIT_QUEUE_HEAD_INIT(name) \
+    { SPINLOCK_INIT(#name), 0 }
+
+void init_waitqueue_head(struct wait_queue_head *wq);
+void prepare_to_wait(struct wait_queue_head *wq,
+                     struct wait_queue_entry *entry);
+void finish_wait(struct wait_queue_head *wq, struct wait_queue_entry *entry);
+void wake_up(struct wait_queue_head *wq);
+void wake_up_process(struct task_struct *p);
+long schedule_timeout(long ticks);
+
+// Sleeps on wq until condition is true. The condition is checked after the
+// task is queued, so a wake_up that happens between the check and the call to
+// schedule is not lost (it just makes the task runnable again).
+#define wait_event(wq, condition)                  \
+    do {                                           \
+        struct wait_queue_entry __entry;           \
+        while (1) {                                \
+            prepare_to_wait(&(wq), &__entry);      \
+            if (condition) {                       \
+                break;                             \
+            }                                      \
+            schedule();                            \
+        }                                          \
+        finish_wait(&(wq), &__entry);              \
+    } while (0)
+
 extern void preempt_disable(void);
 extern void preempt_enable(void);
 extern void schedule_tail(void);
 extern void timer_tick();
+extern void preempt_schedule_irq(void);
 extern void cpu_switch_to(struct task_struct *, struct task_struct *);
 extern void schedule(void);
 extern void exit_process();
 extern int getpid();
+extern void sched_fork(struct task_struct *p);
+extern void wake_up_new_task(struct task_struct *p);
+extern struct task_struct *find_task_by_pid(int pid);
+extern int sched_setscheduler(struct task_struct *p, int policy,
+                              int priority);
+extern int sched_setpriority(struct task_struct *p, int priority);
+extern void cpu_idle(void);
+
+struct sched_stats;
+extern void sched_get_stats(struct sched_stats *stats);
 
-#define INIT_TASK                                                  \
-    {                                                              \
-        /*cpu_context*/ {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0},   \
-            /* state etc */ 0, 0, 15, 0, 0, PF_KTHREAD, /* mm */ { \
-            0, 0, {{0}}, 0, { 0 }                                  \
-        }                                                          \
+#define INIT_TASK                                                \
+    {                                                            \
+        /*cpu_context*/ {0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0}, \
+            /* state etc */ 0, 0, DEF_PRIORITY, 0, 0, 0, 0,      \
+            PF_KTHREAD | PF_IDLE, 0, /* mm */ 0                  \
     }
 
 #endif
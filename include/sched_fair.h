@@ -0,0 +1,18 @@
+#ifndef _SCHED_FAIR_H
+#define _SCHED_FAIR_H
+
+// The fair scheduling class (SCHED_NORMAL), see sched_fair.c. Only the
+// scheduler (sched.c) uses it, always with tasklist_lock held.
+
+struct task_struct;
+
+void fair_enqueue_task(struct task_struct *p);
+void fair_dequeue_task(struct task_struct *p);
+struct task_struct *fair_pick_next_task(void);
+int fair_nr_running(void);
+void fair_update_curr(struct task_struct *curr, unsigned long now);
+void fair_place_task(struct task_struct *p, int waking);
+int fair_check_preempt_tick(struct task_struct *curr);
+int fair_check_preempt_wakeup(struct task_struct *curr, struct task_struct *p);
+
+#endif /*_SCHED_FAIR_H */
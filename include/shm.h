@@ -0,0 +1,39 @@
+#ifndef _SHM_H
+#define _SHM_H
+
+#include "fs.h"
+#include "list.h"
+#include "spinlock.h"
+
+// Max length of a shared memory object name (including the NUL).
+#define SHM_NAME_MAX 32
+
+// Max size of a shared memory object, in pages.
+#define SHM_MAX_PAGES 64
+
+// A set of pages that any number of processes can map (see do_mmap). Named
+// objects (shm_open) can be opened by unrelated processes; unnamed ones back
+// MAP_SHARED | MAP_ANONYMOUS areas and are shared with children through fork.
+// The pages are allocated (zeroed) the first time someone maps them, and every
+// mapping takes its own reference, so they outlive the object if needed.
+struct shm_object {
+    // Protects pages.
+    spinlock_t lock;
+
+    // One for every open file, plus one while the name is linked.
+    int refcount;
+
+    // Empty for unnamed objects.
+    char name[SHM_NAME_MAX];
+    struct list_head list;
+
+    unsigned long nr_pages;
+    // Physical addresses, 0 if not allocated yet.
+    unsigned long pages[SHM_MAX_PAGES];
+};
+
+struct file *shm_file_create(unsigned long size);
+int shm_open(const char *name, unsigned long size);
+int shm_unlink(const char *name);
+
+#endif /*_SHM_H */
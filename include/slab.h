@@ -0,0 +1,73 @@
+#ifndef _SLAB_H
+#define _SLAB_H
+
+#include "list.h"
+#include "percpu.h"
+#include "spinlock.h"
+
+#define L1_CACHE_BYTES 64
+
+// Align the objects to a cache line so that two objects never share one (and
+// CPUs working on different objects don't bounce the line between them).
+#define SLAB_HWCACHE_ALIGN 0x1
+
+// Number of free objects that a CPU keeps for itself (see kmem_cache_alloc).
+#define SLAB_MAGAZINE_SIZE 16
+
+// kmalloc size classes go from 2^KMALLOC_SHIFT_LOW to 2^KMALLOC_SHIFT_HIGH
+// bytes. Larger requests (up to a page) get a whole page.
+#define KMALLOC_SHIFT_LOW 4
+#define KMALLOC_SHIFT_HIGH 10
+#define KMALLOC_MAX_CACHE_SIZE (1 << KMALLOC_SHIFT_HIGH)
+
+// A CPU's stash of free objects. Allocating and freeing normally only touches
+// this, with IRQs disabled, and no lock.
+struct kmem_cache_cpu {
+    unsigned int avail;
+    void *objs[SLAB_MAGAZINE_SIZE];
+
+    // Counted per CPU so that the fast path doesn't share a counter.
+    unsigned long allocs;
+    unsigned long frees;
+} __attribute__((aligned(L1_CACHE_BYTES)));
+
+// A cache of objects of the same size. Objects are carved out of slabs (one
+// page each).
+struct kmem_cache {
+    struct kmem_cache_cpu cpu[NR_CPUS];
+
+    const char *name;
+    // Size that was asked for, and the distance between objects (size rounded
+    // up to the alignment).
+    unsigned long object_size;
+    unsigned long size;
+    unsigned long align;
+    unsigned int objs_per_slab;
+    // Offset of the first object in the slab page (after the slab header).
+    unsigned int offset;
+
+    // Protects the slab lists and counters below.
+    spinlock_t lock;
+    struct list_head slabs_partial;
+    struct list_head slabs_full;
+    struct list_head slabs_free;
+    unsigned long nr_slabs;
+
+    // All the caches (see kmem_cache_stats_dump).
+    struct list_head list;
+};
+
+void slab_init(void);
+struct kmem_cache *kmem_cache_create(const char *name, unsigned long size,
+                                     unsigned long align, unsigned long flags);
+void *kmem_cache_alloc(struct kmem_cache *cache);
+void *kmem_cache_zalloc(struct kmem_cache *cache);
+void kmem_cache_free(struct kmem_cache *cache, void *obj);
+
+void *kmalloc(unsigned long size);
+void *kzalloc(unsigned long size);
+void kfree(const void *obj);
+
+void kmem_cache_stats_dump(void);
+
+#endif /*_SLAB_H */
@@ -0,0 +1,27 @@
+#ifndef _SOFTIRQ_H
+#define _SOFTIRQ_H
+
+// Softirqs are the second half of interrupt handling. A handler does what
+// can't wait (acknowledge the device, grab the data) and raises a softirq for
+// the rest, which runs right after the handler returns but with IRQs enabled,
+// so other interrupts aren't held up by it.
+enum {
+    TIMER_SOFTIRQ,
+    NR_SOFTIRQS
+};
+
+// Softirqs raised while we run them are run again right away, up to this many
+// rounds. Whatever is still pending after that is left to ksoftirqd, so that
+// an interrupt storm can't keep the tasks from running.
+#define MAX_SOFTIRQ_RESTART 10
+
+#ifndef __ASSEMBLER__
+
+void open_softirq(int nr, void (*action)(void));
+void raise_softirq(int nr);
+void irq_exit(void);
+int softirq_init(void);
+void softirq_stats_dump(void);
+
+#endif
+#endif /*_SOFTIRQ_H */
@@ -0,0 +1,47 @@
+#ifndef _SPINLOCK_H
+#define _SPINLOCK_H
+
+// Ticket spinlock. A CPU takes a ticket by atomically incrementing next and
+// waits (in wfe) until owner reaches its ticket. Unlocking increments owner.
+// This makes the lock fair: CPUs get it in the order they asked for it.
+// The owner/next layout (owner in the low half) is relied on by spinlock.S.
+//
+// Note: spin_lock disables preemption (but not IRQs). If the lock is also
+// taken from an interrupt handler, use spin_lock_irqsave.
+typedef struct spinlock {
+    unsigned short owner;
+    unsigned short next;
+
+    // Contention statistics. They're only updated while holding the lock.
+    // acquired: number of times the lock was taken.
+    // contended: number of times the lock was already held when we asked.
+    // spins: total number of times a waiter was woken up (wfe) and found the
+    // lock still held.
+    unsigned long acquired;
+    unsigned long contended;
+    unsigned long spins;
+    const char *name;
+} spinlock_t;
+
+#define SPINLOCK_INIT(lock_name) \
+    { 0, 0, 0, 0, 0, lock_name }
+
+// Defines a lock and registers it in the .data.spinlocks section so that
+// spin_lock_stats_dump can report it.
+#define DEFINE_SPINLOCK(x)                                    \
+    spinlock_t x __attribute__((section(".data.spinlocks"))) = \
+        SPINLOCK_INIT(#x)
+
+void spin_lock_init(spinlock_t *lock, const char *name);
+void spin_lock(spinlock_t *lock);
+void spin_unlock(spinlock_t *lock);
+unsigned long spin_lock_irqsave(spinlock_t *lock);
+void spin_unlock_irqrestore(spinlock_t *lock, unsigned long flags);
+void spin_lock_stats_dump(void);
+
+// Implemented in spinlock.S. arch_spin_lock returns the number of times it
+// had to wait for the lock (0 if it was free).
+unsigned long arch_spin_lock(spinlock_t *lock);
+void arch_spin_unlock(spinlock_t *lock);
+
+#endif /*_SPINLOCK_H */
@@ -2,6 +2,7 @@
 #define _STRING_H
 
 int strcmp(char *, char *);
+int strncmp(char *, char *, int);
 int readline(char *, int);
 
 #endif /*_STRING_H */
\ No newline at end of file
@@ -1,15 +1,145 @@
 #ifndef _SYS_H
 #define _SYS_H
 
-#define __NR_syscalls 4
+// Syscall numbers (shared with user space, see user/lib/sys.S): the index of
+// each handler in sys_call_table.
+#define SYS_WRITE_NUMBER 0
+#define SYS_FORK_NUMBER 1
+#define SYS_EXIT_NUMBER 2
+#define SYS_GETPID_NUMBER 3
+#define SYS_SYSCALL_STATS_NUMBER 4
+#define SYS_NANOSLEEP_NUMBER 5
+#define SYS_SCHED_STATS_NUMBER 6
+#define SYS_EXEC_NUMBER 7
+#define SYS_CLONE_NUMBER 8
+#define SYS_FUTEX_NUMBER 9
+#define SYS_PIPE_NUMBER 10
+#define SYS_READ_NUMBER 11
+#define SYS_WRITE_FD_NUMBER 12
+#define SYS_CLOSE_NUMBER 13
+#define SYS_MMAP_NUMBER 14
+#define SYS_MUNMAP_NUMBER 15
+#define SYS_SHM_OPEN_NUMBER 16
+#define SYS_SHM_UNLINK_NUMBER 17
+#define SYS_SCHED_SETSCHEDULER_NUMBER 18
+#define SYS_SETPRIORITY_NUMBER 19
+#define SYS_GETRUSAGE_NUMBER 20
+#define SYS_OPEN_NUMBER 21
+#define SYS_LSEEK_NUMBER 22
+#define __NR_syscalls 23
+
+// sizeof(struct syscall_stat) == 1 << SYSCALL_STAT_SHIFT. entry.S uses it to
+// index syscall_stats without calling into C.
+#define SYSCALL_STAT_SHIFT 4
+
+// Flags for sys_clone (shared with user space). CLONE_VM: the child shares the
+// address space of the caller, making it a thread of the same process.
+#define CLONE_VM 0x00000100
+
+// Operations for sys_futex (shared with user space, see futex.h).
+#define FUTEX_WAIT 0
+#define FUTEX_WAKE 1
+
+// mmap protection (the same bits as the VM_* flags of a VMA) and flags (shared
+// with user space). Exactly one of MAP_SHARED and MAP_PRIVATE must be given.
+#define PROT_NONE 0x0
+#define PROT_READ 0x1
+#define PROT_WRITE 0x2
+#define PROT_EXEC 0x4
+#define MAP_SHARED 0x01
+#define MAP_PRIVATE 0x02
+#define MAP_ANONYMOUS 0x20
+
+// Flags for sys_open (shared with user space). Files can only be opened for
+// reading.
+#define O_RDONLY 0
+
+// Where sys_lseek counts the offset from (shared with user space).
+#define SEEK_SET 0
+#define SEEK_CUR 1
+#define SEEK_END 2
+
+// Scheduling policies for sys_sched_setscheduler (shared with user space).
+// SCHED_FIFO and SCHED_RR tasks have a priority between SCHED_PRIO_MIN and
+// SCHED_PRIO_MAX (higher runs first); SCHED_NORMAL ones must pass 0.
+#define SCHED_NORMAL 0
+#define SCHED_FIFO 1
+#define SCHED_RR 2
+#define SCHED_PRIO_MIN 1
+#define SCHED_PRIO_MAX 99
+
+// Range of priorities for sys_setpriority. A SCHED_NORMAL task gets a share of
+// the CPU proportional to its priority (15 by default).
+#define PRIO_MIN 1
+#define PRIO_MAX 40
+
+// Whose usage sys_getrusage reports: every task of the calling process, or
+// only the calling task (thread).
+#define RUSAGE_SELF 0
+#define RUSAGE_THREAD 1
 
 #ifndef __ASSEMBLER__
 
+// Per-syscall counters updated by el0_svc and el0_svc_fast on every call.
+// ticks is the time spent in the handler measured with the generic counter
+// (cntvct_el0), so it excludes the exception entry/exit itself.
+struct syscall_stat {
+    unsigned long count;
+    unsigned long ticks;
+};
+
+extern struct syscall_stat syscall_stats[__NR_syscalls];
+
+// Filled by sys_sched_stats. jiffies and idle_jiffies are in timer ticks.
+// idle_entries and idle_exits count the switches to and from the idle tasks,
+// idle_sleeps the times they waited for an interrupt (wfi) and idle_ns how
+// long they waited in total.
+struct sched_stats {
+    unsigned long jiffies;
+    unsigned long idle_jiffies;
+    unsigned long idle_entries;
+    unsigned long idle_exits;
+    unsigned long idle_sleeps;
+    unsigned long idle_ns;
+};
+
+// Filled by sys_getrusage. Times are in nanoseconds. Syscalls that take the
+// fast path (see sys_fast_call_table) count as user time and aren't counted
+// in syscalls.
+struct rusage {
+    unsigned long utime;
+    unsigned long stime;
+    unsigned long nvcsw;
+    unsigned long nivcsw;
+    unsigned long faults;
+    unsigned long syscalls;
+};
+
 // Sys call implementations
 void sys_write(char *buf);
 int sys_fork();
-int sys_exit();
+void sys_exit();
 int sys_getpid();
+int sys_syscall_stats(struct syscall_stat *buf, unsigned long count);
+long sys_nanosleep(unsigned long ns);
+int sys_sched_stats(struct sched_stats *buf);
+int sys_exec(const char *path);
+int sys_clone(unsigned long flags, unsigned long stack);
+int sys_futex(unsigned int *uaddr, int op, unsigned int val);
+int sys_pipe(int *fds);
+long sys_read(int fd, char *buf, unsigned long count);
+long sys_write_fd(int fd, const char *buf, unsigned long count);
+int sys_close(int fd);
+long sys_mmap(unsigned long addr, unsigned long len, int prot, int flags,
+              int fd, unsigned long offset);
+int sys_munmap(unsigned long addr, unsigned long len);
+int sys_shm_open(const char *name, unsigned long size);
+int sys_shm_unlink(const char *name);
+int sys_sched_setscheduler(int pid, int policy, int priority);
+int sys_setpriority(int pid, int priority);
+int sys_getrusage(int who, struct rusage *buf);
+int sys_open(const char *path, int flags);
+long sys_lseek(int fd, long offset, int whence);
 
 #endif
 #endif /*_SYS_H */
\ No newline at end of file
@@ -1,7 +1,58 @@
 #ifndef _TIMER_H
 #define _TIMER_H
 
+#include "list.h"
+
+// Number of timer ticks (jiffies) per second.
+#define HZ 5
+
+#define NSEC_PER_JIFFY (1000000000UL / HZ)
+
+// The timer wheel has TIMER_WHEEL_LEVELS levels of 2^TIMER_WHEEL_BITS slots.
+// Level n has a granularity of 2^(n * TIMER_WHEEL_BITS) ticks, so the wheel
+// covers 2^(TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS) ticks (about 39 days at HZ 5).
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SIZE (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_MASK (TIMER_WHEEL_SIZE - 1)
+#define TIMER_WHEEL_LEVELS 4
+
+// A function to call once jiffies reaches expires. The struct is owned by the
+// caller (it usually lives on its stack) and must stay valid until the timer
+// fires or del_timer is called.
+struct timer_list {
+    struct list_head entry;
+    unsigned long expires;
+    void (*function)(unsigned long);
+    unsigned long data;
+};
+
+// Number of timer ticks since timer_init.
+extern volatile unsigned long jiffies;
+
+// Frequency of the generic timer counter (cntvct_el0) in Hz.
+extern unsigned long timer_freq;
+
 void timer_init(void);
-void handle_timer_irq(void);
+void handle_timer_irq(int irq, void *data);
+
+unsigned long timer_read_counter(void);
+unsigned long ns_to_cycles(unsigned long ns);
+unsigned long cycles_to_ns(unsigned long cycles);
+
+// One-shot deadline on this CPU's timer, on top of the periodic tick. fn is
+// called from the timer interrupt once cntvct_el0 reaches cval. Setting a new
+// deadline replaces the previous one.
+void timer_set_deadline(unsigned long cval, void (*fn)(void));
+void timer_cancel_deadline(void);
+
+void init_timer(struct timer_list *timer, void (*function)(unsigned long),
+                unsigned long data);
+void add_timer(struct timer_list *timer);
+int mod_timer(struct timer_list *timer, unsigned long expires);
+int del_timer(struct timer_list *timer);
+
+static inline int timer_pending(const struct timer_list *timer) {
+    return !list_empty(&timer->entry);
+}
 
-#endif /*_TIMER_H */
\ No newline at end of file
+#endif /*_TIMER_H */
@@ -0,0 +1,28 @@
+#ifndef _UACCESS_H
+#define _UACCESS_H
+
+// Helpers to move data between the kernel and the current task's user space.
+// User pointers are never dereferenced directly: every page in the range must
+// be part of one of the task's VMAs (writable ones to write to it) and is
+// accessed through its kernel mapping (physical address + VA_START), so a bad
+// pointer can't make the kernel fault.
+
+int access_ok(const void *addr, unsigned long size);
+
+// Returns the kernel alias of the user address va (0 if the current task can't
+// access it, for writing if write is set). It holds a reference to the page,
+// so the page can't be freed under the caller even if another thread of the
+// task unmaps it. Drop it with put_user_kva once done with the page.
+unsigned long user_to_kernel_va(unsigned long va, int write);
+void put_user_kva(unsigned long kva);
+
+// Both return the number of bytes that could NOT be copied (0 on success).
+unsigned long copy_from_user(void *to, const void *from, unsigned long n);
+unsigned long copy_to_user(void *to, const void *from, unsigned long n);
+
+// Copies a NUL terminated string of at most count - 1 characters into dst and
+// always NUL terminates it. Returns the length of the copied string or -1 if
+// the user memory is not accessible.
+long strncpy_from_user(char *dst, const char *src, long count);
+
+#endif /*_UACCESS_H */
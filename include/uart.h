@@ -5,9 +5,15 @@ void uart_init();
 void uart_send_string(char *str);
 void uart_send(char c);
 char uart_recv();
+int uart_try_recv(char *c);
+void uart_enable_rx_irq(void);
+void uart_ack_rx_irq(void);
 void uart_send_int(int number);
 int uart_read_int();
 void send_long_as_hex_string(long number);
 void putc(void *p, char c);
+void uart_write(void *p, const char *s, unsigned long len);
+int uart_enable_tx_dma(void);
+void uart_flush(void);
 
 #endif /*_UART_H */
\ No newline at end of file
@@ -8,5 +8,10 @@ extern void branch_to_address(void*);
 extern unsigned int get_cpuid();
 extern unsigned int get_el();
 extern void set_pgd(unsigned long);
+extern void flush_tlb_kernel_page(unsigned long va);
+extern void flush_tlb_page(unsigned long va);
+extern void cpu_do_idle(void);
+extern void dcache_clean_range(unsigned long va, unsigned long len);
+extern void dcache_clean_inval_range(unsigned long va, unsigned long len);
 
 #endif /*_BOOT_H */
@@ -0,0 +1,42 @@
+#ifndef _VDSO_H
+#define _VDSO_H
+
+// Fixed user address where the vDSO data page is mapped (read-only) in every
+// user process. Programs are linked right above 64KB (see user/user.ld) and
+// the user stack ends right below this page (see exec.h), so a small process
+// fits in a single PTE table (one covers the first 2MB).
+#define VDSO_DATA_ADDR 0x100000
+
+#define NSEC_PER_SEC 1000000000UL
+
+// Shift used for the tick -> nanosecond conversion. See vdso_clock_ns.
+#define VDSO_CLOCK_SHIFT 24
+
+#ifndef __ASSEMBLER__
+
+// Layout of the vDSO data page. The kernel writes it and user space only reads
+// it (see the helpers in user/lib/vdso.c). Everything is fixed for the
+// lifetime of the process, so there's no need for a sequence counter. The page
+// is shared by the threads of the process, so per-thread data such as the
+// current CPU can't live here: EL0 reads the CPU number from tpidrro_el0 (see
+// percpu_init).
+struct vdso_data {
+    // pid of the process that owns this page.
+    unsigned long pid;
+
+    // Calibration for the monotonic clock. The clock is
+    // (cntvct_el0 - clock_base) converted to nanoseconds using clock_freq
+    // (from cntfrq_el0) and clock_mult = (NSEC_PER_SEC << VDSO_CLOCK_SHIFT) /
+    // clock_freq.
+    unsigned long clock_base;
+    unsigned long clock_freq;
+    unsigned long clock_mult;
+};
+
+struct mm_struct;
+
+void vdso_init(void);
+int vdso_setup(struct mm_struct *mm, int pid);
+
+#endif
+#endif /*_VDSO_H */
@@ -0,0 +1,33 @@
+#ifndef _WORKQUEUE_H
+#define _WORKQUEUE_H
+
+#include "list.h"
+
+// Deferred work that runs in a kernel thread (one per CPU), so unlike a
+// softirq it can sleep and take as long as it needs. Interrupt handlers and
+// softirqs queue work for whatever doesn't belong in interrupt context.
+//
+// Example:
+//   static void flush_fn(struct work_struct *work) { ... }
+//   static struct work_struct flush_work;
+//   INIT_WORK(&flush_work, flush_fn);
+//   queue_work(&flush_work);
+struct work_struct {
+    struct list_head entry;
+    void (*func)(struct work_struct *work);
+    // Queued and not started yet. Queuing a pending work does nothing.
+    int pending;
+};
+
+#define INIT_WORK(_work, _func)            \
+    do {                                   \
+        INIT_LIST_HEAD(&(_work)->entry);   \
+        (_work)->func = (_func);           \
+        (_work)->pending = 0;              \
+    } while (0)
+
+int workqueue_init(void);
+int queue_work(struct work_struct *work);
+void workqueue_stats_dump(void);
+
+#endif /*_WORKQUEUE_H */
@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+"""Builds the initramfs: a newc cpio archive with every regular file under a
+directory (the user programs, see the Makefile).
+
+The kernel maps read-only program pages straight from the archive (see
+src/exec.c), so the data of every file starts on a page boundary. newc puts
+the data right after the (4-byte padded) file name, so we get there by padding
+the name with NULs. c_namesize counts the padding, which any newc reader
+handles since the name is still NUL terminated.
+
+Usage: mkinitramfs.py <root dir> <output file>
+"""
+
+import os
+import sys
+
+PAGE_SIZE = 4096
+HEADER_SIZE = 110
+TRAILER = "TRAILER!!!"
+
+S_IFDIR = 0o040000
+S_IFREG = 0o100000
+
+
+def align(value, alignment):
+    return (value + alignment - 1) & ~(alignment - 1)
+
+
+def header(ino, mode, nlink, filesize, namesize):
+    # magic, then 13 fields as 8 hex digits: ino, mode, uid, gid, nlink, mtime,
+    # filesize, devmajor, devminor, rdevmajor, rdevminor, namesize, check.
+    fields = [ino, mode, 0, 0, nlink, 0, filesize, 0, 0, 0, 0, namesize, 0]
+    return b"070701" + b"".join(b"%08X" % f for f in fields)
+
+
+class Archive:
+    def __init__(self):
+        self.data = bytearray()
+        self.ino = 1
+
+    def add(self, name, mode, nlink=1, content=b"", page_align=False):
+        name = name.encode() + b"\0"
+        namesize = len(name)
+        if page_align and content:
+            name_start = len(self.data) + HEADER_SIZE
+            namesize = align(name_start + namesize, PAGE_SIZE) - name_start
+
+        self.data += header(self.ino, mode, nlink, len(content), namesize)
+        self.data += name.ljust(namesize, b"\0")
+        self.data += b"\0" * (align(len(self.data), 4) - len(self.data))
+        self.data += content
+        self.data += b"\0" * (align(len(self.data), 4) - len(self.data))
+        self.ino += 1
+
+
+def main():
+    if len(sys.argv) != 3:
+        sys.exit(__doc__)
+    root, output = sys.argv[1], sys.argv[2]
+
+    archive = Archive()
+    for dirpath, dirnames, filenames in os.walk(root):
+        dirnames.sort()
+        rel = os.path.relpath(dirpath, root)
+        if rel != ".":
+            archive.add(rel, S_IFDIR | 0o755, nlink=2)
+        for filename in sorted(filenames):
+            path = os.path.join(dirpath, filename)
+            with open(path, "rb") as f:
+                content = f.read()
+            mode = S_IFREG | (os.stat(path).st_mode & 0o777)
+            archive.add(os.path.normpath(os.path.join(rel, filename)), mode,
+                        content=content, page_align=True)
+    archive.add(TRAILER, 0)
+
+    with open(output, "wb") as f:
+        f.write(archive.data)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,399 @@
+#include "bench.h"
+#include "blkdev.h"
+#include "buffer_head.h"
+#include "dma.h"
+#include "mm.h"
+#include "printf.h"
+#include "sched.h"
+#include "timer.h"
+#include "uart.h"
+
+#define PRINTF_BENCH_ITERATIONS 10000
+
+static inline unsigned long read_cntvct(void) {
+    unsigned long val;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(val));
+    return val;
+}
+
+// Sinks that throw the output away so that we only measure the formatting.
+static unsigned long bench_chars;
+
+static void null_write(void *p, const char *s, unsigned long len) {
+    bench_chars += len;
+}
+
+static void null_putc(void *p, char c) { bench_chars++; }
+
+// The formatter that printf used before it was buffered (tfp_format as it came
+// with the Kustaa Nyholm library), kept as the baseline: putf is called for
+// every character, and numbers are converted by dividing by the largest power
+// of the base first. The 'l' paths are compiled in (they were behind
+// PRINTF_LONG_SUPPORT), with the power held in an unsigned long so that 64-bit
+// numbers come out right.
+static void old_uli2a(unsigned long num, unsigned int base, int uc, char *bf) {
+    int n = 0;
+    unsigned long d = 1;
+    while (num / d >= base) d *= base;
+    while (d != 0) {
+        int dgt = num / d;
+        num %= d;
+        d /= base;
+        if (n || dgt > 0 || d == 0) {
+            *bf++ = dgt + (dgt < 10 ? '0' : (uc ? 'A' : 'a') - 10);
+            ++n;
+        }
+    }
+    *bf = 0;
+}
+
+static void old_li2a(long num, char *bf) {
+    if (num < 0) {
+        num = -num;
+        *bf++ = '-';
+    }
+    old_uli2a(num, 10, 0, bf);
+}
+
+static char old_a2i(char ch, char **src, int *nump) {
+    char *p = *src;
+    int num = 0;
+    while (ch >= '0' && ch <= '9') {
+        num = num * 10 + ch - '0';
+        ch = *p++;
+    }
+    *src = p;
+    *nump = num;
+    return ch;
+}
+
+static void old_putchw(void *putp, void (*putf)(void *, char), int n, char z,
+                       char *bf) {
+    char fc = z ? '0' : ' ';
+    char ch;
+    char *p = bf;
+    while (*p++ && n > 0) n--;
+    while (n-- > 0) putf(putp, fc);
+    while ((ch = *bf++)) putf(putp, ch);
+}
+
+static void old_format(void *putp, void (*putf)(void *, char), char *fmt,
+                       va_list va) {
+    char bf[24];
+    char ch;
+
+    while ((ch = *(fmt++))) {
+        if (ch != '%') {
+            putf(putp, ch);
+            continue;
+        }
+        char lz = 0;
+        char lng = 0;
+        int w = 0;
+        ch = *(fmt++);
+        if (ch == '0') {
+            ch = *(fmt++);
+            lz = 1;
+        }
+        if (ch >= '0' && ch <= '9') {
+            ch = old_a2i(ch, &fmt, &w);
+        }
+        if (ch == 'l') {
+            ch = *(fmt++);
+            lng = 1;
+        }
+        switch (ch) {
+            case 0:
+                return;
+            case 'u':
+                if (lng)
+                    old_uli2a(va_arg(va, unsigned long), 10, 0, bf);
+                else
+                    old_uli2a(va_arg(va, unsigned int), 10, 0, bf);
+                old_putchw(putp, putf, w, lz, bf);
+                break;
+            case 'd':
+                if (lng)
+                    old_li2a(va_arg(va, long), bf);
+                else
+                    old_li2a(va_arg(va, int), bf);
+                old_putchw(putp, putf, w, lz, bf);
+                break;
+            case 'x':
+            case 'X':
+                if (lng)
+                    old_uli2a(va_arg(va, unsigned long), 16, ch == 'X', bf);
+                else
+                    old_uli2a(va_arg(va, unsigned int), 16, ch == 'X', bf);
+                old_putchw(putp, putf, w, lz, bf);
+                break;
+            case 'c':
+                putf(putp, (char)(va_arg(va, int)));
+                break;
+            case 's':
+                old_putchw(putp, putf, w, 0, va_arg(va, char *));
+                break;
+            case '%':
+                putf(putp, ch);
+            default:
+                break;
+        }
+    }
+}
+
+// The formatters take a va_list, so go through variadic helpers.
+static void bench_old_format(const char *fmt, ...) {
+    va_list va;
+    va_start(va, fmt);
+    old_format(0, null_putc, (char *)fmt, va);
+    va_end(va);
+}
+
+static void bench_vformat(const char *fmt, ...) {
+    char buf[64];
+    va_list va;
+    va_start(va, fmt);
+    tfp_vformat(0, null_write, buf, sizeof(buf), fmt, va);
+    va_end(va);
+}
+
+// A line like the ones the kernel logs: numbers, 64-bit addresses, padding and
+// a string. No %p, which the old formatter doesn't know.
+#define BENCH_FMT "task %d: pc %lx sp %lx count %08x state %s\r\n"
+#define BENCH_ARGS(i) i, 0xffff000000081234UL, 0xffff0000003ff0a0UL, \
+    i * 7, "running"
+
+static void report(const char *name, unsigned long cycles, unsigned long freq) {
+    unsigned long per_call = cycles / PRINTF_BENCH_ITERATIONS;
+    unsigned long ns = freq ? per_call * 1000000000UL / freq : 0;
+    printf("%s: %lu cycles/call (%lu ns), %lu chars\r\n", name, per_call, ns,
+           bench_chars / PRINTF_BENCH_ITERATIONS);
+}
+
+// Compares the old per-character formatter (what printf used to do for every
+// character written to the UART) with the buffered one that hands runs of
+// characters to the sink, and with snprintf.
+void printf_bench(void) {
+    unsigned long freq;
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(freq));
+    printf("printf benchmark (%d iterations, counter at %lu Hz)\r\n",
+           PRINTF_BENCH_ITERATIONS, freq);
+
+    bench_chars = 0;
+    unsigned long start = read_cntvct();
+    for (int i = 0; i < PRINTF_BENCH_ITERATIONS; i++) {
+        bench_old_format(BENCH_FMT, BENCH_ARGS(i));
+    }
+    report("old per-character format", read_cntvct() - start, freq);
+
+    bench_chars = 0;
+    start = read_cntvct();
+    for (int i = 0; i < PRINTF_BENCH_ITERATIONS; i++) {
+        bench_vformat(BENCH_FMT, BENCH_ARGS(i));
+    }
+    report("buffered write", read_cntvct() - start, freq);
+
+    char buf[128];
+    bench_chars = 0;
+    start = read_cntvct();
+    for (int i = 0; i < PRINTF_BENCH_ITERATIONS; i++) {
+        bench_chars += snprintf(buf, sizeof(buf), BENCH_FMT, BENCH_ARGS(i));
+    }
+    report("snprintf", read_cntvct() - start, freq);
+}
+
+// Blocks read by each run of blk_bench, and the part of the device that the
+// random run reads from (the first 64MB, so that it works on small images).
+#define BLK_BENCH_SEQ_BLOCKS 4096
+#define BLK_BENCH_RAND_BLOCKS 1024
+#define BLK_BENCH_RAND_SPAN (64 * 1024 * 1024 / BLOCK_SIZE)
+
+// Reads nr blocks through the buffer cache, starting with a cold cache, and
+// prints the throughput and how many requests the driver got.
+static void blk_bench_run(const char *name, struct block_device *bdev,
+                          int random, unsigned long nr) {
+    unsigned long span = bdev->nr_blocks;
+    if (random && span > BLK_BENCH_RAND_SPAN) {
+        span = BLK_BENCH_RAND_SPAN;
+    }
+    if (nr > span) {
+        nr = span;
+    }
+
+    invalidate_bdev(bdev);
+    unsigned long requests = bdev->requests;
+    unsigned long x = 1;
+    unsigned long start = timer_read_counter();
+    for (unsigned long i = 0; i < nr; i++) {
+        unsigned long block = i;
+        if (random) {
+            x = x * 6364136223846793005UL + 1442695040888963407UL;
+            block = (x >> 33) % span;
+        }
+        struct buffer_head *bh = bread(bdev, block);
+        if (!bh) {
+            printf("%s: read of block %lu failed\r\n", name, block);
+            return;
+        }
+        brelse(bh);
+    }
+    unsigned long ns = cycles_to_ns(timer_read_counter() - start);
+
+    unsigned long kb = nr * BLOCK_SIZE / 1024;
+    printf("%s: %lu blocks in %lu us, %lu KB/s, %lu us/block, %lu requests\r\n",
+           name, nr, ns / 1000, ns ? kb * 1000000000UL / ns : 0,
+           ns / 1000 / nr, bdev->requests - requests);
+}
+
+// Sequential reads with and without read-ahead, and random reads, from the
+// SD card.
+void blk_bench(void) {
+    struct block_device *bdev = lookup_bdev("mmcblk0");
+    if (!bdev) {
+        printf("blk bench: no mmcblk0\r\n");
+        return;
+    }
+
+    blk_bench_run("sequential", bdev, 0, BLK_BENCH_SEQ_BLOCKS);
+    buffer_set_readahead(0);
+    blk_bench_run("sequential, no read-ahead", bdev, 0, BLK_BENCH_SEQ_BLOCKS);
+    buffer_set_readahead(1);
+    blk_bench_run("random", bdev, 1, BLK_BENCH_RAND_BLOCKS);
+    buffer_stats_dump();
+}
+
+// Pages that each run of dma_bench copies (as many as a fork copies at most),
+// and how many runs.
+#define DMA_BENCH_PAGES MAX_PROCESS_PAGES
+#define DMA_BENCH_RUNS 16
+// Characters that dma_bench writes to the UART: what fits in the DMA buffers
+// of uart.c.
+#define DMA_BENCH_UART_CHARS 1024
+
+enum dma_bench_op { DMA_BENCH_COPY, DMA_BENCH_ZERO, DMA_BENCH_CHAIN };
+
+static unsigned long dma_bench_dst[DMA_BENCH_PAGES];
+static unsigned long dma_bench_src[DMA_BENCH_PAGES];
+static char dma_bench_text[DMA_BENCH_UART_CHARS];
+
+// CPU time of the current task so far, in counter cycles.
+static unsigned long task_cpu_cycles(void) {
+    struct task_acct *acct = &current->acct;
+    return acct->utime + acct->stime + timer_read_counter() - acct->timestamp;
+}
+
+// Runs op over the pages with DMA (dma) or the CPU, and prints the time per
+// page and the CPU time the task used for it. Returns the CPU time in
+// counter cycles, or 0 if DMA wasn't available.
+static unsigned long dma_bench_run(const char *name, enum dma_bench_op op,
+                                   int dma) {
+    unsigned long start = timer_read_counter();
+    unsigned long cpu_start = task_cpu_cycles();
+    for (int run = 0; run < DMA_BENCH_RUNS; run++) {
+        if (op == DMA_BENCH_CHAIN) {
+            if (dma_copy_pages(dma_bench_dst, dma_bench_src,
+                               DMA_BENCH_PAGES) < 0) {
+                printf("%s: no DMA channel\r\n", name);
+                return 0;
+            }
+            continue;
+        }
+        for (int i = 0; i < DMA_BENCH_PAGES; i++) {
+            unsigned long dst = dma_bench_dst[i], src = dma_bench_src[i];
+            int ret = 0;
+            if (dma && op == DMA_BENCH_COPY) {
+                ret = dma_copy_page(dst, src);
+            } else if (dma) {
+                ret = dma_zero_page(dst);
+            } else if (op == DMA_BENCH_COPY) {
+                memcpy(dst + VA_START, src + VA_START, PAGE_SIZE);
+            } else {
+                memzero(dst + VA_START, PAGE_SIZE);
+            }
+            if (ret < 0) {
+                printf("%s: no DMA channel\r\n", name);
+                return 0;
+            }
+        }
+    }
+    unsigned long cpu = task_cpu_cycles() - cpu_start;
+    unsigned long ns = cycles_to_ns(timer_read_counter() - start);
+
+    unsigned long pages = DMA_BENCH_RUNS * DMA_BENCH_PAGES;
+    printf("%s: %lu ns/page, CPU %lu ns/page\r\n", name, ns / pages,
+           cycles_to_ns(cpu) / pages);
+    return cpu;
+}
+
+// How long writing DMA_BENCH_UART_CHARS characters takes with uart_send (PIO)
+// and with uart_write (DMA), in microseconds. uart_write returns once the text
+// is queued, but the next write may have to wait for it to go out, so the time
+// until the queue is drained is shown too. Both runs start with it empty.
+static void dma_bench_uart(void) {
+    for (int i = 0; i < DMA_BENCH_UART_CHARS; i++) {
+        dma_bench_text[i] = i % 64 == 62 ? '\r' : i % 64 == 63 ? '\n' : '.';
+    }
+
+    uart_flush();
+    unsigned long start = timer_read_counter();
+    for (int i = 0; i < DMA_BENCH_UART_CHARS; i++) {
+        uart_send(dma_bench_text[i]);
+    }
+    unsigned long pio = cycles_to_ns(timer_read_counter() - start);
+
+    start = timer_read_counter();
+    uart_write(0, dma_bench_text, DMA_BENCH_UART_CHARS);
+    unsigned long queued = cycles_to_ns(timer_read_counter() - start);
+    uart_flush();
+    unsigned long sent = cycles_to_ns(timer_read_counter() - start);
+
+    printf("uart, %d chars: %lu us with PIO; with uart_write, queued in %lu "
+           "us and sent in %lu us\r\n",
+           DMA_BENCH_UART_CHARS, pio / 1000, queued / 1000, sent / 1000);
+}
+
+// Compares page copies and zeroing by the CPU with the DMA engine (polled, as
+// in the page allocator, and chained and sleeping, as in fork), and how long
+// writing to the UART takes with and without DMA.
+void dma_bench(void) {
+    int nr = 0;
+    for (; nr < DMA_BENCH_PAGES; nr++) {
+        dma_bench_dst[nr] = get_free_page();
+        dma_bench_src[nr] = get_free_page();
+        if (!dma_bench_dst[nr] || !dma_bench_src[nr]) {
+            break;
+        }
+    }
+    if (nr < DMA_BENCH_PAGES) {
+        printf("dma bench: out of memory\r\n");
+        goto out;
+    }
+
+    unsigned long cpu = dma_bench_run("memcpy", DMA_BENCH_COPY, 0);
+    dma_bench_run("memzero", DMA_BENCH_ZERO, 0);
+    dma_bench_run("dma copy, polled", DMA_BENCH_COPY, 1);
+    dma_bench_run("dma zero, polled", DMA_BENCH_ZERO, 1);
+    unsigned long chain =
+        dma_bench_run("dma copy, chained", DMA_BENCH_CHAIN, 1);
+    if (chain) {
+        // Negative if the chained copies cost the CPU more than memcpy.
+        long saved = cpu >= chain ? (long)cycles_to_ns(cpu - chain)
+                                  : -(long)cycles_to_ns(chain - cpu);
+        printf("CPU time saved per fork of %d pages: %ld us\r\n",
+               DMA_BENCH_PAGES, saved / DMA_BENCH_RUNS / 1000);
+    }
+
+    dma_bench_uart();
+    dma_stats_dump();
+
+out:
+    for (int i = 0; i <= nr && i < DMA_BENCH_PAGES; i++) {
+        if (dma_bench_dst[i]) {
+            free_page(dma_bench_dst[i]);
+        }
+        if (dma_bench_src[i]) {
+            free_page(dma_bench_src[i]);
+        }
+        dma_bench_dst[i] = dma_bench_src[i] = 0;
+    }
+}
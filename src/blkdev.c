@@ -0,0 +1,103 @@
+#include "blkdev.h"
+#include "printf.h"
+#include "string.h"
+
+// The block layer sits between the buffer cache and the drivers: it keeps the
+// list of devices and makes sure that a driver only gets one request at a
+// time.
+
+static struct list_head bdev_list = LIST_HEAD_INIT(bdev_list);
+// Protects bdev_list.
+static DEFINE_SPINLOCK(bdev_list_lock);
+
+// Adds bdev (filled in by its driver) to the devices that lookup_bdev finds.
+// Returns 0 or -1.
+int register_blkdev(struct block_device *bdev) {
+    if (!bdev->ops || !bdev->ops->read || !bdev->max_blocks) {
+        return -1;
+    }
+    if (lookup_bdev(bdev->name)) {
+        return -1;
+    }
+
+    spin_lock_init(&bdev->lock, "bdev");
+    bdev->busy = 0;
+    init_waitqueue_head(&bdev->wait);
+    bdev->ra_next = 0;
+    bdev->ra_window = 0;
+    bdev->requests = 0;
+    bdev->blocks = 0;
+
+    spin_lock(&bdev_list_lock);
+    list_add_tail(&bdev->list, &bdev_list);
+    spin_unlock(&bdev_list_lock);
+    return 0;
+}
+
+// Returns the device called name (e.g. "mmcblk0"), or 0.
+struct block_device *lookup_bdev(const char *name) {
+    struct block_device *found = 0;
+    spin_lock(&bdev_list_lock);
+    for (struct list_head *pos = bdev_list.next; pos != &bdev_list;
+         pos = pos->next) {
+        struct block_device *bdev = list_entry(pos, struct block_device, list);
+        if (strcmp(bdev->name, (char *)name) == 0) {
+            found = bdev;
+            break;
+        }
+    }
+    spin_unlock(&bdev_list_lock);
+    return found;
+}
+
+static int bdev_try_get(struct block_device *bdev) {
+    int ret = 0;
+    spin_lock(&bdev->lock);
+    if (!bdev->busy) {
+        bdev->busy = 1;
+        ret = 1;
+    }
+    spin_unlock(&bdev->lock);
+    return ret;
+}
+
+// Reads count blocks starting at block into bufs (see
+// block_device_operations). Requests larger than the driver takes are split.
+// Sleeps while another task uses the device. Returns 0 or -1.
+int blkdev_read(struct block_device *bdev, unsigned long block,
+                unsigned int count, char **bufs) {
+    if (block >= bdev->nr_blocks || count > bdev->nr_blocks - block) {
+        return -1;
+    }
+
+    wait_event(bdev->wait, bdev_try_get(bdev));
+
+    int ret = 0;
+    while (count && !ret) {
+        unsigned int n = count < bdev->max_blocks ? count : bdev->max_blocks;
+        ret = bdev->ops->read(bdev, block, n, bufs);
+        bdev->requests++;
+        bdev->blocks += n;
+        block += n;
+        bufs += n;
+        count -= n;
+    }
+
+    spin_lock(&bdev->lock);
+    bdev->busy = 0;
+    spin_unlock(&bdev->lock);
+    wake_up(&bdev->wait);
+    return ret;
+}
+
+void blkdev_stats_dump(void) {
+    printf("bdev: blocks / requests / blocks read\r\n");
+    spin_lock(&bdev_list_lock);
+    for (struct list_head *pos = bdev_list.next; pos != &bdev_list;
+         pos = pos->next) {
+        struct block_device *bdev = list_entry(pos, struct block_device, list);
+        printf("%s: %lu / %lu / %lu\r\n", bdev->name, bdev->nr_blocks,
+               bdev->requests, bdev->blocks);
+    }
+    spin_unlock(&bdev_list_lock);
+}
@@ -0,0 +1,248 @@
+#include "buffer_head.h"
+#include "blkdev.h"
+#include "mm.h"
+#include "printf.h"
+#include "sched.h"
+#include "spinlock.h"
+
+// The buffer cache keeps recently read blocks in memory. Blocks are found by
+// (device, block number) in a hash table, and the buffers nobody is using are
+// kept in LRU order so that the one that wasn't used for the longest time is
+// the one that gets reused. The data lives in pages carved into BLOCK_SIZE
+// buffers at boot, so the cache never allocates after that.
+//
+// A buffer is locked (BH_Lock) while it's being read. Tasks that want it wait
+// on buffer_wait instead of holding buffer_lock over the I/O, which can take
+// milliseconds.
+
+static struct buffer_head buffers[NR_BUFFERS];
+static struct list_head buffer_hash[BUFFER_HASH_SIZE];
+// Unreferenced buffers, least recently used first.
+static struct list_head buffer_lru = LIST_HEAD_INIT(buffer_lru);
+
+// Protects the hash table, the LRU list, the buffers (except the data of a
+// locked one) and the read-ahead state of the devices.
+static DEFINE_SPINLOCK(buffer_lock);
+
+static struct wait_queue_head buffer_wait = WAIT_QUEUE_HEAD_INIT(buffer_wait);
+
+static int readahead_enabled = 1;
+
+struct buffer_stats {
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long readahead;
+    unsigned long evictions;
+};
+
+static struct buffer_stats buffer_stats;
+
+static struct list_head *hash_bucket(struct block_device *bdev,
+                                     unsigned long block) {
+    unsigned long hash = block ^ ((unsigned long)bdev >> 6);
+    return &buffer_hash[hash & (BUFFER_HASH_SIZE - 1)];
+}
+
+// Must be called with buffer_lock held.
+static struct buffer_head *find_buffer(struct block_device *bdev,
+                                       unsigned long block) {
+    struct list_head *bucket = hash_bucket(bdev, block);
+    for (struct list_head *pos = bucket->next; pos != bucket; pos = pos->next) {
+        struct buffer_head *bh = list_entry(pos, struct buffer_head, b_hash);
+        if (bh->b_bdev == bdev && bh->b_blocknr == block) {
+            return bh;
+        }
+    }
+    return 0;
+}
+
+// Takes the least recently used buffer and gives it to block, locked. Returns
+// 0 if every buffer is in use. Must be called with buffer_lock held.
+static struct buffer_head *get_free_buffer(struct block_device *bdev,
+                                           unsigned long block) {
+    if (list_empty(&buffer_lru)) {
+        return 0;
+    }
+    struct buffer_head *bh =
+        list_entry(buffer_lru.next, struct buffer_head, b_lru);
+    list_del_init(&bh->b_lru);
+    if (bh->b_state & BH_Uptodate) {
+        buffer_stats.evictions++;
+    }
+    list_del_init(&bh->b_hash);
+
+    bh->b_bdev = bdev;
+    bh->b_blocknr = block;
+    bh->b_count = 0;
+    bh->b_state = BH_Lock;
+    list_add(&bh->b_hash, hash_bucket(bdev, block));
+    return bh;
+}
+
+// How many blocks to read on a miss at block. A miss right after the last
+// block that was read grows the window, anything else resets it. Must be
+// called with buffer_lock held.
+static unsigned int readahead_window(struct block_device *bdev,
+                                     unsigned long block, int sequential) {
+    if (!readahead_enabled || !sequential) {
+        bdev->ra_window = 0;
+        return 1;
+    }
+    if (!bdev->ra_window) {
+        bdev->ra_window = BUFFER_RA_MIN;
+    } else if (bdev->ra_window < BUFFER_RA_MAX) {
+        bdev->ra_window *= 2;
+    }
+    return bdev->ra_window;
+}
+
+static int buffer_unlocked(struct buffer_head *bh) {
+    return !(__atomic_load_n(&bh->b_state, __ATOMIC_ACQUIRE) & BH_Lock);
+}
+
+// Returns the buffer of block of bdev, read from the device if it isn't in
+// the cache, with a reference (see brelse). Returns 0 if the read failed or
+// every buffer is in use.
+struct buffer_head *bread(struct block_device *bdev, unsigned long block) {
+    struct buffer_head *bhs[BUFFER_RA_MAX];
+    char *bufs[BUFFER_RA_MAX];
+
+    if (block >= bdev->nr_blocks) {
+        return 0;
+    }
+
+    spin_lock(&buffer_lock);
+    int sequential = block == bdev->ra_next;
+    bdev->ra_next = block + 1;
+
+    struct buffer_head *bh = find_buffer(bdev, block);
+    if (bh) {
+        if (bh->b_count++ == 0) {
+            list_del_init(&bh->b_lru);
+        }
+        buffer_stats.hits++;
+        spin_unlock(&buffer_lock);
+
+        // It may still be on its way in (someone else's read-ahead).
+        wait_event(buffer_wait, buffer_unlocked(bh));
+        if (!(bh->b_state & BH_Uptodate)) {
+            brelse(bh);
+            return 0;
+        }
+        return bh;
+    }
+
+    buffer_stats.misses++;
+    bh = get_free_buffer(bdev, block);
+    if (!bh) {
+        spin_unlock(&buffer_lock);
+        return 0;
+    }
+    bh->b_count = 1;
+    bhs[0] = bh;
+
+    // Read ahead the blocks that follow, as long as they aren't cached. They
+    // must be consecutive on the device to go in the same request.
+    unsigned int window = readahead_window(bdev, block, sequential);
+    unsigned int n = 1;
+    while (n < window && block + n < bdev->nr_blocks &&
+           !find_buffer(bdev, block + n)) {
+        struct buffer_head *ra = get_free_buffer(bdev, block + n);
+        if (!ra) {
+            break;
+        }
+        bhs[n++] = ra;
+    }
+    buffer_stats.readahead += n - 1;
+    spin_unlock(&buffer_lock);
+
+    for (unsigned int i = 0; i < n; i++) {
+        bufs[i] = bhs[i]->b_data;
+    }
+    int err = blkdev_read(bdev, block, n, bufs);
+
+    spin_lock(&buffer_lock);
+    for (unsigned int i = 0; i < n; i++) {
+        struct buffer_head *b = bhs[i];
+        __atomic_store_n(&b->b_state, err ? 0 : BH_Uptodate, __ATOMIC_RELEASE);
+        // A failed block is dropped from the cache so the next bread tries
+        // again.
+        if (err) {
+            list_del_init(&b->b_hash);
+        }
+        // Read-ahead buffers that nobody asked for yet go on the LRU list.
+        if (!b->b_count) {
+            list_add_tail(&b->b_lru, &buffer_lru);
+        }
+    }
+    spin_unlock(&buffer_lock);
+    wake_up(&buffer_wait);
+
+    if (err) {
+        brelse(bh);
+        return 0;
+    }
+    return bh;
+}
+
+// Drops a reference taken by bread.
+void brelse(struct buffer_head *bh) {
+    spin_lock(&buffer_lock);
+    if (--bh->b_count == 0) {
+        list_add_tail(&bh->b_lru, &buffer_lru);
+    }
+    spin_unlock(&buffer_lock);
+}
+
+// Drops the cached blocks of bdev that nobody is using, so that the next
+// reads go to the device.
+void invalidate_bdev(struct block_device *bdev) {
+    spin_lock(&buffer_lock);
+    for (int i = 0; i < NR_BUFFERS; i++) {
+        struct buffer_head *bh = &buffers[i];
+        if (bh->b_bdev != bdev || bh->b_count || (bh->b_state & BH_Lock)) {
+            continue;
+        }
+        list_del_init(&bh->b_hash);
+        bh->b_bdev = 0;
+        bh->b_state = 0;
+        // Reuse these first.
+        list_del_init(&bh->b_lru);
+        list_add(&bh->b_lru, &buffer_lru);
+    }
+    bdev->ra_next = 0;
+    bdev->ra_window = 0;
+    spin_unlock(&buffer_lock);
+}
+
+void buffer_set_readahead(int enabled) { readahead_enabled = enabled; }
+
+// Carves the buffers out of pages. Returns 0 or -1.
+int buffer_init(void) {
+    for (int i = 0; i < BUFFER_HASH_SIZE; i++) {
+        INIT_LIST_HEAD(&buffer_hash[i]);
+    }
+
+    char *page = 0;
+    for (int i = 0; i < NR_BUFFERS; i++) {
+        if (i % (PAGE_SIZE / BLOCK_SIZE) == 0) {
+            page = (char *)allocate_kernel_page();
+            if (!page) {
+                return -1;
+            }
+        }
+        struct buffer_head *bh = &buffers[i];
+        bh->b_data = page + (i % (PAGE_SIZE / BLOCK_SIZE)) * BLOCK_SIZE;
+        INIT_LIST_HEAD(&bh->b_hash);
+        list_add_tail(&bh->b_lru, &buffer_lru);
+    }
+    return 0;
+}
+
+void buffer_stats_dump(void) {
+    printf("buffer cache: %d buffers, read-ahead %s\r\n", NR_BUFFERS,
+           readahead_enabled ? "on" : "off");
+    printf("hits %lu, misses %lu, read ahead %lu, evictions %lu\r\n",
+           buffer_stats.hits, buffer_stats.misses, buffer_stats.readahead,
+           buffer_stats.evictions);
+}
@@ -0,0 +1,178 @@
+#include "console.h"
+#include "bench.h"
+#include "blkdev.h"
+#include "buffer_head.h"
+#include "dma.h"
+#include "fork.h"
+#include "irq.h"
+#include "kstack.h"
+#include "pagemap.h"
+#include "printf.h"
+#include "rusage.h"
+#include "slab.h"
+#include "softirq.h"
+#include "spinlock.h"
+#include "string.h"
+#include "uart.h"
+#include "workqueue.h"
+
+// A tiny shell on the UART that runs next to whatever user space is doing.
+// The UART IRQ handler only moves received characters into rx_buf and queues
+// console_work, which edits the line and runs the command once it's complete.
+// Commands only print kernel state, so they can be used to look at a running
+// system (e.g. "ps" while a benchmark runs). Benchmarks take seconds, so they
+// run in a kernel thread of their own (console_bench_thread) instead of
+// holding up the workqueue, which everything else defers its work to.
+
+static DEFINE_SPINLOCK(console_rx_lock);
+static struct work_struct console_work;
+
+static char rx_buf[CONSOLE_BUF_SIZE];
+// rx_head is where the handler writes and rx_tail where the work reads.
+// They only grow, the index is taken modulo CONSOLE_BUF_SIZE.
+static unsigned long rx_head;
+static unsigned long rx_tail;
+
+// The line being typed. Only used by console_work.
+static char line[CONSOLE_LINE_MAX];
+static int line_len;
+
+static void handle_uart_irq(int irq, void *data) {
+    char c;
+
+    spin_lock(&console_rx_lock);
+    while (uart_try_recv(&c)) {
+        if (rx_head - rx_tail < CONSOLE_BUF_SIZE) {
+            rx_buf[rx_head++ % CONSOLE_BUF_SIZE] = c;
+        }
+    }
+    spin_unlock(&console_rx_lock);
+    uart_ack_rx_irq();
+    queue_work(&console_work);
+}
+
+// Returns 1 and stores the next received character in c, or 0 if there's
+// none.
+static int console_getc(char *c) {
+    int ret = 0;
+    unsigned long flags = spin_lock_irqsave(&console_rx_lock);
+    if (rx_tail != rx_head) {
+        *c = rx_buf[rx_tail++ % CONSOLE_BUF_SIZE];
+        ret = 1;
+    }
+    spin_unlock_irqrestore(&console_rx_lock, flags);
+    return ret;
+}
+
+static void console_help(void);
+
+struct console_cmd {
+    char *name;
+    char *help;
+    void (*fn)(void);
+    // Runs in console_bench_thread.
+    int slow;
+};
+
+// The slow command that console_bench_thread has to run, or 0 once it's done.
+static struct console_cmd *bench_cmd;
+static struct wait_queue_head bench_wait;
+
+static struct console_cmd console_cmds[] = {
+    {"ps", "tasks and their CPU time, switches and faults", task_usage_dump},
+    {"lockstat", "spinlock contention", spin_lock_stats_dump},
+    {"irq", "interrupt counts", irq_stats_dump},
+    {"slab", "slab caches", kmem_cache_stats_dump},
+    {"stack", "kernel stack watermarks", stack_watermark_dump},
+    {"softirq", "softirqs run on each CPU", softirq_stats_dump},
+    {"work", "work run by the workqueue", workqueue_stats_dump},
+    {"bdev", "block devices", blkdev_stats_dump},
+    {"bcache", "buffer cache hits and misses", buffer_stats_dump},
+    {"pagecache", "page cache hits and misses", page_cache_stats_dump},
+    {"blkbench", "SD card read benchmark", blk_bench, 1},
+    {"dma", "DMA channels and page copies", dma_stats_dump},
+    {"dmabench", "CPU time of copies and UART output with and without DMA",
+     dma_bench, 1},
+    {"help", "this list", console_help},
+};
+
+#define NR_CONSOLE_CMDS (sizeof(console_cmds) / sizeof(console_cmds[0]))
+
+static void console_help(void) {
+    for (int i = 0; i < NR_CONSOLE_CMDS; i++) {
+        printf("%s: %s\r\n", console_cmds[i].name, console_cmds[i].help);
+    }
+}
+
+static void console_run(char *cmd) {
+    if (!cmd[0]) {
+        return;
+    }
+    for (int i = 0; i < NR_CONSOLE_CMDS; i++) {
+        struct console_cmd *c = &console_cmds[i];
+        if (strcmp(cmd, c->name) != 0) {
+            continue;
+        }
+        if (!c->slow) {
+            c->fn();
+            return;
+        }
+        struct console_cmd *idle = 0;
+        if (!__atomic_compare_exchange_n(&bench_cmd, &idle, c, 0,
+                                         __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            printf("%s is still running\r\n", idle->name);
+            return;
+        }
+        wake_up(&bench_wait);
+        return;
+    }
+    printf("unknown command %s, try help\r\n", cmd);
+}
+
+static void console_bench_thread(unsigned long arg) {
+    while (1) {
+        wait_event(bench_wait,
+                   __atomic_load_n(&bench_cmd, __ATOMIC_ACQUIRE) != 0);
+        bench_cmd->fn();
+        printf("%s done\r\n> ", bench_cmd->name);
+        __atomic_store_n(&bench_cmd, 0, __ATOMIC_RELEASE);
+    }
+}
+
+// Echoes what was typed and runs the line once it's complete.
+static void console_work_fn(struct work_struct *work) {
+    char c;
+    while (console_getc(&c)) {
+        if (c == '\r' || c == '\n') {
+            printf("\r\n");
+            line[line_len] = 0;
+            console_run(line);
+            line_len = 0;
+            printf("> ");
+        } else if (c == '\b' || c == 0x7f) {
+            if (line_len > 0) {
+                line_len--;
+                printf("\b \b");
+            }
+        } else if (line_len < CONSOLE_LINE_MAX - 1) {
+            line[line_len++] = c;
+            printf("%c", c);
+        }
+    }
+}
+
+// Enables the UART receive interrupt. Call it once the boot loader is done
+// with the UART and the workqueue is running. Returns 0 or -1.
+int console_init(void) {
+    INIT_WORK(&console_work, console_work_fn);
+    init_waitqueue_head(&bench_wait);
+    if (copy_process(PF_KTHREAD, (unsigned long)&console_bench_thread, 0,
+                     0) < 0) {
+        return -1;
+    }
+    if (request_irq(IRQ_UART, handle_uart_irq, 0) < 0) {
+        return -1;
+    }
+    uart_enable_rx_irq();
+    return 0;
+}
@@ -0,0 +1,394 @@
+#include "dma.h"
+#include "irq.h"
+#include "mm.h"
+#include "peripherals/dma.h"
+#include "printf.h"
+#include "printk.h"
+#include "spinlock.h"
+#include "timer.h"
+#include "utils.h"
+
+// Driver for the DMA engine. A transfer is a chain of control blocks in
+// memory: the channel gets the bus address of the first one and runs them in
+// order, each moving txfr_len bytes (see struct dma_cb). dma_request_channel
+// hands out channels, each with a page of control blocks for its owner.
+//
+// There are two ways to wait for a transfer:
+//   - dma_poll spins on DMA_CS. It works anywhere, with spinlocks held or IRQs
+//     disabled, which is what the page allocator needs (dma_zero_page).
+//   - dma_wait sleeps until the completion interrupt, which the last block of
+//     the chain asks for (DMA_TI_INTEN). The CPU runs other tasks meanwhile
+//     (dma_copy_pages, for fork).
+//
+// The engine reads and writes RAM behind the data cache. RAM is mapped
+// non-cacheable for now (see arm/mmu.h), so the cache maintenance below
+// finds nothing to do, but it keeps the transfers right if that changes: what
+// the engine reads (the data and the control blocks) is cleaned before a
+// transfer, and what it writes is cleaned and invalidated before and after.
+
+// Memory to memory: 128-bit reads and writes in bursts.
+#define DMA_TI_MEMCPY                                                 \
+    (DMA_TI_SRC_INC | DMA_TI_DEST_INC | DMA_TI_SRC_WIDTH |            \
+     DMA_TI_DEST_WIDTH | DMA_TI_BURST_LENGTH(4) | DMA_TI_WAIT_RESP)
+
+// How long dma_poll waits before it gives up on the channel.
+#define DMA_TIMEOUT_NS 100000000UL
+
+// Updated by every CPU without a lock, hence the atomics.
+struct dma_stats {
+    unsigned long page_copies;
+    unsigned long page_zeroes;
+    // Page operations done by the CPU because every channel was taken.
+    unsigned long no_channel;
+};
+
+static struct dma_chan dma_chans[DMA_MAX_CHANNELS];
+static struct dma_stats dma_stats;
+
+// Protects the in_use flags of the channels.
+static DEFINE_SPINLOCK(dma_lock);
+
+static int dma_ready;
+// dma_set_page_ops can turn dma_copy_page and dma_zero_page off (to compare
+// them with the CPU).
+static int page_ops_enabled = 1;
+// The source of dma_zero_page.
+static unsigned long zero_page;
+
+// Bus address of the physical address pa of RAM.
+unsigned int dma_bus_addr(unsigned long pa) {
+    return (unsigned int)pa | DMA_BUS_RAM;
+}
+
+unsigned int dma_cb_bus_addr(struct dma_cb *cb) {
+    return dma_bus_addr((unsigned long)cb - VA_START);
+}
+
+// Bus address of a peripheral register (e.g. UART_DR).
+static unsigned int dma_dev_bus_addr(unsigned long reg) {
+    return (unsigned int)(reg - PBASE) + DMA_BUS_PERIPHERALS;
+}
+
+static void dma_chan_reset(struct dma_chan *chan) {
+    put32(chan->base + DMA_CS, DMA_CS_RESET);
+    put32(chan->base + DMA_DEBUG, DMA_DEBUG_ERRORS);
+}
+
+// Returns a free channel, or 0 if they're all taken. Doesn't sleep.
+struct dma_chan *dma_request_channel(void) {
+    if (!dma_ready) {
+        return 0;
+    }
+
+    struct dma_chan *found = 0;
+    unsigned long flags = spin_lock_irqsave(&dma_lock);
+    for (int i = 0; i < DMA_MAX_CHANNELS; i++) {
+        struct dma_chan *chan = &dma_chans[i];
+        if (chan->cbs && !chan->in_use) {
+            chan->in_use = 1;
+            chan->callback = 0;
+            found = chan;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&dma_lock, flags);
+    return found;
+}
+
+// The channel must be idle.
+void dma_release_channel(struct dma_chan *chan) {
+    unsigned long flags = spin_lock_irqsave(&dma_lock);
+    chan->callback = 0;
+    chan->in_use = 0;
+    spin_unlock_irqrestore(&dma_lock, flags);
+}
+
+// fn is called by the completion interrupt of every transfer of chan.
+void dma_set_callback(struct dma_chan *chan, dma_callback_t fn, void *data) {
+    chan->callback_data = data;
+    chan->callback = fn;
+}
+
+// Fills the control blocks of chan from index first on to copy len bytes
+// from src to dst (physical addresses), and links them after block first - 1
+// if first isn't 0. Returns the index of the block after the last one, or -1
+// if they don't fit.
+int dma_prep_memcpy(struct dma_chan *chan, int first, unsigned long dst,
+                    unsigned long src, unsigned long len) {
+    int i = first;
+    while (len) {
+        if (i >= (int)DMA_MAX_CBS) {
+            return -1;
+        }
+        unsigned long n = len < DMA_MAX_LEN ? len : DMA_MAX_LEN;
+        struct dma_cb *cb = &chan->cbs[i];
+        cb->ti = DMA_TI_MEMCPY;
+        cb->source_ad = dma_bus_addr(src);
+        cb->dest_ad = dma_bus_addr(dst);
+        cb->txfr_len = n;
+        cb->stride = 0;
+        cb->nextconbk = 0;
+        if (i > 0) {
+            chan->cbs[i - 1].nextconbk = dma_cb_bus_addr(cb);
+        }
+        i++;
+        dst += n;
+        src += n;
+        len -= n;
+    }
+    return i;
+}
+
+// Fills control block i of chan to write len bytes from src (a physical
+// address) to the peripheral register reg, one 32-bit word at a time, as fast
+// as the peripheral asks for them (dreq, see DMA_DREQ_*).
+void dma_prep_mem_to_dev(struct dma_chan *chan, int i, unsigned long src,
+                         unsigned long reg, unsigned long len, int dreq) {
+    struct dma_cb *cb = &chan->cbs[i];
+    cb->ti = DMA_TI_SRC_INC | DMA_TI_DEST_DREQ | DMA_TI_PERMAP(dreq) |
+             DMA_TI_WAIT_RESP;
+    cb->source_ad = dma_bus_addr(src);
+    cb->dest_ad = dma_dev_bus_addr(reg);
+    cb->txfr_len = len;
+    cb->stride = 0;
+    cb->nextconbk = 0;
+}
+
+// Starts the chain of nr control blocks of chan that begins at block first.
+// With irq, the completion interrupt fires when it's done (see dma_wait and
+// dma_set_callback). The channel must be idle.
+void dma_start(struct dma_chan *chan, int first, int nr, int irq) {
+    struct dma_cb *cb = &chan->cbs[first];
+    if (irq) {
+        cb[nr - 1].ti |= DMA_TI_INTEN;
+    }
+    for (int i = 0; i < nr; i++) {
+        chan->bytes += cb[i].txfr_len;
+    }
+    chan->transfers++;
+    dcache_clean_range((unsigned long)cb, nr * sizeof(*cb));
+
+    __atomic_store_n(&chan->done, 0, __ATOMIC_RELAXED);
+    chan->error = 0;
+    // Clear what the last transfer left (writing 1 clears END and INT).
+    put32(chan->base + DMA_CS, DMA_CS_END | DMA_CS_INT);
+    put32(chan->base + DMA_CONBLK_AD, dma_cb_bus_addr(cb));
+    put32(chan->base + DMA_CS,
+          DMA_CS_ACTIVE | DMA_CS_WAIT_FOR_OUTSTANDING_WRITES);
+}
+
+// Returns 1 while chan is running a chain.
+int dma_busy(struct dma_chan *chan) {
+    return (get32(chan->base + DMA_CS) & DMA_CS_ACTIVE) != 0;
+}
+
+// Spins until the transfer of chan is done. Returns 0, or -1 if the engine
+// reported an error or didn't finish in time (the channel is reset).
+int dma_poll(struct dma_chan *chan) {
+    unsigned long deadline =
+        timer_read_counter() + ns_to_cycles(DMA_TIMEOUT_NS);
+    while (1) {
+        unsigned int cs = get32(chan->base + DMA_CS);
+        if (cs & DMA_CS_ERROR) {
+            break;
+        }
+        if (!(cs & DMA_CS_ACTIVE)) {
+            put32(chan->base + DMA_CS, DMA_CS_END | DMA_CS_INT);
+            return 0;
+        }
+        if (timer_read_counter() > deadline) {
+            break;
+        }
+    }
+    printk(KERN_ERR "dma: channel %d failed, debug %x\r\n", chan->id,
+           get32(chan->base + DMA_DEBUG));
+    chan->errors++;
+    dma_chan_reset(chan);
+    return -1;
+}
+
+static void dma_wait_timeout(unsigned long data) {
+    struct dma_chan *chan = (struct dma_chan *)data;
+    __atomic_store_n(&chan->timed_out, 1, __ATOMIC_RELEASE);
+    wake_up(&chan->wait);
+}
+
+// Sleeps until the completion interrupt of a transfer started with irq, for
+// DMA_TIMEOUT_NS at least (the timer rounds it up to ticks). Returns 0, or -1
+// if the engine reported an error or the interrupt never came (the channel is
+// reset then).
+int dma_wait(struct dma_chan *chan) {
+    struct timer_list timer;
+    init_timer(&timer, dma_wait_timeout, (unsigned long)chan);
+    timer.expires = jiffies + 1 + DMA_TIMEOUT_NS / NSEC_PER_JIFFY;
+    chan->timed_out = 0;
+    add_timer(&timer);
+    wait_event(chan->wait,
+               __atomic_load_n(&chan->done, __ATOMIC_ACQUIRE) ||
+                   __atomic_load_n(&chan->timed_out, __ATOMIC_ACQUIRE));
+    del_timer(&timer);
+
+    if (!__atomic_load_n(&chan->done, __ATOMIC_ACQUIRE)) {
+        printk(KERN_ERR "dma: channel %d timed out, debug %x\r\n", chan->id,
+               get32(chan->base + DMA_DEBUG));
+        chan->errors++;
+        dma_chan_reset(chan);
+        return -1;
+    }
+    return chan->error ? -1 : 0;
+}
+
+static void dma_irq(int irq, void *data) {
+    struct dma_chan *chan = data;
+    unsigned int cs = get32(chan->base + DMA_CS);
+    // dma_start clears INT of the previous transfer, so it may already be
+    // gone.
+    if (!(cs & DMA_CS_INT)) {
+        return;
+    }
+    put32(chan->base + DMA_CS, DMA_CS_END | DMA_CS_INT);
+
+    int error = (cs & DMA_CS_ERROR) != 0;
+    if (error) {
+        chan->errors++;
+        dma_chan_reset(chan);
+    }
+    chan->error = error;
+    __atomic_store_n(&chan->done, 1, __ATOMIC_RELEASE);
+    wake_up(&chan->wait);
+    if (chan->callback) {
+        chan->callback(chan, error, chan->callback_data);
+    }
+}
+
+// Copies a page to another one (physical addresses), polling.
+static int dma_page_op(unsigned long dst, unsigned long src) {
+    if (!page_ops_enabled) {
+        return -1;
+    }
+    struct dma_chan *chan = dma_request_channel();
+    if (!chan) {
+        __atomic_add_fetch(&dma_stats.no_channel, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    dcache_clean_range(src + VA_START, PAGE_SIZE);
+    dcache_clean_inval_range(dst + VA_START, PAGE_SIZE);
+    dma_prep_memcpy(chan, 0, dst, src, PAGE_SIZE);
+    dma_start(chan, 0, 1, 0);
+    int ret = dma_poll(chan);
+    dcache_clean_inval_range(dst + VA_START, PAGE_SIZE);
+    dma_release_channel(chan);
+    return ret;
+}
+
+// Copies a page to another one (physical addresses) and waits by polling, so
+// it can be called with spinlocks held. Returns 0, or -1 if the caller has to
+// do it with the CPU (no free channel, or an error).
+int dma_copy_page(unsigned long dst, unsigned long src) {
+    int ret = dma_page_op(dst, src);
+    if (ret == 0) {
+        __atomic_add_fetch(&dma_stats.page_copies, 1, __ATOMIC_RELAXED);
+    }
+    return ret;
+}
+
+// Zeroes a page (a physical address) by copying zero_page over it. Same rules
+// as dma_copy_page.
+int dma_zero_page(unsigned long page) {
+    if (!zero_page) {
+        return -1;
+    }
+    int ret = dma_page_op(page, zero_page);
+    if (ret == 0) {
+        __atomic_add_fetch(&dma_stats.page_zeroes, 1, __ATOMIC_RELAXED);
+    }
+    return ret;
+}
+
+// Copies the nr pages of src to the ones of dst (physical addresses) with a
+// single chain, and sleeps until the completion interrupt. Returns 0, or -1 if
+// the caller has to do it with the CPU. Must be called from a task that can
+// sleep.
+int dma_copy_pages(const unsigned long *dst, const unsigned long *src,
+                   int nr) {
+    if (!page_ops_enabled || !nr || nr > (int)DMA_MAX_CBS) {
+        return -1;
+    }
+    struct dma_chan *chan = dma_request_channel();
+    if (!chan) {
+        __atomic_add_fetch(&dma_stats.no_channel, 1, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    int n = 0;
+    for (int i = 0; i < nr; i++) {
+        dcache_clean_range(src[i] + VA_START, PAGE_SIZE);
+        dcache_clean_inval_range(dst[i] + VA_START, PAGE_SIZE);
+        n = dma_prep_memcpy(chan, n, dst[i], src[i], PAGE_SIZE);
+    }
+    dma_start(chan, 0, n, 1);
+    int ret = dma_wait(chan);
+    for (int i = 0; i < nr; i++) {
+        dcache_clean_inval_range(dst[i] + VA_START, PAGE_SIZE);
+    }
+    dma_release_channel(chan);
+    if (ret == 0) {
+        __atomic_add_fetch(&dma_stats.page_copies, nr, __ATOMIC_RELAXED);
+    }
+    return ret;
+}
+
+void dma_set_page_ops(int enabled) { page_ops_enabled = enabled; }
+
+// Resets the channels in DMA_CHANNEL_MASK and requests their interrupts.
+// Returns 0 or -1.
+int dma_init(void) {
+    zero_page = get_free_page();
+    if (!zero_page) {
+        return -1;
+    }
+
+    unsigned int enable = get32(DMA_ENABLE);
+    for (int i = 0; i < DMA_MAX_CHANNELS; i++) {
+        if (!(DMA_CHANNEL_MASK & (1 << i))) {
+            continue;
+        }
+        struct dma_chan *chan = &dma_chans[i];
+        chan->id = i;
+        chan->base = DMA_CHAN_BASE(i);
+        init_waitqueue_head(&chan->wait);
+        unsigned long cbs = allocate_kernel_page();
+        if (!cbs) {
+            return -1;
+        }
+
+        put32(DMA_ENABLE, enable | (1 << i));
+        enable |= 1 << i;
+        dma_chan_reset(chan);
+        if (request_irq(IRQ_DMA(i), dma_irq, chan) < 0) {
+            free_page(cbs - VA_START);
+            continue;
+        }
+        chan->cbs = (struct dma_cb *)cbs;
+    }
+
+    dma_ready = 1;
+    printk(KERN_INFO "dma: channels %x\r\n", DMA_CHANNEL_MASK);
+    return 0;
+}
+
+void dma_stats_dump(void) {
+    printf("dma: channel: transfers / bytes / errors%s\r\n",
+           page_ops_enabled ? "" : " (page copies off)");
+    for (int i = 0; i < DMA_MAX_CHANNELS; i++) {
+        struct dma_chan *chan = &dma_chans[i];
+        if (chan->cbs) {
+            printf("%d%s: %lu / %lu / %lu\r\n", i, chan->in_use ? "*" : "",
+                   chan->transfers, chan->bytes, chan->errors);
+        }
+    }
+    printf("pages copied %lu, zeroed %lu, done by the CPU (no channel) %lu\r\n",
+           dma_stats.page_copies, dma_stats.page_zeroes,
+           dma_stats.no_channel);
+}
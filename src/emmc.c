@@ -0,0 +1,330 @@
+#include "emmc.h"
+#include "blkdev.h"
+#include "peripherals/emmc.h"
+#include "printk.h"
+#include "timer.h"
+#include "utils.h"
+
+// Driver for the SD card behind the EMMC controller. Everything is polled:
+// commands are short, and a data transfer moves a block through the 32-bit
+// EMMC_DATA register as soon as the controller says it has one (READ_RDY), so
+// there's nothing worth sleeping for. The GPIOs of the card slot (48 - 53) are
+// already set up by the firmware, which loads the kernel from the card.
+//
+// Card initialization follows the SD Physical Layer Simplified Specification:
+// reset (CMD0), check the voltage (CMD8), wait until the card is ready
+// (ACMD41), get its address (CMD2, CMD3) and its size (CMD9), select it (CMD7)
+// and switch to a 4-bit bus (ACMD6).
+
+// SD commands.
+#define GO_IDLE_STATE 0
+#define ALL_SEND_CID 2
+#define SEND_RELATIVE_ADDR 3
+#define SET_BUS_WIDTH 6     // ACMD6
+#define SELECT_CARD 7
+#define SEND_IF_COND 8
+#define SEND_CSD 9
+#define SET_BLOCKLEN 16
+#define READ_SINGLE_BLOCK 17
+#define READ_MULTIPLE_BLOCK 18
+#define SD_SEND_OP_COND 41  // ACMD41
+#define APP_CMD 55
+
+// CMDTM value of a command without data. rsp is the response type (see
+// CMDTM_RSPNS_*).
+#define SD_CMD(index, rsp) (CMDTM_INDEX(index) | CMDTM_RSPNS_##rsp)
+
+// SEND_IF_COND argument: 2.7 - 3.6V and a check pattern that the card echoes.
+#define IF_COND_ARG 0x1AA
+// SD_SEND_OP_COND argument: we support SDHC/SDXC (HCS) at 3.2 - 3.4V. In the
+// response, bit 31 is set once the card is ready and CCS (bit 30) if it's
+// addressed by block instead of by byte.
+#define OCR_HCS (1 << 30)
+#define OCR_VOLTAGE 0x00FF8000
+#define OCR_BUSY (1 << 31)
+#define OCR_CCS (1 << 30)
+
+#define EMMC_INIT_CLOCK 400000UL
+#define EMMC_DATA_CLOCK 25000000UL
+
+// How long to wait for the controller or the card before giving up.
+#define EMMC_TIMEOUT_NS 1000000000UL
+// ACMD41 is repeated until the card finishes its power up, which the spec
+// allows to take up to a second.
+#define EMMC_OP_COND_RETRIES 1000
+
+// Most blocks per request. BLKSIZECNT has 16 bits for the count.
+#define EMMC_MAX_BLOCKS 128
+
+struct emmc_card {
+    unsigned int rca;  // Relative card address, in the high 16 bits.
+    int block_addressed;
+    unsigned int sdhci_version;
+};
+
+static struct emmc_card card;
+static struct block_device emmc_bdev = {
+    .name = "mmcblk0",
+    .max_blocks = EMMC_MAX_BLOCKS,
+};
+
+static unsigned long emmc_deadline(void) {
+    return timer_read_counter() + ns_to_cycles(EMMC_TIMEOUT_NS);
+}
+
+// Waits until (EMMC_INTERRUPT & mask) or an error bit is set, and clears mask.
+// Returns 0, or -1 on an error or timeout (the error bits are left set for
+// the caller to report).
+static int emmc_wait_interrupt(unsigned int mask) {
+    unsigned long deadline = emmc_deadline();
+    while (1) {
+        unsigned int irpt = get32(EMMC_INTERRUPT);
+        if (irpt & INT_ERROR_MASK) {
+            return -1;
+        }
+        if (irpt & mask) {
+            put32(EMMC_INTERRUPT, mask);
+            return 0;
+        }
+        if (timer_read_counter() > deadline) {
+            return -1;
+        }
+    }
+}
+
+static int emmc_wait_status_clear(unsigned int mask) {
+    unsigned long deadline = emmc_deadline();
+    while (get32(EMMC_STATUS) & mask) {
+        if (timer_read_counter() > deadline) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Sends a command (cmdtm, see peripherals/emmc.h) and waits until it's done.
+// The response is left in EMMC_RESP0 - 3. Returns 0 or -1.
+static int emmc_send_cmd(unsigned int cmdtm, unsigned int arg) {
+    if (emmc_wait_status_clear(STATUS_CMD_INHIBIT) < 0) {
+        return -1;
+    }
+    // Clear whatever the last command left.
+    put32(EMMC_INTERRUPT, get32(EMMC_INTERRUPT));
+    put32(EMMC_ARG1, arg);
+    put32(EMMC_CMDTM, cmdtm);
+    if (emmc_wait_interrupt(INT_CMD_DONE) < 0) {
+        printk(KERN_ERR "emmc: command %d failed, interrupt %x\r\n",
+               cmdtm >> 24, get32(EMMC_INTERRUPT));
+        put32(EMMC_INTERRUPT, get32(EMMC_INTERRUPT));
+        return -1;
+    }
+    return 0;
+}
+
+// Application commands (ACMDs) are prefixed by APP_CMD.
+static int emmc_send_app_cmd(unsigned int cmdtm, unsigned int arg) {
+    if (emmc_send_cmd(SD_CMD(APP_CMD, 48), card.rca) < 0) {
+        return -1;
+    }
+    return emmc_send_cmd(cmdtm, arg);
+}
+
+// The card clock is the base clock divided by a 10-bit divider (SDHCI 3.0) or
+// by a power of 2 (older versions).
+static int emmc_set_clock(unsigned long freq) {
+    if (emmc_wait_status_clear(STATUS_CMD_INHIBIT | STATUS_DAT_INHIBIT) < 0) {
+        return -1;
+    }
+
+    unsigned int div = (EMMC_BASE_CLOCK + freq - 1) / freq;
+    if (card.sdhci_version < SDHCI_SPEC_300) {
+        unsigned int pow = 1;
+        while (pow < div && pow < 0x80) {
+            pow <<= 1;
+        }
+        div = pow;
+    }
+    if (div < 2) {
+        div = 2;
+    }
+    if (div > 0x3FF) {
+        div = 0x3FF;
+    }
+
+    unsigned int control1 = get32(EMMC_CONTROL1);
+    control1 &= ~CONTROL1_CLK_EN;
+    put32(EMMC_CONTROL1, control1);
+    control1 &= ~CONTROL1_CLK_FREQ_MASK;
+    control1 |= ((div & 0xFF) << 8) | (((div >> 8) & 0x3) << 6);
+    put32(EMMC_CONTROL1, control1);
+    put32(EMMC_CONTROL1, control1 | CONTROL1_CLK_EN);
+
+    unsigned long deadline = emmc_deadline();
+    while (!(get32(EMMC_CONTROL1) & CONTROL1_CLK_STABLE)) {
+        if (timer_read_counter() > deadline) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int emmc_reset(void) {
+    put32(EMMC_CONTROL0, 0);
+    put32(EMMC_CONTROL1, CONTROL1_SRST_HC);
+    unsigned long deadline = emmc_deadline();
+    while (get32(EMMC_CONTROL1) & CONTROL1_SRST_HC) {
+        if (timer_read_counter() > deadline) {
+            return -1;
+        }
+    }
+
+    put32(EMMC_CONTROL1, CONTROL1_CLK_INTLEN | CONTROL1_DATA_TOUNIT_MAX);
+    // We poll EMMC_INTERRUPT, so every source is enabled there but none of
+    // them is routed to the interrupt controller.
+    put32(EMMC_IRPT_EN, 0);
+    put32(EMMC_IRPT_MASK, 0xFFFFFFFF);
+    put32(EMMC_INTERRUPT, 0xFFFFFFFF);
+    return 0;
+}
+
+// Capacity in blocks, from the CSD register (in EMMC_RESP0 - 3 after
+// SEND_CSD). The controller drops the CRC byte, so CSD bit n is response bit
+// n - 8.
+static unsigned long emmc_csd_blocks(void) {
+    unsigned int resp1 = get32(EMMC_RESP1);
+    unsigned int resp2 = get32(EMMC_RESP2);
+    unsigned int resp3 = get32(EMMC_RESP3);
+
+    if (((resp3 >> 22) & 0x3) == 1) {
+        // CSD version 2.0 (SDHC/SDXC): C_SIZE (bits 48 - 69) in units of
+        // 512KB.
+        unsigned long c_size = (resp1 >> 8) & 0x3FFFFF;
+        return (c_size + 1) * 1024;
+    }
+
+    // CSD version 1.0: C_SIZE (bits 62 - 73), C_SIZE_MULT (47 - 49) and
+    // READ_BL_LEN (80 - 83).
+    unsigned long c_size = ((resp2 & 0x3) << 10) | (resp1 >> 22);
+    unsigned int mult = (resp1 >> 7) & 0x7;
+    unsigned int read_bl_len = (resp2 >> 8) & 0xF;
+    unsigned long bytes = (c_size + 1) << (mult + 2 + read_bl_len);
+    return bytes / BLOCK_SIZE;
+}
+
+static int emmc_read(struct block_device *bdev, unsigned long block,
+                     unsigned int count, char **bufs) {
+    if (emmc_wait_status_clear(STATUS_DAT_INHIBIT) < 0) {
+        return -1;
+    }
+
+    put32(EMMC_BLKSIZECNT, (count << 16) | BLOCK_SIZE);
+    unsigned int cmdtm = CMDTM_RSPNS_48 | CMDTM_ISDATA | CMDTM_DAT_DIR_READ;
+    if (count > 1) {
+        // The controller sends STOP_TRANSMISSION (CMD12) by itself after the
+        // last block.
+        cmdtm |= CMDTM_INDEX(READ_MULTIPLE_BLOCK) | CMDTM_MULTI_BLOCK |
+                 CMDTM_BLKCNT_EN | CMDTM_AUTO_CMD12;
+    } else {
+        cmdtm |= CMDTM_INDEX(READ_SINGLE_BLOCK);
+    }
+    unsigned int arg = card.block_addressed ? block : block * BLOCK_SIZE;
+    if (emmc_send_cmd(cmdtm, arg) < 0) {
+        return -1;
+    }
+
+    for (unsigned int i = 0; i < count; i++) {
+        if (emmc_wait_interrupt(INT_READ_RDY) < 0) {
+            goto error;
+        }
+        unsigned int *words = (unsigned int *)bufs[i];
+        for (int w = 0; w < BLOCK_SIZE / 4; w++) {
+            words[w] = get32(EMMC_DATA);
+        }
+    }
+    if (emmc_wait_interrupt(INT_DATA_DONE) < 0) {
+        goto error;
+    }
+    return 0;
+
+error:
+    printk(KERN_ERR "emmc: read of %d blocks at %lu failed, interrupt %x\r\n",
+           count, block, get32(EMMC_INTERRUPT));
+    put32(EMMC_INTERRUPT, get32(EMMC_INTERRUPT));
+    return -1;
+}
+
+static const struct block_device_operations emmc_ops = {
+    .read = emmc_read,
+};
+
+// Initializes the card and registers it as the block device "mmcblk0".
+// Returns 0 or -1 (e.g. there's no card). Needs the timer (timer_init).
+int emmc_init(void) {
+    card.sdhci_version = SLOTISR_VER_SDVERSION(get32(EMMC_SLOTISR_VER));
+    card.rca = 0;
+    if (emmc_reset() < 0 || emmc_set_clock(EMMC_INIT_CLOCK) < 0) {
+        printk(KERN_ERR "emmc: controller reset failed\r\n");
+        return -1;
+    }
+
+    if (emmc_send_cmd(SD_CMD(GO_IDLE_STATE, NONE), 0) < 0) {
+        return -1;
+    }
+    // Cards older than 2.0 don't know SEND_IF_COND (and don't support SDHC).
+    unsigned int ocr_arg = OCR_VOLTAGE;
+    if (emmc_send_cmd(SD_CMD(SEND_IF_COND, 48), IF_COND_ARG) == 0 &&
+        (get32(EMMC_RESP0) & 0xFFF) == IF_COND_ARG) {
+        ocr_arg |= OCR_HCS;
+    }
+
+    unsigned int ocr = 0;
+    for (int i = 0; i < EMMC_OP_COND_RETRIES; i++) {
+        if (emmc_send_app_cmd(SD_CMD(SD_SEND_OP_COND, 48), ocr_arg) < 0) {
+            return -1;
+        }
+        ocr = get32(EMMC_RESP0);
+        if (ocr & OCR_BUSY) {
+            break;
+        }
+        delay(1000);
+    }
+    if (!(ocr & OCR_BUSY)) {
+        printk(KERN_ERR "emmc: card didn't power up\r\n");
+        return -1;
+    }
+    card.block_addressed = (ocr & OCR_CCS) != 0;
+
+    if (emmc_send_cmd(SD_CMD(ALL_SEND_CID, 136), 0) < 0 ||
+        emmc_send_cmd(SD_CMD(SEND_RELATIVE_ADDR, 48), 0) < 0) {
+        return -1;
+    }
+    card.rca = get32(EMMC_RESP0) & 0xFFFF0000;
+
+    if (emmc_send_cmd(SD_CMD(SEND_CSD, 136), card.rca) < 0) {
+        return -1;
+    }
+    unsigned long nr_blocks = emmc_csd_blocks();
+
+    if (emmc_set_clock(EMMC_DATA_CLOCK) < 0 ||
+        emmc_send_cmd(SD_CMD(SELECT_CARD, 48_BUSY), card.rca) < 0) {
+        return -1;
+    }
+    if (!card.block_addressed &&
+        emmc_send_cmd(SD_CMD(SET_BLOCKLEN, 48), BLOCK_SIZE) < 0) {
+        return -1;
+    }
+    // Every SD memory card supports a 4-bit bus (argument 2).
+    if (emmc_send_app_cmd(SD_CMD(SET_BUS_WIDTH, 48), 2) == 0) {
+        put32(EMMC_CONTROL0, get32(EMMC_CONTROL0) | CONTROL0_HCTL_DWIDTH);
+    }
+
+    emmc_bdev.nr_blocks = nr_blocks;
+    emmc_bdev.ops = &emmc_ops;
+    emmc_bdev.private_data = &card;
+    if (register_blkdev(&emmc_bdev) < 0) {
+        return -1;
+    }
+    printk(KERN_INFO "emmc: %s, %lu blocks (%lu MB)\r\n", emmc_bdev.name,
+           nr_blocks, nr_blocks / (1024 * 1024 / BLOCK_SIZE));
+    return 0;
+}
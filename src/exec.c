@@ -0,0 +1,174 @@
+#include "exec.h"
+#include "elf.h"
+#include "fork.h"
+#include "fpsimd.h"
+#include "initramfs.h"
+#include "sched.h"
+#include "utils.h"
+
+// Checks that the file is a static AArch64 executable and that its program
+// headers are inside of it.
+static int elf_check(const struct initramfs_file *file) {
+    const Elf64_Ehdr *ehdr = (const Elf64_Ehdr *)file->data;
+
+    if (file->size < sizeof(Elf64_Ehdr)) {
+        return -1;
+    }
+    for (int i = 0; i < SELFMAG; i++) {
+        if (ehdr->e_ident[i] != ELFMAG[i]) {
+            return -1;
+        }
+    }
+    if (ehdr->e_ident[EI_CLASS] != ELFCLASS64 ||
+        ehdr->e_ident[EI_DATA] != ELFDATA2LSB || ehdr->e_type != ET_EXEC ||
+        ehdr->e_machine != EM_AARCH64 ||
+        ehdr->e_phentsize != sizeof(Elf64_Phdr)) {
+        return -1;
+    }
+    if (ehdr->e_phoff > file->size ||
+        ehdr->e_phnum * sizeof(Elf64_Phdr) > file->size - ehdr->e_phoff) {
+        return -1;
+    }
+    return 0;
+}
+
+// Turns the PT_LOAD segments of the program into VMAs (plus one for the
+// stack). Nothing is mapped here: the pages are mapped from the archive when
+// the program touches them (see handle_mm_fault). Returns the number of VMAs
+// or -1 if the program can't be loaded.
+static int elf_build_vmas(const struct initramfs_file *file,
+                          struct vm_area_struct *vmas) {
+    const Elf64_Ehdr *ehdr = (const Elf64_Ehdr *)file->data;
+    const Elf64_Phdr *phdr = (const Elf64_Phdr *)(file->data + ehdr->e_phoff);
+    unsigned long limit = USER_STACK_TOP - USER_STACK_SIZE;
+    unsigned long prev_end = 0;
+    int nr_vmas = 0;
+
+    for (int i = 0; i < ehdr->e_phnum; i++, phdr++) {
+        if (phdr->p_type != PT_LOAD || phdr->p_memsz == 0) {
+            continue;
+        }
+
+        // Leave room for the stack.
+        if (nr_vmas == MAX_VMAS - 1) {
+            return -1;
+        }
+        if (phdr->p_filesz > phdr->p_memsz || phdr->p_offset > file->size ||
+            phdr->p_filesz > file->size - phdr->p_offset) {
+            return -1;
+        }
+        // The page offset of the segment must be the same in the file and in
+        // memory, otherwise its pages can't be mapped from the archive.
+        if ((phdr->p_offset & ~PAGE_MASK) != (phdr->p_vaddr & ~PAGE_MASK)) {
+            return -1;
+        }
+
+        unsigned long start = phdr->p_vaddr & PAGE_MASK;
+        unsigned long end = phdr->p_vaddr + phdr->p_memsz;
+        // Segments must be sorted, not overlap and stay below the stack.
+        if (end < phdr->p_vaddr || end > limit || start < prev_end) {
+            return -1;
+        }
+        end = (end + PAGE_SIZE - 1) & PAGE_MASK;
+
+        // The VMA starts at a page boundary, so the file data starts that many
+        // bytes earlier too.
+        unsigned long lead = phdr->p_vaddr - start;
+        struct vm_area_struct *vma = &vmas[nr_vmas++];
+        vma->vm_start = start;
+        vma->vm_end = end;
+        vma->vm_flags = 0;
+        if (phdr->p_flags & PF_R) {
+            vma->vm_flags |= VM_READ;
+        }
+        if (phdr->p_flags & PF_W) {
+            vma->vm_flags |= VM_WRITE;
+        }
+        if (phdr->p_flags & PF_X) {
+            vma->vm_flags |= VM_EXEC;
+        }
+        vma->file_data = (unsigned long)file->data + phdr->p_offset - lead;
+        vma->file_size = phdr->p_filesz + lead;
+        vma->vm_file = 0;
+        vma->vm_pgoff = 0;
+        prev_end = end;
+    }
+
+    if (nr_vmas == 0 || ehdr->e_entry >= prev_end) {
+        return -1;
+    }
+
+    struct vm_area_struct *stack = &vmas[nr_vmas++];
+    stack->vm_start = limit;
+    stack->vm_end = USER_STACK_TOP;
+    stack->vm_flags = VM_READ | VM_WRITE;
+    stack->file_data = 0;
+    stack->file_size = 0;
+    stack->vm_file = 0;
+    stack->vm_pgoff = 0;
+    return nr_vmas;
+}
+
+// Replaces the user image of the current task with the program at path in the
+// initramfs. Works for both user tasks (sys_exec) and kernel threads that are
+// about to become user tasks (kernel_process). On success, the task returns
+// to user space at the entry point of the program, with the stack pointer at
+// USER_STACK_TOP and every other register zeroed. On failure, -1 is returned
+// and the old image is left untouched.
+int do_exec(const char *path) {
+    struct initramfs_file file;
+    struct vm_area_struct vmas[MAX_VMAS];
+
+    if (initramfs_lookup(path, &file) < 0 || elf_check(&file) < 0) {
+        return -1;
+    }
+
+    int nr_vmas = elf_build_vmas(&file, vmas);
+    if (nr_vmas < 0) {
+        return -1;
+    }
+
+    // The new address space is built on the side. If the task is a thread,
+    // it leaves its process: the other threads keep running the old program
+    // and the old mm is freed with its last user.
+    struct mm_struct *mm = mm_alloc();
+    if (!mm) {
+        return -1;
+    }
+    mm->nr_vmas = nr_vmas;
+    for (int i = 0; i < nr_vmas; i++) {
+        mm->vmas[i] = vmas[i];
+    }
+
+    // This also allocates the new page tables.
+    if (vdso_setup(mm, current->pid) < 0) {
+        mmput(mm);
+        return -1;
+    }
+
+    // switch_to must not see the task halfway through the switch.
+    preempt_disable();
+
+    struct mm_struct *old_mm = current->mm;
+    current->mm = mm;
+    current->tgid = current->pid;
+    set_pgd(mm->pgd);
+    // We don't use the old page tables anymore (set_pgd flushed the TLB).
+    if (old_mm) {
+        mmput(old_mm);
+    }
+
+    fpsimd_flush_thread();
+    current->flags &= ~PF_KTHREAD;
+
+    struct pt_regs *regs = task_pt_regs(current);
+    memzero((unsigned long)regs, sizeof(*regs));
+    regs->pc = ((const Elf64_Ehdr *)file.data)->e_entry;
+    regs->sp = USER_STACK_TOP;
+    // Set the pstate to el0 so that when kernel_exit runs (eret), it will
+    // return to user mode.
+    regs->pstate = PSR_MODE_EL0t;
+
+    preempt_enable();
+    return 0;
+}
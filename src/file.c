@@ -0,0 +1,117 @@
+#include "fs.h"
+#include "sched.h"
+#include "slab.h"
+
+static struct kmem_cache *filp_cachep;
+
+void files_init(void) {
+    filp_cachep = kmem_cache_create("filp", sizeof(struct file), 0, 0);
+}
+
+// Returns a new file with one reference (the caller's), or 0.
+struct file *alloc_file(const struct file_operations *f_op,
+                        unsigned int f_mode, void *private_data) {
+    struct file *file = kmem_cache_zalloc(filp_cachep);
+    if (!file) {
+        return 0;
+    }
+    file->f_count = 1;
+    file->f_mode = f_mode;
+    file->f_op = f_op;
+    file->private_data = private_data;
+    return file;
+}
+
+void get_file(struct file *file) {
+    __atomic_add_fetch(&file->f_count, 1, __ATOMIC_RELAXED);
+}
+
+// Drops a reference to file. The last one releases it (e.g. closes that end
+// of a pipe).
+void fput(struct file *file) {
+    if (__atomic_sub_fetch(&file->f_count, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+    if (file->f_op->release) {
+        file->f_op->release(file);
+    }
+    kmem_cache_free(filp_cachep, file);
+}
+
+// Puts file in the lowest free fd of the current task. The fd takes over the
+// caller's reference. Returns the fd or -1 if the table is full.
+int fd_install(struct file *file) {
+    for (int fd = 0; fd < NR_OPEN; fd++) {
+        if (!current->files[fd]) {
+            current->files[fd] = file;
+            return fd;
+        }
+    }
+    return -1;
+}
+
+// Returns the file behind fd with a new reference (drop it with fput), or 0.
+struct file *fget(int fd) {
+    if (fd < 0 || fd >= NR_OPEN) {
+        return 0;
+    }
+    struct file *file = current->files[fd];
+    if (file) {
+        get_file(file);
+    }
+    return file;
+}
+
+int close_fd(int fd) {
+    if (fd < 0 || fd >= NR_OPEN || !current->files[fd]) {
+        return -1;
+    }
+    struct file *file = current->files[fd];
+    current->files[fd] = 0;
+    fput(file);
+    return 0;
+}
+
+// Gives the new task p the same open files as the current one (fork and
+// clone).
+void dup_fds(struct task_struct *p) {
+    for (int fd = 0; fd < NR_OPEN; fd++) {
+        struct file *file = current->files[fd];
+        if (file) {
+            get_file(file);
+        }
+        p->files[fd] = file;
+    }
+}
+
+// Closes every fd of p. p is exiting (or never ran).
+void exit_files(struct task_struct *p) {
+    for (int fd = 0; fd < NR_OPEN; fd++) {
+        struct file *file = p->files[fd];
+        if (file) {
+            p->files[fd] = 0;
+            fput(file);
+        }
+    }
+}
+
+long vfs_read(struct file *file, char *buf, unsigned long count) {
+    if (!(file->f_mode & FMODE_READ) || !file->f_op->read) {
+        return -1;
+    }
+    return file->f_op->read(file, buf, count);
+}
+
+long vfs_write(struct file *file, const char *buf, unsigned long count) {
+    if (!(file->f_mode & FMODE_WRITE) || !file->f_op->write) {
+        return -1;
+    }
+    return file->f_op->write(file, buf, count);
+}
+
+long vfs_llseek(struct file *file, long offset, int whence) {
+    if (!file->f_op->llseek) {
+        return -1;
+    }
+    return file->f_op->llseek(file, offset, whence);
+}
@@ -0,0 +1,130 @@
+#include "pagemap.h"
+#include "list.h"
+#include "mm.h"
+#include "printf.h"
+#include "slab.h"
+#include "spinlock.h"
+
+// The page cache keeps the pages of files in memory once they've been read:
+// read copies out of them and mmap maps them, so every process that maps a
+// file shares the same pages. Pages are found by (address_space, index) in a
+// hash table, and the cache holds a reference on each of them.
+//
+// Nothing is evicted. The only files are the ones of the initramfs, which is
+// read-only and small, and most of their pages are the pages of the archive
+// itself, which the cache uses in place (see initramfs.c).
+
+struct page_cache_entry {
+    struct address_space *mapping;
+    unsigned long index;
+    unsigned long page;
+    struct list_head hash;
+};
+
+struct page_cache_stats {
+    unsigned long hits;
+    unsigned long misses;
+};
+
+static struct list_head page_cache_hash[PAGE_CACHE_HASH_SIZE];
+static struct kmem_cache *page_cache_entry_cachep;
+static struct page_cache_stats page_cache_stats;
+static unsigned long page_cache_pages;
+
+// Protects the hash table and the page counts.
+static DEFINE_SPINLOCK(page_cache_lock);
+
+static struct list_head *page_hash(struct address_space *mapping,
+                                   unsigned long index) {
+    unsigned long hash = index ^ ((unsigned long)mapping >> 6);
+    return &page_cache_hash[hash & (PAGE_CACHE_HASH_SIZE - 1)];
+}
+
+// Must be called with page_cache_lock held.
+static struct page_cache_entry *page_cache_lookup(
+    struct address_space *mapping, unsigned long index) {
+    struct list_head *bucket = page_hash(mapping, index);
+    for (struct list_head *pos = bucket->next; pos != bucket; pos = pos->next) {
+        struct page_cache_entry *entry =
+            list_entry(pos, struct page_cache_entry, hash);
+        if (entry->mapping == mapping && entry->index == index) {
+            return entry;
+        }
+    }
+    return 0;
+}
+
+void page_cache_init(void) {
+    for (int i = 0; i < PAGE_CACHE_HASH_SIZE; i++) {
+        INIT_LIST_HEAD(&page_cache_hash[i]);
+    }
+    page_cache_entry_cachep = kmem_cache_create(
+        "page_cache", sizeof(struct page_cache_entry), 0, 0);
+}
+
+// Returns page index of mapping with a new reference (drop it with
+// free_page), or 0 if it isn't in the cache.
+unsigned long find_get_page(struct address_space *mapping,
+                            unsigned long index) {
+    unsigned long page = 0;
+    spin_lock(&page_cache_lock);
+    struct page_cache_entry *entry = page_cache_lookup(mapping, index);
+    if (entry) {
+        page = entry->page;
+        get_page(page);
+    }
+    spin_unlock(&page_cache_lock);
+    return page;
+}
+
+// Like find_get_page, but reads the page into the cache (readpage) if it
+// isn't there. Returns 0 if it's past the end of the file or there's no
+// memory.
+unsigned long read_cache_page(struct address_space *mapping,
+                              unsigned long index) {
+    unsigned long page = find_get_page(mapping, index);
+    if (page) {
+        __atomic_add_fetch(&page_cache_stats.hits, 1, __ATOMIC_RELAXED);
+        return page;
+    }
+    __atomic_add_fetch(&page_cache_stats.misses, 1, __ATOMIC_RELAXED);
+
+    // readpage may copy a page (or wait for a device), so it runs without the
+    // lock. If another task added the page meanwhile, we use theirs.
+    page = mapping->a_ops->readpage(mapping, index);
+    if (!page) {
+        return 0;
+    }
+    struct page_cache_entry *entry =
+        kmem_cache_alloc(page_cache_entry_cachep);
+    if (!entry) {
+        // Not cached, but the caller can still use it.
+        return page;
+    }
+
+    spin_lock(&page_cache_lock);
+    struct page_cache_entry *found = page_cache_lookup(mapping, index);
+    if (found) {
+        unsigned long cached = found->page;
+        get_page(cached);
+        spin_unlock(&page_cache_lock);
+        kmem_cache_free(page_cache_entry_cachep, entry);
+        free_page(page);
+        return cached;
+    }
+    entry->mapping = mapping;
+    entry->index = index;
+    entry->page = page;
+    // The cache's own reference. The caller keeps the one from readpage.
+    get_page(page);
+    list_add(&entry->hash, page_hash(mapping, index));
+    mapping->nrpages++;
+    page_cache_pages++;
+    spin_unlock(&page_cache_lock);
+    return page;
+}
+
+void page_cache_stats_dump(void) {
+    printf("page cache: %lu pages, hits %lu, misses %lu\r\n",
+           page_cache_pages, page_cache_stats.hits, page_cache_stats.misses);
+}
@@ -1,29 +1,118 @@
 #include "fork.h"
 #include "entry.h"
+#include "fpsimd.h"
+#include "fs.h"
 #include "mm.h"
 #include "sched.h"
+#include "slab.h"
 #include "utils.h"
+#include "vdso.h"
+
+static struct kmem_cache *task_struct_cachep;
+static struct kmem_cache *mm_cachep;
+
+// task_structs come from their own cache. They're aligned to a cache line so
+// that two tasks running on different CPUs never share one. So are the
+// mm_structs, whose users count and lock are written by every thread.
+void fork_init(void) {
+    task_struct_cachep = kmem_cache_create(
+        "task_struct", sizeof(struct task_struct), 0, SLAB_HWCACHE_ALIGN);
+    mm_cachep = kmem_cache_create("mm_struct", sizeof(struct mm_struct), 0,
+                                  SLAB_HWCACHE_ALIGN);
+}
+
+// Returns an empty address space with one user (the caller), or 0.
+struct mm_struct *mm_alloc(void) {
+    struct mm_struct *mm = kmem_cache_zalloc(mm_cachep);
+    if (!mm) {
+        return 0;
+    }
+    mm->users = 1;
+    spin_lock_init(&mm->page_table_lock, "mm");
+    return mm;
+}
+
+void mmget(struct mm_struct *mm) {
+    __atomic_add_fetch(&mm->users, 1, __ATOMIC_RELAXED);
+}
+
+// Drops a reference to mm. The last user frees the pages, the page tables and
+// the vDSO page, so it must not have mm's page tables loaded anymore.
+void mmput(struct mm_struct *mm) {
+    if (__atomic_sub_fetch(&mm->users, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+
+    exit_mmap(mm);
+    if (mm->vdso_page) {
+        free_page(mm->vdso_page);
+    }
+    kmem_cache_free(mm_cachep, mm);
+}
+
+// Returns a copy of oldmm for fork (without the vDSO page, which holds the
+// pid of the new process), or 0.
+static struct mm_struct *dup_mm(struct mm_struct *oldmm) {
+    struct mm_struct *mm = mm_alloc();
+    if (!mm) {
+        return 0;
+    }
+    if (copy_virt_memory(mm, oldmm) < 0) {
+        mmput(mm);
+        return 0;
+    }
+    return mm;
+}
+
+static void free_task(struct task_struct *p) {
+    exit_files(p);
+    if (p->mm) {
+        mmput(p->mm);
+    }
+    if (p->stack) {
+        free_kernel_stack(p->stack);
+    }
+    kmem_cache_free(task_struct_cachep, p);
+}
 
 // Creates a task and adds it to the task array making it ready to run. Note
 // that this function doesn't call schedule, so the task will be scheduled at a
 // later time, but will not necessarily run immediately.
+//
+// Kernel threads (PF_KTHREAD) run fn(arg). Otherwise, the child is a copy of
+// the current user task that returns 0 from the syscall, with the same open
+// files. With CLONE_VM it shares the address space of its parent (it's a
+// thread of the same process) instead of getting a copy. If stack is not 0,
+// the child starts with its stack pointer there (threads need their own
+// stack).
 int copy_process(unsigned long clone_flags, unsigned long fn,
-                 unsigned long arg) {
-    // Not SMP safe
-    preempt_disable();
-
-    // We allocate a new page for the task. The task_struct goes at the bottom
-    // (beginning) of the page and the stack goes at the top of the page
-    // (growing down).
-    struct task_struct *p;
+                 unsigned long arg, unsigned long stack) {
+    // User tasks are copies of the current one, so it needs an address space.
+    // Kernel threads don't have one to share.
+    if (clone_flags & PF_KTHREAD) {
+        if (clone_flags & CLONE_VM) {
+            return -1;
+        }
+    } else if (!current->mm) {
+        return -1;
+    }
 
-    // Virtual address
-    unsigned long page = allocate_kernel_page();
-    if (!page) {
+    // The child is only visible to the scheduler once wake_up_new_task
+    // publishes it, so it's set up with preemption enabled: dup_mm may sleep
+    // while the DMA engine copies the pages (see copy_virt_memory).
+    //
+    // The task_struct comes from the slab (zeroed) and the kernel stack from
+    // the stack area, with a guard page below it.
+    struct task_struct *p = kmem_cache_zalloc(task_struct_cachep);
+    if (!p) {
         return -1;
     }
 
-    p = (struct task_struct *)page;
+    p->stack = alloc_kernel_stack();
+    if (!p->stack) {
+        free_task(p);
+        return -1;
+    }
 
     struct pt_regs *childregs = task_pt_regs(p);
 
@@ -38,15 +127,29 @@ int copy_process(unsigned long clone_flags, unsigned long fn,
         // x0 = 0 which is the return value of copy_process (0 for child, pid
         // for parent)
         childregs->regs[0] = 0;
-        int ret = copy_virt_memory(p);
-        if (ret < 0) {
-            return -1;
+        if (stack) {
+            childregs->sp = stack;
+        }
+
+        if (clone_flags & CLONE_VM) {
+            mmget(current->mm);
+            p->mm = current->mm;
+        } else {
+            p->mm = dup_mm(current->mm);
+            if (!p->mm) {
+                free_task(p);
+                return -1;
+            }
         }
+        // Our FP/SIMD registers may be live in this CPU.
+        preempt_disable();
+        fpsimd_fork(p);
+        preempt_enable();
+        dup_fds(p);
     }
 
-    p->flags = clone_flags;
-    p->priority = current->priority;
-    p->counter = p->priority;
+    p->flags = clone_flags & PF_KTHREAD;
+    sched_fork(p);
     p->state = TASK_RUNNING;
     // This will be cleared in the sched_tail function (called by
     // ret_from_fork which is the first thing that will be executed when this
@@ -61,52 +164,37 @@ int copy_process(unsigned long clone_flags, unsigned long fn,
     // point the stack pointer after childregs is finished.
     p->cpu_context.sp = (unsigned long)childregs;
 
-    // We could overflow here.
+    // Reserve the pid first and only publish the task in task[] once it's
+    // completely set up. Otherwise, another CPU could schedule it too early.
+    // pids (task[] slots) are never reused, so we run out after NR_TASKS.
+    unsigned long flags = spin_lock_irqsave(&tasklist_lock);
+    if (nr_tasks >= NR_TASKS) {
+        spin_unlock_irqrestore(&tasklist_lock, flags);
+        free_task(p);
+        return -1;
+    }
     int pid = nr_tasks++;
-    task[pid] = p;
+    spin_unlock_irqrestore(&tasklist_lock, flags);
     p->pid = pid;
+    p->tgid = (clone_flags & CLONE_VM) ? current->tgid : pid;
+    p->ppid = current->tgid;
 
-    preempt_enable();
-    return pid;
-}
-
-// Expects the start of user memory, its size, and a pointer to a function that
-// must reside within start and start + size.
-int move_to_user_mode(unsigned long start, unsigned long size,
-                      unsigned long pc) {
-    // Will be used on kernel_exit
-    struct pt_regs *regs = task_pt_regs(current);
-
-    // Pointer to the function that we want to execute
-    regs->pc = pc;
-    // Set the pstate to el0 so that when kernel_exit runs (eret), it will
-    // return to user mode.
-    regs->pstate = PSR_MODE_EL0t;
-
-    // The first page is used for the code. The second page is used for the
-    // stack. Note that the stack grows downward so this is why sp is equal to 2
-    // * PAGE_SIZE instead of just PAGE_SIZE. Also, note that we're not
-    // allocating the page here. We do this on demand (when the process requests
-    // access to that page), we page fault, allocate it and return it
-    // transparently to the process.
-    regs->sp = 2 * PAGE_SIZE;
-    unsigned long code_page = allocate_user_page(current, 0);
-
-    if (!code_page) {
+    // A new process needs its own vDSO page since it holds its pid.
+    if (p->mm && !(clone_flags & CLONE_VM) &&
+        vdso_setup(p->mm, p->tgid) < 0) {
+        free_task(p);
         return -1;
     }
 
-    memcpy(code_page, start, size);
-    set_pgd(current->mm.pgd);
-    return 0;
+    preempt_disable();
+    wake_up_new_task(p);
+    preempt_enable();
+    return pid;
 }
 
-// Returns a section at the top of the page of where the task_struct is located
-// where we store the pt_regs structure for that task.
+// Returns a section at the top of the kernel stack of the task where we store
+// the pt_regs structure for that task.
 struct pt_regs *task_pt_regs(struct task_struct *tsk) {
-    // Not sure why THREAD_SIZE instead of PAGE_SIZE (which is what we're
-    // allocating). Seems like THREAD_SIZE could become a problem if PAGE_SIZE
-    // becomes too small for it.
-    unsigned long p = (unsigned long)tsk + THREAD_SIZE - sizeof(struct pt_regs);
+    unsigned long p = tsk->stack + THREAD_SIZE - sizeof(struct pt_regs);
     return (struct pt_regs *)p;
 }
\ No newline at end of file
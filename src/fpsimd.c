@@ -0,0 +1,89 @@
+#include "fpsimd.h"
+#include "arm/sysregs.h"
+#include "mm.h"
+#include "percpu.h"
+#include "sched.h"
+
+// Lazy FP/SIMD context switching. Only the FP/SIMD registers of one task (the
+// owner) are live in a CPU at any time. When we switch to a task that isn't the
+// owner, we make EL0 FP/SIMD instructions trap (CPACR_EL1.FPEN). If the task
+// never uses FP/SIMD, that's all it costs. The first FP/SIMD instruction
+// traps into do_fpsimd_acc, which saves the owner's registers, loads the
+// current task's and makes it the owner. Switching back to the owner doesn't
+// need to restore anything since its registers are still loaded.
+
+// Task whose FP/SIMD state is loaded in this CPU's registers (or 0).
+static DEFINE_PER_CPU(struct task_struct *, fpsimd_owner);
+
+// Last value written to CPACR_EL1, so we don't write it when it doesn't change.
+static DEFINE_PER_CPU(unsigned long, cpacr);
+
+static void set_cpacr(unsigned long value) {
+    if (this_cpu(cpacr) == value) {
+        return;
+    }
+    this_cpu(cpacr) = value;
+    // No isb needed: the eret back to EL0 synchronizes the context.
+    asm volatile("msr cpacr_el1, %0" : : "r"(value));
+}
+
+void fpsimd_init(void) {
+    this_cpu(cpacr) = CPACR_EL1_FPEN_TRAP_EL0;
+    asm volatile("msr cpacr_el1, %0; isb" : : "r"(this_cpu(cpacr)));
+}
+
+// Called by switch_to before switching to next.
+void fpsimd_thread_switch(struct task_struct *next) {
+    if (this_cpu(fpsimd_owner) == next) {
+        set_cpacr(CPACR_EL1_FPEN_NO_TRAP);
+    } else {
+        set_cpacr(CPACR_EL1_FPEN_TRAP_EL0);
+    }
+}
+
+// The child of fork starts with a copy of the parent's FP/SIMD registers. If
+// the parent's registers are live in the CPU, save them first.
+void fpsimd_fork(struct task_struct *child) {
+    if (this_cpu(fpsimd_owner) == current) {
+        fpsimd_save_state(&current->fpsimd_state);
+    }
+    memcpy((unsigned long)&child->fpsimd_state,
+           (unsigned long)&current->fpsimd_state, sizeof(struct fpsimd_state));
+}
+
+void fpsimd_exit(struct task_struct *tsk) {
+    if (this_cpu(fpsimd_owner) == tsk) {
+        this_cpu(fpsimd_owner) = 0;
+    }
+}
+
+// exec starts the new program with zeroed FP/SIMD registers. If the old ones
+// are live in this CPU, we give up the ownership so that the first FP/SIMD
+// instruction of the program traps and loads the zeroed state. Must be called
+// with preemption disabled.
+void fpsimd_flush_thread(void) {
+    if (this_cpu(fpsimd_owner) == current) {
+        this_cpu(fpsimd_owner) = 0;
+        set_cpacr(CPACR_EL1_FPEN_TRAP_EL0);
+    }
+    memzero((unsigned long)&current->fpsimd_state,
+            sizeof(struct fpsimd_state));
+}
+
+// Called from el0_sync (with IRQs disabled) when the current task executes an
+// FP/SIMD instruction while it isn't the owner.
+void do_fpsimd_acc(void) {
+    struct task_struct *owner = this_cpu(fpsimd_owner);
+
+    if (owner != current) {
+        if (owner) {
+            fpsimd_save_state(&owner->fpsimd_state);
+        }
+        // A task that never used FP/SIMD has a zeroed state (copy_process
+        // zeroes the task_struct).
+        fpsimd_load_state(&current->fpsimd_state);
+        this_cpu(fpsimd_owner) = current;
+    }
+
+    set_cpacr(CPACR_EL1_FPEN_NO_TRAP);
+}
@@ -0,0 +1,120 @@
+#include "futex.h"
+#include "list.h"
+#include "mm.h"
+#include "sched.h"
+#include "spinlock.h"
+#include "uaccess.h"
+
+// A task sleeping on a futex. It lives on the waiter's kernel stack.
+struct futex_q {
+    struct list_head list;
+    unsigned long key;
+    struct task_struct *task;
+};
+
+struct futex_hash_bucket {
+    spinlock_t lock;
+    struct list_head chain;
+};
+
+static struct futex_hash_bucket futex_queues[FUTEX_HASH_SIZE];
+
+void futex_init(void) {
+    for (int i = 0; i < FUTEX_HASH_SIZE; i++) {
+        spin_lock_init(&futex_queues[i].lock, "futex");
+        INIT_LIST_HEAD(&futex_queues[i].chain);
+    }
+}
+
+// Fibonacci hashing of the word address (the low 2 bits are always 0).
+static struct futex_hash_bucket *hash_futex(unsigned long key) {
+    unsigned long hash = (key >> 2) * 0x9e3779b97f4a7c15UL;
+    return &futex_queues[hash >> (64 - FUTEX_HASH_BITS)];
+}
+
+// The key of a futex is the physical address of the word. We return its kernel
+// alias (physical address + VA_START), which is just as unique and can be used
+// to read the word. Faults the page in if needed, and holds a reference to it
+// until put_user_kva. Returns 0 if uaddr is not aligned or not accessible.
+static unsigned long get_futex_key(unsigned int *uaddr) {
+    unsigned long va = (unsigned long)uaddr;
+    if (va & (sizeof(unsigned int) - 1)) {
+        return 0;
+    }
+    return user_to_kernel_va(va, 0);
+}
+
+// Sleeps until a futex_wake on uaddr, but only if *uaddr still holds val.
+// Checking the value under the bucket lock is what makes this race free: the
+// waker changes the value before calling futex_wake, which takes the same
+// lock, so either we see the new value or the waker sees us in the queue.
+// Returns 0 after being woken up, -1 if the value didn't match (or uaddr is
+// bad).
+int futex_wait(unsigned int *uaddr, unsigned int val) {
+    unsigned long key = get_futex_key(uaddr);
+    if (!key) {
+        return -1;
+    }
+
+    struct futex_hash_bucket *hb = hash_futex(key);
+    struct futex_q q;
+    q.key = key;
+    q.task = current;
+
+    spin_lock(&hb->lock);
+    if (__atomic_load_n((unsigned int *)key, __ATOMIC_SEQ_CST) != val) {
+        spin_unlock(&hb->lock);
+        put_user_kva(key);
+        return -1;
+    }
+    list_add_tail(&q.list, &hb->chain);
+    // Like prepare_to_wait: the state changes under the lock the waker takes.
+    current->state = TASK_SLEEPING;
+    spin_unlock(&hb->lock);
+    // The word has been read. From now on the key is only a number.
+    put_user_kva(key);
+
+    schedule();
+
+    // futex_wake already took us off the queue. This only matters if we got
+    // to run for some other reason.
+    spin_lock(&hb->lock);
+    current->state = TASK_RUNNING;
+    if (!list_empty(&q.list)) {
+        list_del_init(&q.list);
+    }
+    spin_unlock(&hb->lock);
+    return 0;
+}
+
+// Wakes up to nr_wake tasks waiting on uaddr (in FIFO order). Returns the
+// number of tasks woken up or -1 if uaddr is bad.
+int futex_wake(unsigned int *uaddr, int nr_wake) {
+    unsigned long key = get_futex_key(uaddr);
+    if (!key) {
+        return -1;
+    }
+
+    struct futex_hash_bucket *hb = hash_futex(key);
+    int woken = 0;
+
+    spin_lock(&hb->lock);
+    struct list_head *pos = hb->chain.next;
+    while (pos != &hb->chain && woken < nr_wake) {
+        struct futex_q *q = list_entry(pos, struct futex_q, list);
+        pos = pos->next;
+        if (q->key != key) {
+            continue;
+        }
+
+        // q lives on the waiter's stack, so we're done with it once the
+        // waiter can run.
+        struct task_struct *task = q->task;
+        list_del_init(&q->list);
+        wake_up_process(task);
+        woken++;
+    }
+    spin_unlock(&hb->lock);
+    put_user_kva(key);
+    return woken;
+}
@@ -0,0 +1,199 @@
+#include "hrtimer.h"
+#include "irq.h"
+#include "list.h"
+#include "percpu.h"
+#include "sched.h"
+#include "timer.h"
+
+// The queued hrtimers of a CPU are kept in a binary min-heap ordered by
+// expires, so the next one to fire is always heap[0] and that's the deadline we
+// program in the CPU's timer. Every timer remembers its position in the heap,
+// so cancelling doesn't need to search for it. Inserting and cancelling are
+// O(log n) and looking at the earliest one is O(1).
+struct hrtimer_base {
+    struct hrtimer *heap[HRTIMER_HEAP_SIZE];
+    int count;
+};
+
+static DEFINE_PER_CPU(struct hrtimer_base, hrtimer_bases);
+
+static void hrtimer_interrupt(void);
+
+void hrtimer_init(struct hrtimer *timer, void (*function)(struct hrtimer *)) {
+    timer->expires = 0;
+    timer->function = function;
+    timer->index = -1;
+}
+
+static void heap_set(struct hrtimer_base *base, int i, struct hrtimer *timer) {
+    base->heap[i] = timer;
+    timer->index = i;
+}
+
+static void sift_up(struct hrtimer_base *base, int i) {
+    struct hrtimer *timer = base->heap[i];
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (base->heap[parent]->expires <= timer->expires) {
+            break;
+        }
+        heap_set(base, i, base->heap[parent]);
+        i = parent;
+    }
+    heap_set(base, i, timer);
+}
+
+static void sift_down(struct hrtimer_base *base, int i) {
+    struct hrtimer *timer = base->heap[i];
+    while (1) {
+        int child = 2 * i + 1;
+        if (child >= base->count) {
+            break;
+        }
+        if (child + 1 < base->count &&
+            base->heap[child + 1]->expires < base->heap[child]->expires) {
+            child++;
+        }
+        if (timer->expires <= base->heap[child]->expires) {
+            break;
+        }
+        heap_set(base, i, base->heap[child]);
+        i = child;
+    }
+    heap_set(base, i, timer);
+}
+
+static void heap_remove(struct hrtimer_base *base, struct hrtimer *timer) {
+    int i = timer->index;
+    struct hrtimer *last = base->heap[--base->count];
+    timer->index = -1;
+    if (last == timer) {
+        return;
+    }
+
+    // Move the last element to the hole and restore the heap in whichever
+    // direction it's broken.
+    heap_set(base, i, last);
+    if (i > 0 && base->heap[(i - 1) / 2]->expires > last->expires) {
+        sift_up(base, i);
+    } else {
+        sift_down(base, i);
+    }
+}
+
+// Programs the CPU's timer for the earliest hrtimer (if any).
+static void hrtimer_reprogram(struct hrtimer_base *base) {
+    if (base->count) {
+        timer_set_deadline(base->heap[0]->expires, hrtimer_interrupt);
+    } else {
+        timer_cancel_deadline();
+    }
+}
+
+// Queues timer to fire once the counter reaches expires. If it was already
+// queued, it's moved. Returns -1 if the heap is full.
+int hrtimer_start(struct hrtimer *timer, unsigned long expires) {
+    unsigned long flags = local_irq_save();
+    struct hrtimer_base *base = this_cpu_ptr(&hrtimer_bases);
+
+    if (hrtimer_queued(timer)) {
+        heap_remove(base, timer);
+    }
+
+    if (base->count == HRTIMER_HEAP_SIZE) {
+        local_irq_restore(flags);
+        return -1;
+    }
+
+    timer->expires = expires;
+    heap_set(base, base->count++, timer);
+    sift_up(base, timer->index);
+
+    // Only the earliest timer matters to the hardware.
+    if (base->heap[0] == timer) {
+        hrtimer_reprogram(base);
+    }
+    local_irq_restore(flags);
+    return 0;
+}
+
+// Returns 1 if the timer was queued.
+int hrtimer_cancel(struct hrtimer *timer) {
+    unsigned long flags = local_irq_save();
+    struct hrtimer_base *base = this_cpu_ptr(&hrtimer_bases);
+
+    if (!hrtimer_queued(timer)) {
+        local_irq_restore(flags);
+        return 0;
+    }
+
+    int was_first = base->heap[0] == timer;
+    heap_remove(base, timer);
+    if (was_first) {
+        hrtimer_reprogram(base);
+    }
+    local_irq_restore(flags);
+    return 1;
+}
+
+// Called from the timer interrupt when the deadline is reached. Runs every
+// timer that already expired (they can start timers again) and programs the
+// next deadline.
+static void hrtimer_interrupt(void) {
+    struct hrtimer_base *base = this_cpu_ptr(&hrtimer_bases);
+
+    while (base->count &&
+           base->heap[0]->expires <= timer_read_counter()) {
+        struct hrtimer *timer = base->heap[0];
+        heap_remove(base, timer);
+        timer->function(timer);
+    }
+    hrtimer_reprogram(base);
+}
+
+struct hrtimer_sleeper {
+    struct hrtimer timer;
+    struct task_struct *task;
+};
+
+static void hrtimer_wakeup(struct hrtimer *timer) {
+    struct hrtimer_sleeper *sleeper =
+        container_of(timer, struct hrtimer_sleeper, timer);
+    wake_up_process(sleeper->task);
+}
+
+// Puts the current task to sleep for (at least) ns nanoseconds. Unlike
+// schedule_timeout, the wakeup doesn't wait for the next tick. Returns the
+// number of nanoseconds left if the task was woken up earlier, or 0.
+//
+// Note: the task must not move to another CPU while sleeping since the hrtimer
+// is queued on the current CPU.
+long hrtimer_nanosleep(unsigned long ns) {
+    struct hrtimer_sleeper sleeper;
+
+    if (!ns) {
+        return 0;
+    }
+
+    hrtimer_init(&sleeper.timer, hrtimer_wakeup);
+    sleeper.task = current;
+    unsigned long expires = timer_read_counter() + ns_to_cycles(ns);
+
+    // Same as in schedule_timeout: if the timer fires before we get to
+    // schedule, schedule returns right away.
+    current->state = TASK_SLEEPING;
+    if (hrtimer_start(&sleeper.timer, expires) < 0) {
+        // Too many hrtimers queued. Fall back to the tick.
+        current->state = TASK_RUNNING;
+        long ticks = (ns + NSEC_PER_JIFFY - 1) / NSEC_PER_JIFFY;
+        return schedule_timeout(ticks) * NSEC_PER_JIFFY;
+    }
+
+    schedule();
+
+    hrtimer_cancel(&sleeper.timer);
+    current->state = TASK_RUNNING;
+
+    unsigned long now = timer_read_counter();
+    return expires > now ? cycles_to_ns(expires - now) : 0;
+}
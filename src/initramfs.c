@@ -0,0 +1,256 @@
+#include "initramfs.h"
+#include "fs.h"
+#include "list.h"
+#include "mm.h"
+#include "pagemap.h"
+#include "slab.h"
+#include "spinlock.h"
+#include "string.h"
+#include "sys.h"
+#include "uaccess.h"
+
+#define CPIO_NEWC_MAGIC "070701"
+#define CPIO_TRAILER "TRAILER!!!"
+
+#define S_IFMT 0170000
+#define S_IFREG 0100000
+
+// Every field is 8 ASCII hex digits.
+struct cpio_newc_header {
+    char c_magic[6];
+    char c_ino[8];
+    char c_mode[8];
+    char c_uid[8];
+    char c_gid[8];
+    char c_nlink[8];
+    char c_mtime[8];
+    char c_filesize[8];
+    char c_devmajor[8];
+    char c_devminor[8];
+    char c_rdevmajor[8];
+    char c_rdevminor[8];
+    char c_namesize[8];
+    char c_check[8];
+};
+
+// The name and the data are each padded to a multiple of 4 bytes (counting
+// from the start of the archive).
+#define CPIO_ALIGN(x) (((x) + 3) & ~3UL)
+
+static unsigned long parse_hex(const char *s) {
+    unsigned long value = 0;
+    for (int i = 0; i < 8; i++) {
+        char c = s[i];
+        value <<= 4;
+        if (c >= '0' && c <= '9') {
+            value |= c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            value |= c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            value |= c - 'A' + 10;
+        }
+    }
+    return value;
+}
+
+static int is_magic(const char *s) {
+    for (int i = 0; i < 6; i++) {
+        if (s[i] != CPIO_NEWC_MAGIC[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// A linear walk of the headers. The archive only holds a handful of programs
+// and only exec and open look files up, so there's no point in building an
+// index.
+int initramfs_lookup(const char *path, struct initramfs_file *file) {
+    unsigned long start = (unsigned long)initramfs_start;
+    unsigned long end = (unsigned long)initramfs_end;
+    unsigned long p = start;
+
+    while (*path == '/') {
+        path++;
+    }
+
+    while (p + sizeof(struct cpio_newc_header) <= end) {
+        struct cpio_newc_header *hdr = (struct cpio_newc_header *)p;
+        if (!is_magic(hdr->c_magic)) {
+            return -1;
+        }
+
+        unsigned long namesize = parse_hex(hdr->c_namesize);
+        unsigned long filesize = parse_hex(hdr->c_filesize);
+        char *name = (char *)(p + sizeof(struct cpio_newc_header));
+        unsigned long data =
+            start + CPIO_ALIGN((unsigned long)name - start + namesize);
+        if (!namesize || data + filesize > end || name[namesize - 1] != '\0') {
+            return -1;
+        }
+
+        if (strcmp(name, CPIO_TRAILER) == 0) {
+            return -1;
+        }
+
+        unsigned long mode = parse_hex(hdr->c_mode);
+        if ((mode & S_IFMT) == S_IFREG && strcmp(name, (char *)path) == 0) {
+            file->data = (const char *)data;
+            file->size = filesize;
+            file->mode = mode;
+            return 0;
+        }
+
+        p = start + CPIO_ALIGN(data - start + filesize);
+    }
+    return -1;
+}
+
+// The filesystem on top of the archive. A file gets an inode the first time
+// it's opened, which is kept for as long as the kernel runs (the archive never
+// changes), so that every open of the file shares the pages that the page
+// cache has for it. read copies from those pages and mmap maps them.
+
+struct initramfs_inode {
+    struct initramfs_file file;
+    struct address_space mapping;
+    struct list_head list;
+};
+
+static struct list_head initramfs_inodes = LIST_HEAD_INIT(initramfs_inodes);
+// Protects initramfs_inodes.
+static DEFINE_SPINLOCK(initramfs_inode_lock);
+
+// The full pages of a file are pages of the archive, which mkinitramfs.py
+// page aligns, so they're used as they are. They're part of the kernel image,
+// which get_page and free_page leave alone. The last partial page is copied,
+// because the next header of the archive follows it.
+static unsigned long initramfs_readpage(struct address_space *mapping,
+                                        unsigned long index) {
+    struct initramfs_inode *inode = mapping->host;
+    unsigned long offset = index << PAGE_SHIFT;
+    if (offset >= inode->file.size) {
+        return 0;
+    }
+
+    unsigned long data = (unsigned long)inode->file.data + offset;
+    unsigned long n = inode->file.size - offset;
+    if (!(data & ~PAGE_MASK) && n >= PAGE_SIZE) {
+        return data - VA_START;
+    }
+    unsigned long page = get_free_page();
+    if (page) {
+        memcpy(page + VA_START, data, n < PAGE_SIZE ? n : PAGE_SIZE);
+    }
+    return page;
+}
+
+static const struct address_space_operations initramfs_aops = {
+    .readpage = initramfs_readpage,
+};
+
+// Returns the inode of file, creating it the first time, or 0.
+static struct initramfs_inode *initramfs_iget(struct initramfs_file *file) {
+    struct initramfs_inode *new_inode = kzalloc(sizeof(*new_inode));
+    if (!new_inode) {
+        return 0;
+    }
+
+    spin_lock(&initramfs_inode_lock);
+    for (struct list_head *pos = initramfs_inodes.next;
+         pos != &initramfs_inodes; pos = pos->next) {
+        struct initramfs_inode *inode =
+            list_entry(pos, struct initramfs_inode, list);
+        if (inode->file.data == file->data) {
+            spin_unlock(&initramfs_inode_lock);
+            kfree(new_inode);
+            return inode;
+        }
+    }
+    new_inode->file = *file;
+    new_inode->mapping.a_ops = &initramfs_aops;
+    new_inode->mapping.host = new_inode;
+    list_add(&new_inode->list, &initramfs_inodes);
+    spin_unlock(&initramfs_inode_lock);
+    return new_inode;
+}
+
+static long initramfs_read(struct file *file, char *buf, unsigned long count) {
+    struct initramfs_inode *inode = file->private_data;
+    unsigned long size = inode->file.size;
+    unsigned long pos = file->f_pos;
+    if (pos >= size || !count) {
+        return 0;
+    }
+    if (count > size - pos) {
+        count = size - pos;
+    }
+
+    unsigned long done = 0;
+    while (done < count) {
+        unsigned long offset = pos & ~PAGE_MASK;
+        unsigned long n = PAGE_SIZE - offset;
+        if (n > count - done) {
+            n = count - done;
+        }
+        unsigned long page =
+            read_cache_page(&inode->mapping, pos >> PAGE_SHIFT);
+        if (!page) {
+            break;
+        }
+        unsigned long left =
+            copy_to_user(buf + done, (char *)(page + VA_START + offset), n);
+        free_page(page);
+        done += n - left;
+        pos += n - left;
+        if (left) {
+            break;
+        }
+    }
+
+    file->f_pos = pos;
+    return done ? (long)done : -1;
+}
+
+static long initramfs_llseek(struct file *file, long offset, int whence) {
+    struct initramfs_inode *inode = file->private_data;
+    long pos;
+    if (whence == SEEK_SET) {
+        pos = offset;
+    } else if (whence == SEEK_CUR) {
+        pos = (long)file->f_pos + offset;
+    } else if (whence == SEEK_END) {
+        pos = (long)inode->file.size + offset;
+    } else {
+        return -1;
+    }
+    // Past the end is fine (read returns 0 there), before the start isn't.
+    if (pos < 0) {
+        return -1;
+    }
+    file->f_pos = pos;
+    return pos;
+}
+
+static unsigned long initramfs_fault(struct file *file, unsigned long pgoff) {
+    struct initramfs_inode *inode = file->private_data;
+    return read_cache_page(&inode->mapping, pgoff);
+}
+
+static const struct file_operations initramfs_fops = {
+    .read = initramfs_read,
+    .llseek = initramfs_llseek,
+    .fault = initramfs_fault,
+};
+
+struct file *initramfs_open(const char *path) {
+    struct initramfs_file file;
+    if (initramfs_lookup(path, &file) < 0) {
+        return 0;
+    }
+    struct initramfs_inode *inode = initramfs_iget(&file);
+    if (!inode) {
+        return 0;
+    }
+    return alloc_file(&initramfs_fops, FMODE_READ, inode);
+}
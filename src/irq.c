@@ -1,6 +1,10 @@
+#include "irq.h"
 #include "peripherals/irq.h"
+#include "peripherals/local.h"
 #include "entry.h"
 #include "printf.h"
+#include "printk.h"
+#include "spinlock.h"
 #include "timer.h"
 #include "utils.h"
 
@@ -19,26 +23,194 @@ const char *entry_error_messages[] = {
 
     "SYNC_ERROR",          "SYSCALL_ERROR"};
 
-// Enables System Timer IRQ.
-void enable_interrupt_controller() { put32(ENABLE_IRQS_1, SYSTEM_TIMER_IRQ_1); }
+// The GPU controller has three banks: IRQ_PENDING_1 (IRQs 0 - 31),
+// IRQ_PENDING_2 (32 - 63) and the ARM IRQs in IRQ_BASIC_PENDING (64 - 71). The
+// 4th bank is the local controller of the core (72 - 83).
+#define NR_BANKS 4
+#define LOCAL_BANK 3
+
+// Local sources that we know how to enable: the 4 generic timers of the core.
+#define LOCAL_TIMER_MASK 0xf
+
+struct irq_desc {
+    irq_handler_t handler;
+    void *data;
+};
+
+static struct irq_desc irq_descs[NR_IRQS];
+static struct irq_stat irq_stats[NR_IRQS];
+
+// IRQs enabled in each bank. Pending bits of IRQs that we didn't enable are
+// ignored.
+static unsigned int irq_enabled[NR_BANKS];
+
+static const unsigned long enable_regs[LOCAL_BANK] = {
+    ENABLE_IRQS_1, ENABLE_IRQS_2, ENABLE_BASIC_IRQS};
+static const unsigned long disable_regs[LOCAL_BANK] = {
+    DISABLE_IRQS_1, DISABLE_IRQS_2, DISABLE_BASIC_IRQS};
+
+// Protects irq_descs and irq_enabled.
+static DEFINE_SPINLOCK(irq_lock);
+
+// The local timer sources are enabled per core, in the timer control register
+// of the core that makes the request.
+static void irq_unmask(int irq) {
+    int bank = irq / 32;
+    if (bank == LOCAL_BANK) {
+        unsigned long reg = CORE_TIMER_IRQCNTL(get_cpuid());
+        put32(reg, get32(reg) | (1 << (irq % 32)));
+        return;
+    }
+    // Writing a 1 only enables that IRQ. The other bits are unaffected.
+    put32(enable_regs[bank], 1 << (irq % 32));
+}
+
+static void irq_mask(int irq) {
+    int bank = irq / 32;
+    if (bank == LOCAL_BANK) {
+        unsigned long reg = CORE_TIMER_IRQCNTL(get_cpuid());
+        put32(reg, get32(reg) & ~(1 << (irq % 32)));
+        return;
+    }
+    put32(disable_regs[bank], 1 << (irq % 32));
+}
+
+// Disables every source so that we only get the interrupts that someone asked
+// for with request_irq. GPU interrupts go to core 0.
+void irq_init(void) {
+    for (int bank = 0; bank < LOCAL_BANK; bank++) {
+        put32(disable_regs[bank], 0xffffffff);
+        irq_enabled[bank] = 0;
+    }
+    put32(CORE_TIMER_IRQCNTL(get_cpuid()), 0);
+    irq_enabled[LOCAL_BANK] = 0;
+    put32(GPU_INT_ROUTING, 0);
+}
+
+// Registers handler for irq and enables the IRQ in the controller. handler is
+// called with IRQs disabled.
+int request_irq(int irq, irq_handler_t handler, void *data) {
+    if (irq < 0 || irq >= NR_IRQS || !handler) {
+        return -1;
+    }
+    if (irq >= IRQ_LOCAL_BASE &&
+        !((1 << (irq - IRQ_LOCAL_BASE)) & LOCAL_TIMER_MASK)) {
+        return -1;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&irq_lock);
+    if (irq_descs[irq].handler) {
+        spin_unlock_irqrestore(&irq_lock, flags);
+        return -1;
+    }
+
+    irq_descs[irq].handler = handler;
+    irq_descs[irq].data = data;
+    irq_enabled[irq / 32] |= 1 << (irq % 32);
+    irq_unmask(irq);
+    spin_unlock_irqrestore(&irq_lock, flags);
+    return 0;
+}
+
+void free_irq(int irq) {
+    if (irq < 0 || irq >= NR_IRQS) {
+        return;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&irq_lock);
+    irq_mask(irq);
+    irq_enabled[irq / 32] &= ~(1 << (irq % 32));
+    irq_descs[irq].handler = 0;
+    irq_descs[irq].data = 0;
+    spin_unlock_irqrestore(&irq_lock, flags);
+}
 
 void show_invalid_entry_message(int type, unsigned long esr,
                                 unsigned long address) {
-    printf("%s, ESR: %x, address: %x\r\n", entry_error_messages[type], esr,
-           address);
+    printk(KERN_EMERG "%s, ESR: %lx, address: %lx\r\n",
+           entry_error_messages[type], esr, address);
+    // We're not coming back from this one. Get everything out now.
+    log_panic_flush();
+}
+
+static inline unsigned long read_cntvct(void) {
+    unsigned long val;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(val));
+    return val;
+}
+
+static void account_irq(int irq, unsigned long ticks) {
+    int bucket = ticks ? 64 - __builtin_clzl(ticks) : 0;
+    if (bucket >= IRQ_HIST_BUCKETS) {
+        bucket = IRQ_HIST_BUCKETS - 1;
+    }
+    irq_stats[irq].count++;
+    irq_stats[irq].hist[bucket]++;
 }
 
 // Called from entry.S in the el1_irq function.
+//
+// We read the pending registers once and then handle every IRQ that is set,
+// lowest number first. Each handler acknowledges its own device, so the
+// sources we handled won't show up as pending next time. If a new IRQ comes in
+// meanwhile, it stays pending and we're interrupted again as soon as we
+// return.
 void handle_irq(void) {
-    unsigned int irq = get32(IRQ_PENDING_1);
-    // Not sure if this works as intended. irq can hold more than one interrupt
-    // at the same time. In those cases, irq != SYSTEM_TIMER_IRQ_1, even though
-    // irq & SYSTEM_TIMER_IRQ_1 == SYSTEM_TIMER_IRQ_1.
-    switch (irq) {
-        case (SYSTEM_TIMER_IRQ_1):
-            handle_timer_irq();
-            break;
-        default:
-            printf("Unknown pending irq: %x\r\n", irq);
+    unsigned long start = read_cntvct();
+    unsigned int pending[NR_BANKS] = {0, 0, 0, 0};
+
+    // The local controller tells us whether anything is pending in the GPU
+    // controller. If not, we don't have to touch it at all (the usual case for
+    // a timer tick).
+    unsigned int local = get32(CORE_IRQ_SOURCE(get_cpuid()));
+    pending[LOCAL_BANK] = local & ((1 << LOCAL_IRQ_COUNT) - 1);
+
+    if (local & (1 << LOCAL_IRQ_GPU)) {
+        unsigned int basic = get32(IRQ_BASIC_PENDING);
+
+        // Only touch the bank registers when the basic register says there's
+        // something there.
+        if (basic & (BASIC_PENDING_1 | BASIC_SHORTCUTS_1)) {
+            pending[0] = get32(IRQ_PENDING_1);
+        }
+        if (basic & (BASIC_PENDING_2 | BASIC_SHORTCUTS_2)) {
+            pending[1] = get32(IRQ_PENDING_2);
+        }
+        pending[2] = basic & BASIC_ARM_IRQS;
+    }
+
+    for (int bank = 0; bank < NR_BANKS; bank++) {
+        unsigned int bits = pending[bank] & irq_enabled[bank];
+        while (bits) {
+            int irq = bank * 32 + __builtin_ctz(bits);
+            // Clear the lowest set bit.
+            bits &= bits - 1;
+
+            struct irq_desc *desc = &irq_descs[irq];
+            if (desc->handler) {
+                desc->handler(irq, desc->data);
+            } else {
+                // Should not happen since we only look at enabled IRQs. Disable
+                // it so that it doesn't keep firing.
+                printk(KERN_WARNING "Unknown pending irq: %d\r\n", irq);
+                irq_mask(irq);
+            }
+            account_irq(irq, read_cntvct() - start);
+        }
+    }
+}
+
+void irq_stats_dump(void) {
+    printf("irq: count / latency histogram (log2 ticks)\r\n");
+    for (int irq = 0; irq < NR_IRQS; irq++) {
+        struct irq_stat *stat = &irq_stats[irq];
+        if (!stat->count) {
+            continue;
+        }
+        printf("%d: %lu /", irq, stat->count);
+        for (int i = 0; i < IRQ_HIST_BUCKETS; i++) {
+            printf(" %lu", stat->hist[i]);
+        }
+        printf("\r\n");
     }
 }
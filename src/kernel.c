@@ -1,41 +1,56 @@
+#include "bench.h"
+#include "buffer_head.h"
+#include "console.h"
+#include "dma.h"
+#include "emmc.h"
+#include "exec.h"
 #include "fork.h"
+#include "fpsimd.h"
+#include "fs.h"
+#include "futex.h"
 #include "irq.h"
+#include "kstack.h"
+#include "pagemap.h"
+#include "percpu.h"
 #include "printf.h"
+#include "printk.h"
 #include "sched.h"
+#include "slab.h"
+#include "softirq.h"
 #include "string.h"
 #include "sys.h"
 #include "timer.h"
 #include "uart.h"
 #include "uart_boot.h"
-#include "user.h"
 #include "utils.h"
+#include "vdso.h"
+#include "workqueue.h"
 
 #define BUFF_SIZE 100
 #define CHAIN_LOADING_ADDRESS ((char *)0x8000)
 
+// Boot option to run another program from the initramfs instead of /init,
+// e.g. "init=/futex_bench".
+#define INIT_OPTION "init="
+
+static char init_path[BUFF_SIZE] = "/init";
+
 // When this function finishes, it returns to the ret_from_fork function and
-// executes the ret_to_user function.
-void kernel_process() {
-    printf("Kernel process started. EL %d\r\n", get_el());
-
-    unsigned long begin = (unsigned long)&user_begin;
-    unsigned long end = (unsigned long)&user_end;
-    unsigned long process = (unsigned long)&user_process;
-
-    printf("Calling move_to_user_mode(%x, %x, %x)\r\n", begin, end - begin,
-           process - begin);
-
-    // Here, we compute an offset of where the user_process function relative to
-    // the user_begin portion.
-    int err = move_to_user_mode(begin, end - begin, process - begin);
-    if (err < 0) {
-        printf("Error while moving process to user mode\r\n");
+// executes the ret_to_user function, which starts the program at path in user
+// mode.
+void kernel_process(const char *path) {
+    printk(KERN_INFO "Kernel process started. EL %d\r\n", get_el());
+
+    if (do_exec(path) < 0) {
+        printk(KERN_ERR "Error while executing %s\r\n", path);
     }
 }
 
 void kernel_main(void) {
+    percpu_init();
     uart_init();
-    init_printf(0, putc);
+    init_printf(0, uart_write);
+    log_init();
 
     char buffer[BUFF_SIZE];
     readline(buffer, BUFF_SIZE);
@@ -44,27 +59,69 @@ void kernel_main(void) {
         copy_current_kernel_and_jump(CHAIN_LOADING_ADDRESS);
     }
 
+    if (strcmp(buffer, "printf-bench") == 0) {
+        printf_bench();
+    }
+
+    if (strncmp(buffer, INIT_OPTION, sizeof(INIT_OPTION) - 1) == 0) {
+        char *path = buffer + sizeof(INIT_OPTION) - 1;
+        int i = 0;
+        do {
+            init_path[i] = path[i];
+        } while (path[i++] != '\0');
+    }
+
     int cpuid = get_cpuid();
     int el = get_el();
     printf("Hello from CPU %d\r\n", cpuid);
     printf("Exception level: %d\r\n", el);
 
+    slab_init();
+    fork_init();
+    files_init();
+    page_cache_init();
+
     irq_vector_init();
+    if (irq_stack_init() < 0) {
+        printf("error while allocating the IRQ stack\r\n");
+        return;
+    }
+    irq_init();
     timer_init();
-    enable_interrupt_controller();
+    vdso_init();
+    fpsimd_init();
+    futex_init();
     enable_irq();
 
-    int res = copy_process(PF_KTHREAD, (unsigned long)&kernel_process, 0);
+    if (softirq_init() < 0 || workqueue_init() < 0) {
+        printf("error while starting the kernel worker threads\r\n");
+        return;
+    }
+    // Not fatal: page copies and the UART fall back to the CPU.
+    if (dma_init() < 0 || uart_enable_tx_dma() < 0) {
+        printf("no DMA\r\n");
+    }
+    if (buffer_init() < 0) {
+        printf("error while allocating the buffer cache\r\n");
+        return;
+    }
+    // Not fatal: everything else comes from the initramfs.
+    if (emmc_init() < 0) {
+        printf("no SD card\r\n");
+    }
+
+    int res = copy_process(PF_KTHREAD, (unsigned long)&kernel_process,
+                           (unsigned long)init_path, 0);
     if (res < 0) {
         printf("error while starting kernel process\r\n");
         return;
     }
-
-    while (1) {
-        // Once we call schedule for the first time, since current points to the
-        // init task, we become the init task. So, everytime init runs, it's
-        // actually running this while loop. Here, we're voluntarily giving up
-        // the cpu.
-        schedule();
+    if (console_init() < 0) {
+        printf("error while starting the console\r\n");
     }
+
+    // We're the init task, which is also the idle task of this CPU. Once we
+    // call schedule for the first time, everytime init runs, it's actually
+    // running the loop in cpu_idle.
+    cpu_idle();
 }
\ No newline at end of file
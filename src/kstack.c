@@ -0,0 +1,141 @@
+#include "kstack.h"
+#include "arm/mmu.h"
+#include "mm.h"
+#include "percpu.h"
+#include "printf.h"
+#include "printk.h"
+#include "sched.h"
+#include "spinlock.h"
+#include "utils.h"
+
+// Free stacks are filled with this so that stack_usage can tell how deep they
+// have been used.
+#define STACK_FILL 0x57ac57ac57ac57acUL
+
+// Top of the IRQ stack of each CPU (read by the irq_stack_entry macro in
+// entry.S) and its lowest address.
+DEFINE_PER_CPU(unsigned long, irq_stack_ptr);
+static DEFINE_PER_CPU(unsigned long, irq_stack_base);
+
+// Used by el1_sync once it notices that the stack pointer is in a guard page.
+DEFINE_PER_CPU(unsigned long[OVERFLOW_STACK_SIZE / sizeof(unsigned long)],
+               overflow_stack);
+
+static char kstack_slots[NR_KSTACK_SLOTS];
+
+// Protects kstack_slots and the page tables of the stack area.
+static DEFINE_SPINLOCK(kstack_lock);
+
+static inline unsigned long slot_stack(int slot) {
+    return KSTACK_AREA_START + slot * KSTACK_SLOT_SIZE + THREAD_SIZE;
+}
+
+static void kstack_unmap(unsigned long stack, int pages) {
+    for (int i = 0; i < pages; i++) {
+        unsigned long va = stack + i * PAGE_SIZE;
+        unsigned long page = unmap_kernel_page(va);
+        if (page) {
+            free_page(page);
+        }
+    }
+}
+
+// Returns the lowest address of a new stack of THREAD_SIZE bytes, or 0.
+unsigned long alloc_kernel_stack(void) {
+    unsigned long flags = spin_lock_irqsave(&kstack_lock);
+    int slot;
+    for (slot = 0; slot < NR_KSTACK_SLOTS; slot++) {
+        if (!kstack_slots[slot]) {
+            break;
+        }
+    }
+    if (slot == NR_KSTACK_SLOTS) {
+        spin_unlock_irqrestore(&kstack_lock, flags);
+        return 0;
+    }
+    kstack_slots[slot] = 1;
+
+    unsigned long stack = slot_stack(slot);
+    for (int i = 0; i < THREAD_SIZE / PAGE_SIZE; i++) {
+        unsigned long page = get_free_page();
+        if (!page || map_kernel_page(stack + i * PAGE_SIZE, page,
+                                     MMU_PTE_FLAGS_KERNEL) < 0) {
+            if (page) {
+                free_page(page);
+            }
+            kstack_unmap(stack, i);
+            kstack_slots[slot] = 0;
+            spin_unlock_irqrestore(&kstack_lock, flags);
+            return 0;
+        }
+
+        unsigned long *p = (unsigned long *)(page + VA_START);
+        for (int j = 0; j < PAGE_SIZE / sizeof(unsigned long); j++) {
+            p[j] = STACK_FILL;
+        }
+    }
+    spin_unlock_irqrestore(&kstack_lock, flags);
+    return stack;
+}
+
+void free_kernel_stack(unsigned long stack) {
+    unsigned long flags = spin_lock_irqsave(&kstack_lock);
+    kstack_unmap(stack, THREAD_SIZE / PAGE_SIZE);
+    kstack_slots[(stack - KSTACK_AREA_START) / KSTACK_SLOT_SIZE] = 0;
+    spin_unlock_irqrestore(&kstack_lock, flags);
+}
+
+// Returns the maximum number of bytes of the stack (lowest address stack, size
+// bytes) that were ever used: everything above the lowest word that doesn't
+// hold STACK_FILL anymore.
+unsigned long stack_usage(unsigned long stack, unsigned long size) {
+    unsigned long *p = (unsigned long *)stack;
+    unsigned long *end = (unsigned long *)(stack + size);
+    while (p < end && *p == STACK_FILL) {
+        p++;
+    }
+    return (unsigned long)end - (unsigned long)p;
+}
+
+// Allocates the IRQ stack of the calling CPU. Must run before it enables IRQs.
+int irq_stack_init(void) {
+    unsigned long stack = alloc_kernel_stack();
+    if (!stack) {
+        return -1;
+    }
+    this_cpu(irq_stack_base) = stack;
+    this_cpu(irq_stack_ptr) = stack + IRQ_STACK_SIZE;
+    return 0;
+}
+
+void stack_watermark_dump(void) {
+    printf("stack: used / size (bytes)\r\n");
+
+    unsigned long flags = spin_lock_irqsave(&tasklist_lock);
+    for (int i = 0; i < NR_TASKS; i++) {
+        struct task_struct *p = task[i];
+        if (!p || !p->stack) {
+            continue;
+        }
+        printf("pid %d: %lu / %d\r\n", p->pid, stack_usage(p->stack, THREAD_SIZE),
+               THREAD_SIZE);
+    }
+    spin_unlock_irqrestore(&tasklist_lock, flags);
+
+    for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+        unsigned long base = per_cpu(irq_stack_base, cpu);
+        if (!base) {
+            continue;
+        }
+        printf("irq cpu %d: %lu / %d\r\n", cpu,
+               stack_usage(base, IRQ_STACK_SIZE), IRQ_STACK_SIZE);
+    }
+}
+
+// Called from el1_sync on the overflow stack. There's no way back: the
+// registers of the task weren't saved.
+void handle_bad_stack(unsigned long sp, unsigned long esr, unsigned long far) {
+    printk(KERN_EMERG "Kernel stack overflow: sp %lx, ESR %lx, FAR %lx\r\n",
+           sp, esr, far);
+    log_panic_flush();
+}
@@ -1,12 +1,23 @@
 #include "mm.h"
 #include "arm/mmu.h"
+#include "arm/sysregs.h"
+#include "dma.h"
+#include "fs.h"
+#include "printk.h"
 #include "sched.h"
+#include "slab.h"
+#include "spinlock.h"
+#include "utils.h"
 
 // Holds references to the memory pages.
 static unsigned short mem_map[PAGING_PAGES] = {
     0,
 };
 
+// Protects mem_map. Pages aren't allocated from interrupt handlers today, but
+// we take it with IRQs disabled anyway so that it stays safe if that changes.
+static DEFINE_SPINLOCK(mem_map_lock);
+
 unsigned long allocate_kernel_page() {
     unsigned long page = get_free_page();
     if (page == 0) {
@@ -15,31 +26,46 @@ unsigned long allocate_kernel_page() {
     return page + VA_START;
 }
 
-unsigned long allocate_user_page(struct task_struct *task, unsigned long va) {
-    // page here is a physical pointer
-    unsigned long page = get_free_page();
-
-    if (page == 0) {
-        return 0;
+// Maps the physical page at the kernel virtual address va (in the kernel page
+// tables, pg_dir) with a 4KB page. The intermediate tables are allocated as
+// needed and never freed. Used for the areas that aren't part of the linear
+// map built in boot.S (e.g. the kernel stacks, see kstack.c). Callers
+// serialize.
+int map_kernel_page(unsigned long va, unsigned long page, unsigned long flags) {
+    unsigned long *table = (unsigned long *)&pg_dir;
+    int new_table;
+    for (unsigned long shift = PGD_SHIFT; shift > PAGE_SHIFT;
+         shift -= TABLE_SHIFT) {
+        unsigned long next = map_table(table, shift, va, &new_table);
+        if (!next) {
+            return -1;
+        }
+        table = (unsigned long *)(next + VA_START);
     }
+    map_table_entry(table, va, page, flags);
+    // Make the entry visible to the table walker before anyone uses it.
+    asm volatile("dsb ishst; isb" ::: "memory");
+    return 0;
+}
 
-    int ret = map_page(task, va, page);
-
-    // If there was an error, we return 0. Note that we don't return -1 since
-    // this is an unsigned long.
-    // TODO: There's a lot of cleanup that we should be doing here.
-    if (ret < 0) {
-        return 0;
+// Removes the mapping of va made by map_kernel_page and returns the physical
+// page that was mapped there (or 0).
+unsigned long unmap_kernel_page(unsigned long va) {
+    unsigned long *table = (unsigned long *)&pg_dir;
+    for (unsigned long shift = PGD_SHIFT; shift > PAGE_SHIFT;
+         shift -= TABLE_SHIFT) {
+        unsigned long entry = table[(va >> shift) & (PTRS_PER_TABLE - 1)];
+        if (!entry) {
+            return 0;
+        }
+        table = (unsigned long *)((entry & PAGE_MASK) + VA_START);
     }
 
-    // By adding VA_START, we're effectively making this a virtual address in
-    // Kernel space. For example, if get_free_page() returns 4096, then that is
-    // the physical address, and VA_START + 4096 is the virtual address is
-    // kernel space. So, technically, we can get any physical address and get
-    // its virtual address in kernel space by adding VA_START (or determine a
-    // physical address by subtracting VA_START from a kernel space virtual
-    // address).
-    return page + VA_START;
+    unsigned long index = (va >> PAGE_SHIFT) & (PTRS_PER_TABLE - 1);
+    unsigned long page = table[index] & PAGE_MASK;
+    table[index] = 0;
+    flush_tlb_kernel_page(va);
+    return page;
 }
 
 // This implementation differs with the implementation in boot.S in:
@@ -47,53 +73,122 @@ unsigned long allocate_user_page(struct task_struct *task, unsigned long va) {
 //   2. This maps a single page to a single virtual address (not a range). In
 //   boot.S, we map all of memory.
 //   3. We're not using section mapping here (we use PMD and PTE).
-// TODO: Validate the page counts are still within limit (potential buffer
-// overflow).
-int map_page(struct task_struct *task, unsigned long va, unsigned long page) {
-    unsigned long pgd;
-    if (!task->mm.pgd) {
-        // This is a physical pointer.
-        task->mm.pgd = get_free_page();
-        if (task->mm.pgd < 0) {
-            return -1;
-        }
-        task->mm.kernel_pages[++(task->mm.kernel_pages_count)] = task->mm.pgd;
-    }
-    pgd = task->mm.pgd;
-    int new_table;
-    unsigned long pud =
-        map_table((unsigned long *)(pgd + VA_START), PGD_SHIFT, va, &new_table);
-    if (pud < 0) {
+int map_page(struct mm_struct *mm, unsigned long va, unsigned long page) {
+    return map_user_page(mm, va, page, MMU_PTE_FLAGS);
+}
+
+// Maps page at va with the given descriptor flags and records it in
+// user_pages, which means that the mm owns it: it is copied on fork and freed
+// by exit_mmap.
+int map_user_page(struct mm_struct *mm, unsigned long va, unsigned long page,
+                  unsigned long flags) {
+    if (mm->user_pages_count >= MAX_PROCESS_PAGES) {
         return -1;
     }
-    if (new_table) {
-        task->mm.kernel_pages[++(task->mm.kernel_pages_count)] = pud;
+
+    int ret = map_page_prot(mm, va, page, flags);
+    if (ret < 0) {
+        return ret;
     }
 
-    unsigned long pmd =
-        map_table((unsigned long *)(pud + VA_START), PUD_SHIFT, va, &new_table);
-    if (pmd < 0) {
+    // page is a physical address, va is the virtual address
+    struct user_page user_page = {page, va};
+    mm->user_pages[mm->user_pages_count++] = user_page;
+
+    return 0;
+}
+
+// Records a page table page of mm so that exit_mmap can free it.
+static int add_kernel_page(struct mm_struct *mm, unsigned long page) {
+    if (mm->kernel_pages_count >= MAX_PROCESS_PAGES) {
         return -1;
     }
-    if (new_table) {
-        task->mm.kernel_pages[++(task->mm.kernel_pages_count)] = pmd;
+    mm->kernel_pages[mm->kernel_pages_count++] = page;
+    return 0;
+}
+
+// Does the actual page table walk for map_page, but lets the caller choose the
+// descriptor flags (e.g. read-only for EL0). Note that the page is NOT recorded
+// in user_pages, so it won't be copied on fork or freed with the task (e.g. the
+// vDSO page or pages of the initramfs).
+int map_page_prot(struct mm_struct *mm, unsigned long va, unsigned long page,
+                  unsigned long flags) {
+    unsigned long pgd;
+    if (!mm->pgd) {
+        // This is a physical pointer.
+        mm->pgd = get_free_page();
+        if (!mm->pgd) {
+            return -1;
+        }
+        add_kernel_page(mm, mm->pgd);
     }
+    pgd = mm->pgd;
 
-    unsigned long pte =
-        map_table((unsigned long *)(pmd + VA_START), PMD_SHIFT, va, &new_table);
-    if (pte < 0) {
-        return -1;
+    // Walk (and fill in) the PGD, PUD and PMD to get to the PTE table.
+    unsigned long table = pgd;
+    for (unsigned long shift = PGD_SHIFT; shift > PAGE_SHIFT;
+         shift -= TABLE_SHIFT) {
+        int new_table;
+        unsigned long next = map_table((unsigned long *)(table + VA_START),
+                                       shift, va, &new_table);
+        if (!next) {
+            return -1;
+        }
+        if (new_table && add_kernel_page(mm, next) < 0) {
+            // The table is already linked in, so we can't just free it. Fail
+            // the mapping instead of losing track of it.
+            return -1;
+        }
+        table = next;
     }
-    if (new_table) {
-        task->mm.kernel_pages[++(task->mm.kernel_pages_count)] = pte;
+
+    map_table_entry((unsigned long *)(table + VA_START), va, page, flags);
+    return 0;
+}
+
+// Returns a pointer (kernel virtual address) to the descriptor of va in the
+// PTE table of mm, or 0 if one of the tables on the way isn't there.
+static unsigned long *user_pte(struct mm_struct *mm, unsigned long va) {
+    if (!mm->pgd) {
+        return 0;
     }
 
-    map_table_entry((unsigned long *)(pte + VA_START), va, page);
+    unsigned long *table = (unsigned long *)(mm->pgd + VA_START);
+    for (unsigned long shift = PGD_SHIFT; shift > PAGE_SHIFT;
+         shift -= TABLE_SHIFT) {
+        unsigned long entry = table[(va >> shift) & (PTRS_PER_TABLE - 1)];
+        if (!entry) {
+            return 0;
+        }
+        table = (unsigned long *)((entry & PAGE_MASK) + VA_START);
+    }
+    return &table[(va >> PAGE_SHIFT) & (PTRS_PER_TABLE - 1)];
+}
 
-    // page is a physical address, va is the virtual address
-    struct user_page user_page = {page, va};
-    task->mm.user_pages[task->mm.user_pages_count++] = user_page;
+// Returns the physical address va is mapped to in mm (0 if it isn't) and the
+// descriptor in *pte (if pte is not null).
+unsigned long user_virt_to_phys(struct mm_struct *mm, unsigned long va,
+                                unsigned long *pte) {
+    unsigned long *entry = user_pte(mm, va);
+    if (!entry || !*entry) {
+        return 0;
+    }
+    if (pte) {
+        *pte = *entry;
+    }
+    return (*entry & MM_ADDR_MASK) | (va & ~PAGE_MASK);
+}
 
+// Returns the user_pages entry of the page mapped at va, or 0 if mm doesn't own
+// that page.
+static struct user_page *find_user_page(struct mm_struct *mm,
+                                        unsigned long va) {
+    va &= PAGE_MASK;
+    for (int i = 0; i < mm->user_pages_count; i++) {
+        if (mm->user_pages[i].virt_addr == va) {
+            return &mm->user_pages[i];
+        }
+    }
     return 0;
 }
 
@@ -122,8 +217,8 @@ unsigned long map_table(unsigned long *table, unsigned long shift,
     // return the mapping.
     *new_table = 1;
     unsigned long next_level_table = get_free_page();
-    if (free_page < 0) {
-        return -1;
+    if (!next_level_table) {
+        return 0;
     }
     unsigned long entry = next_level_table | MM_TYPE_PAGE_TABLE;
     table[index] = entry;
@@ -135,82 +230,512 @@ unsigned long map_table(unsigned long *table, unsigned long shift,
 // Maps the PMD to the physical address. It uses the va to extract the index. We
 // don't need the shift argument here because this function only deals with
 // PTEs. pa stands for physical address
-void map_table_entry(unsigned long *table, unsigned long va, unsigned long pa) {
+void map_table_entry(unsigned long *table, unsigned long va, unsigned long pa,
+                     unsigned long flags) {
     // the least significant 12 bits are the page offset (see the mm.h diagram).
     unsigned long index = (va >> PAGE_SHIFT) & (PTRS_PER_TABLE - 1);
-    table[index] = pa | MMU_PTE_FLAGS;
+    table[index] = pa | flags;
 }
 
-// Returns a physical address to a free page.
+// Returns a physical address to a free page. The caller holds the only
+// reference to it (see get_page and free_page). The page is zeroed by the DMA
+// engine when there's a free channel (it polls, so callers may hold
+// spinlocks).
 unsigned long get_free_page() {
+    unsigned long flags = spin_lock_irqsave(&mem_map_lock);
     // Iterate through all pages until we find one that is free. At that point,
     // we take it and calculate the offset of that page.
     for (int i = 0; i < PAGING_PAGES; i++) {
         if (mem_map[i] == 0) {
             mem_map[i] = 1;
+            spin_unlock_irqrestore(&mem_map_lock, flags);
             // We start at LOW_MEMORY and use the index as an offset of the page
-            // size.
+            // size. The page is ours now, so we zero it outside the lock.
             unsigned long page = LOW_MEMORY + i * PAGE_SIZE;
-            memzero(page + VA_START, PAGE_SIZE);
+            if (dma_zero_page(page) < 0) {
+                memzero(page + VA_START, PAGE_SIZE);
+            }
             return page;
         }
     }
+    spin_unlock_irqrestore(&mem_map_lock, flags);
     return 0;
 }
 
+// Copies the page src to dst (physical addresses), with the DMA engine if
+// there's a free channel. May be called with spinlocks held.
+static void copy_page(unsigned long dst, unsigned long src) {
+    if (dma_copy_page(dst, src) < 0) {
+        memcpy(dst + VA_START, src + VA_START, PAGE_SIZE);
+    }
+}
+
+// mem_map counts the references to every page: a page can be mapped by more
+// than one address space and held by a pipe at the same time (see
+// loan_user_page). Pages below LOW_MEMORY (the kernel image, including the
+// initramfs) are never allocated nor freed, so they aren't counted.
+void get_page(unsigned long p) {
+    if (p < LOW_MEMORY) {
+        return;
+    }
+    unsigned long flags = spin_lock_irqsave(&mem_map_lock);
+    mem_map[(p - LOW_MEMORY) / PAGE_SIZE]++;
+    spin_unlock_irqrestore(&mem_map_lock, flags);
+}
+
+// Returns the number of references to the page (0 for the pages that aren't
+// counted).
+unsigned int page_count(unsigned long p) {
+    if (p < LOW_MEMORY) {
+        return 0;
+    }
+    return __atomic_load_n(&mem_map[(p - LOW_MEMORY) / PAGE_SIZE],
+                           __ATOMIC_RELAXED);
+}
+
+// Drops a reference to the page. It's free again once the last one is gone.
 void free_page(unsigned long p) {
+    if (p < LOW_MEMORY) {
+        return;
+    }
     // p = LOW_MEMORY + i * PAGE_SIZE
     // (p - LOW_MEMORY) = i * PAGE_SIZE
     // (p - LOW_MEMORY)/PAGE_SIZE = i
-    mem_map[(p - LOW_MEMORY) / PAGE_SIZE] = 0;
+    unsigned long flags = spin_lock_irqsave(&mem_map_lock);
+    unsigned long i = (p - LOW_MEMORY) / PAGE_SIZE;
+    int underflow = mem_map[i] == 0;
+    if (!underflow) {
+        mem_map[i]--;
+    }
+    spin_unlock_irqrestore(&mem_map_lock, flags);
+
+    // A reference was dropped twice: somebody still uses a page they don't
+    // hold a reference to anymore.
+    if (underflow) {
+        printk(KERN_ERR "free_page: page %lx is already free (caller %p)\r\n",
+               p, __builtin_return_address(0));
+    }
+}
+
+// Returns the VMA of mm that contains va, or 0.
+struct vm_area_struct *find_vma(struct mm_struct *mm, unsigned long va) {
+    for (int i = 0; i < mm->nr_vmas; i++) {
+        struct vm_area_struct *vma = &mm->vmas[i];
+        if (va >= vma->vm_start && va < vma->vm_end) {
+            return vma;
+        }
+    }
+    return 0;
+}
+
+// Descriptor flags for the pages of vma. EL0 can't execute from areas without
+// VM_EXEC, and not at all from areas without VM_READ (PROT_NONE): their pages,
+// if they had any (handle_mm_fault refuses them), would only be mapped for EL1.
+static unsigned long vma_pte_flags(struct vm_area_struct *vma) {
+    if (!(vma->vm_flags & VM_READ)) {
+        return MMU_PTE_FLAGS_KERNEL | MM_UXN;
+    }
+    unsigned long flags =
+        (vma->vm_flags & VM_WRITE) ? MMU_PTE_FLAGS : MMU_PTE_FLAGS_RO;
+    if (!(vma->vm_flags & VM_EXEC)) {
+        flags |= MM_UXN;
+    }
+    return flags;
+}
+
+// Iterates through all user_pages of src and copies them to dst (allocates
+// pages for dst), except for the pages of shared areas (VM_SHARED), which dst
+// maps too. The VMAs are shared as they are, so the pages that come straight
+// from a file (not in user_pages) are simply faulted in again by the child.
+// Threads of src may be faulting in pages meanwhile, hence the lock.
+//
+// The private pages are copied after the lock is dropped, by the DMA engine in
+// a single transfer if there's a free channel, so that the CPU can run
+// something else meanwhile (see dma_copy_pages). A reference on every source
+// page keeps a thread of src from freeing one before it's copied. The caller
+// must be able to sleep (copy_process calls it with preemption enabled).
+int copy_virt_memory(struct mm_struct *dst, struct mm_struct *src) {
+    unsigned long *copy_dst =
+        kmalloc(2 * MAX_PROCESS_PAGES * sizeof(unsigned long));
+    if (!copy_dst) {
+        return -1;
+    }
+    unsigned long *copy_src = copy_dst + MAX_PROCESS_PAGES;
+    int nr_copies = 0;
+
+    int ret = 0;
+    spin_lock(&src->page_table_lock);
+
+    dst->nr_vmas = src->nr_vmas;
+    for (int i = 0; i < src->nr_vmas; i++) {
+        dst->vmas[i] = src->vmas[i];
+        if (dst->vmas[i].vm_file) {
+            get_file(dst->vmas[i].vm_file);
+        }
+    }
+
+    for (int i = 0; i < src->user_pages_count; i++) {
+        struct user_page *src_page = &src->user_pages[i];
+        struct vm_area_struct *vma = find_vma(src, src_page->virt_addr);
+        if (!vma) {
+            ret = -1;
+            break;
+        }
+
+        if (vma->vm_flags & VM_SHARED) {
+            get_page(src_page->phys_addr);
+            if (map_user_page(dst, src_page->virt_addr, src_page->phys_addr,
+                              vma_pte_flags(vma)) < 0) {
+                free_page(src_page->phys_addr);
+                ret = -1;
+                break;
+            }
+            continue;
+        }
+
+        unsigned long page = get_free_page();
+        if (!page || map_user_page(dst, src_page->virt_addr, page,
+                                   vma_pte_flags(vma)) < 0) {
+            if (page) {
+                free_page(page);
+            }
+            ret = -1;
+            break;
+        }
+        get_page(src_page->phys_addr);
+        copy_dst[nr_copies] = page;
+        copy_src[nr_copies] = src_page->phys_addr;
+        nr_copies++;
+    }
+
+    spin_unlock(&src->page_table_lock);
+
+    if (!ret && dma_copy_pages(copy_dst, copy_src, nr_copies) < 0) {
+        for (int i = 0; i < nr_copies; i++) {
+            copy_page(copy_dst[i], copy_src[i]);
+        }
+    }
+    for (int i = 0; i < nr_copies; i++) {
+        free_page(copy_src[i]);
+    }
+    kfree(copy_dst);
+    return ret;
+}
+
+// Replaces the valid entry *pte that maps va with new_pte. Changing the
+// output address needs break-before-make: the old entry is invalidated and
+// flushed from every TLB before the new one is written, otherwise another CPU
+// could hold both translations at once, which the architecture doesn't allow.
+// Called with page_table_lock held.
+static void set_user_pte(unsigned long *pte, unsigned long va,
+                         unsigned long new_pte) {
+    if ((*pte & MM_ADDR_MASK) == (new_pte & MM_ADDR_MASK)) {
+        *pte = new_pte;
+        flush_tlb_page(va);
+        return;
+    }
+    *pte = 0;
+    flush_tlb_page(va);
+    *pte = new_pte;
+    // The entry was invalid, no TLB maintenance needed.
+    asm volatile("dsb ishst" ::: "memory");
 }
 
-// Iterates through all user_pages from current and copies them to dst
-// (allocates pages for dst).
-int copy_virt_memory(struct task_struct *dst) {
-    struct task_struct *src = current;
+// Handles a write to a page that is mapped read-only in a writable VMA. These
+// pages are shared copy-on-write with a pipe or another address space (see
+// loan_user_page and remap_user_page). If nobody else holds a reference
+// anymore, the page just becomes writable again. Otherwise, mm gets a private
+// copy of it. Called with mm->page_table_lock held.
+static int do_wp_page(struct mm_struct *mm, struct vm_area_struct *vma,
+                      unsigned long va, unsigned long *pte) {
+    struct user_page *user_page = find_user_page(mm, va);
+    if (!user_page) {
+        return -1;
+    }
 
-    for (int i = 0; i < src->mm.user_pages_count; i++) {
-        unsigned long kernel_va =
-            allocate_user_page(dst, src->mm.user_pages[i].virt_addr);
-        if (kernel_va == 0) {
+    // Nobody can take a new reference to the page behind our back: loaning it
+    // needs page_table_lock, and everyone else that maps it (e.g. a pipe
+    // reader) already holds a reference, so the count can only go down.
+    unsigned long old = *pte & MM_ADDR_MASK;
+    unsigned long page = old;
+    if (page_count(old) != 1) {
+        page = get_free_page();
+        if (!page) {
             return -1;
         }
-        memcpy(kernel_va, src->mm.user_pages[i].virt_addr, PAGE_SIZE);
+        copy_page(page, old);
+        user_page->phys_addr = page;
+    }
+
+    set_user_pte(pte, va, page | vma_pte_flags(vma));
+    if (page != old) {
+        free_page(old);
     }
     return 0;
 }
 
-// Not sure if this static ind is shared across all processes, or if it's unique
-// per process.
-static int ind = 1;
+// Lends the page that holds the user address va of mm to the kernel (e.g. to a
+// pipe) instead of copying it: takes a reference to the page and write-protects
+// it, so the next write by mm gets a copy (see do_wp_page) and the lent data
+// doesn't change. Only pages owned by mm (user_pages) of private areas are lent
+// (making a shared page copy-on-write would unshare it). Returns the physical
+// address of the page, or 0 if the caller has to copy instead.
+unsigned long loan_user_page(struct mm_struct *mm, unsigned long va) {
+    va &= PAGE_MASK;
+    if (!user_virt_to_phys(mm, va, 0) && handle_mm_fault(mm, va, 0) < 0) {
+        return 0;
+    }
+
+    unsigned long page = 0;
+    spin_lock(&mm->page_table_lock);
 
-// Ensures that we're handling a translation fault, and then maps a new page to
-// the requested address to the current process.
+    struct vm_area_struct *vma = find_vma(mm, va);
+    struct user_page *user_page = find_user_page(mm, va);
+    unsigned long *pte = user_pte(mm, va);
+    if (!vma || (vma->vm_flags & VM_SHARED) || !user_page || !pte || !*pte) {
+        goto out;
+    }
+
+    if (pte_write(*pte)) {
+        *pte = pte_wrprotect(*pte);
+        // Other threads of mm may still have the writable translation.
+        flush_tlb_page(va);
+    }
+    page = user_page->phys_addr;
+    get_page(page);
+out:
+    spin_unlock(&mm->page_table_lock);
+    return page;
+}
+
+// Maps page (a physical page the caller holds a reference to, e.g. one from a
+// pipe) at the user address va of mm instead of copying its contents there.
+// Whatever was mapped at va is dropped. va must be page aligned and part of a
+// writable, private VMA. The page is mapped read-only (copy-on-write, see
+// do_wp_page) and mm takes its own reference to it. Returns -1 if the page
+// can't be mapped (e.g. mm already owns MAX_PROCESS_PAGES pages); the caller
+// has to copy then.
+int remap_user_page(struct mm_struct *mm, unsigned long va,
+                    unsigned long page) {
+    int ret = -1;
+    spin_lock(&mm->page_table_lock);
+
+    struct vm_area_struct *vma = find_vma(mm, va);
+    if (!vma || !(vma->vm_flags & VM_WRITE) || (vma->vm_flags & VM_SHARED)) {
+        goto out;
+    }
+    unsigned long flags = pte_wrprotect(vma_pte_flags(vma));
+
+    unsigned long *pte = user_pte(mm, va);
+    if (pte && *pte) {
+        struct user_page *user_page = find_user_page(mm, va);
+        if (!user_page) {
+            goto out;
+        }
+        unsigned long old = user_page->phys_addr;
+        get_page(page);
+        user_page->phys_addr = page;
+        set_user_pte(pte, va, page | flags);
+        free_page(old);
+    } else {
+        get_page(page);
+        if (map_user_page(mm, va, page, flags) < 0) {
+            free_page(page);
+            goto out;
+        }
+        // The entry was invalid, no TLB maintenance needed.
+        asm volatile("dsb ishst" ::: "memory");
+    }
+    ret = 0;
+out:
+    spin_unlock(&mm->page_table_lock);
+    return ret;
+}
+
+// Maps the page containing addr in mm according to its VMA. Pages that are
+// entirely backed by the file and never written (e.g. the code of a program in
+// the initramfs) are mapped in place, so every process running the program
+// shares them. Every other page gets a private copy (what's left of the file
+// in it, and zeroes for the rest). Areas that map a file (vm_file) get their
+// pages from it instead. Returns -1 if the task isn't allowed to access addr
+// in that way (fault_flags).
+int handle_mm_fault(struct mm_struct *mm, unsigned long addr,
+                    unsigned long fault_flags) {
+    int ret = -1;
+    spin_lock(&mm->page_table_lock);
+
+    struct vm_area_struct *vma = find_vma(mm, addr);
+    // Nothing may touch a PROT_NONE area.
+    if (!vma || !(vma->vm_flags & VM_READ)) {
+        goto out;
+    }
+    if ((fault_flags & FAULT_FLAG_WRITE) && !(vma->vm_flags & VM_WRITE)) {
+        goto out;
+    }
+    if ((fault_flags & FAULT_FLAG_EXEC) && !(vma->vm_flags & VM_EXEC)) {
+        goto out;
+    }
+
+    unsigned long va = addr & PAGE_MASK;
+    unsigned long *pte = user_pte(mm, va);
+    if (pte && *pte) {
+        // Either another thread of the mm got here first, or this is a write
+        // to a copy-on-write page.
+        if ((fault_flags & FAULT_FLAG_WRITE) && !pte_write(*pte)) {
+            ret = do_wp_page(mm, vma, va, pte);
+        } else {
+            ret = 0;
+        }
+        goto out;
+    }
+
+    unsigned long offset = va - vma->vm_start;
+    unsigned long flags = vma_pte_flags(vma);
+
+    if (vma->vm_file) {
+        // A shared area maps the page of the file itself. A private one maps
+        // it read-only (copy-on-write, see do_wp_page) or, on a write, gets a
+        // copy right away.
+        struct file *file = vma->vm_file;
+        unsigned long page =
+            file->f_op->fault(file, vma->vm_pgoff + (offset >> PAGE_SHIFT));
+        if (!page) {
+            goto out;
+        }
+        if (!(vma->vm_flags & VM_SHARED)) {
+            if (fault_flags & FAULT_FLAG_WRITE) {
+                unsigned long copy = get_free_page();
+                if (copy) {
+                    copy_page(copy, page);
+                }
+                free_page(page);
+                page = copy;
+                if (!page) {
+                    goto out;
+                }
+            } else {
+                flags = pte_wrprotect(flags);
+            }
+        }
+        ret = map_user_page(mm, va, page, flags);
+        if (ret < 0) {
+            free_page(page);
+        }
+    } else if (vma->file_data && !(vma->vm_flags & VM_WRITE) &&
+               offset + PAGE_SIZE <= vma->file_size &&
+               !((vma->file_data + offset) & ~PAGE_MASK)) {
+        unsigned long page = vma->file_data + offset - VA_START;
+        ret = map_page_prot(mm, va, page, flags);
+    } else {
+        unsigned long page = get_free_page();
+        if (!page) {
+            goto out;
+        }
+        if (offset < vma->file_size) {
+            unsigned long n = vma->file_size - offset;
+            memcpy(page + VA_START, vma->file_data + offset,
+                   n < PAGE_SIZE ? n : PAGE_SIZE);
+        }
+        ret = map_user_page(mm, va, page, flags);
+        if (ret < 0) {
+            free_page(page);
+        }
+    }
+
+    // Make the new entry visible to the table walker before we return to the
+    // task. The entry was invalid, so there's nothing to invalidate in the TLB
+    // of any CPU (see the TLB rules above flush_tlb_page in utils.S).
+    asm volatile("dsb ishst" ::: "memory");
+out:
+    spin_unlock(&mm->page_table_lock);
+    return ret;
+}
+
+// Unmaps [start, end) (page aligned) from mm and drops the references of mm to
+// the pages that were mapped there. The VMAs are left alone (see do_munmap).
+// Called with page_table_lock held.
+void zap_user_range(struct mm_struct *mm, unsigned long start,
+                    unsigned long end) {
+    // Only the VMAs can have pages mapped, so we don't walk the whole range.
+    for (int i = 0; i < mm->nr_vmas; i++) {
+        struct vm_area_struct *vma = &mm->vmas[i];
+        unsigned long from = vma->vm_start > start ? vma->vm_start : start;
+        unsigned long to = vma->vm_end < end ? vma->vm_end : end;
+
+        for (unsigned long va = from; va < to; va += PAGE_SIZE) {
+            unsigned long *pte = user_pte(mm, va);
+            if (!pte || !*pte) {
+                continue;
+            }
+            *pte = 0;
+            // No CPU may use the page anymore once we drop our reference.
+            flush_tlb_page(va);
+
+            struct user_page *user_page = find_user_page(mm, va);
+            if (user_page) {
+                free_page(user_page->phys_addr);
+                *user_page = mm->user_pages[--mm->user_pages_count];
+            }
+        }
+    }
+}
+
+// Drops the references of mm to the pages it owns (user_pages, which frees them
+// unless they're shared, and the page tables) and to the files its VMAs map,
+// and forgets about them. Pages mapped with map_page_prot (the vDSO page,
+// initramfs pages) are not owned. Only called for the last user of the mm (see
+// mmput) once no CPU has its page tables loaded anymore.
+void exit_mmap(struct mm_struct *mm) {
+    for (int i = 0; i < mm->user_pages_count; i++) {
+        free_page(mm->user_pages[i].phys_addr);
+    }
+    for (int i = 0; i < mm->nr_vmas; i++) {
+        if (mm->vmas[i].vm_file) {
+            fput(mm->vmas[i].vm_file);
+        }
+    }
+    for (int i = 0; i < mm->kernel_pages_count; i++) {
+        free_page(mm->kernel_pages[i]);
+    }
+    mm->user_pages_count = 0;
+    mm->kernel_pages_count = 0;
+    mm->nr_vmas = 0;
+    mm->pgd = 0;
+}
+
+// Translation faults are handled by mapping the page (see handle_mm_fault) if
+// addr is part of one of the task's VMAs. So are write permission faults,
+// which are writes to copy-on-write pages if the VMA is writable. Any other
+// permission fault (e.g. writing to code) and accesses outside of the VMAs are
+// errors.
 // addr = address that caused the page fault.
 // esr = exception syndrome register
 int do_mem_abort(unsigned long addr, unsigned long esr) {
     unsigned long dfs = (esr & 0b111111);
+    unsigned long ec = (esr >> ESR_ELx_EC_SHIFT) & ESR_ELx_EC_MASK;
 
-    // Verify that this is a translation fault. Page faults can happen for a
-    // variety of reasons, including permissions, access, etc. More information
-    // in the reference manual in page 2463.
-    if ((dfs & 0b111100) != 0b100) {
-        return -1;
-    }
+    current->acct.faults++;
 
-    unsigned long page = get_free_page();
-    if (page == 0) {
-        return -1;
+    unsigned long fault_flags = 0;
+    if (ec == ESR_ELx_EC_IABT_LOW) {
+        fault_flags |= FAULT_FLAG_EXEC;
+    } else if (esr & ESR_ELx_WNR) {
+        fault_flags |= FAULT_FLAG_WRITE;
     }
-    map_page(current, addr & PAGE_MASK, page);
-    ind++;
 
-    // Seems like we only want to map 1 page at most.
-    if (ind > 2) {
+    // Page faults can happen for a variety of reasons, including permissions,
+    // access, etc. The low 2 bits are the level of the table. More
+    // information in the reference manual in page 2463.
+    unsigned long type = dfs & 0b111100;
+    if (type == 0b001100 && (fault_flags & FAULT_FLAG_WRITE)) {
+        // Permission fault on a write.
+        return handle_mm_fault(current->mm, addr, fault_flags);
+    }
+    if (type != 0b000100) {
+        // Not a translation fault.
         return -1;
     }
-    return 0;
+    return handle_mm_fault(current->mm, addr, fault_flags);
 }
 
 unsigned long memcpy(unsigned long dst, unsigned long src, unsigned long n) {
@@ -0,0 +1,222 @@
+#include "fs.h"
+#include "mm.h"
+#include "sched.h"
+#include "shm.h"
+#include "sys.h"
+
+// Returns 1 if no VMA of mm overlaps [start, end).
+static int range_is_free(struct mm_struct *mm, unsigned long start,
+                         unsigned long end) {
+    for (int i = 0; i < mm->nr_vmas; i++) {
+        if (mm->vmas[i].vm_start < end && mm->vmas[i].vm_end > start) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Finds room for len bytes in the mmap area: at addr if it's free (it's only a
+// hint), otherwise at the lowest free address. Returns 0 if there's no room.
+// Called with page_table_lock held.
+static unsigned long get_unmapped_area(struct mm_struct *mm, unsigned long addr,
+                                       unsigned long len) {
+    if (addr && !(addr & ~PAGE_MASK) && addr >= MMAP_BASE &&
+        addr <= MMAP_END - len && range_is_free(mm, addr, addr + len)) {
+        return addr;
+    }
+
+    // The VMAs are sorted, so the first gap that is big enough is the lowest.
+    addr = MMAP_BASE;
+    for (int i = 0; i < mm->nr_vmas; i++) {
+        struct vm_area_struct *vma = &mm->vmas[i];
+        if (vma->vm_end <= addr) {
+            continue;
+        }
+        if (vma->vm_start >= addr + len) {
+            break;
+        }
+        addr = vma->vm_end;
+    }
+    return addr <= MMAP_END - len ? addr : 0;
+}
+
+// Adds vma to mm, keeping the VMAs sorted. Returns -1 if mm has MAX_VMAS
+// already. Called with page_table_lock held.
+static int insert_vma(struct mm_struct *mm, struct vm_area_struct *vma) {
+    if (mm->nr_vmas == MAX_VMAS) {
+        return -1;
+    }
+    int i = mm->nr_vmas;
+    while (i > 0 && mm->vmas[i - 1].vm_start > vma->vm_start) {
+        mm->vmas[i] = mm->vmas[i - 1];
+        i--;
+    }
+    mm->vmas[i] = *vma;
+    mm->nr_vmas++;
+    return 0;
+}
+
+static void remove_vma(struct mm_struct *mm, int i) {
+    for (; i < mm->nr_vmas - 1; i++) {
+        mm->vmas[i] = mm->vmas[i + 1];
+    }
+    mm->nr_vmas--;
+}
+
+// Makes vma start at start (inside of it), moving its file offsets along.
+static void vma_trim_front(struct vm_area_struct *vma, unsigned long start) {
+    unsigned long delta = start - vma->vm_start;
+    vma->vm_start = start;
+    vma->vm_pgoff += delta >> PAGE_SHIFT;
+    if (vma->file_data) {
+        vma->file_data += delta;
+        vma->file_size = vma->file_size > delta ? vma->file_size - delta : 0;
+    }
+}
+
+// Creates a new area of len bytes in the current task's address space and
+// returns its address, or -1. Nothing is mapped until the task touches it.
+//   - MAP_PRIVATE | MAP_ANONYMOUS: zero filled memory of the process only.
+//     Forked children get a copy.
+//   - MAP_SHARED | MAP_ANONYMOUS: zero filled memory that forked children
+//     share with us. It's backed by an unnamed shared memory object.
+//   - A file (e.g. a shared memory object from shm_open) at offset: with
+//     MAP_SHARED, every process that maps the file sees the same pages. With
+//     MAP_PRIVATE, writes go to private copies.
+long do_mmap(unsigned long addr, unsigned long len, unsigned long prot,
+             unsigned long flags, struct file *file, unsigned long offset) {
+    struct mm_struct *mm = current->mm;
+    unsigned long type = flags & (MAP_SHARED | MAP_PRIVATE);
+
+    if (!mm || len == 0 || (offset & ~PAGE_MASK) ||
+        (prot & ~(PROT_READ | PROT_WRITE | PROT_EXEC)) ||
+        (type != MAP_SHARED && type != MAP_PRIVATE)) {
+        return -1;
+    }
+    len = PAGE_ALIGN(len);
+    if (len == 0 || len > MMAP_END - MMAP_BASE) {
+        return -1;
+    }
+
+    if (flags & MAP_ANONYMOUS) {
+        file = 0;
+        offset = 0;
+    } else {
+        if (!file || !file->f_op->fault || !(file->f_mode & FMODE_READ)) {
+            return -1;
+        }
+        if (type == MAP_SHARED && (prot & PROT_WRITE) &&
+            !(file->f_mode & FMODE_WRITE)) {
+            return -1;
+        }
+    }
+
+    // The page tables can't express pages that can be written or executed
+    // but not read, so these imply PROT_READ. A PROT_NONE area can't be
+    // accessed at all (see handle_mm_fault).
+    if (prot & (PROT_WRITE | PROT_EXEC)) {
+        prot |= PROT_READ;
+    }
+    struct vm_area_struct vma = {0};
+    vma.vm_flags = prot;
+    if (type == MAP_SHARED) {
+        vma.vm_flags |= VM_SHARED;
+    }
+    vma.vm_pgoff = offset >> PAGE_SHIFT;
+
+    // The area holds its own reference to the file.
+    if (file) {
+        get_file(file);
+    } else if (type == MAP_SHARED) {
+        file = shm_file_create(len);
+        if (!file) {
+            return -1;
+        }
+    }
+    vma.vm_file = file;
+
+    spin_lock(&mm->page_table_lock);
+    addr = get_unmapped_area(mm, addr, len);
+    if (addr) {
+        vma.vm_start = addr;
+        vma.vm_end = addr + len;
+        if (insert_vma(mm, &vma) < 0) {
+            addr = 0;
+        }
+    }
+    spin_unlock(&mm->page_table_lock);
+
+    if (!addr) {
+        if (file) {
+            fput(file);
+        }
+        return -1;
+    }
+    return addr;
+}
+
+// Removes the mappings in [start, start + len) of mm. Areas that are only
+// partially in the range are trimmed, or split in two if the range is in the
+// middle of one. Returns -1 if the range is bad or a split needs more than
+// MAX_VMAS areas (in which case nothing is unmapped).
+int do_munmap(struct mm_struct *mm, unsigned long start, unsigned long len) {
+    // Files to release once we've dropped the lock.
+    struct file *files[MAX_VMAS];
+    int nr_files = 0;
+
+    if (!mm || (start & ~PAGE_MASK) || len == 0) {
+        return -1;
+    }
+    unsigned long end = start + PAGE_ALIGN(len);
+    if (end <= start || end > VA_START) {
+        return -1;
+    }
+
+    spin_lock(&mm->page_table_lock);
+
+    if (mm->nr_vmas == MAX_VMAS) {
+        for (int i = 0; i < mm->nr_vmas; i++) {
+            if (mm->vmas[i].vm_start < start && mm->vmas[i].vm_end > end) {
+                spin_unlock(&mm->page_table_lock);
+                return -1;
+            }
+        }
+    }
+
+    zap_user_range(mm, start, end);
+
+    for (int i = 0; i < mm->nr_vmas;) {
+        struct vm_area_struct *vma = &mm->vmas[i];
+        if (vma->vm_end <= start || vma->vm_start >= end) {
+            i++;
+        } else if (vma->vm_start >= start && vma->vm_end <= end) {
+            if (vma->vm_file) {
+                files[nr_files++] = vma->vm_file;
+            }
+            remove_vma(mm, i);
+        } else if (vma->vm_start < start && vma->vm_end > end) {
+            struct vm_area_struct tail = *vma;
+            vma_trim_front(&tail, end);
+            vma->vm_end = start;
+            if (tail.vm_file) {
+                get_file(tail.vm_file);
+            }
+            insert_vma(mm, &tail);
+            i += 2;
+        } else {
+            if (vma->vm_start < start) {
+                vma->vm_end = start;
+            } else {
+                vma_trim_front(vma, end);
+            }
+            i++;
+        }
+    }
+
+    spin_unlock(&mm->page_table_lock);
+
+    for (int i = 0; i < nr_files; i++) {
+        fput(files[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,26 @@
+#include "percpu.h"
+#include "mm.h"
+#include "utils.h"
+
+// Copies the initial values of the per-CPU variables (CPU 0's copy, which is
+// what the compiler initialized) to the other CPUs' areas and points tpidr_el1
+// at this CPU's area. boot.S sets tpidr_el1 to 0 so per-CPU variables can be
+// used (as CPU 0's) before this runs.
+void percpu_init(void) {
+    unsigned long size = percpu_end - percpu_begin;
+    unsigned int cpu = get_cpuid();
+
+    if (cpu == 0) {
+        for (int i = 1; i < NR_CPUS; i++) {
+            memcpy((unsigned long)percpu_begin + per_cpu_offset(i),
+                   (unsigned long)percpu_begin, size);
+        }
+    }
+
+    unsigned long offset = per_cpu_offset(cpu);
+    asm volatile("msr tpidr_el1, %0" : : "r"(offset));
+
+    // EL0 can read (but not write) tpidrro_el0. It tells user space which CPU
+    // it runs on (see vdso_getcpu).
+    asm volatile("msr tpidrro_el0, %0" : : "r"((unsigned long)cpu));
+}
@@ -0,0 +1,291 @@
+#include "pipe.h"
+#include "mm.h"
+#include "slab.h"
+#include "uaccess.h"
+
+// Pipes move data through a ring of pages (pipe_buffers). Small writes are
+// copied into the last page of the ring. Whole, page aligned pages of a large
+// write aren't copied at all: the writer lends them to the pipe (see
+// loan_user_page) and they become copy-on-write for the writer. On the other
+// side, a reader that asks for a whole page into a page aligned buffer gets the
+// page itself mapped there (see remap_user_page) instead of a copy. So a page
+// aligned transfer doesn't copy the data at all, and any other one copies it
+// twice at most (in and out of the pipe), like before. pipe->lock is never
+// held while copying or mapping: the ring slots are reserved under it, filled
+// or drained without it, and published under it again.
+
+#define pipe_empty(pipe) ((pipe)->head == (pipe)->tail)
+#define pipe_full(pipe) ((pipe)->head - (pipe)->tail == PIPE_BUFFERS)
+#define pipe_buf(pipe, n) (&(pipe)->bufs[(n) & (PIPE_BUFFERS - 1)])
+// The first buffer may be empty while a writer appends to it.
+#define pipe_readable(pipe) \
+    (!pipe_empty(pipe) && pipe_buf(pipe, (pipe)->tail)->len)
+
+// Copying and mapping pages can fault pages in and allocate, so it's done
+// without pipe->lock. Instead, a read or a write takes its turn (busy is
+// &pipe->reading or &pipe->writing), so that it's never interleaved with
+// another one of the same kind. Called and returns with pipe->lock held.
+static void pipe_begin(struct pipe_inode_info *pipe, int *busy) {
+    while (*busy) {
+        spin_unlock(&pipe->lock);
+        wait_event(pipe->wait, !*busy);
+        spin_lock(&pipe->lock);
+    }
+    *busy = 1;
+}
+
+// Ends the turn and unlocks. Waiters for the turn, and the other side (which
+// may be waiting for data or space), are woken up.
+static void pipe_end(struct pipe_inode_info *pipe, int *busy) {
+    *busy = 0;
+    spin_unlock(&pipe->lock);
+    wake_up(&pipe->wait);
+}
+
+static long pipe_read(struct file *file, char *buf, unsigned long count) {
+    struct pipe_inode_info *pipe = file->private_data;
+    unsigned long dst = (unsigned long)buf;
+    long ret = 0;
+
+    if (count == 0) {
+        return 0;
+    }
+
+    spin_lock(&pipe->lock);
+    pipe_begin(pipe, &pipe->reading);
+    // Block until there's something to read. No data and no writers left is
+    // the end of the file.
+    while (!pipe_readable(pipe)) {
+        if (!pipe->writers) {
+            pipe_end(pipe, &pipe->reading);
+            return 0;
+        }
+        spin_unlock(&pipe->lock);
+        wait_event(pipe->wait, pipe_readable(pipe) || !pipe->writers);
+        spin_lock(&pipe->lock);
+    }
+
+    while (count > 0 && pipe_readable(pipe)) {
+        // The first n bytes of the buffer stay ours while we copy them: only
+        // readers consume a buffer, and a writer only adds data after them.
+        struct pipe_buffer *pb = pipe_buf(pipe, pipe->tail);
+        unsigned long n = pb->len < count ? pb->len : count;
+        unsigned long src = pb->page + VA_START + pb->offset;
+        unsigned long page = pb->page;
+        spin_unlock(&pipe->lock);
+
+        // A whole page (offset 0) into a page aligned buffer: hand over the
+        // page. If we can't map it, fall back to copying.
+        int remapped = n == PAGE_SIZE && !(dst & ~PAGE_MASK) &&
+                       remap_user_page(current->mm, dst, page) == 0;
+        int failed = !remapped &&
+                     copy_to_user((void *)dst, (const void *)src, n) != 0;
+
+        spin_lock(&pipe->lock);
+        if (failed) {
+            if (ret == 0) {
+                ret = -1;
+            }
+            break;
+        }
+
+        pb->offset += n;
+        pb->len -= n;
+        dst += n;
+        count -= n;
+        ret += n;
+        if (pb->len == 0 && !(pb->flags & PIPE_BUF_FLAG_APPENDING)) {
+            free_page(pb->page);
+            pipe->tail++;
+        }
+    }
+
+    // There's room for the writers now.
+    pipe_end(pipe, &pipe->reading);
+    return ret;
+}
+
+static long pipe_write(struct file *file, const char *buf,
+                       unsigned long count) {
+    struct pipe_inode_info *pipe = file->private_data;
+    unsigned long src = (unsigned long)buf;
+    long ret = 0;
+
+    spin_lock(&pipe->lock);
+    pipe_begin(pipe, &pipe->writing);
+    while (count > 0) {
+        // Nobody will ever read this (there are no signals, so no SIGPIPE).
+        if (!pipe->readers) {
+            if (ret == 0) {
+                ret = -1;
+            }
+            break;
+        }
+
+        unsigned long n;
+        struct pipe_buffer *last =
+            pipe_empty(pipe) ? 0 : pipe_buf(pipe, pipe->head - 1);
+        int whole_page = !(src & ~PAGE_MASK) && count >= PAGE_SIZE;
+
+        if (!whole_page && last && !(last->flags & PIPE_BUF_FLAG_LOANED) &&
+            last->offset + last->len < PAGE_SIZE) {
+            // Append to the last page. The flag keeps the reader from freeing
+            // it if it reads everything that's in it meanwhile.
+            unsigned long room = PAGE_SIZE - last->offset - last->len;
+            n = count < room ? count : room;
+            unsigned long dst =
+                last->page + VA_START + last->offset + last->len;
+            last->flags |= PIPE_BUF_FLAG_APPENDING;
+            spin_unlock(&pipe->lock);
+
+            unsigned long left = copy_from_user((void *)dst, (const void *)src,
+                                                n);
+
+            spin_lock(&pipe->lock);
+            last->flags &= ~PIPE_BUF_FLAG_APPENDING;
+            if (left) {
+                // The reader may have emptied the page (it's the first one
+                // then) and left it to us.
+                if (last->len == 0) {
+                    free_page(last->page);
+                    pipe->tail++;
+                }
+                if (ret == 0) {
+                    ret = -1;
+                }
+                break;
+            }
+            last->len += n;
+        } else if (pipe_full(pipe)) {
+            // Let the readers have what we wrote so far and wait for them to
+            // make room.
+            spin_unlock(&pipe->lock);
+            wake_up(&pipe->wait);
+            wait_event(pipe->wait, !pipe_full(pipe) || !pipe->readers);
+            spin_lock(&pipe->lock);
+            continue;
+        } else {
+            // The slot at head is ours until we move head: readers stop
+            // before it, and it can only get further from being full.
+            struct pipe_buffer *pb = pipe_buf(pipe, pipe->head);
+            spin_unlock(&pipe->lock);
+
+            unsigned long page = 0;
+            unsigned int flags = 0;
+            if (whole_page) {
+                page = loan_user_page(current->mm, src);
+            }
+            if (page) {
+                n = PAGE_SIZE;
+                flags = PIPE_BUF_FLAG_LOANED;
+            } else {
+                n = count < PAGE_SIZE ? count : PAGE_SIZE;
+                page = get_free_page();
+                if (page && copy_from_user((void *)(page + VA_START),
+                                           (const void *)src, n)) {
+                    free_page(page);
+                    page = 0;
+                }
+            }
+
+            spin_lock(&pipe->lock);
+            if (!page) {
+                if (ret == 0) {
+                    ret = -1;
+                }
+                break;
+            }
+            pb->page = page;
+            pb->offset = 0;
+            pb->len = n;
+            pb->flags = flags;
+            pipe->head++;
+        }
+
+        src += n;
+        count -= n;
+        ret += n;
+    }
+
+    pipe_end(pipe, &pipe->writing);
+    return ret;
+}
+
+// Closes one end of the pipe. The other end is woken up, since it may be
+// waiting for something that will never happen now (see the end of file and
+// the missing readers above). The pipe goes away with its last file.
+static void pipe_release(struct file *file) {
+    struct pipe_inode_info *pipe = file->private_data;
+
+    spin_lock(&pipe->lock);
+    if (file->f_mode & FMODE_READ) {
+        pipe->readers--;
+    }
+    if (file->f_mode & FMODE_WRITE) {
+        pipe->writers--;
+    }
+    int free = !pipe->readers && !pipe->writers;
+    spin_unlock(&pipe->lock);
+
+    if (!free) {
+        wake_up(&pipe->wait);
+        return;
+    }
+
+    for (unsigned int i = pipe->tail; i != pipe->head; i++) {
+        free_page(pipe_buf(pipe, i)->page);
+    }
+    kfree(pipe);
+}
+
+static const struct file_operations pipe_fops = {
+    .read = pipe_read,
+    .write = pipe_write,
+    .release = pipe_release,
+};
+
+// Creates a pipe. Its read end goes in fds[0] and its write end in fds[1] (a
+// user pointer). Returns 0 or -1.
+int do_pipe(int *fds) {
+    struct pipe_inode_info *pipe = kzalloc(sizeof(*pipe));
+    if (!pipe) {
+        return -1;
+    }
+    spin_lock_init(&pipe->lock, "pipe");
+    init_waitqueue_head(&pipe->wait);
+
+    struct file *rfile = alloc_file(&pipe_fops, FMODE_READ, pipe);
+    if (!rfile) {
+        kfree(pipe);
+        return -1;
+    }
+    pipe->readers = 1;
+
+    // Until the write end exists, dropping rfile frees the pipe.
+    struct file *wfile = alloc_file(&pipe_fops, FMODE_WRITE, pipe);
+    if (!wfile) {
+        fput(rfile);
+        return -1;
+    }
+    pipe->writers = 1;
+
+    int kfds[2];
+    kfds[0] = fd_install(rfile);
+    kfds[1] = kfds[0] < 0 ? -1 : fd_install(wfile);
+    if (kfds[1] < 0) {
+        if (kfds[0] >= 0) {
+            close_fd(kfds[0]);
+        } else {
+            fput(rfile);
+        }
+        fput(wfile);
+        return -1;
+    }
+
+    if (copy_to_user(fds, kfds, sizeof(kfds))) {
+        close_fd(kfds[0]);
+        close_fd(kfds[1]);
+        return -1;
+    }
+    return 0;
+}
@@ -21,60 +21,101 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
 
 #include "printf.h"
 
-typedef void (*putcf)(void*, char);
-static putcf stdout_putf;
-static void* stdout_putp;
-
-#ifdef PRINTF_LONG_SUPPORT
-
-static void uli2a(unsigned long int num, unsigned int base, int uc, char* bf) {
-    int n = 0;
-    unsigned int d = 1;
-    while (num / d >= base) d *= base;
-    while (d != 0) {
-        int dgt = num / d;
-        num %= d;
-        d /= base;
-        if (n || dgt > 0 || d == 0) {
-            *bf++ = dgt + (dgt < 10 ? '0' : (uc ? 'A' : 'a') - 10);
-            ++n;
-        }
+// Size of the buffer that tfp_printf formats into before writing to the
+// console. It lives on the (small) kernel stack.
+#define PRINTF_BUF_SIZE 64
+
+// Enough for the digits of a 64-bit number in base 8 or more, and the sign.
+#define NUM_BUF_SIZE 24
+
+static writef stdout_write;
+static void* stdout_writep;
+
+// Output state of tfp_vformat. With a write function, buf is flushed to it
+// whenever it fills up. Without one (snprintf), buf is the destination and
+// whatever doesn't fit (leaving room for the NUL) is dropped. total counts
+// every character produced, whether it was stored or not.
+struct out {
+    writef write;
+    void* writep;
+    char* buf;
+    unsigned long size;
+    unsigned long pos;
+    unsigned long total;
+};
+
+static void out_flush(struct out* o) {
+    if (o->write && o->pos) {
+        o->write(o->writep, o->buf, o->pos);
+        o->pos = 0;
     }
-    *bf = 0;
 }
 
-static void li2a(long num, char* bf) {
-    if (num < 0) {
-        num = -num;
-        *bf++ = '-';
+static void out_put(struct out* o, const char* s, unsigned long len) {
+    o->total += len;
+
+    if (!o->write) {
+        unsigned long room = o->size ? o->size - 1 - o->pos : 0;
+        if (len > room) len = room;
+        for (unsigned long i = 0; i < len; i++) o->buf[o->pos++] = s[i];
+        return;
+    }
+
+    // Long runs bypass the buffer.
+    if (len >= o->size) {
+        out_flush(o);
+        o->write(o->writep, s, len);
+        return;
     }
-    uli2a(num, 10, 0, bf);
-}
 
-#endif
-
-static void ui2a(unsigned int num, unsigned int base, int uc, char* bf) {
-    int n = 0;
-    unsigned int d = 1;
-    while (num / d >= base) d *= base;
-    while (d != 0) {
-        int dgt = num / d;
-        num %= d;
-        d /= base;
-        if (n || dgt > 0 || d == 0) {
-            *bf++ = dgt + (dgt < 10 ? '0' : (uc ? 'A' : 'a') - 10);
-            ++n;
+    while (len) {
+        unsigned long n = o->size - o->pos;
+        if (!n) {
+            out_flush(o);
+            continue;
         }
+        if (n > len) n = len;
+        for (unsigned long i = 0; i < n; i++) o->buf[o->pos++] = s[i];
+        s += n;
+        len -= n;
     }
-    *bf = 0;
 }
 
-static void i2a(int num, char* bf) {
-    if (num < 0) {
-        num = -num;
-        *bf++ = '-';
+static void out_fill(struct out* o, char c, int n) {
+    char pad[16];
+    for (int i = 0; i < (int)sizeof(pad); i++) pad[i] = c;
+    while (n > 0) {
+        int chunk = n > (int)sizeof(pad) ? (int)sizeof(pad) : n;
+        out_put(o, pad, chunk);
+        n -= chunk;
     }
-    ui2a(num, 10, 0, bf);
+}
+
+// Writes the digits of num right-aligned so that they end right before end.
+// Returns the number of digits (at least one).
+static int ultoa(unsigned long num, unsigned int base, int uc, char* end) {
+    const char* digits = uc ? "0123456789ABCDEF" : "0123456789abcdef";
+    char* p = end;
+    do {
+        *--p = digits[num % base];
+        num /= base;
+    } while (num);
+    return end - p;
+}
+
+// Pads to width w in front of the number. With zero padding the sign goes
+// before the zeros ("-0042"), otherwise after the spaces ("  -42").
+static void out_number(struct out* o, unsigned long num, unsigned int base,
+                       int uc, int neg, int w, char lz) {
+    char bf[NUM_BUF_SIZE];
+    char* end = bf + sizeof(bf);
+    int n = ultoa(num, base, uc, end);
+    int pad = w - n - neg;
+
+    if (!lz && pad > 0) out_fill(o, ' ', pad);
+    if (neg) out_put(o, "-", 1);
+    if (lz && pad > 0) out_fill(o, '0', pad);
+    out_put(o, end - n, n);
 }
 
 static int a2d(char ch) {
@@ -88,8 +129,8 @@ static int a2d(char ch) {
         return -1;
 }
 
-static char a2i(char ch, char** src, int base, int* nump) {
-    char* p = *src;
+static char a2i(char ch, const char** src, int base, int* nump) {
+    const char* p = *src;
     int num = 0;
     int digit;
     while ((digit = a2d(ch)) >= 0) {
@@ -102,111 +143,140 @@ static char a2i(char ch, char** src, int base, int* nump) {
     return ch;
 }
 
-static void putchw(void* putp, putcf putf, int n, char z, char* bf) {
-    char fc = z ? '0' : ' ';
+// Formats fmt into buf (size bytes) and passes the result to write in runs.
+// If write is NULL, buf is the destination: the output is truncated to size -
+// 1 characters and NUL-terminated. Returns the number of characters that the
+// full output has (like snprintf).
+int tfp_vformat(void* writep, writef write, char* buf, unsigned long size,
+                const char* fmt, va_list va) {
+    struct out o = {write, writep, buf, size, 0, 0};
     char ch;
-    char* p = bf;
-    while (*p++ && n > 0) n--;
-    while (n-- > 0) putf(putp, fc);
-    while ((ch = *bf++)) putf(putp, ch);
-}
-
-void tfp_format(void* putp, putcf putf, char* fmt, va_list va) {
-    char bf[12];
 
-    char ch;
+    while (1) {
+        // Copy the literal text up to the next conversion in one go.
+        const char* run = fmt;
+        while (*fmt && *fmt != '%') fmt++;
+        if (fmt != run) out_put(&o, run, fmt - run);
+        if (!*fmt) break;
+        fmt++;
 
-    while ((ch = *(fmt++))) {
-        if (ch != '%')
-            putf(putp, ch);
-        else {
-            char lz = 0;
-#ifdef PRINTF_LONG_SUPPORT
-            char lng = 0;
-#endif
-            int w = 0;
+        char lz = 0;
+        char lng = 0;
+        int w = 0;
+        ch = *(fmt++);
+        if (ch == '0') {
             ch = *(fmt++);
-            if (ch == '0') {
-                ch = *(fmt++);
-                lz = 1;
+            lz = 1;
+        }
+        if (ch >= '0' && ch <= '9') {
+            ch = a2i(ch, &fmt, 10, &w);
+        }
+        while (ch == 'l') {
+            ch = *(fmt++);
+            lng = 1;
+        }
+        switch (ch) {
+            case 0:
+                goto abort;
+            case 'u': {
+                unsigned long num = lng ? va_arg(va, unsigned long)
+                                        : va_arg(va, unsigned int);
+                out_number(&o, num, 10, 0, 0, w, lz);
+                break;
             }
-            if (ch >= '0' && ch <= '9') {
-                ch = a2i(ch, &fmt, 10, &w);
+            case 'd': {
+                long num = lng ? va_arg(va, long) : va_arg(va, int);
+                int neg = num < 0;
+                out_number(&o, neg ? -(unsigned long)num : num, 10, 0, neg, w,
+                           lz);
+                break;
             }
-#ifdef PRINTF_LONG_SUPPORT
-            if (ch == 'l') {
-                ch = *(fmt++);
-                lng = 1;
+            case 'x':
+            case 'X': {
+                unsigned long num = lng ? va_arg(va, unsigned long)
+                                        : va_arg(va, unsigned int);
+                out_number(&o, num, 16, ch == 'X', 0, w, lz);
+                break;
             }
-#endif
-            switch (ch) {
-                case 0:
-                    goto abort;
-                case 'u': {
-#ifdef PRINTF_LONG_SUPPORT
-                    if (lng)
-                        uli2a(va_arg(va, unsigned long int), 10, 0, bf);
-                    else
-#endif
-                        ui2a(va_arg(va, unsigned int), 10, 0, bf);
-                    putchw(putp, putf, w, lz, bf);
-                    break;
-                }
-                case 'd': {
-#ifdef PRINTF_LONG_SUPPORT
-                    if (lng)
-                        li2a(va_arg(va, unsigned long int), bf);
-                    else
-#endif
-                        i2a(va_arg(va, int), bf);
-                    putchw(putp, putf, w, lz, bf);
-                    break;
-                }
-                case 'x':
-                case 'X':
-#ifdef PRINTF_LONG_SUPPORT
-                    if (lng)
-                        uli2a(va_arg(va, unsigned long int), 16, (ch == 'X'),
-                              bf);
-                    else
-#endif
-                        ui2a(va_arg(va, unsigned int), 16, (ch == 'X'), bf);
-                    putchw(putp, putf, w, lz, bf);
-                    break;
-                case 'c':
-                    putf(putp, (char)(va_arg(va, int)));
-                    break;
-                case 's':
-                    putchw(putp, putf, w, 0, va_arg(va, char*));
-                    break;
-                case '%':
-                    putf(putp, ch);
-                default:
-                    break;
+            case 'p':
+                out_put(&o, "0x", 2);
+                out_number(&o, (unsigned long)va_arg(va, void*), 16, 0, 0, 16,
+                           1);
+                break;
+            case 'c': {
+                char c = (char)(va_arg(va, int));
+                out_put(&o, &c, 1);
+                break;
             }
+            case 's': {
+                const char* str = va_arg(va, char*);
+                int n = 0;
+                while (str[n]) n++;
+                if (w > n) out_fill(&o, ' ', w - n);
+                out_put(&o, str, n);
+                break;
+            }
+            case '%':
+                out_put(&o, "%", 1);
+                break;
+            default:
+                break;
         }
     }
-abort:;
+abort:
+    if (write) {
+        out_flush(&o);
+    } else if (size) {
+        buf[o.pos] = 0;
+    }
+    return o.total;
 }
 
-void init_printf(void* putp, void (*putf)(void*, char)) {
-    stdout_putf = putf;
-    stdout_putp = putp;
+void init_printf(void* writep, writef write) {
+    stdout_write = write;
+    stdout_writep = writep;
 }
 
 void tfp_printf(char* fmt, ...) {
+    char buf[PRINTF_BUF_SIZE];
     va_list va;
     va_start(va, fmt);
-    tfp_format(stdout_putp, stdout_putf, fmt, va);
+    tfp_vformat(stdout_writep, stdout_write, buf, sizeof(buf), fmt, va);
     va_end(va);
 }
 
-static void putcp(void* p, char c) { *(*((char**)p))++ = c; }
+int tfp_vsnprintf(char* s, unsigned long size, const char* fmt, va_list va) {
+    return tfp_vformat(0, 0, s, size, fmt, va);
+}
+
+int tfp_snprintf(char* s, unsigned long size, const char* fmt, ...) {
+    va_list va;
+    va_start(va, fmt);
+    int ret = tfp_vsnprintf(s, size, fmt, va);
+    va_end(va);
+    return ret;
+}
 
 void tfp_sprintf(char* s, char* fmt, ...) {
     va_list va;
     va_start(va, fmt);
-    tfp_format(&s, putcp, fmt, va);
-    putcp(&s, 0);
+    tfp_vsnprintf(s, ~0UL, fmt, va);
     va_end(va);
-}
\ No newline at end of file
+}
+
+struct putf_adapter {
+    void (*putf)(void*, char);
+    void* putp;
+};
+
+static void putf_write(void* p, const char* s, unsigned long len) {
+    struct putf_adapter* a = p;
+    for (unsigned long i = 0; i < len; i++) a->putf(a->putp, s[i]);
+}
+
+// Old interface: calls putf once per character.
+void tfp_format(void* putp, void (*putf)(void*, char), char* fmt, va_list va) {
+    char buf[PRINTF_BUF_SIZE];
+    struct putf_adapter a = {putf, putp};
+    tfp_vformat(&a, putf_write, buf, sizeof(buf), fmt, va);
+}
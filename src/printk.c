@@ -0,0 +1,249 @@
+#include "printk.h"
+#include "irq.h"
+#include "mm.h"
+#include "percpu.h"
+#include "printf.h"
+#include "spinlock.h"
+#include "uart.h"
+#include "utils.h"
+
+// printk doesn't write to the UART. It formats the message and appends it to
+// a ring buffer of the CPU that calls it, which takes nanoseconds instead of
+// the milliseconds that the polled UART needs per line. log_flush drains the
+// rings to the console later, from a context where waiting is fine (the idle
+// loop).
+//
+// Each ring has a single producer (its CPU, with IRQs disabled while writing)
+// and a single consumer (whoever holds console_lock), so the producer side
+// doesn't need any lock: it only publishes head with a store-release after
+// writing the record, and the consumer publishes tail the same way after
+// printing it. If a ring is full the new message is dropped and counted.
+//
+// The rings live at LOG_AREA_START (see mm.h) and memory is mapped
+// non-cacheable, so the records are in RAM as soon as printk returns. log_init
+// prints whatever was left unflushed by the previous boot.
+
+#define LOG_MAGIC 0x4c4f47504f534931UL
+
+// Records are aligned to this, so there's always room for a header before the
+// end of the ring.
+#define LOG_ALIGN 16
+
+// Level of the records that fill the end of the ring when a record doesn't fit.
+#define LOG_PAD 0xff
+
+struct log_record {
+    unsigned long ts;  // cntvct_el0 when it was logged
+    unsigned short size;  // header + text, rounded up to LOG_ALIGN
+    unsigned short text_len;
+    unsigned char level;
+    unsigned char cpu;
+    unsigned short pad;
+};
+
+// head and tail are positions that only grow. The offset in the ring is
+// position % LOG_BUF_SIZE.
+struct log_buf {
+    unsigned long head;  // Written by the producer.
+    unsigned long tail;  // Written by the consumer.
+    unsigned long dropped;  // Written by the producer.
+    unsigned long reported;  // Written by the consumer.
+} __attribute__((aligned(64)));
+
+struct log_area {
+    unsigned long magic;
+    struct log_buf bufs[NR_CPUS] __attribute__((aligned(64)));
+};
+
+#define log_area ((struct log_area *)(VA_START + LOG_AREA_START))
+#define log_data(cpu) \
+    ((char *)(VA_START + LOG_AREA_START + PAGE_SIZE + (cpu) * LOG_BUF_SIZE))
+
+int console_loglevel = 7;
+
+static unsigned long log_freq;
+
+// Serializes the consumers.
+static DEFINE_SPINLOCK(console_lock);
+
+static inline unsigned long read_cntvct(void) {
+    unsigned long val;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(val));
+    return val;
+}
+
+static void console_write(struct log_record *rec) {
+    unsigned long sec = 0, usec = 0;
+    if (log_freq) {
+        sec = rec->ts / log_freq;
+        usec = (rec->ts % log_freq) * 1000000 / log_freq;
+    }
+    printf("[%d.%06d] ", (unsigned int)sec, (unsigned int)usec);
+
+    uart_write(0, (char *)(rec + 1), rec->text_len);
+}
+
+// Returns the oldest unprinted record of buf, or 0 if there's none. A record
+// that doesn't look right (after a reset, for example) discards the rest of
+// the ring.
+static struct log_record *log_peek(int cpu) {
+    struct log_buf *buf = &log_area->bufs[cpu];
+    unsigned long head = __atomic_load_n(&buf->head, __ATOMIC_ACQUIRE);
+    unsigned long tail = buf->tail;
+
+    while (tail != head) {
+        unsigned long off = tail & (LOG_BUF_SIZE - 1);
+        struct log_record *rec = (struct log_record *)(log_data(cpu) + off);
+        if (head - tail > LOG_BUF_SIZE || rec->size < sizeof(*rec) ||
+            rec->size % LOG_ALIGN || off + rec->size > LOG_BUF_SIZE) {
+            __atomic_store_n(&buf->tail, head, __ATOMIC_RELEASE);
+            return 0;
+        }
+        if (rec->level != LOG_PAD) {
+            return rec;
+        }
+        tail += rec->size;
+        __atomic_store_n(&buf->tail, tail, __ATOMIC_RELEASE);
+    }
+    return 0;
+}
+
+// Prints the pending records of every CPU, oldest first (the rings are merged
+// by timestamp). Must be called with console_lock held, or when nothing else
+// can run.
+static void __log_flush(void) {
+    for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+        struct log_buf *buf = &log_area->bufs[cpu];
+        unsigned long dropped = buf->dropped;
+        if (dropped != buf->reported) {
+            printf("<%d messages dropped on CPU %d>\r\n",
+                   (unsigned int)(dropped - buf->reported), cpu);
+            buf->reported = dropped;
+        }
+    }
+
+    while (1) {
+        struct log_record *oldest = 0;
+        int oldest_cpu = 0;
+        for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+            struct log_record *rec = log_peek(cpu);
+            if (rec && (!oldest || rec->ts < oldest->ts)) {
+                oldest = rec;
+                oldest_cpu = cpu;
+            }
+        }
+        if (!oldest) {
+            return;
+        }
+
+        if (oldest->level < console_loglevel) {
+            console_write(oldest);
+        }
+
+        // Only now can the producer reuse the space.
+        struct log_buf *buf = &log_area->bufs[oldest_cpu];
+        __atomic_store_n(&buf->tail, buf->tail + oldest->size,
+                         __ATOMIC_RELEASE);
+    }
+}
+
+// Prints the messages that the previous boot didn't get to flush and resets
+// the rings. Must run before the first printk and after init_printf.
+void log_init(void) {
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(log_freq));
+
+    if (log_area->magic == LOG_MAGIC) {
+        printf("---- unflushed kernel log from the previous boot ----\r\n");
+        __log_flush();
+        printf("---- end of previous log ----\r\n");
+    }
+
+    for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+        struct log_buf *buf = &log_area->bufs[cpu];
+        buf->head = 0;
+        buf->tail = 0;
+        buf->dropped = 0;
+        buf->reported = 0;
+    }
+    log_area->magic = LOG_MAGIC;
+}
+
+static void log_store(int level, const char *text, int len) {
+    int cpu = get_cpuid();
+    struct log_buf *buf = &log_area->bufs[cpu];
+    char *data = log_data(cpu);
+
+    unsigned long head = buf->head;
+    unsigned long tail = __atomic_load_n(&buf->tail, __ATOMIC_ACQUIRE);
+    unsigned long size =
+        (sizeof(struct log_record) + len + LOG_ALIGN - 1) & ~(LOG_ALIGN - 1);
+    unsigned long off = head & (LOG_BUF_SIZE - 1);
+
+    // Records don't wrap around. If this one doesn't fit before the end of
+    // the ring, the rest of the ring is skipped with a padding record.
+    unsigned long pad = off + size > LOG_BUF_SIZE ? LOG_BUF_SIZE - off : 0;
+    if (head + pad + size - tail > LOG_BUF_SIZE) {
+        buf->dropped++;
+        return;
+    }
+
+    if (pad) {
+        struct log_record *rec = (struct log_record *)(data + off);
+        rec->size = pad;
+        rec->level = LOG_PAD;
+        head += pad;
+        off = 0;
+    }
+
+    struct log_record *rec = (struct log_record *)(data + off);
+    rec->ts = read_cntvct();
+    rec->size = size;
+    rec->text_len = len;
+    rec->level = level;
+    rec->cpu = cpu;
+    memcpy((unsigned long)(rec + 1), (unsigned long)text, len);
+
+    __atomic_store_n(&buf->head, head + size, __ATOMIC_RELEASE);
+}
+
+int vprintk(const char *fmt, va_list va) {
+    char text[LOG_LINE_MAX];
+    int level = LOGLEVEL_DEFAULT;
+
+    if (fmt[0] == '<' && fmt[1] >= '0' && fmt[1] <= '7' && fmt[2] == '>') {
+        level = fmt[1] - '0';
+        fmt += 3;
+    }
+
+    // Format on the stack with IRQs enabled. Only copying into the ring needs
+    // them disabled.
+    int len = vsnprintf(text, sizeof(text), fmt, va);
+    if (len > LOG_LINE_MAX - 1) {
+        len = LOG_LINE_MAX - 1;
+    }
+
+    unsigned long flags = local_irq_save();
+    log_store(level, text, len);
+    local_irq_restore(flags);
+    return len;
+}
+
+int printk(const char *fmt, ...) {
+    va_list va;
+    va_start(va, fmt);
+    int ret = vprintk(fmt, va);
+    va_end(va);
+    return ret;
+}
+
+// Drains the rings to the console. Slow (it waits on the UART), so call it
+// from process context.
+void log_flush(void) {
+    spin_lock(&console_lock);
+    __log_flush();
+    spin_unlock(&console_lock);
+}
+
+// For the crash path: prints the rings without taking console_lock since the
+// CPU that holds it may be the one that crashed.
+void log_panic_flush(void) { __log_flush(); }
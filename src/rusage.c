@@ -0,0 +1,161 @@
+#include "rusage.h"
+#include "arm/sysregs.h"
+#include "printf.h"
+#include "sched.h"
+#include "timer.h"
+
+// Per-task CPU time is measured with the generic counter at every boundary
+// where the task changes what it's doing: entering the kernel from EL0 (a
+// syscall, fault or IRQ), returning to EL0 and being switched in or out. The
+// time between two boundaries is charged as user or system time depending on
+// which side of them the task was. Time spent in IRQ handlers is charged to
+// whoever was interrupted, as system time.
+
+void account_user_exit(unsigned long esr) {
+    struct task_acct *acct = &current->acct;
+    unsigned long now = timer_read_counter();
+    acct->utime += now - acct->timestamp;
+    acct->timestamp = now;
+
+    if (((esr >> ESR_ELx_EC_SHIFT) & ESR_ELx_EC_MASK) == ESR_ELx_EC_SVC64) {
+        acct->syscalls++;
+    }
+}
+
+void account_user_enter(void) {
+    struct task_acct *acct = &current->acct;
+    unsigned long now = timer_read_counter();
+    acct->stime += now - acct->timestamp;
+    acct->timestamp = now;
+}
+
+// Called by switch_to. Tasks are always switched in the kernel, so the time
+// prev ran since its last boundary is system time.
+void account_task_switch(struct task_struct *prev, struct task_struct *next) {
+    unsigned long now = timer_read_counter();
+    prev->acct.stime += now - prev->acct.timestamp;
+    if (prev->state == TASK_RUNNING) {
+        prev->acct.nivcsw++;
+    } else {
+        prev->acct.nvcsw++;
+    }
+    next->acct.timestamp = now;
+}
+
+// Adds the usage of p to ru, with the times still in counter cycles. The
+// current task is in a syscall, so the time since its last boundary is system
+// time.
+static void add_task_usage(struct rusage *ru, struct task_struct *p,
+                           unsigned long now) {
+    ru->utime += p->acct.utime;
+    ru->stime += p->acct.stime;
+    if (p == current) {
+        ru->stime += now - p->acct.timestamp;
+    }
+    ru->nvcsw += p->acct.nvcsw;
+    ru->nivcsw += p->acct.nivcsw;
+    ru->faults += p->acct.faults;
+    ru->syscalls += p->acct.syscalls;
+}
+
+// Fills ru with the usage of the current task (RUSAGE_THREAD) or of every task
+// of its process, including the threads that already exited (RUSAGE_SELF).
+// Returns 0 or -1.
+int do_getrusage(int who, struct rusage *ru) {
+    if (who != RUSAGE_SELF && who != RUSAGE_THREAD) {
+        return -1;
+    }
+
+    *ru = (struct rusage){0};
+    unsigned long now = timer_read_counter();
+    if (who == RUSAGE_THREAD) {
+        add_task_usage(ru, current, now);
+    } else {
+        unsigned long flags = spin_lock_irqsave(&tasklist_lock);
+        for (int i = 0; i < NR_TASKS; i++) {
+            struct task_struct *p = task[i];
+            if (p && p->tgid == current->tgid) {
+                add_task_usage(ru, p, now);
+            }
+        }
+        spin_unlock_irqrestore(&tasklist_lock, flags);
+    }
+
+    ru->utime = cycles_to_ns(ru->utime);
+    ru->stime = cycles_to_ns(ru->stime);
+    return 0;
+}
+
+static const char *task_state_name(struct task_struct *p) {
+    switch (p->state) {
+        case TASK_RUNNING:
+            return "R";
+        case TASK_SLEEPING:
+            return "S";
+        case TASK_ZOMBIE:
+            return "Z";
+    }
+    return "?";
+}
+
+static const char *task_policy_name(struct task_struct *p) {
+    switch (p->policy) {
+        case SCHED_FIFO:
+            return "fifo";
+        case SCHED_RR:
+            return "rr";
+    }
+    return "normal";
+}
+
+// What task_usage_dump prints about a task.
+struct task_usage {
+    int pid;
+    int tgid;
+    const char *state;
+    const char *policy;
+    int prio;
+    struct task_acct acct;
+};
+
+// Tasks copied per round of task_usage_dump (on the stack).
+#define TASK_USAGE_BATCH 8
+
+// ps-like list of every task and what it used so far. Times are in
+// milliseconds. The numbers are copied under tasklist_lock a few tasks at a
+// time and printed after dropping it, since printing can take a while (and
+// wait for the UART) and the lock keeps IRQs disabled.
+void task_usage_dump(void) {
+    printf("pid tgid state policy prio: user sys / vcsw ivcsw / faults "
+           "syscalls\r\n");
+
+    struct task_usage batch[TASK_USAGE_BATCH];
+    int i = 0;
+    while (i < NR_TASKS) {
+        int n = 0;
+        unsigned long flags = spin_lock_irqsave(&tasklist_lock);
+        for (; i < NR_TASKS && n < TASK_USAGE_BATCH; i++) {
+            struct task_struct *p = task[i];
+            if (!p) {
+                continue;
+            }
+            struct task_usage *u = &batch[n++];
+            u->pid = p->pid;
+            u->tgid = p->tgid;
+            u->state = task_state_name(p);
+            u->policy = task_policy_name(p);
+            u->prio = rt_task(p) ? p->rt_priority : (int)p->priority;
+            u->acct = p->acct;
+        }
+        spin_unlock_irqrestore(&tasklist_lock, flags);
+
+        for (int j = 0; j < n; j++) {
+            struct task_usage *u = &batch[j];
+            printf("%d %d %s %s %d: %lu %lu / %lu %lu / %lu %lu\r\n", u->pid,
+                   u->tgid, u->state, u->policy, u->prio,
+                   cycles_to_ns(u->acct.utime) / 1000000,
+                   cycles_to_ns(u->acct.stime) / 1000000, u->acct.nvcsw,
+                   u->acct.nivcsw, u->acct.faults, u->acct.syscalls);
+        }
+    }
+}
@@ -1,6 +1,16 @@
 #include "sched.h"
+#include "fork.h"
+#include "fpsimd.h"
+#include "fs.h"
 #include "irq.h"
 #include "mm.h"
+#include "percpu.h"
+#include "printk.h"
+#include "rusage.h"
+#include "sched_fair.h"
+#include "spinlock.h"
+#include "sys.h"
+#include "timer.h"
 #include "utils.h"
 
 static struct task_struct init_task = INIT_TASK;
@@ -16,9 +26,56 @@ struct task_struct *task[NR_TASKS] = {
 // Number of currently running tasks in the system.
 int nr_tasks = 1;
 
+// Protects task[], nr_tasks and the state and scheduling fields of the tasks
+// in it (including the fair run queue). It is taken from the timer interrupt
+// (through _schedule), so it must always be taken with spin_lock_irqsave.
+DEFINE_SPINLOCK(tasklist_lock);
+
+// The task that _schedule picked last. It's the same as current, except while
+// _schedule is switching to it. Protected by tasklist_lock.
+static struct task_struct *rq_curr = &init_task;
+
+unsigned long idle_jiffies = 0;
+
+// The task that runs on each CPU when nothing else can (see cpu_idle).
+static DEFINE_PER_CPU(struct task_struct *, idle_task) = &init_task;
+
+// How often each CPU went idle and for how long. entries and exits count the
+// switches to and from the idle task, sleeps the times it waited in wfi.
+struct idle_stats {
+    unsigned long entries;
+    unsigned long exits;
+    unsigned long sleeps;
+    unsigned long cycles;
+};
+
+static DEFINE_PER_CPU(struct idle_stats, idle_stats);
+
+// Set when the current task should give up the CPU as soon as possible: by
+// timer_tick when its time slice is over, or when a task with a higher
+// priority wakes up.
+static DEFINE_PER_CPU(int, need_resched);
+
+// Last rt_seq handed out (see task_struct). Protected by tasklist_lock.
+static unsigned long rt_seq;
+
+void _schedule(void);
+
 void preempt_disable(void) { current->preempt_count++; }
 
-void preempt_enable(void) { current->preempt_count--; }
+// If someone asked for a reschedule while we couldn't be preempted, this is
+// the first chance to do it (the next one could be a whole tick away). Only
+// if IRQs are enabled, though: the code that disabled them expects to keep
+// running until it enables them again.
+void preempt_enable(void) {
+    if (--current->preempt_count > 0 || !this_cpu(need_resched)) {
+        return;
+    }
+    if (current->state != TASK_RUNNING || irqs_disabled()) {
+        return;
+    }
+    _schedule();
+}
 
 // This function is executed when a task is executing for the first time. We
 // make sure to call preempt_enable so that it can be preempted going forward.
@@ -30,76 +87,234 @@ void switch_to(struct task_struct *next) {
     }
 
     struct task_struct *prev = current;
+    account_task_switch(prev, next);
     current = next;
-    set_pgd(next->mm.pgd);
+    // Threads of the same process keep the page tables (and the TLB) loaded.
+    if (next->mm != prev->mm) {
+        set_pgd(next->mm ? next->mm->pgd : 0);
+    }
+    fpsimd_thread_switch(next);
     cpu_switch_to(prev, current);
 }
 
+// Priority of p for preemption decisions: every real-time task beats every
+// normal one, and everyone beats the idle task, which only runs when nobody
+// else can.
+static int task_prio(struct task_struct *p) {
+    if (is_idle_task(p)) {
+        return -1;
+    }
+    return rt_task(p) ? p->rt_priority : 0;
+}
+
+// Tasks that are scheduled by the fair class (see sched_fair.c).
+static int fair_task(struct task_struct *p) {
+    return !rt_task(p) && !is_idle_task(p);
+}
+
+// Puts p at the back of the queue of its real-time priority. Must be called
+// with tasklist_lock held.
+static void requeue_rt_task(struct task_struct *p) { p->rt_seq = ++rt_seq; }
+
+// Returns the real-time task to run next (the runnable one with the highest
+// priority, the first queued among equals), or 0. Must be called with
+// tasklist_lock held.
+static struct task_struct *pick_next_rt_task(void) {
+    struct task_struct *next = 0;
+    for (int i = 0; i < NR_TASKS; i++) {
+        struct task_struct *p = task[i];
+        if (!p || p->state != TASK_RUNNING || !rt_task(p)) {
+            continue;
+        }
+        if (!next || p->rt_priority > next->rt_priority ||
+            (p->rt_priority == next->rt_priority && p->rt_seq < next->rt_seq)) {
+            next = p;
+        }
+    }
+    return next;
+}
+
+// Picks the next task to run: the real-time task with the highest priority,
+// otherwise the fair task with the smallest vruntime, otherwise the idle task.
 void _schedule(void) {
     preempt_disable();
 
-    int next, c;
-    struct task_struct *p;
+    unsigned long flags = spin_lock_irqsave(&tasklist_lock);
+    struct task_struct *prev = rq_curr, *next;
+    unsigned long now = timer_read_counter();
 
-    while (1) {
-        c = -1;
-
-        // Find runnable task that has the highest counter.
-        for (int i = 0; i < NR_TASKS; i++) {
-            p = task[i];
-            if (p && p->state == TASK_RUNNING && p->counter > c) {
-                c = p->counter;
-                next = i;
-            }
-        }
+    // Whatever asked for a reschedule gets it now.
+    this_cpu(need_resched) = 0;
 
-        // If we found a task, we schedule that one.
-        if (c > 0) {
-            break;
+    // prev goes back to the run queue if it's still runnable. If it's going to
+    // sleep, wake_up_process queues it again.
+    if (fair_task(prev)) {
+        fair_update_curr(prev, now);
+        if (prev->state == TASK_RUNNING) {
+            fair_enqueue_task(prev);
         }
+    }
 
-        // If we end up here, it means that either, there are no runnable tasks,
-        // or all tasks have counter <= 0. Here we go through all the tasks and
-        // update their counters. If none of the tasks are runnable, the outer
-        // while loop will keep executing until one of them becomes runnable
-        // (once an interrupt unblocks a task).
-        for (int i = 0; i < NR_TASKS; i++) {
-            p = task[i];
-            if (p) {
-                p->counter = (p->counter >> 1) + p->priority;
-            }
+    next = pick_next_rt_task();
+    if (!next) {
+        next = fair_pick_next_task();
+    }
+    if (!next) {
+        next = this_cpu(idle_task);
+    }
+    if (next != prev) {
+        if (is_idle_task(next)) {
+            this_cpu(idle_stats).entries++;
+        } else if (is_idle_task(prev)) {
+            this_cpu(idle_stats).exits++;
         }
     }
+    next->exec_start = now;
+    rq_curr = next;
+    spin_unlock_irqrestore(&tasklist_lock, flags);
 
-    switch_to(task[next]);
+    switch_to(next);
 
     preempt_enable();
 }
 
 void timer_tick(void) {
-    --current->counter;
-    if (current->counter > 0 || current->preempt_count > 0) {
+    if (is_idle_task(current)) {
+        idle_jiffies++;
         return;
     }
 
-    current->counter = 0;
+    // SCHED_FIFO tasks run until they block or yield. SCHED_RR tasks go to the
+    // back of their queue when their slice is over, so that the next task of
+    // the same priority runs.
+    if (rt_task(current)) {
+        if (current->policy == SCHED_RR && --current->counter <= 0) {
+            current->counter = RR_TIMESLICE;
+            unsigned long flags = spin_lock_irqsave(&tasklist_lock);
+            requeue_rt_task(current);
+            spin_unlock_irqrestore(&tasklist_lock, flags);
+            this_cpu(need_resched) = 1;
+        }
+        return;
+    }
 
-    // timer_tick is called with interrupts disabled. We reenable them while we
-    // call _schedule and then disable them again.
+    // A fair task makes room once it got ahead of another runnable task. We
+    // look at rq_curr: while _schedule is switching tasks, current may already
+    // be back in the run queue, where its vruntime must not change.
+    unsigned long flags = spin_lock_irqsave(&tasklist_lock);
+    struct task_struct *curr = rq_curr;
+    int preempt = 0;
+    if (fair_task(curr)) {
+        fair_update_curr(curr, timer_read_counter());
+        preempt = fair_check_preempt_tick(curr);
+    }
+    spin_unlock_irqrestore(&tasklist_lock, flags);
+    if (!preempt) {
+        return;
+    }
+
+    // The task is on its way to sleep (between prepare_to_wait and schedule).
+    // It's about to call schedule anyway.
+    if (current->state != TASK_RUNNING) {
+        return;
+    }
+
+    // We're on the IRQ stack, so we can't switch tasks here. The IRQ exit path
+    // does it once it's back on the task's stack (preempt_schedule_irq), or
+    // preempt_enable if the task can't be preempted right now.
+    this_cpu(need_resched) = 1;
+}
+
+// Called at the end of every IRQ and syscall, on the stack of the interrupted
+// task and with IRQs disabled.
+void preempt_schedule_irq(void) {
+    if (!this_cpu(need_resched)) {
+        return;
+    }
+
+    // Same checks as in timer_tick: things could have changed in the handlers
+    // that ran after it. If we can't schedule now, preempt_enable or the next
+    // IRQ tries again.
+    if (current->preempt_count > 0 || current->state != TASK_RUNNING) {
+        return;
+    }
+    this_cpu(need_resched) = 0;
+
+    // We reenable interrupts while we call _schedule and then disable them
+    // again.
     enable_irq();
     _schedule();
     disable_irq();
 }
 
 void schedule(void) {
-    // Set counter to 0 to prevent the same task from being scheduled again
-    // since it is giving up the CPU voluntarily.
-    current->counter = 0;
+    // A real-time task that gives up the CPU goes to the back of its queue. A
+    // fair task that is still runnable only runs again if its vruntime is
+    // still the smallest.
+    if (rt_task(current)) {
+        unsigned long flags = spin_lock_irqsave(&tasklist_lock);
+        requeue_rt_task(current);
+        spin_unlock_irqrestore(&tasklist_lock, flags);
+    }
     _schedule();
 }
 
+// Returns 1 if a task other than the idle task is waiting for the CPU.
+static int rq_has_runnable(void) {
+    unsigned long flags = spin_lock_irqsave(&tasklist_lock);
+    int ret = pick_next_rt_task() || fair_nr_running();
+    spin_unlock_irqrestore(&tasklist_lock, flags);
+    return ret;
+}
+
+// The loop of the idle task of each CPU (the init task on CPU 0, which gets
+// here from kernel_main). The CPU has nothing better to do, so this is where
+// the kernel log gets written to the UART. Then the CPU sleeps in wfi until
+// an interrupt comes. If its handler wakes up a task, that task preempts us on
+// the way out of the interrupt (every task beats the idle task, see
+// wakeup_preempt), so it runs right away.
+void cpu_idle(void) {
+    struct idle_stats *stats = this_cpu_ptr(&idle_stats);
+
+    while (1) {
+        log_flush();
+
+        // IRQs stay disabled from the check until wfi, so that a wakeup can't
+        // sneak in between and leave us sleeping with work to do. wfi returns
+        // when an interrupt is pending even if IRQs are disabled; the
+        // interrupt is taken as soon as we enable them.
+        disable_irq();
+        if (!rq_has_runnable()) {
+            unsigned long start = timer_read_counter();
+            cpu_do_idle();
+            stats->sleeps++;
+            stats->cycles += timer_read_counter() - start;
+        }
+        enable_irq();
+
+        // Tasks that became runnable without preempting us (wake_up_new_task
+        // doesn't) get the CPU here.
+        schedule();
+    }
+}
+
+// Fills stats for sys_sched_stats. The idle counters are summed over the
+// CPUs.
+void sched_get_stats(struct sched_stats *stats) {
+    *stats = (struct sched_stats){0};
+    stats->jiffies = jiffies;
+    stats->idle_jiffies = idle_jiffies;
+    for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+        struct idle_stats *idle = per_cpu_ptr(&idle_stats, cpu);
+        stats->idle_entries += idle->entries;
+        stats->idle_exits += idle->exits;
+        stats->idle_sleeps += idle->sleeps;
+        stats->idle_ns += cycles_to_ns(idle->cycles);
+    }
+}
+
 void exit_process() {
-    preempt_disable();
+    unsigned long flags = spin_lock_irqsave(&tasklist_lock);
     // not sure why not just current->state = TASK_ZOMBIE
     for (int i = 0; i < NR_TASKS; i++) {
         if (task[i] == current) {
@@ -107,8 +322,256 @@ void exit_process() {
         }
     }
     // current->state = TASK_ZOMBIE;
+    spin_unlock_irqrestore(&tasklist_lock, flags);
+    fpsimd_exit(current);
+    exit_files(current);
+
+    // Drop our reference to the address space. The last thread to exit frees
+    // it, so stop using its page tables first.
+    preempt_disable();
+    struct mm_struct *mm = current->mm;
+    current->mm = 0;
+    if (mm) {
+        set_pgd(0);
+        mmput(mm);
+    }
     preempt_enable();
+
     schedule();
 }
 
-int getpid() { return current->pid; }
\ No newline at end of file
+// Threads share the pid of their process (see CLONE_VM).
+int getpid() { return current->tgid; }
+
+// Sets up the scheduling state of p, a new child of the current task. It
+// inherits the scheduling class and priority of its parent.
+void sched_fork(struct task_struct *p) {
+    p->priority = current->priority;
+    p->policy = current->policy;
+    p->rt_priority = current->rt_priority;
+    p->counter = RR_TIMESLICE;
+    p->on_rq = 0;
+    p->rq_index = -1;
+}
+
+// Publishes p (set up by copy_process) in task[] and makes it runnable. A new
+// fair task starts at the current min_vruntime, so it neither gets ahead of
+// the tasks that are already running nor has to catch up with them.
+void wake_up_new_task(struct task_struct *p) {
+    unsigned long flags = spin_lock_irqsave(&tasklist_lock);
+    task[p->pid] = p;
+    if (rt_task(p)) {
+        requeue_rt_task(p);
+    } else {
+        fair_place_task(p, 0);
+        fair_enqueue_task(p);
+    }
+    spin_unlock_irqrestore(&tasklist_lock, flags);
+}
+
+// Looks up p in the task array by pid. Used by the syscalls that take the pid
+// of a task, with 0 meaning the caller. Threads are tasks of their own, so
+// this is the pid of a single task (what clone returns), not of a whole
+// process. Returns 0 if there's no such task.
+struct task_struct *find_task_by_pid(int pid) {
+    if (pid == 0) {
+        return current;
+    }
+    if (pid < 0 || pid >= NR_TASKS) {
+        return 0;
+    }
+    // task[] entries are never freed, so the task stays valid after we drop
+    // the lock.
+    unsigned long flags = spin_lock_irqsave(&tasklist_lock);
+    struct task_struct *p = task[pid];
+    spin_unlock_irqrestore(&tasklist_lock, flags);
+    return p;
+}
+
+// Moves p to the scheduling class policy with the given real-time priority
+// (0 for SCHED_NORMAL). p goes to the back of the queue of its new priority
+// (or to min_vruntime if it becomes a fair task) and we reschedule, since p
+// may now have to preempt the current task (or the current task may not be
+// the most important one anymore). Returns 0 or -1.
+int sched_setscheduler(struct task_struct *p, int policy, int priority) {
+    if (policy == SCHED_NORMAL) {
+        if (priority != 0) {
+            return -1;
+        }
+    } else if (policy == SCHED_FIFO || policy == SCHED_RR) {
+        if (priority < SCHED_PRIO_MIN || priority > SCHED_PRIO_MAX) {
+            return -1;
+        }
+    } else {
+        return -1;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&tasklist_lock);
+    if (p->state == TASK_ZOMBIE) {
+        spin_unlock_irqrestore(&tasklist_lock, flags);
+        return -1;
+    }
+    if (p == rq_curr && fair_task(p)) {
+        fair_update_curr(p, timer_read_counter());
+    }
+    fair_dequeue_task(p);
+
+    int was_rt = rt_task(p);
+    p->policy = policy;
+    p->rt_priority = priority;
+    p->counter = RR_TIMESLICE;
+    if (rt_task(p)) {
+        requeue_rt_task(p);
+    } else {
+        if (was_rt) {
+            fair_place_task(p, 0);
+        }
+        if (p->state == TASK_RUNNING && p != rq_curr) {
+            fair_enqueue_task(p);
+        }
+    }
+    this_cpu(need_resched) = 1;
+    spin_unlock_irqrestore(&tasklist_lock, flags);
+    return 0;
+}
+
+// Sets the weight of p in the fair class (see sched_fair.c). It only matters
+// while p is SCHED_NORMAL. Returns 0 or -1.
+int sched_setpriority(struct task_struct *p, int priority) {
+    if (priority < PRIO_MIN || priority > PRIO_MAX) {
+        return -1;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&tasklist_lock);
+    // The time p ran so far is charged at its old weight.
+    if (p == rq_curr && fair_task(p)) {
+        fair_update_curr(p, timer_read_counter());
+    }
+    p->priority = priority;
+    spin_unlock_irqrestore(&tasklist_lock, flags);
+    return 0;
+}
+
+void init_waitqueue_head(struct wait_queue_head *wq) {
+    spin_lock_init(&wq->lock, "wait_queue");
+    wq->head = 0;
+}
+
+// Removes entry from wq if it's still there. Must be called with wq->lock held.
+static void __remove_wait_queue(struct wait_queue_head *wq,
+                                struct wait_queue_entry *entry) {
+    struct wait_queue_entry **pp = &wq->head;
+    while (*pp) {
+        if (*pp == entry) {
+            *pp = entry->next;
+            return;
+        }
+        pp = &(*pp)->next;
+    }
+}
+
+// Queues the current task on wq and marks it as sleeping. The caller should
+// check its wait condition afterwards and call schedule() if it's not met.
+// The queue lock is taken with IRQs disabled since wake_up may run from an
+// interrupt handler. Setting the state under the same lock that wake_up takes
+// means a wake_up can't slip in between the two.
+void prepare_to_wait(struct wait_queue_head *wq,
+                     struct wait_queue_entry *entry) {
+    unsigned long flags = spin_lock_irqsave(&wq->lock);
+    __remove_wait_queue(wq, entry);
+    entry->task = current;
+    entry->next = wq->head;
+    wq->head = entry;
+    current->state = TASK_SLEEPING;
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+void finish_wait(struct wait_queue_head *wq, struct wait_queue_entry *entry) {
+    unsigned long flags = spin_lock_irqsave(&wq->lock);
+    current->state = TASK_RUNNING;
+    __remove_wait_queue(wq, entry);
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+// Returns 1 if p, which just woke up, should preempt the running task. Must
+// be called with tasklist_lock held.
+static int wakeup_preempt(struct task_struct *p) {
+    struct task_struct *curr = rq_curr;
+    if (p == curr) {
+        return 0;
+    }
+    if (!fair_task(p) || !fair_task(curr)) {
+        return task_prio(p) > task_prio(curr);
+    }
+    fair_update_curr(curr, timer_read_counter());
+    return fair_check_preempt_wakeup(curr, p);
+}
+
+// If p should run before the current task (it has a higher priority, or it's
+// a fair task that is well behind), the current task is preempted right away
+// (see need_resched) instead of at the end of its time slice. That's what
+// bounds the wakeup latency of real-time tasks, and what keeps interactive
+// tasks responsive under CPU bound load.
+void wake_up_process(struct task_struct *p) {
+    unsigned long flags = spin_lock_irqsave(&tasklist_lock);
+    if (p->state == TASK_SLEEPING) {
+        p->state = TASK_RUNNING;
+        if (rt_task(p)) {
+            requeue_rt_task(p);
+        } else if (p != rq_curr) {
+            // A task that is still running (it was woken up before it got to
+            // schedule) is queued by _schedule if needed.
+            fair_place_task(p, 1);
+            fair_enqueue_task(p);
+        }
+        if (wakeup_preempt(p)) {
+            this_cpu(need_resched) = 1;
+        }
+    }
+    spin_unlock_irqrestore(&tasklist_lock, flags);
+}
+
+// Wakes every task on wq and empties the queue. Safe to call from interrupt
+// handlers.
+void wake_up(struct wait_queue_head *wq) {
+    unsigned long flags = spin_lock_irqsave(&wq->lock);
+    struct wait_queue_entry *entry = wq->head;
+    wq->head = 0;
+    while (entry) {
+        // Read next before waking: the entry lives on the sleeper's stack.
+        struct wait_queue_entry *next = entry->next;
+        wake_up_process(entry->task);
+        entry = next;
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+static void process_timeout(unsigned long data) {
+    wake_up_process((struct task_struct *)data);
+}
+
+// Puts the current task to sleep for (at least) ticks timer ticks. Returns the
+// number of ticks left if the task was woken up earlier, or 0.
+long schedule_timeout(long ticks) {
+    struct timer_list timer;
+
+    if (ticks <= 0) {
+        return 0;
+    }
+
+    init_timer(&timer, process_timeout, (unsigned long)current);
+    timer.expires = jiffies + ticks;
+
+    // If the timer fires before we get to schedule, it just sets us back to
+    // TASK_RUNNING and schedule returns right away.
+    current->state = TASK_SLEEPING;
+    add_timer(&timer);
+
+    schedule();
+
+    del_timer(&timer);
+    current->state = TASK_RUNNING;
+
+    long left = timer.expires - jiffies;
+    return left < 0 ? 0 : left;
+}
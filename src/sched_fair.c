@@ -0,0 +1,168 @@
+#include "sched_fair.h"
+#include "sched.h"
+#include "timer.h"
+
+// The fair class (SCHED_NORMAL). Every task has a virtual runtime: the time it
+// spent on the CPU (in generic counter cycles) divided by its weight, which is
+// its priority relative to DEF_PRIORITY. The runnable task with the smallest
+// vruntime is the one that got the least of its share so far, so that's the
+// one that runs next. Time is charged exactly, from the counter, so a task
+// that sleeps right before every tick pays for the time it ran just like one
+// that is running when the tick comes.
+//
+// Runnable tasks are kept in a binary min-heap ordered by vruntime (like the
+// hrtimers, see hrtimer.c), except for the task that is running: it's charged
+// as it goes and only goes back into the heap when it's switched out.
+//
+// Everything here must be called with tasklist_lock held.
+
+// How much vruntime a task gets back when it wakes up. Tasks that sleep a lot
+// (interactive ones) wake up slightly ahead of the others, so they run soon,
+// but they can't bank the time they spent sleeping.
+#define FAIR_SLEEPER_CREDIT_NS 10000000UL
+
+// A task that wakes up only preempts the running one if it's behind by more
+// than this, so that two tasks that keep waking each other up don't switch on
+// every wakeup.
+#define FAIR_WAKEUP_GRAN_NS 1000000UL
+
+static struct task_struct *fair_heap[NR_TASKS];
+static int fair_count;
+
+// Never goes backwards: it follows the smallest vruntime of the runnable
+// tasks. New and waking tasks are placed relative to it.
+static unsigned long min_vruntime;
+
+// vruntimes only grow, so they're compared the way jiffies are, in case they
+// wrap around.
+static int vruntime_before(unsigned long a, unsigned long b) {
+    return (long)(a - b) < 0;
+}
+
+static void heap_set(int i, struct task_struct *p) {
+    fair_heap[i] = p;
+    p->rq_index = i;
+}
+
+static void sift_up(int i) {
+    struct task_struct *p = fair_heap[i];
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (!vruntime_before(p->vruntime, fair_heap[parent]->vruntime)) {
+            break;
+        }
+        heap_set(i, fair_heap[parent]);
+        i = parent;
+    }
+    heap_set(i, p);
+}
+
+static void sift_down(int i) {
+    struct task_struct *p = fair_heap[i];
+    while (1) {
+        int child = 2 * i + 1;
+        if (child >= fair_count) {
+            break;
+        }
+        if (child + 1 < fair_count &&
+            vruntime_before(fair_heap[child + 1]->vruntime,
+                            fair_heap[child]->vruntime)) {
+            child++;
+        }
+        if (!vruntime_before(fair_heap[child]->vruntime, p->vruntime)) {
+            break;
+        }
+        heap_set(i, fair_heap[child]);
+        i = child;
+    }
+    heap_set(i, p);
+}
+
+void fair_enqueue_task(struct task_struct *p) {
+    if (p->on_rq) {
+        return;
+    }
+    p->on_rq = 1;
+    heap_set(fair_count++, p);
+    sift_up(p->rq_index);
+}
+
+void fair_dequeue_task(struct task_struct *p) {
+    if (!p->on_rq) {
+        return;
+    }
+    int i = p->rq_index;
+    struct task_struct *last = fair_heap[--fair_count];
+    p->on_rq = 0;
+    if (last == p) {
+        return;
+    }
+
+    heap_set(i, last);
+    if (i > 0 &&
+        vruntime_before(last->vruntime, fair_heap[(i - 1) / 2]->vruntime)) {
+        sift_up(i);
+    } else {
+        sift_down(i);
+    }
+}
+
+// Number of runnable fair tasks, not counting the running one.
+int fair_nr_running(void) { return fair_count; }
+
+// Removes and returns the task with the smallest vruntime, or 0 if there are
+// no runnable fair tasks.
+struct task_struct *fair_pick_next_task(void) {
+    if (!fair_count) {
+        return 0;
+    }
+    struct task_struct *p = fair_heap[0];
+    fair_dequeue_task(p);
+    if (vruntime_before(min_vruntime, p->vruntime)) {
+        min_vruntime = p->vruntime;
+    }
+    return p;
+}
+
+// Charges curr (the running fair task) for the time since its exec_start.
+void fair_update_curr(struct task_struct *curr, unsigned long now) {
+    unsigned long delta = now - curr->exec_start;
+    unsigned long weight = curr->priority > 0 ? curr->priority : 1;
+    curr->exec_start = now;
+    curr->vruntime += delta * DEF_PRIORITY / weight;
+
+    unsigned long vmin = curr->vruntime;
+    if (fair_count && vruntime_before(fair_heap[0]->vruntime, vmin)) {
+        vmin = fair_heap[0]->vruntime;
+    }
+    if (vruntime_before(min_vruntime, vmin)) {
+        min_vruntime = vmin;
+    }
+}
+
+// Sets the vruntime of p, which is about to be queued. New tasks start at
+// min_vruntime. Waking tasks (waking = 1) keep their own vruntime unless they
+// slept long enough to fall behind min_vruntime by more than the sleeper
+// credit.
+void fair_place_task(struct task_struct *p, int waking) {
+    unsigned long vruntime = min_vruntime;
+    if (waking) {
+        vruntime -= ns_to_cycles(FAIR_SLEEPER_CREDIT_NS);
+    }
+    if (!waking || vruntime_before(p->vruntime, vruntime)) {
+        p->vruntime = vruntime;
+    }
+}
+
+// Returns 1 if curr (charged up to now) has run ahead of another runnable task
+// and should make room for it.
+int fair_check_preempt_tick(struct task_struct *curr) {
+    return fair_count &&
+           vruntime_before(fair_heap[0]->vruntime, curr->vruntime);
+}
+
+// Returns 1 if p, which just woke up, should preempt curr (charged up to now).
+int fair_check_preempt_wakeup(struct task_struct *curr, struct task_struct *p) {
+    return vruntime_before(p->vruntime + ns_to_cycles(FAIR_WAKEUP_GRAN_NS),
+                           curr->vruntime);
+}
@@ -0,0 +1,161 @@
+#include "shm.h"
+#include "mm.h"
+#include "slab.h"
+#include "string.h"
+
+// Named objects. Protects the list and the names in it.
+static struct list_head shm_objects = LIST_HEAD_INIT(shm_objects);
+static DEFINE_SPINLOCK(shm_lock);
+
+static struct shm_object *shm_alloc(unsigned long size) {
+    if (size == 0 || size > SHM_MAX_PAGES * PAGE_SIZE) {
+        return 0;
+    }
+    struct shm_object *obj = kzalloc(sizeof(*obj));
+    if (!obj) {
+        return 0;
+    }
+    spin_lock_init(&obj->lock, "shm");
+    INIT_LIST_HEAD(&obj->list);
+    obj->refcount = 1;
+    obj->nr_pages = PAGE_ALIGN(size) >> PAGE_SHIFT;
+    return obj;
+}
+
+static void shm_get(struct shm_object *obj) {
+    __atomic_add_fetch(&obj->refcount, 1, __ATOMIC_RELAXED);
+}
+
+// Drops a reference. The last one frees the object and its references to the
+// pages (processes that still map them keep theirs).
+static void shm_put(struct shm_object *obj) {
+    if (__atomic_sub_fetch(&obj->refcount, 1, __ATOMIC_ACQ_REL) != 0) {
+        return;
+    }
+    for (unsigned long i = 0; i < obj->nr_pages; i++) {
+        if (obj->pages[i]) {
+            free_page(obj->pages[i]);
+        }
+    }
+    kfree(obj);
+}
+
+// Returns the page at pgoff with a new reference (allocating it the first
+// time), or 0 if it's past the end of the object.
+static unsigned long shm_fault(struct file *file, unsigned long pgoff) {
+    struct shm_object *obj = file->private_data;
+    if (pgoff >= obj->nr_pages) {
+        return 0;
+    }
+
+    spin_lock(&obj->lock);
+    unsigned long page = obj->pages[pgoff];
+    if (!page) {
+        page = get_free_page();
+        obj->pages[pgoff] = page;
+    }
+    if (page) {
+        get_page(page);
+    }
+    spin_unlock(&obj->lock);
+    return page;
+}
+
+static void shm_release(struct file *file) { shm_put(file->private_data); }
+
+static const struct file_operations shm_fops = {
+    .fault = shm_fault,
+    .release = shm_release,
+};
+
+// Returns a file for obj, taking over the caller's reference to it, or 0.
+static struct file *shm_file(struct shm_object *obj) {
+    struct file *file = alloc_file(&shm_fops, FMODE_READ | FMODE_WRITE, obj);
+    if (!file) {
+        shm_put(obj);
+    }
+    return file;
+}
+
+// Returns a file for a new unnamed object of size bytes (for
+// MAP_SHARED | MAP_ANONYMOUS), or 0.
+struct file *shm_file_create(unsigned long size) {
+    struct shm_object *obj = shm_alloc(size);
+    if (!obj) {
+        return 0;
+    }
+    return shm_file(obj);
+}
+
+// Must be called with shm_lock held.
+static struct shm_object *shm_lookup(const char *name) {
+    struct list_head *pos;
+    for (pos = shm_objects.next; pos != &shm_objects; pos = pos->next) {
+        struct shm_object *obj = list_entry(pos, struct shm_object, list);
+        if (strcmp(obj->name, (char *)name) == 0) {
+            return obj;
+        }
+    }
+    return 0;
+}
+
+// Opens the object called name, creating it with size bytes if it doesn't
+// exist. An existing object must be at least size bytes. Returns an fd to map
+// the object with mmap, or -1.
+int shm_open(const char *name, unsigned long size) {
+    if (name[0] == '\0') {
+        return -1;
+    }
+
+    spin_lock(&shm_lock);
+    struct shm_object *obj = shm_lookup(name);
+    if (obj) {
+        if (size > obj->nr_pages * PAGE_SIZE) {
+            spin_unlock(&shm_lock);
+            return -1;
+        }
+        shm_get(obj);
+    } else {
+        obj = shm_alloc(size);
+        if (!obj) {
+            spin_unlock(&shm_lock);
+            return -1;
+        }
+        // obj is zeroed, so the name stays NUL terminated.
+        for (int i = 0; i < SHM_NAME_MAX - 1 && name[i] != '\0'; i++) {
+            obj->name[i] = name[i];
+        }
+        // The reference from shm_alloc is the name's. The file gets another.
+        list_add_tail(&obj->list, &shm_objects);
+        shm_get(obj);
+    }
+    spin_unlock(&shm_lock);
+
+    struct file *file = shm_file(obj);
+    if (!file) {
+        return -1;
+    }
+    int fd = fd_install(file);
+    if (fd < 0) {
+        fput(file);
+    }
+    return fd;
+}
+
+// Removes the name. The object goes away once nobody has it open anymore;
+// until then, whoever maps it keeps using it. Returns -1 if there's no object
+// called name.
+int shm_unlink(const char *name) {
+    spin_lock(&shm_lock);
+    struct shm_object *obj = shm_lookup(name);
+    if (obj) {
+        list_del_init(&obj->list);
+    }
+    spin_unlock(&shm_lock);
+
+    if (!obj) {
+        return -1;
+    }
+    shm_put(obj);
+    return 0;
+}
@@ -0,0 +1,317 @@
+#include "slab.h"
+#include "irq.h"
+#include "mm.h"
+#include "printf.h"
+#include "utils.h"
+
+// Slab allocator. Each cache hands out objects of one size. The objects come
+// from slabs: a page that starts with a struct slab, followed by as many
+// objects as fit. The free objects of a slab are linked through their first
+// word. Given an object, its slab is found by rounding the address down to the
+// page.
+//
+// On top of that, every CPU keeps a magazine of free objects per cache.
+// kmem_cache_alloc/kmem_cache_free only go to the slabs (and take the cache
+// lock) when the magazine is empty or full, and then they move
+// SLAB_MAGAZINE_SIZE / 2 objects at once.
+
+struct slab {
+    struct list_head list;
+    struct kmem_cache *cache;
+    void *freelist;
+    unsigned int inuse;
+};
+
+#define ALIGN_UP(x, a) (((x) + (a)-1) & ~((unsigned long)(a)-1))
+
+// Objects moved between a magazine and the slabs at once.
+#define SLAB_BATCH (SLAB_MAGAZINE_SIZE / 2)
+
+// The cache of struct kmem_cache, which can't come from kmem_cache_create.
+static struct kmem_cache cache_cache;
+
+static struct kmem_cache *kmalloc_caches[KMALLOC_SHIFT_HIGH + 1];
+static const char *kmalloc_names[KMALLOC_SHIFT_HIGH + 1] = {
+    0,           0,           0,           0,
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024"};
+
+static struct list_head cache_chain = LIST_HEAD_INIT(cache_chain);
+static DEFINE_SPINLOCK(cache_chain_lock);
+
+static void kmem_cache_setup(struct kmem_cache *cache, const char *name,
+                             unsigned long size, unsigned long align,
+                             unsigned long flags) {
+    if (flags & SLAB_HWCACHE_ALIGN) {
+        align = L1_CACHE_BYTES;
+    }
+    // Objects hold the freelist pointer while they're free.
+    if (align < sizeof(void *)) {
+        align = sizeof(void *);
+    }
+    if (size < sizeof(void *)) {
+        size = sizeof(void *);
+    }
+
+    for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+        cache->cpu[cpu].avail = 0;
+        cache->cpu[cpu].allocs = 0;
+        cache->cpu[cpu].frees = 0;
+    }
+    cache->name = name;
+    cache->object_size = size;
+    cache->size = ALIGN_UP(size, align);
+    cache->align = align;
+    cache->offset = ALIGN_UP(sizeof(struct slab), align);
+    cache->objs_per_slab = (PAGE_SIZE - cache->offset) / cache->size;
+    spin_lock_init(&cache->lock, name);
+    INIT_LIST_HEAD(&cache->slabs_partial);
+    INIT_LIST_HEAD(&cache->slabs_full);
+    INIT_LIST_HEAD(&cache->slabs_free);
+    cache->nr_slabs = 0;
+
+    unsigned long lock_flags = spin_lock_irqsave(&cache_chain_lock);
+    list_add_tail(&cache->list, &cache_chain);
+    spin_unlock_irqrestore(&cache_chain_lock, lock_flags);
+}
+
+// Creates a cache for objects of size bytes aligned to align. Returns 0 if the
+// objects don't fit in a slab or we're out of memory.
+struct kmem_cache *kmem_cache_create(const char *name, unsigned long size,
+                                     unsigned long align, unsigned long flags) {
+    struct kmem_cache *cache = kmem_cache_alloc(&cache_cache);
+    if (!cache) {
+        return 0;
+    }
+
+    kmem_cache_setup(cache, name, size, align, flags);
+    if (!cache->objs_per_slab) {
+        unsigned long lock_flags = spin_lock_irqsave(&cache_chain_lock);
+        list_del_init(&cache->list);
+        spin_unlock_irqrestore(&cache_chain_lock, lock_flags);
+        kmem_cache_free(&cache_cache, cache);
+        return 0;
+    }
+    return cache;
+}
+
+void slab_init(void) {
+    kmem_cache_setup(&cache_cache, "kmem_cache", sizeof(struct kmem_cache), 0,
+                     SLAB_HWCACHE_ALIGN);
+
+    for (int shift = KMALLOC_SHIFT_LOW; shift <= KMALLOC_SHIFT_HIGH; shift++) {
+        // Power of 2 sizes are naturally aligned, up to a cache line.
+        unsigned long size = 1UL << shift;
+        unsigned long align = size < L1_CACHE_BYTES ? size : L1_CACHE_BYTES;
+        kmalloc_caches[shift] =
+            kmem_cache_create(kmalloc_names[shift], size, align, 0);
+    }
+}
+
+// Must be called with cache->lock held. Returns a slab with free objects.
+static struct slab *cache_grow(struct kmem_cache *cache) {
+    if (!list_empty(&cache->slabs_partial)) {
+        return list_entry(cache->slabs_partial.next, struct slab, list);
+    }
+    if (!list_empty(&cache->slabs_free)) {
+        struct slab *slab =
+            list_entry(cache->slabs_free.next, struct slab, list);
+        list_del_init(&slab->list);
+        list_add(&slab->list, &cache->slabs_partial);
+        return slab;
+    }
+
+    // get_free_page zeroes the page. Note that we're holding the cache lock
+    // here (with IRQs disabled), so the page allocator must never allocate
+    // from a slab.
+    unsigned long page = allocate_kernel_page();
+    if (!page) {
+        return 0;
+    }
+
+    struct slab *slab = (struct slab *)page;
+    slab->cache = cache;
+    slab->inuse = 0;
+    slab->freelist = 0;
+    // Link the objects so that they're handed out in address order.
+    for (int i = cache->objs_per_slab - 1; i >= 0; i--) {
+        void **obj = (void **)(page + cache->offset + i * cache->size);
+        *obj = slab->freelist;
+        slab->freelist = obj;
+    }
+    list_add(&slab->list, &cache->slabs_partial);
+    cache->nr_slabs++;
+    return slab;
+}
+
+// Moves up to count objects from the slabs to objs. Returns how many it moved.
+static int cache_alloc_refill(struct kmem_cache *cache, void **objs,
+                              int count) {
+    int n = 0;
+    spin_lock(&cache->lock);
+    while (n < count) {
+        struct slab *slab = cache_grow(cache);
+        if (!slab) {
+            break;
+        }
+
+        while (n < count && slab->freelist) {
+            void **obj = slab->freelist;
+            slab->freelist = *obj;
+            slab->inuse++;
+            objs[n++] = obj;
+        }
+
+        if (!slab->freelist) {
+            list_del_init(&slab->list);
+            list_add(&slab->list, &cache->slabs_full);
+        }
+    }
+    spin_unlock(&cache->lock);
+    return n;
+}
+
+// Gives count objects back to their slabs. Keeps one empty slab around and
+// returns any other to the page allocator.
+static void cache_flush(struct kmem_cache *cache, void **objs, int count) {
+    spin_lock(&cache->lock);
+    for (int i = 0; i < count; i++) {
+        void **obj = objs[i];
+        struct slab *slab = (struct slab *)((unsigned long)obj & PAGE_MASK);
+        int was_full = !slab->freelist;
+
+        *obj = slab->freelist;
+        slab->freelist = obj;
+        slab->inuse--;
+
+        if (!slab->inuse) {
+            list_del_init(&slab->list);
+            if (list_empty(&cache->slabs_free)) {
+                list_add(&slab->list, &cache->slabs_free);
+            } else {
+                cache->nr_slabs--;
+                free_page((unsigned long)slab - VA_START);
+            }
+        } else if (was_full) {
+            list_del_init(&slab->list);
+            list_add(&slab->list, &cache->slabs_partial);
+        }
+    }
+    spin_unlock(&cache->lock);
+}
+
+void *kmem_cache_alloc(struct kmem_cache *cache) {
+    void *obj = 0;
+    unsigned long flags = local_irq_save();
+    struct kmem_cache_cpu *mag = &cache->cpu[get_cpuid()];
+
+    if (!mag->avail) {
+        mag->avail = cache_alloc_refill(cache, mag->objs, SLAB_BATCH);
+    }
+    if (mag->avail) {
+        obj = mag->objs[--mag->avail];
+        mag->allocs++;
+    }
+    local_irq_restore(flags);
+    return obj;
+}
+
+void *kmem_cache_zalloc(struct kmem_cache *cache) {
+    void *obj = kmem_cache_alloc(cache);
+    if (obj) {
+        // object_size may not be a multiple of 8 (what memzero writes), but
+        // size is.
+        memzero((unsigned long)obj, ALIGN_UP(cache->object_size, 8));
+    }
+    return obj;
+}
+
+void kmem_cache_free(struct kmem_cache *cache, void *obj) {
+    if (!obj) {
+        return;
+    }
+
+    unsigned long flags = local_irq_save();
+    struct kmem_cache_cpu *mag = &cache->cpu[get_cpuid()];
+
+    if (mag->avail == SLAB_MAGAZINE_SIZE) {
+        // Give back the oldest half of the magazine.
+        cache_flush(cache, mag->objs, SLAB_BATCH);
+        for (int i = SLAB_BATCH; i < SLAB_MAGAZINE_SIZE; i++) {
+            mag->objs[i - SLAB_BATCH] = mag->objs[i];
+        }
+        mag->avail -= SLAB_BATCH;
+    }
+    mag->objs[mag->avail++] = obj;
+    mag->frees++;
+    local_irq_restore(flags);
+}
+
+// Allocates size bytes from the smallest size class that fits, or a whole
+// page for anything larger than KMALLOC_MAX_CACHE_SIZE (up to PAGE_SIZE).
+void *kmalloc(unsigned long size) {
+    if (size > KMALLOC_MAX_CACHE_SIZE) {
+        if (size > PAGE_SIZE) {
+            return 0;
+        }
+        return (void *)allocate_kernel_page();
+    }
+
+    int shift = KMALLOC_SHIFT_LOW;
+    while ((1UL << shift) < size) {
+        shift++;
+    }
+    return kmem_cache_alloc(kmalloc_caches[shift]);
+}
+
+void *kzalloc(unsigned long size) {
+    void *obj = kmalloc(size);
+    // Whole pages come zeroed from get_free_page.
+    if (obj && size <= KMALLOC_MAX_CACHE_SIZE) {
+        memzero((unsigned long)obj, ALIGN_UP(size, 8));
+    }
+    return obj;
+}
+
+// Objects that come from a slab are never page aligned (the page starts with
+// the slab header), so a page aligned pointer is one of the whole pages.
+void kfree(const void *obj) {
+    unsigned long addr = (unsigned long)obj;
+    if (!obj) {
+        return;
+    }
+    if (!(addr & ~PAGE_MASK)) {
+        free_page(addr - VA_START);
+        return;
+    }
+
+    struct slab *slab = (struct slab *)(addr & PAGE_MASK);
+    kmem_cache_free(slab->cache, (void *)obj);
+}
+
+// Objects sitting in the magazines count as free. Bytes used is what the
+// callers asked for. Bytes wasted is the rest of the slab pages that can't
+// hold an object: slab headers, the tail of each page and the padding of each
+// live object.
+void kmem_cache_stats_dump(void) {
+    printf("cache: objsize / live / slabs / used bytes / wasted bytes\r\n");
+
+    unsigned long lock_flags = spin_lock_irqsave(&cache_chain_lock);
+    struct list_head *pos;
+    for (pos = cache_chain.next; pos != &cache_chain; pos = pos->next) {
+        struct kmem_cache *cache = list_entry(pos, struct kmem_cache, list);
+        unsigned long live = 0;
+        for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+            live += cache->cpu[cpu].allocs - cache->cpu[cpu].frees;
+        }
+
+        unsigned long slabs = cache->nr_slabs;
+        unsigned long used = live * cache->object_size;
+        unsigned long wasted =
+            slabs * (PAGE_SIZE - cache->objs_per_slab * cache->size) +
+            live * (cache->size - cache->object_size);
+        printf("%s: %lu / %lu / %lu / %lu / %lu\r\n", cache->name,
+               cache->object_size, live, slabs, used, wasted);
+    }
+    spin_unlock_irqrestore(&cache_chain_lock, lock_flags);
+}
@@ -0,0 +1,130 @@
+#include "softirq.h"
+#include "fork.h"
+#include "irq.h"
+#include "percpu.h"
+#include "printf.h"
+#include "sched.h"
+
+static void (*softirq_vec[NR_SOFTIRQS])(void);
+
+static const char *softirq_names[NR_SOFTIRQS] = {"timer"};
+
+struct softirq_cpu {
+    // Bit n is set if softirq n was raised and didn't run yet. Only touched by
+    // this CPU, with IRQs disabled.
+    unsigned long pending;
+    // __do_softirq is running on this CPU. An IRQ that comes in meanwhile
+    // leaves its softirqs to the loop in __do_softirq.
+    int running;
+    // Where ksoftirqd waits for pending softirqs.
+    struct wait_queue_head wait;
+
+    // Statistics.
+    unsigned long count[NR_SOFTIRQS];
+    unsigned long deferred;
+};
+
+static DEFINE_PER_CPU(struct softirq_cpu, softirq_cpu) = {
+    .wait = WAIT_QUEUE_HEAD_INIT(ksoftirqd_wait),
+};
+
+void open_softirq(int nr, void (*action)(void)) { softirq_vec[nr] = action; }
+
+// Marks softirq nr as pending on this CPU. Called from an interrupt handler
+// (with IRQs disabled); the softirq runs on the way out of the interrupt.
+void raise_softirq(int nr) { this_cpu(softirq_cpu).pending |= 1UL << nr; }
+
+static void wakeup_softirqd(struct softirq_cpu *sc) {
+    sc->deferred++;
+    wake_up(&sc->wait);
+}
+
+// Runs the pending softirqs of this CPU. Called with IRQs disabled and
+// preemption disabled, returns the same way. The softirqs themselves run with
+// IRQs enabled.
+static void __do_softirq(struct softirq_cpu *sc) {
+    sc->running = 1;
+    for (int restart = 0; restart < MAX_SOFTIRQ_RESTART && sc->pending;
+         restart++) {
+        unsigned long pending = sc->pending;
+        sc->pending = 0;
+
+        enable_irq();
+        while (pending) {
+            int nr = __builtin_ctzl(pending);
+            pending &= pending - 1;
+            softirq_vec[nr]();
+            sc->count[nr]++;
+        }
+        disable_irq();
+    }
+    sc->running = 0;
+}
+
+// Called from entry.S at the end of every IRQ, back on the stack of the
+// interrupted task and with IRQs disabled. If the interrupted code can't be
+// preempted, it may hold a spinlock that a softirq wants too (spin_lock
+// doesn't disable IRQs), so we leave the softirqs to ksoftirqd, which runs
+// once it's safe.
+void irq_exit(void) {
+    struct softirq_cpu *sc = this_cpu_ptr(&softirq_cpu);
+    if (!sc->pending || sc->running) {
+        return;
+    }
+    if (current->preempt_count > 0) {
+        wakeup_softirqd(sc);
+        return;
+    }
+
+    // Not preempt_disable/preempt_enable: preempt_enable would schedule, and
+    // preempt_schedule_irq takes care of that right after us.
+    current->preempt_count++;
+    __do_softirq(sc);
+    current->preempt_count--;
+
+    if (sc->pending) {
+        wakeup_softirqd(sc);
+    }
+}
+
+// Runs the softirqs that irq_exit couldn't. It's a normal task, so the fair
+// class decides how much CPU time they get.
+static void ksoftirqd(struct softirq_cpu *sc) {
+    while (1) {
+        wait_event(sc->wait, __atomic_load_n(&sc->pending, __ATOMIC_RELAXED));
+
+        preempt_disable();
+        unsigned long flags = local_irq_save();
+        if (!sc->running) {
+            __do_softirq(sc);
+        }
+        local_irq_restore(flags);
+        preempt_enable();
+    }
+}
+
+// Starts ksoftirqd for this CPU. Returns 0 or -1.
+int softirq_init(void) {
+    struct softirq_cpu *sc = this_cpu_ptr(&softirq_cpu);
+    if (copy_process(PF_KTHREAD, (unsigned long)&ksoftirqd, (unsigned long)sc,
+                     0) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+void softirq_stats_dump(void) {
+    printf("softirq: count per cpu\r\n");
+    for (int nr = 0; nr < NR_SOFTIRQS; nr++) {
+        printf("%s:", softirq_names[nr]);
+        for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+            printf(" %lu", per_cpu(softirq_cpu, cpu).count[nr]);
+        }
+        printf("\r\n");
+    }
+    printf("deferred to ksoftirqd:");
+    for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+        printf(" %lu", per_cpu(softirq_cpu, cpu).deferred);
+    }
+    printf("\r\n");
+}
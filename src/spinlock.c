@@ -0,0 +1,61 @@
+#include "spinlock.h"
+#include "irq.h"
+#include "printf.h"
+#include "sched.h"
+
+// Set by the linker script around the .data.spinlocks section (every lock
+// defined with DEFINE_SPINLOCK).
+extern spinlock_t spinlocks_begin[];
+extern spinlock_t spinlocks_end[];
+
+void spin_lock_init(spinlock_t *lock, const char *name) {
+    lock->owner = 0;
+    lock->next = 0;
+    lock->acquired = 0;
+    lock->contended = 0;
+    lock->spins = 0;
+    lock->name = name;
+}
+
+// Preemption is disabled while holding the lock. Otherwise, a timer tick could
+// switch to another task on this CPU that then spins forever waiting for the
+// lock held by the task that was switched out.
+void spin_lock(spinlock_t *lock) {
+    preempt_disable();
+    unsigned long spins = arch_spin_lock(lock);
+
+    // We hold the lock, so nobody else is updating the stats.
+    lock->acquired++;
+    if (spins) {
+        lock->contended++;
+        lock->spins += spins;
+    }
+}
+
+void spin_unlock(spinlock_t *lock) {
+    arch_spin_unlock(lock);
+    preempt_enable();
+}
+
+// Same as spin_lock, but also disables IRQs on this CPU. Returns the previous
+// IRQ state, to be passed to spin_unlock_irqrestore. Needed for any lock that
+// is also taken from an interrupt handler: otherwise the handler could spin
+// forever on a lock held by the code it interrupted.
+unsigned long spin_lock_irqsave(spinlock_t *lock) {
+    unsigned long flags = local_irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+void spin_unlock_irqrestore(spinlock_t *lock, unsigned long flags) {
+    spin_unlock(lock);
+    local_irq_restore(flags);
+}
+
+void spin_lock_stats_dump(void) {
+    printf("lock: acquired / contended / spins\r\n");
+    for (spinlock_t *lock = spinlocks_begin; lock < spinlocks_end; lock++) {
+        printf("%s: %lu / %lu / %lu\r\n", lock->name, lock->acquired,
+               lock->contended, lock->spins);
+    }
+}
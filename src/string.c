@@ -15,6 +15,20 @@ int strcmp(char *str1, char *str2) {
     }
 }
 
+// Like strcmp, but only compares up to n characters.
+int strncmp(char *str1, char *str2, int n) {
+    for (int i = 0; i < n; i++) {
+        if (str1[i] != str2[i]) {
+            return str1[i] - str2[i];
+        }
+
+        if (str1[i] == '\0') {
+            return 0;
+        }
+    }
+    return 0;
+}
+
 int readline(char *buf, int maxlen) {
     int num = 0;
     while (num < maxlen - 1) {
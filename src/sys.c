@@ -1,16 +1,300 @@
+#include "sys.h"
+#include "exec.h"
 #include "fork.h"
+#include "fs.h"
+#include "futex.h"
+#include "hrtimer.h"
+#include "initramfs.h"
 #include "mm.h"
+#include "pipe.h"
 #include "printf.h"
+#include "rusage.h"
 #include "sched.h"
+#include "shm.h"
+#include "timer.h"
+#include "uaccess.h"
 #include "utils.h"
 
-// Dangerous! no bounds checking
-void sys_write(char *buff) { printf(buff); }
+// Size of the chunks in which sys_write copies the user string into the
+// kernel.
+#define SYS_WRITE_CHUNK 128
 
-int sys_fork() { return copy_process(0, 0, 0); }
+struct syscall_stat syscall_stats[__NR_syscalls];
+
+// The user buffer is copied (and validated) in chunks before printing it, so a
+// bad pointer only ends the write instead of faulting the kernel.
+void sys_write(char *buff) {
+    char kbuf[SYS_WRITE_CHUNK];
+
+    while (1) {
+        long len = strncpy_from_user(kbuf, buff, SYS_WRITE_CHUNK);
+        if (len < 0) {
+            return;
+        }
+
+        // The string is data, not a format.
+        printf("%s", kbuf);
+
+        if (len < SYS_WRITE_CHUNK - 1) {
+            return;
+        }
+        buff += len;
+    }
+}
+
+int sys_fork() { return copy_process(0, 0, 0, 0); }
 
 void sys_exit() { exit_process(); }
 
 int sys_getpid() { return getpid(); }
 
-void *const sys_call_table[] = {sys_write, sys_fork, sys_exit, sys_getpid};
\ No newline at end of file
+// Copies up to count entries of syscall_stats (indexed by syscall number) to
+// buf. Returns the number of entries copied or -1 if buf is not accessible.
+int sys_syscall_stats(struct syscall_stat *buf, unsigned long count) {
+    if (count > __NR_syscalls) {
+        count = __NR_syscalls;
+    }
+
+    if (copy_to_user(buf, syscall_stats, count * sizeof(struct syscall_stat))) {
+        return -1;
+    }
+    return count;
+}
+
+// Sleeps for at least ns nanoseconds using an hrtimer, so the resolution is the
+// generic timer's instead of a tick. Returns the number of nanoseconds left if
+// the task was woken up early.
+long sys_nanosleep(unsigned long ns) { return hrtimer_nanosleep(ns); }
+
+int sys_sched_stats(struct sched_stats *buf) {
+    struct sched_stats stats;
+    sched_get_stats(&stats);
+    if (copy_to_user(buf, &stats, sizeof(stats))) {
+        return -1;
+    }
+    return 0;
+}
+
+// Longest path that exec and open take, including the NUL.
+#define PATH_MAX 64
+
+// Replaces the calling program with the one at path (in the initramfs). Only
+// returns on failure (-1). The new program doesn't get any arguments.
+int sys_exec(const char *path) {
+    char kpath[PATH_MAX];
+    if (strncpy_from_user(kpath, path, PATH_MAX) < 0) {
+        return -1;
+    }
+    return do_exec(kpath);
+}
+
+// Like fork, but flags can only be CLONE_VM for now. The child starts with its
+// stack pointer at stack (unless it's 0, which keeps the caller's). Threads
+// (CLONE_VM) must pass their own stack. Returns the pid of the child (0 in the
+// child) or -1.
+int sys_clone(unsigned long flags, unsigned long stack) {
+    if ((flags & ~CLONE_VM) || ((flags & CLONE_VM) && !stack)) {
+        return -1;
+    }
+    return copy_process(flags, 0, 0, stack);
+}
+
+// FUTEX_WAIT: sleeps until woken up if *uaddr == val. FUTEX_WAKE: wakes up to
+// val tasks waiting on uaddr. See futex.c.
+int sys_futex(unsigned int *uaddr, int op, unsigned int val) {
+    if (op == FUTEX_WAIT) {
+        return futex_wait(uaddr, val);
+    }
+    if (op == FUTEX_WAKE) {
+        return futex_wake(uaddr, val);
+    }
+    return -1;
+}
+
+// Creates a pipe: fds[0] is the read end and fds[1] the write end. Returns 0
+// or -1.
+int sys_pipe(int *fds) { return do_pipe(fds); }
+
+// Reads up to count bytes from fd into buf. Blocks until there is something to
+// read. Returns the number of bytes read, 0 at the end of the file or -1.
+long sys_read(int fd, char *buf, unsigned long count) {
+    struct file *file = fget(fd);
+    if (!file) {
+        return -1;
+    }
+    long ret = vfs_read(file, buf, count);
+    fput(file);
+    return ret;
+}
+
+// Writes count bytes from buf to fd (sys_write only prints strings to the
+// console). Returns the number of bytes written or -1.
+long sys_write_fd(int fd, const char *buf, unsigned long count) {
+    struct file *file = fget(fd);
+    if (!file) {
+        return -1;
+    }
+    long ret = vfs_write(file, buf, count);
+    fput(file);
+    return ret;
+}
+
+int sys_close(int fd) { return close_fd(fd); }
+
+// Maps len bytes (see do_mmap). fd is ignored with MAP_ANONYMOUS. Returns the
+// address of the mapping or -1.
+long sys_mmap(unsigned long addr, unsigned long len, int prot, int flags,
+              int fd, unsigned long offset) {
+    struct file *file = 0;
+    if (!(flags & MAP_ANONYMOUS)) {
+        file = fget(fd);
+        if (!file) {
+            return -1;
+        }
+    }
+    long ret = do_mmap(addr, len, prot, flags, file, offset);
+    if (file) {
+        fput(file);
+    }
+    return ret;
+}
+
+int sys_munmap(unsigned long addr, unsigned long len) {
+    return do_munmap(current->mm, addr, len);
+}
+
+// Copies the name of a shared memory object from user space. Returns -1 if it
+// doesn't fit in SHM_NAME_MAX (rather than opening a truncated name).
+static int get_shm_name(char *kname, const char *name) {
+    long len = strncpy_from_user(kname, name, SHM_NAME_MAX + 1);
+    if (len < 0 || len >= SHM_NAME_MAX) {
+        return -1;
+    }
+    return 0;
+}
+
+// Opens (or creates, with size bytes) the shared memory object called name.
+// Returns an fd to mmap it, or -1.
+int sys_shm_open(const char *name, unsigned long size) {
+    char kname[SHM_NAME_MAX + 1];
+    if (get_shm_name(kname, name) < 0) {
+        return -1;
+    }
+    return shm_open(kname, size);
+}
+
+int sys_shm_unlink(const char *name) {
+    char kname[SHM_NAME_MAX + 1];
+    if (get_shm_name(kname, name) < 0) {
+        return -1;
+    }
+    return shm_unlink(kname);
+}
+
+// Returns the task pid (the caller if pid is 0) if the caller may change how
+// it's scheduled, or 0. That's any task of the caller's process or of one of
+// its descendants, but never a kernel thread: a SCHED_FIFO task could starve
+// kworker or ksoftirqd, or anything else outside of the caller's processes.
+static struct task_struct *find_sched_target(int pid) {
+    struct task_struct *p = find_task_by_pid(pid);
+    if (!p || (p->flags & PF_KTHREAD)) {
+        return 0;
+    }
+    // Walk up the parents. A ppid of 0 is the boot task (and
+    // find_task_by_pid(0) would be the caller), so we're done there.
+    struct task_struct *t = p;
+    for (int depth = 0; t && depth < NR_TASKS; depth++) {
+        if (t->tgid == current->tgid) {
+            return p;
+        }
+        if (t->ppid <= 0) {
+            break;
+        }
+        t = find_task_by_pid(t->ppid);
+    }
+    return 0;
+}
+
+// Sets the scheduling class and real-time priority (see sched_setscheduler)
+// of the task pid, or of the caller if pid is 0. Returns 0 or -1.
+int sys_sched_setscheduler(int pid, int policy, int priority) {
+    struct task_struct *p = find_sched_target(pid);
+    if (!p) {
+        return -1;
+    }
+    return sched_setscheduler(p, policy, priority);
+}
+
+// Sets the priority (the CPU share in the fair class) of the task pid, or of
+// the caller if pid is 0. Same rules as sys_sched_setscheduler. Returns 0 or
+// -1.
+int sys_setpriority(int pid, int priority) {
+    struct task_struct *p = find_sched_target(pid);
+    if (!p) {
+        return -1;
+    }
+    return sched_setpriority(p, priority);
+}
+
+// Copies the resource usage of the caller (RUSAGE_THREAD) or of its whole
+// process (RUSAGE_SELF) to buf. Returns 0 or -1.
+int sys_getrusage(int who, struct rusage *buf) {
+    struct rusage ru;
+    if (do_getrusage(who, &ru) < 0 || copy_to_user(buf, &ru, sizeof(ru))) {
+        return -1;
+    }
+    return 0;
+}
+
+// Opens the file path of the initramfs. flags must be O_RDONLY. Returns an fd
+// to read or mmap it, or -1.
+int sys_open(const char *path, int flags) {
+    char kpath[PATH_MAX];
+    if (flags != O_RDONLY || strncpy_from_user(kpath, path, PATH_MAX) < 0) {
+        return -1;
+    }
+    struct file *file = initramfs_open(kpath);
+    if (!file) {
+        return -1;
+    }
+    int fd = fd_install(file);
+    if (fd < 0) {
+        fput(file);
+    }
+    return fd;
+}
+
+// Moves the position of fd to offset, counted from whence (SEEK_*). Returns
+// the new position or -1 (e.g. fd is a pipe).
+long sys_lseek(int fd, long offset, int whence) {
+    struct file *file = fget(fd);
+    if (!file) {
+        return -1;
+    }
+    long ret = vfs_llseek(file, offset, whence);
+    fput(file);
+    return ret;
+}
+
+void *const sys_call_table[] = {sys_write,              sys_fork,
+                                sys_exit,               sys_getpid,
+                                sys_syscall_stats,      sys_nanosleep,
+                                sys_sched_stats,        sys_exec,
+                                sys_clone,              sys_futex,
+                                sys_pipe,               sys_read,
+                                sys_write_fd,           sys_close,
+                                sys_mmap,               sys_munmap,
+                                sys_shm_open,           sys_shm_unlink,
+                                sys_sched_setscheduler, sys_setpriority,
+                                sys_getrusage,          sys_open,
+                                sys_lseek};
+
+// Syscalls that can run in el0_svc_fast (entry.S). They must not block, call
+// schedule or rely on IRQs being enabled since they run with IRQs masked and
+// without a full pt_regs frame. A 0 entry means the syscall goes through the
+// regular el0_svc path. Nothing that touches user memory belongs here:
+// copy_to_user may fault a page in or copy it (copy-on-write), which can take
+// a while, and IRQs would stay masked all that time.
+void *const sys_fast_call_table[] = {
+    0, 0, 0, sys_getpid, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
@@ -1,34 +1,300 @@
-#include "peripherals/timer.h"
+#include "timer.h"
+#include "arm/sysregs.h"
+#include "irq.h"
+#include "percpu.h"
 #include "printf.h"
 #include "sched.h"
+#include "softirq.h"
+#include "spinlock.h"
 #include "utils.h"
+#include "vdso.h"
 
-// This constant defines how many ticks we want between timer interrupts.
-const unsigned int interval = 200000;
+// Every core has its own generic timer. We use the virtual timer (CNTV) which
+// compares cntvct_el0 against cntv_cval_el0 and raises a (level) interrupt
+// while the counter is past the compare value. The interrupt is routed through
+// the local controller of the core (see peripherals/local.h). Writing a
+// compare value in the future deasserts it, so that's our acknowledge.
 
-// Not SMP safe. Maybe having an array with the number of CPUs and modifying in
-// with the CPU number could solve it.
-unsigned int curVal = 0;
+unsigned long timer_freq;
 
-// The timer is a counter (TIMER_CLO) that increases by 1 every tick. We set a
-// compare register (Compare Register 1 in this case) that the timer compares
-// agains every tick. If the comparison matches, it generates an interrupt.
+// Counter cycles between ticks.
+static unsigned long tick_interval;
+
+// Per-CPU state of the timer. cntv_cval_el0 always holds the earliest of
+// next_tick and deadline.
+struct clock_event {
+    unsigned long next_tick;
+    unsigned long deadline;  // 0 if there's no deadline.
+    void (*deadline_fn)(void);
+};
+
+static DEFINE_PER_CPU(struct clock_event, clock_event);
+
+volatile unsigned long jiffies = 0;
+
+// Protects jiffies and the timer wheel. Taken from the timer interrupt, so
+// always with spin_lock_irqsave.
+static DEFINE_SPINLOCK(timer_lock);
+
+// Hierarchical timer wheel. A timer that expires less than TIMER_WHEEL_SIZE
+// ticks from now goes in level 0, indexed by its expiration tick. Timers further
+// away go in a higher level, where each slot covers TIMER_WHEEL_SIZE times more
+// ticks. Whenever level 0 wraps around, the next slot of level 1 is "cascaded":
+// its timers are re-added and land in level 0 (and so on for higher levels).
+// Adding and deleting a timer are O(1) since the slots are intrusive
+// doubly-linked lists. On each tick we only look at one slot of level 0.
+static struct list_head timer_wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SIZE];
+
+// The tick that the wheel processes next. It's behind jiffies only while
+// run_timers catches up.
+static unsigned long timer_jiffies;
+
+// Index into level n of the wheel for tick t.
+#define WHEEL_INDEX(t, n) \
+    (((t) >> ((n) * TIMER_WHEEL_BITS)) & TIMER_WHEEL_MASK)
+
+unsigned long timer_read_counter(void) {
+    unsigned long val;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(val));
+    return val;
+}
+
+// Whole seconds and the remainder are converted separately so that the
+// multiplication can't overflow.
+unsigned long ns_to_cycles(unsigned long ns) {
+    return (ns / NSEC_PER_SEC) * timer_freq +
+           (ns % NSEC_PER_SEC) * timer_freq / NSEC_PER_SEC;
+}
+
+unsigned long cycles_to_ns(unsigned long cycles) {
+    return (cycles / timer_freq) * NSEC_PER_SEC +
+           (cycles % timer_freq) * NSEC_PER_SEC / timer_freq;
+}
+
+static void clock_event_program(struct clock_event *ce) {
+    unsigned long cval = ce->next_tick;
+    if (ce->deadline && ce->deadline < cval) {
+        cval = ce->deadline;
+    }
+    asm volatile("msr cntv_cval_el0, %0" : : "r"(cval));
+}
+
+static void run_timers(void);
+
+// Starts the periodic tick on this CPU. The tick is programmed as an absolute
+// compare value that advances by tick_interval each time, so the time we take
+// to handle the interrupt doesn't make the tick drift.
 void timer_init(void) {
-    curVal = get32(TIMER_CLO);
-    curVal += interval;
-    put32(TIMER_C1, curVal);
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(timer_freq));
+    tick_interval = timer_freq / HZ;
+
+    struct clock_event *ce = this_cpu_ptr(&clock_event);
+    ce->next_tick = timer_read_counter() + tick_interval;
+    ce->deadline = 0;
+    clock_event_program(ce);
+
+    unsigned long ctl = CNTV_CTL_ENABLE;
+    asm volatile("msr cntv_ctl_el0, %0" : : "r"(ctl));
+    request_irq(IRQ_LOCAL_CNTV, handle_timer_irq, 0);
+
+    if (get_cpuid() == 0) {
+        for (int level = 0; level < TIMER_WHEEL_LEVELS; level++) {
+            for (int i = 0; i < TIMER_WHEEL_SIZE; i++) {
+                INIT_LIST_HEAD(&timer_wheel[level][i]);
+            }
+        }
+        timer_jiffies = jiffies;
+        open_softirq(TIMER_SOFTIRQ, run_timers);
+    }
+}
+
+void timer_set_deadline(unsigned long cval, void (*fn)(void)) {
+    unsigned long flags = local_irq_save();
+    struct clock_event *ce = this_cpu_ptr(&clock_event);
+    // 0 means "no deadline".
+    ce->deadline = cval ? cval : 1;
+    ce->deadline_fn = fn;
+    clock_event_program(ce);
+    local_irq_restore(flags);
 }
 
-void handle_timer_irq(void) {
-    curVal += interval;
+void timer_cancel_deadline(void) {
+    unsigned long flags = local_irq_save();
+    struct clock_event *ce = this_cpu_ptr(&clock_event);
+    ce->deadline = 0;
+    ce->deadline_fn = 0;
+    clock_event_program(ce);
+    local_irq_restore(flags);
+}
+
+void init_timer(struct timer_list *timer, void (*function)(unsigned long),
+                unsigned long data) {
+    INIT_LIST_HEAD(&timer->entry);
+    timer->expires = 0;
+    timer->function = function;
+    timer->data = data;
+}
 
-    // Update the TIMER_C1 to get interrupted again after interval ticks
-    put32(TIMER_C1, curVal);
+// Must be called with timer_lock held.
+static void internal_add_timer(struct timer_list *timer) {
+    unsigned long expires = timer->expires;
+    long delta = expires - timer_jiffies;
+    struct list_head *slot;
 
-    // We set this bit (2nd bit) in the TIMER_CS register to indicate that we
-    // handled that timer interrupt
-    put32(TIMER_CS, TIMER_CS_M1);
+    if (delta < 0) {
+        // Already expired: run it on the next tick.
+        slot = &timer_wheel[0][WHEEL_INDEX(timer_jiffies, 0)];
+    } else {
+        int level = 0;
+        while (level < TIMER_WHEEL_LEVELS - 1 &&
+               (unsigned long)delta >=
+                   (1UL << ((level + 1) * TIMER_WHEEL_BITS))) {
+            level++;
+        }
+
+        // Too far in the future for the wheel. Park it in the last slot that
+        // the top level can reach; it gets re-added when that slot cascades.
+        unsigned long max =
+            (1UL << (TIMER_WHEEL_LEVELS * TIMER_WHEEL_BITS)) - 1;
+        if ((unsigned long)delta > max) {
+            expires = timer_jiffies + max;
+        }
+        slot = &timer_wheel[level][WHEEL_INDEX(expires, level)];
+    }
+    list_add_tail(&timer->entry, slot);
+}
+
+// A timer whose expiration time already passed fires on the next tick.
+void add_timer(struct timer_list *timer) {
+    unsigned long flags = spin_lock_irqsave(&timer_lock);
+    internal_add_timer(timer);
+    spin_unlock_irqrestore(&timer_lock, flags);
+}
+
+// Changes the expiration time of a timer, whether it's pending or not. Returns
+// 1 if the timer was pending.
+int mod_timer(struct timer_list *timer, unsigned long expires) {
+    int ret = 0;
+    unsigned long flags = spin_lock_irqsave(&timer_lock);
+    if (timer_pending(timer)) {
+        list_del_init(&timer->entry);
+        ret = 1;
+    }
+    timer->expires = expires;
+    internal_add_timer(timer);
+    spin_unlock_irqrestore(&timer_lock, flags);
+    return ret;
+}
+
+// Returns 1 if the timer was pending, 0 if it had already fired (or was never
+// added).
+int del_timer(struct timer_list *timer) {
+    int ret = 0;
+    unsigned long flags = spin_lock_irqsave(&timer_lock);
+    if (timer_pending(timer)) {
+        list_del_init(&timer->entry);
+        ret = 1;
+    }
+    spin_unlock_irqrestore(&timer_lock, flags);
+    return ret;
+}
+
+// Re-adds the timers of slot index of level. They end up in lower levels since
+// they now expire closer than the granularity of this level. Returns index so
+// that run_timers knows whether this level wrapped around too.
+static int cascade(int level, int index) {
+    struct list_head list;
+    list_replace_init(&timer_wheel[level][index], &list);
+    while (!list_empty(&list)) {
+        struct timer_list *timer =
+            list_entry(list.next, struct timer_list, entry);
+        list_del_init(&timer->entry);
+        internal_add_timer(timer);
+    }
+    return index;
+}
+
+// Runs the timers that expired since the last call (TIMER_SOFTIRQ, raised by
+// every tick on CPU 0). Expired timers are moved to a local list under the
+// lock, and their functions run after dropping it so that they can add timers
+// themselves. They run with IRQs enabled.
+static void run_timers(void) {
+    unsigned long flags = spin_lock_irqsave(&timer_lock);
+
+    while ((long)(jiffies - timer_jiffies) >= 0) {
+        struct list_head expired;
+        int index = WHEEL_INDEX(timer_jiffies, 0);
+
+        // Level 0 wrapped around: bring down the next slot of level 1, and of
+        // level 2 if level 1 wrapped too, and so on.
+        if (!index) {
+            for (int level = 1; level < TIMER_WHEEL_LEVELS; level++) {
+                if (cascade(level, WHEEL_INDEX(timer_jiffies, level))) {
+                    break;
+                }
+            }
+        }
+        timer_jiffies++;
+
+        list_replace_init(&timer_wheel[0][index], &expired);
+        while (!list_empty(&expired)) {
+            struct timer_list *timer =
+                list_entry(expired.next, struct timer_list, entry);
+            // Unlink before calling the function since the owner may reuse
+            // (or free) the timer as soon as it's woken up.
+            list_del_init(&timer->entry);
+            void (*function)(unsigned long) = timer->function;
+            unsigned long data = timer->data;
+
+            spin_unlock_irqrestore(&timer_lock, flags);
+            function(data);
+            flags = spin_lock_irqsave(&timer_lock);
+        }
+    }
+    spin_unlock_irqrestore(&timer_lock, flags);
+}
+
+void handle_timer_irq(int irq, void *data) {
+    struct clock_event *ce = this_cpu_ptr(&clock_event);
+    unsigned long now = timer_read_counter();
+    void (*deadline_fn)(void) = 0;
+    int tick = 0;
+
+    if (now >= ce->next_tick) {
+        // If we were late enough to miss whole ticks, skip them instead of
+        // firing them back to back. The tick stays aligned to the same phase.
+        unsigned long missed = (now - ce->next_tick) / tick_interval;
+        ce->next_tick += (missed + 1) * tick_interval;
+        tick = 1;
+    }
+
+    if (ce->deadline && now >= ce->deadline) {
+        deadline_fn = ce->deadline_fn;
+        ce->deadline = 0;
+        ce->deadline_fn = 0;
+    }
+
+    // Both values are now in the future, which also clears the interrupt.
+    clock_event_program(ce);
+
+    if (deadline_fn) {
+        deadline_fn();
+    }
+
+    if (!tick) {
+        return;
+    }
+
+    // jiffies and the timer wheel are global, so only CPU 0 advances them. The
+    // timers themselves run in the softirq, after this handler. The scheduler
+    // tick runs on every CPU.
+    if (get_cpuid() == 0) {
+        unsigned long flags = spin_lock_irqsave(&timer_lock);
+        jiffies++;
+        spin_unlock_irqrestore(&timer_lock, flags);
+        raise_softirq(TIMER_SOFTIRQ);
+    }
 
     // Notify scheduler of tick
     timer_tick();
-}
\ No newline at end of file
+}
@@ -0,0 +1,164 @@
+#include "uaccess.h"
+#include "arm/mmu.h"
+#include "mm.h"
+#include "sched.h"
+
+// Translates a user virtual address of the current task to its kernel virtual
+// address, and takes a reference to the page (see put_user_kva). Returns 0 if
+// the task isn't allowed to access it (it's not part of one of its VMAs, the
+// VMA is PROT_NONE, or write is set and the VMA is read-only). Pages that the
+// task didn't touch yet are faulted in, just like if the task had accessed
+// them itself, and writing to a copy-on-write page gets the task its own copy.
+// Note that the vDSO page is not part of a VMA, so it is deliberately not
+// accessible through here.
+unsigned long user_to_kernel_va(unsigned long va, int write) {
+    // Kernel addresses have the top 16 bits set. These are never valid user
+    // addresses.
+    if (va >= VA_START) {
+        return 0;
+    }
+
+    struct mm_struct *mm = current->mm;
+    if (!mm) {
+        return 0;
+    }
+
+    // The page is looked up and its reference taken under page_table_lock:
+    // another thread of the task may be unmapping or replacing it (munmap,
+    // do_wp_page, remap_user_page), and the reference keeps it from being
+    // freed while the caller uses it. The second try comes after faulting the
+    // page in.
+    for (int tries = 0; tries < 2; tries++) {
+        spin_lock(&mm->page_table_lock);
+        struct vm_area_struct *vma = find_vma(mm, va);
+        if (!vma || !(vma->vm_flags & VM_READ) ||
+            (write && !(vma->vm_flags & VM_WRITE))) {
+            spin_unlock(&mm->page_table_lock);
+            return 0;
+        }
+
+        unsigned long pte;
+        unsigned long pa = user_virt_to_phys(mm, va, &pte);
+        if (pa && (!write || pte_write(pte))) {
+            get_page(pa & PAGE_MASK);
+            spin_unlock(&mm->page_table_lock);
+            return pa + VA_START;
+        }
+        spin_unlock(&mm->page_table_lock);
+
+        // Not mapped yet, or mapped read-only because the page is shared
+        // copy-on-write (see do_wp_page).
+
+        if (handle_mm_fault(mm, va, write ? FAULT_FLAG_WRITE : 0) < 0) {
+            return 0;
+        }
+    }
+    return 0;
+}
+
+void put_user_kva(unsigned long kva) {
+    free_page((kva - VA_START) & PAGE_MASK);
+}
+
+int access_ok(const void *addr, unsigned long size) {
+    unsigned long start = (unsigned long)addr;
+    unsigned long end = start + size;
+
+    // Overflow (wrapping around the address space).
+    if (end < start) {
+        return 0;
+    }
+
+    for (unsigned long va = start & PAGE_MASK; va < end; va += PAGE_SIZE) {
+        unsigned long kva = user_to_kernel_va(va, 0);
+        if (!kva) {
+            return 0;
+        }
+        put_user_kva(kva);
+    }
+    return 1;
+}
+
+// Copies page by page since consecutive user pages don't need to be
+// consecutive in physical memory.
+unsigned long copy_from_user(void *to, const void *from, unsigned long n) {
+    unsigned long dst = (unsigned long)to;
+    unsigned long src = (unsigned long)from;
+
+    while (n > 0) {
+        unsigned long kva = user_to_kernel_va(src, 0);
+        if (!kva) {
+            break;
+        }
+
+        unsigned long chunk = PAGE_SIZE - (src & ~PAGE_MASK);
+        if (chunk > n) {
+            chunk = n;
+        }
+
+        memcpy(dst, kva, chunk);
+        put_user_kva(kva);
+        dst += chunk;
+        src += chunk;
+        n -= chunk;
+    }
+    return n;
+}
+
+unsigned long copy_to_user(void *to, const void *from, unsigned long n) {
+    unsigned long dst = (unsigned long)to;
+    unsigned long src = (unsigned long)from;
+
+    while (n > 0) {
+        unsigned long kva = user_to_kernel_va(dst, 1);
+        if (!kva) {
+            break;
+        }
+
+        unsigned long chunk = PAGE_SIZE - (dst & ~PAGE_MASK);
+        if (chunk > n) {
+            chunk = n;
+        }
+
+        memcpy(kva, src, chunk);
+        put_user_kva(kva);
+        dst += chunk;
+        src += chunk;
+        n -= chunk;
+    }
+    return n;
+}
+
+long strncpy_from_user(char *dst, const char *src, long count) {
+    unsigned long va = (unsigned long)src;
+    long len = 0;
+
+    if (count <= 0) {
+        return -1;
+    }
+
+    while (len < count - 1) {
+        // Only translate once per page.
+        unsigned long kva = user_to_kernel_va(va, 0);
+        if (!kva) {
+            return -1;
+        }
+
+        const char *p = (const char *)kva;
+        unsigned long left = PAGE_SIZE - (va & ~PAGE_MASK);
+        while (left-- > 0 && len < count - 1) {
+            char c = *p++;
+            dst[len] = c;
+            if (c == '\0') {
+                put_user_kva(kva);
+                return len;
+            }
+            len++;
+            va++;
+        }
+        put_user_kva(kva);
+    }
+
+    dst[len] = '\0';
+    return len;
+}
@@ -1,7 +1,36 @@
+#include "uart.h"
+#include "dma.h"
+#include "mm.h"
+#include "peripherals/dma.h"
 #include "peripherals/uart.h"
 #include "peripherals/gpio.h"
+#include "spinlock.h"
 #include "utils.h"
 
+// Transmission over DMA (see uart_enable_tx_dma). uart_write copies the text
+// into one of UART_TX_SLOTS buffers, a character per word (DR takes one per
+// write, and the engine writes whole words), starts the transfer and returns.
+// The engine feeds the transmit FIFO as it drains, and the completion
+// interrupt starts the next buffer, so the CPU only waits for the UART when
+// every buffer is queued, instead of for every character (87us at 115200
+// baud).
+#define UART_TX_SLOTS 4
+#define UART_TX_SLOT_CHARS (PAGE_SIZE / UART_TX_SLOTS / 4)
+// Shorter writes (echo, prompts) aren't worth a transfer.
+#define UART_DMA_MIN 32
+
+struct uart_tx {
+    struct dma_chan *chan;
+    unsigned int *bufs;  // UART_TX_SLOTS buffers of UART_TX_SLOT_CHARS words
+    unsigned int head;   // Next slot to fill.
+    unsigned int tail;   // Oldest queued slot.
+    int active;          // The tail slot is being sent.
+};
+
+static struct uart_tx uart_tx;
+// Protects uart_tx.
+static DEFINE_SPINLOCK(uart_tx_lock);
+
 void uart_init() {
     // Formula from BCM2837-ARM-Peripherals.-.Revised.-.V2-1.pdf
     // Page 183
@@ -81,7 +110,80 @@ void uart_init() {
     put32(UART_CR, (1 << 9) | (1 << 8) | 1);
 }
 
+// Retires the slot that the channel finished with and starts the next one.
+// Must be called with uart_tx_lock held.
+static void uart_tx_kick(void) {
+    if (uart_tx.active) {
+        if (dma_busy(uart_tx.chan)) {
+            return;
+        }
+        uart_tx.active = 0;
+        uart_tx.tail++;
+    }
+    if (uart_tx.tail != uart_tx.head) {
+        dma_start(uart_tx.chan, uart_tx.tail % UART_TX_SLOTS, 1, 1);
+        uart_tx.active = 1;
+    }
+}
+
+static void uart_tx_done(struct dma_chan *chan, int error, void *data) {
+    spin_lock(&uart_tx_lock);
+    uart_tx_kick();
+    spin_unlock(&uart_tx_lock);
+}
+
+// Waits until the channel is done with the slot it's sending. A full slot
+// takes about 22ms at 115200 baud, so the lock is dropped and IRQs go back to
+// the caller's state meanwhile: timers and interrupts keep running. Doesn't
+// wait for the completion interrupt, which may be masked on this CPU (the
+// caller retires the slot with uart_tx_kick). Called with uart_tx_lock held
+// (flags from spin_lock_irqsave), and returns with it held again and the new
+// flags.
+static unsigned long uart_tx_wait(unsigned long flags) {
+    spin_unlock_irqrestore(&uart_tx_lock, flags);
+    while (dma_busy(uart_tx.chan))
+        ;
+    return spin_lock_irqsave(&uart_tx_lock);
+}
+
+// Waits until the queued text is in the transmit FIFO, so that what is sent
+// without DMA comes after it.
+void uart_flush(void) {
+    if (!__atomic_load_n(&uart_tx.chan, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+    unsigned long flags = spin_lock_irqsave(&uart_tx_lock);
+    while (uart_tx.tail != uart_tx.head) {
+        flags = uart_tx_wait(flags);
+        uart_tx_kick();
+    }
+    spin_unlock_irqrestore(&uart_tx_lock, flags);
+}
+
+// Sends what uart_write gets over DMA from now on. Returns 0, or -1 if
+// there's no channel (the UART keeps working without it).
+int uart_enable_tx_dma(void) {
+    struct dma_chan *chan = dma_request_channel();
+    if (!chan) {
+        return -1;
+    }
+    unsigned long bufs = allocate_kernel_page();
+    if (!bufs) {
+        dma_release_channel(chan);
+        return -1;
+    }
+
+    uart_tx.bufs = (unsigned int *)bufs;
+    dma_set_callback(chan, uart_tx_done, 0);
+    put32(UART_DMACR, get32(UART_DMACR) | UART_DMACR_TXDMAE);
+    __atomic_store_n(&uart_tx.chan, chan, __ATOMIC_RELEASE);
+    return 0;
+}
+
 void uart_send(char c) {
+    if (uart_tx.head != __atomic_load_n(&uart_tx.tail, __ATOMIC_RELAXED)) {
+        uart_flush();
+    }
     // while transmit FIFO is full (page 181)
     while (get32(UART_FR) & (1 << 5))
         ;
@@ -95,6 +197,24 @@ char uart_recv() {
     return get32(UART_DR) & 0xFF;
 }
 
+// Returns 1 and stores the next received character in c, or 0 if the receive
+// FIFO is empty. Doesn't wait.
+int uart_try_recv(char *c) {
+    if (get32(UART_FR) & (1 << 4)) {
+        return 0;
+    }
+    *c = get32(UART_DR) & 0xFF;
+    return 1;
+}
+
+// Makes the UART raise IRQ_UART when characters arrive. The handler should
+// drain the FIFO with uart_try_recv and then call uart_ack_rx_irq.
+void uart_enable_rx_irq(void) {
+    put32(UART_IMSC, get32(UART_IMSC) | UART_INT_RX | UART_INT_RT);
+}
+
+void uart_ack_rx_irq(void) { put32(UART_ICR, UART_INT_RX | UART_INT_RT); }
+
 void uart_send_string(char* str) {
     for (char c = *str; c != '\0'; c = *(++str)) {
         uart_send(c);
@@ -141,3 +261,40 @@ void send_long_as_hex_string(long number) {
 void putc(void *p, char c) {
     uart_send(c);
 }
+
+// printf's output function (see init_printf). Long writes go over DMA once
+// uart_enable_tx_dma is done.
+void uart_write(void *p, const char *s, unsigned long len) {
+    if (len < UART_DMA_MIN ||
+        !__atomic_load_n(&uart_tx.chan, __ATOMIC_ACQUIRE)) {
+        for (unsigned long i = 0; i < len; i++) {
+            uart_send(s[i]);
+        }
+        return;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&uart_tx_lock);
+    while (len) {
+        // Every slot is queued: wait for the oldest one to go out. Another
+        // writer may queue text while we wait, so ours can end up split.
+        while (uart_tx.head - uart_tx.tail == UART_TX_SLOTS) {
+            flags = uart_tx_wait(flags);
+            uart_tx_kick();
+        }
+
+        int slot = uart_tx.head % UART_TX_SLOTS;
+        unsigned int *buf = uart_tx.bufs + slot * UART_TX_SLOT_CHARS;
+        unsigned long n = len < UART_TX_SLOT_CHARS ? len : UART_TX_SLOT_CHARS;
+        for (unsigned long i = 0; i < n; i++) {
+            buf[i] = (unsigned char)s[i];
+        }
+        dcache_clean_range((unsigned long)buf, n * 4);
+        dma_prep_mem_to_dev(uart_tx.chan, slot, (unsigned long)buf - VA_START,
+                            UART_DR, n * 4, DMA_DREQ_UART_TX);
+        uart_tx.head++;
+        s += n;
+        len -= n;
+        uart_tx_kick();
+    }
+    spin_unlock_irqrestore(&uart_tx_lock, flags);
+}
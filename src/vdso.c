@@ -0,0 +1,49 @@
+#include "vdso.h"
+#include "arm/mmu.h"
+#include "mm.h"
+#include "sched.h"
+#include "utils.h"
+
+// Calibration shared by all the vDSO pages. Computed once in vdso_init.
+static unsigned long clock_base;
+static unsigned long clock_freq;
+static unsigned long clock_mult;
+
+// Lets EL0 read cntvct_el0 (bit 1 of CNTKCTL_EL1, EL0VCTEN) so user space can
+// compute the time without a syscall, and computes the clock calibration.
+void vdso_init(void) {
+    unsigned long cntkctl;
+    asm volatile("mrs %0, cntkctl_el1" : "=r"(cntkctl));
+    cntkctl |= (1 << 1);
+    asm volatile("msr cntkctl_el1, %0" : : "r"(cntkctl));
+
+    asm volatile("mrs %0, cntfrq_el0" : "=r"(clock_freq));
+    asm volatile("mrs %0, cntvct_el0" : "=r"(clock_base));
+    if (clock_freq) {
+        clock_mult = (NSEC_PER_SEC << VDSO_CLOCK_SHIFT) / clock_freq;
+    }
+}
+
+// Allocates the vDSO page of mm, fills it and maps it read-only at
+// VDSO_DATA_ADDR. pid is the process the mm belongs to (its threads share the
+// page). The page is freed with the mm (see mmput).
+int vdso_setup(struct mm_struct *mm, int pid) {
+    unsigned long page = get_free_page();
+    if (!page) {
+        return -1;
+    }
+
+    struct vdso_data *data = (struct vdso_data *)(page + VA_START);
+    data->pid = pid;
+    data->clock_base = clock_base;
+    data->clock_freq = clock_freq;
+    data->clock_mult = clock_mult;
+
+    if (map_page_prot(mm, VDSO_DATA_ADDR, page, MMU_PTE_FLAGS_RO) < 0) {
+        free_page(page);
+        return -1;
+    }
+
+    mm->vdso_page = page;
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include "workqueue.h"
+#include "fork.h"
+#include "percpu.h"
+#include "printf.h"
+#include "sched.h"
+#include "spinlock.h"
+
+// Every CPU has a worker thread with its own list of work, so queuing never
+// contends with other CPUs. Work runs on the CPU that queued it, in order.
+struct worker_pool {
+    // Protects worklist and the pending flag of the work in it. Taken from
+    // interrupt handlers, so always with spin_lock_irqsave.
+    spinlock_t lock;
+    struct list_head worklist;
+    struct wait_queue_head wait;
+    int online;
+
+    // Statistics.
+    unsigned long queued;
+    unsigned long executed;
+};
+
+static DEFINE_PER_CPU(struct worker_pool, worker_pool);
+
+static void worker_thread(struct worker_pool *pool) {
+    while (1) {
+        wait_event(pool->wait, !list_empty(&pool->worklist));
+
+        unsigned long flags = spin_lock_irqsave(&pool->lock);
+        struct work_struct *work =
+            list_entry(pool->worklist.next, struct work_struct, entry);
+        list_del_init(&work->entry);
+        // Cleared before it runs, so that it can queue itself again.
+        work->pending = 0;
+        spin_unlock_irqrestore(&pool->lock, flags);
+
+        work->func(work);
+        pool->executed++;
+    }
+}
+
+// Sets up the pool of this CPU and starts its worker. Returns 0 or -1.
+int workqueue_init(void) {
+    struct worker_pool *pool = this_cpu_ptr(&worker_pool);
+    spin_lock_init(&pool->lock, "worker_pool");
+    INIT_LIST_HEAD(&pool->worklist);
+    init_waitqueue_head(&pool->wait);
+    pool->online = 1;
+
+    if (copy_process(PF_KTHREAD, (unsigned long)&worker_thread,
+                     (unsigned long)pool, 0) < 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// Queues work on this CPU's worker. Can be called from any context. Returns 1
+// if the work was queued or 0 if it was already pending (or the workqueue
+// isn't set up).
+int queue_work(struct work_struct *work) {
+    struct worker_pool *pool = this_cpu_ptr(&worker_pool);
+    if (!pool->online) {
+        return 0;
+    }
+
+    unsigned long flags = spin_lock_irqsave(&pool->lock);
+    if (work->pending) {
+        spin_unlock_irqrestore(&pool->lock, flags);
+        return 0;
+    }
+    work->pending = 1;
+    list_add_tail(&work->entry, &pool->worklist);
+    pool->queued++;
+    spin_unlock_irqrestore(&pool->lock, flags);
+
+    wake_up(&pool->wait);
+    return 1;
+}
+
+void workqueue_stats_dump(void) {
+    printf("workqueue: cpu: queued / executed\r\n");
+    for (int cpu = 0; cpu < NR_CPUS; cpu++) {
+        struct worker_pool *pool = per_cpu_ptr(&worker_pool, cpu);
+        if (pool->online) {
+            printf("%d: %lu / %lu\r\n", cpu, pool->queued, pool->executed);
+        }
+    }
+}
@@ -0,0 +1,158 @@
+#include "print.h"
+#include "user_sys.h"
+
+// Wakeup latency benchmark in the style of cyclictest. Run it with the
+// "init=/cyclictest" boot option. A task sleeps for INTERVAL_NS over and over
+// and measures how late it wakes up: the time between when its sleep should
+// have ended and when it gets to run again. It runs three times:
+//   - idle: nothing else wants the CPU.
+//   - load, SCHED_NORMAL: NR_LOAD processes keep the CPU busy (in user space
+//     and in syscalls). The sleeper only preempts them if the fair class
+//     thinks it's owed CPU time, otherwise it waits for a tick.
+//   - load, SCHED_FIFO: same load, but the sleeper is a real-time task, so it
+//     preempts the load as soon as its timer fires.
+// The latencies are printed in microseconds. The worst case is what matters.
+// At the end, the sleeper prints its own resource usage: almost all of its
+// context switches should be voluntary (it goes to sleep).
+
+#define INTERVAL_NS 1000000UL
+#define NR_LOOPS 1000
+// A run stops after this long even if it didn't get NR_LOOPS samples (without
+// real-time priority, every sample can take a few ticks).
+#define MAX_RUN_NS 5000000000UL
+#define NR_LOAD 3
+#define RT_PRIORITY 80
+
+#define LOAD_BUF_SIZE 512
+
+// Shared with the load processes (MAP_SHARED), which stop once stop is set.
+struct control {
+    unsigned int stop;
+};
+
+struct result {
+    unsigned long samples;
+    unsigned long min;
+    unsigned long max;
+    unsigned long total;
+};
+
+// Busy work for a load process: some computation and a pipe round trip (to
+// itself), so that it spends time in the kernel too.
+static void load(struct control *ctl) {
+    static char buf[LOAD_BUF_SIZE];
+    int fds[2];
+    if (call_sys_pipe(fds) < 0) {
+        die("cyclictest: pipe failed\r\n");
+    }
+
+    unsigned long x = call_sys_getpid();
+    while (!__atomic_load_n(&ctl->stop, __ATOMIC_RELAXED)) {
+        for (int i = 0; i < 1000; i++) {
+            x = x * 6364136223846793005UL + 1442695040888963407UL;
+        }
+        buf[0] = (char)x;
+        call_sys_write_fd(fds[1], buf, sizeof(buf));
+        call_sys_read(fds[0], buf, sizeof(buf));
+    }
+    call_sys_exit();
+}
+
+static void measure(struct result *res) {
+    res->samples = 0;
+    res->min = ~0UL;
+    res->max = 0;
+    res->total = 0;
+
+    unsigned long start = vdso_clock_ns();
+    for (int i = 0; i < NR_LOOPS; i++) {
+        unsigned long expected = vdso_clock_ns() + INTERVAL_NS;
+        call_sys_nanosleep(INTERVAL_NS);
+        unsigned long now = vdso_clock_ns();
+
+        unsigned long latency = now > expected ? now - expected : 0;
+        res->samples++;
+        res->total += latency;
+        if (latency < res->min) {
+            res->min = latency;
+        }
+        if (latency > res->max) {
+            res->max = latency;
+        }
+        if (now - start > MAX_RUN_NS) {
+            break;
+        }
+    }
+}
+
+static void report(char *name, struct result *res) {
+    call_sys_write(name);
+    call_sys_write(": ");
+    print_number(res->samples);
+    call_sys_write(" samples, latency (us) min ");
+    print_number(res->min / 1000);
+    call_sys_write(" avg ");
+    print_number(res->total / res->samples / 1000);
+    call_sys_write(" max ");
+    print_number(res->max / 1000);
+    call_sys_write("\r\n");
+}
+
+static void report_usage(void) {
+    struct rusage ru;
+    if (call_sys_getrusage(RUSAGE_THREAD, &ru) < 0) {
+        die("cyclictest: getrusage failed\r\n");
+    }
+    call_sys_write("usage: user ");
+    print_number(ru.utime / 1000000);
+    call_sys_write(" ms, sys ");
+    print_number(ru.stime / 1000000);
+    call_sys_write(" ms, voluntary switches ");
+    print_number(ru.nvcsw);
+    call_sys_write(", involuntary ");
+    print_number(ru.nivcsw);
+    call_sys_write("\r\n");
+}
+
+int main() {
+    struct result res;
+
+    call_sys_write("cyclictest: interval ");
+    print_number(INTERVAL_NS / 1000);
+    call_sys_write(" us, ");
+    print_number(NR_LOAD);
+    call_sys_write(" load processes\r\n");
+
+    measure(&res);
+    report("idle", &res);
+
+    struct control *ctl = call_sys_mmap(0, sizeof(*ctl), PROT_READ | PROT_WRITE,
+                                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (ctl == MAP_FAILED) {
+        die("cyclictest: mmap failed\r\n");
+    }
+    // Forked before we change our policy, so the load stays SCHED_NORMAL.
+    for (int i = 0; i < NR_LOAD; i++) {
+        int pid = call_sys_fork();
+        if (pid < 0) {
+            die("cyclictest: fork failed\r\n");
+        }
+        if (pid == 0) {
+            load(ctl);
+        }
+    }
+
+    measure(&res);
+    report("load, SCHED_NORMAL", &res);
+
+    if (call_sys_sched_setscheduler(0, SCHED_FIFO, RT_PRIORITY) < 0) {
+        die("cyclictest: sched_setscheduler failed\r\n");
+    }
+    measure(&res);
+    call_sys_sched_setscheduler(0, SCHED_NORMAL, 0);
+    report("load, SCHED_FIFO", &res);
+
+    __atomic_store_n(&ctl->stop, 1, __ATOMIC_RELAXED);
+    report_usage();
+    return 0;
+}
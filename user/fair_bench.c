@@ -0,0 +1,193 @@
+#include "print.h"
+#include "timer.h"
+#include "user_sys.h"
+
+// Fairness benchmark for the SCHED_NORMAL class. Run it with the
+// "init=/fair_bench" boot option. CPU bound workers count how many units of
+// work they get done in RUN_NS; since a unit always takes the same time, the
+// counts tell how the CPU was shared. Two runs:
+//   - weights: NR_WEIGHTS workers with different priorities. Each one should
+//     get a share proportional to its priority.
+//   - tick dodger: a worker that sleeps right before every tick and wakes up
+//     right after it, next to a plain CPU hog. A scheduler that charges whole
+//     ticks to whoever is running when they happen never charges the dodger.
+//     With exact accounting, both get the same share.
+// Shares are printed in percent.
+
+#define RUN_NS 10000000000UL
+#define TICK_NS NSEC_PER_JIFFY
+#define MAX_WORKERS 4
+
+static int weights[] = {5, 15, 30};
+#define NR_WEIGHTS (sizeof(weights) / sizeof(weights[0]))
+
+// Shared with the workers (MAP_SHARED). Workers wait for go, count until stop
+// and decrement running before they exit.
+struct control {
+    unsigned int go;
+    unsigned int stop;
+    unsigned int running;
+    unsigned long counts[MAX_WORKERS];
+};
+
+// One unit of work.
+static unsigned long work(unsigned long x) {
+    for (int i = 0; i < 1000; i++) {
+        x = x * 6364136223846793005UL + 1442695040888963407UL;
+    }
+    return x;
+}
+
+static void wait_for_go(struct control *ctl) {
+    while (!__atomic_load_n(&ctl->go, __ATOMIC_ACQUIRE)) {
+        call_sys_futex(&ctl->go, FUTEX_WAIT, 0);
+    }
+}
+
+static void worker_exit(struct control *ctl, unsigned long x) {
+    // Keep the work from being optimized away.
+    if (x == 42) {
+        call_sys_write("");
+    }
+    __atomic_sub_fetch(&ctl->running, 1, __ATOMIC_SEQ_CST);
+    call_sys_futex(&ctl->running, FUTEX_WAKE, 1);
+    call_sys_exit();
+}
+
+static void hog(struct control *ctl, int id) {
+    unsigned long x = id;
+    wait_for_go(ctl);
+    while (!__atomic_load_n(&ctl->stop, __ATOMIC_RELAXED)) {
+        x = work(x);
+        ctl->counts[id]++;
+    }
+    worker_exit(ctl, x);
+}
+
+// Works until just before the next tick and sleeps until just after it, so
+// it's never running when a tick happens.
+static void dodger(struct control *ctl, int id) {
+    unsigned long x = id;
+    wait_for_go(ctl);
+
+    // Ticks are periodic, so one tick tells us when all the others happen.
+    unsigned long ticks = vdso_ticks();
+    while (vdso_ticks() == ticks) {
+    }
+    unsigned long phase = vdso_clock_ns();
+
+    while (!__atomic_load_n(&ctl->stop, __ATOMIC_RELAXED)) {
+        unsigned long now = vdso_clock_ns();
+        unsigned long next_tick =
+            phase + ((now - phase) / TICK_NS + 1) * TICK_NS;
+        while (vdso_clock_ns() < next_tick - TICK_NS / 10) {
+            x = work(x);
+            ctl->counts[id]++;
+        }
+        now = vdso_clock_ns();
+        if (now < next_tick + TICK_NS / 20) {
+            call_sys_nanosleep(next_tick + TICK_NS / 20 - now);
+        }
+    }
+    worker_exit(ctl, x);
+}
+
+// Starts the workers (set up by the caller), lets them run for RUN_NS and
+// copies their counts to counts.
+static void run(struct control *ctl, int nr_workers, unsigned long *counts) {
+    __atomic_store_n(&ctl->go, 1, __ATOMIC_RELEASE);
+    call_sys_futex(&ctl->go, FUTEX_WAKE, nr_workers);
+
+    call_sys_nanosleep(RUN_NS);
+    for (int i = 0; i < nr_workers; i++) {
+        counts[i] = __atomic_load_n(&ctl->counts[i], __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&ctl->stop, 1, __ATOMIC_RELAXED);
+
+    unsigned int running;
+    while ((running = __atomic_load_n(&ctl->running, __ATOMIC_SEQ_CST))) {
+        call_sys_futex(&ctl->running, FUTEX_WAIT, running);
+    }
+}
+
+static struct control *new_control(int nr_workers) {
+    struct control *ctl = call_sys_mmap(0, sizeof(*ctl), PROT_READ | PROT_WRITE,
+                                        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (ctl == MAP_FAILED) {
+        die("fair_bench: mmap failed\r\n");
+    }
+    ctl->running = nr_workers;
+    return ctl;
+}
+
+static int start_worker(void) {
+    int pid = call_sys_fork();
+    if (pid < 0) {
+        die("fair_bench: fork failed\r\n");
+    }
+    return pid;
+}
+
+static void print_share(char *name, unsigned long part, unsigned long total) {
+    call_sys_write(name);
+    print_number(total ? part * 100 / total : 0);
+    call_sys_write("%");
+}
+
+static void run_weights(void) {
+    unsigned long counts[MAX_WORKERS];
+    unsigned long total = 0, total_weight = 0;
+    struct control *ctl = new_control(NR_WEIGHTS);
+
+    for (int i = 0; i < NR_WEIGHTS; i++) {
+        if (start_worker() == 0) {
+            if (call_sys_setpriority(0, weights[i]) < 0) {
+                die("fair_bench: setpriority failed\r\n");
+            }
+            hog(ctl, i);
+        }
+        total_weight += weights[i];
+    }
+    run(ctl, NR_WEIGHTS, counts);
+
+    for (int i = 0; i < NR_WEIGHTS; i++) {
+        total += counts[i];
+    }
+    for (int i = 0; i < NR_WEIGHTS; i++) {
+        call_sys_write("priority ");
+        print_number(weights[i]);
+        print_share(": expected ", weights[i], total_weight);
+        print_share(", got ", counts[i], total);
+        call_sys_write("\r\n");
+    }
+    call_sys_munmap(ctl, sizeof(*ctl));
+}
+
+static void run_dodger(void) {
+    unsigned long counts[MAX_WORKERS];
+    struct control *ctl = new_control(2);
+
+    if (start_worker() == 0) {
+        hog(ctl, 0);
+    }
+    if (start_worker() == 0) {
+        dodger(ctl, 1);
+    }
+    run(ctl, 2, counts);
+
+    unsigned long total = counts[0] + counts[1];
+    print_share("tick dodger: expected 50%, got ", counts[1], total);
+    print_share(" (hog ", counts[0], total);
+    call_sys_write(")\r\n");
+    call_sys_munmap(ctl, sizeof(*ctl));
+}
+
+int main() {
+    call_sys_write("fair_bench: ");
+    print_number(RUN_NS / 1000000000UL);
+    call_sys_write(" s per run\r\n");
+
+    run_weights();
+    run_dodger();
+    return 0;
+}
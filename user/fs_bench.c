@@ -0,0 +1,103 @@
+#include "print.h"
+#include "user_sys.h"
+
+// Reads a file of the initramfs with read and with mmap. Run it with the
+// "init=/fs_bench" boot option. Both go through the page cache (see
+// src/filemap.c): read copies from the cached pages into our buffer, while
+// mmap maps those same pages, so after the first run the mapped file is read
+// in place without a syscall or a copy. The first run of each also shows what
+// filling the cache and faulting the pages in costs.
+
+#define PAGE_SIZE 4096
+#define FILE_PATH "/init"
+#define RUNS 16
+
+static char buf[PAGE_SIZE];
+// Keeps the compiler from dropping the checksums that nobody looks at.
+static volatile unsigned long sink;
+
+static unsigned long checksum(const unsigned char *p, unsigned long len,
+                              unsigned long sum) {
+    for (unsigned long i = 0; i < len; i++) {
+        sum = sum * 31 + p[i];
+    }
+    return sum;
+}
+
+static unsigned long read_file(int fd) {
+    if (call_sys_lseek(fd, 0, SEEK_SET) != 0) {
+        die("fs_bench: lseek failed\r\n");
+    }
+    unsigned long sum = 0;
+    long n;
+    while ((n = call_sys_read(fd, buf, sizeof(buf))) > 0) {
+        sum = checksum((unsigned char *)buf, n, sum);
+    }
+    if (n < 0) {
+        die("fs_bench: read failed\r\n");
+    }
+    return sum;
+}
+
+static void report(char *name, unsigned long ns, unsigned long size) {
+    call_sys_write(name);
+    call_sys_write(": ");
+    print_number(ns / 1000);
+    call_sys_write(" us, ");
+    print_number(ns * 1024 / size);
+    call_sys_write(" ns/KB\r\n");
+}
+
+int main() {
+    int fd = call_sys_open(FILE_PATH, O_RDONLY);
+    if (fd < 0) {
+        die("fs_bench: can't open " FILE_PATH "\r\n");
+    }
+    long size = call_sys_lseek(fd, 0, SEEK_END);
+    if (size <= 0) {
+        die("fs_bench: lseek failed\r\n");
+    }
+    call_sys_write("fs_bench: " FILE_PATH ", ");
+    print_number(size);
+    call_sys_write(" bytes\r\n");
+
+    unsigned long start = vdso_clock_ns();
+    unsigned long read_sum = read_file(fd);
+    report("read, first run", vdso_clock_ns() - start, size);
+    start = vdso_clock_ns();
+    for (int i = 0; i < RUNS; i++) {
+        read_file(fd);
+    }
+    report("read, cached", (vdso_clock_ns() - start) / RUNS, size);
+
+    const unsigned char *map =
+        call_sys_mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        die("fs_bench: mmap failed\r\n");
+    }
+    start = vdso_clock_ns();
+    unsigned long map_sum = checksum(map, size, 0);
+    report("mmap, first run", vdso_clock_ns() - start, size);
+    start = vdso_clock_ns();
+    for (int i = 0; i < RUNS; i++) {
+        sink = checksum(map, size, 0);
+    }
+    report("mmap, mapped", (vdso_clock_ns() - start) / RUNS, size);
+
+    // A read from the middle of the file must match the mapping too.
+    long offset = size / 2;
+    long n = -1;
+    if (call_sys_lseek(fd, offset, SEEK_SET) == offset) {
+        n = call_sys_read(fd, buf, 16);
+    }
+    if (n <= 0 || checksum((unsigned char *)buf, n, 0) !=
+                      checksum(map + offset, n, 0)) {
+        map_sum = ~read_sum;
+    }
+    call_sys_write(read_sum == map_sum ? "read and mmap agree\r\n"
+                                       : "read and mmap DIFFER\r\n");
+
+    call_sys_munmap((void *)map, size);
+    call_sys_close(fd);
+    return 0;
+}
@@ -0,0 +1,126 @@
+#include "mutex.h"
+#include "print.h"
+#include "user_sys.h"
+
+// Contention benchmark for the futex based mutex. Run it with the
+// "init=/futex_bench" boot option. NR_THREADS threads increment a shared
+// counter ITERATIONS times each, first with the mutex and then with a plain
+// EL0 spinlock (which keeps spinning while the owner is preempted). For each
+// run, it prints the time per increment, the final counter (to check that the
+// lock works) and the number of futex syscalls, which should be 0 when
+// uncontended.
+
+#define NR_THREADS 4
+#define ITERATIONS 20000
+#define THREAD_STACK_SIZE 2048
+
+// A run's threads may still be exiting when the next run starts, so every run
+// gets its own stacks.
+#define NR_RUNS 2
+static char stacks[NR_RUNS][NR_THREADS][THREAD_STACK_SIZE]
+    __attribute__((aligned(16)));
+
+static struct mutex mutex = MUTEX_INIT;
+static unsigned int spinlock;
+static unsigned long counter;
+
+// There's no way to wait for a task to exit, so the threads count themselves
+// out here and wake up main.
+static unsigned int finished;
+
+static void thread_done(void) {
+    __atomic_add_fetch(&finished, 1, __ATOMIC_RELEASE);
+    call_sys_futex(&finished, FUTEX_WAKE, 1);
+}
+
+static void wait_threads(void) {
+    unsigned int f;
+    while ((f = __atomic_load_n(&finished, __ATOMIC_ACQUIRE)) != NR_THREADS) {
+        call_sys_futex(&finished, FUTEX_WAIT, f);
+    }
+}
+
+static void spin_lock(unsigned int *lock) {
+    while (__atomic_exchange_n(lock, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(lock, __ATOMIC_RELAXED)) {
+        }
+    }
+}
+
+static void spin_unlock(unsigned int *lock) {
+    __atomic_store_n(lock, 0, __ATOMIC_RELEASE);
+}
+
+static int mutex_worker(void *arg) {
+    for (int i = 0; i < ITERATIONS; i++) {
+        mutex_lock(&mutex);
+        counter++;
+        mutex_unlock(&mutex);
+    }
+    thread_done();
+    return 0;
+}
+
+static int spin_worker(void *arg) {
+    for (int i = 0; i < ITERATIONS; i++) {
+        spin_lock(&spinlock);
+        counter++;
+        spin_unlock(&spinlock);
+    }
+    thread_done();
+    return 0;
+}
+
+static void report(char *name, unsigned long ns, unsigned long ops,
+                   unsigned long calls) {
+    call_sys_write(name);
+    call_sys_write(": ");
+    print_number(ns / ops);
+    call_sys_write(" ns/op, counter ");
+    print_number(counter);
+    call_sys_write(", futex calls ");
+    print_number(calls);
+    call_sys_write("\r\n");
+}
+
+static void run(char *name, int (*worker)(void *),
+                char (*run_stacks)[THREAD_STACK_SIZE]) {
+    counter = 0;
+    finished = 0;
+    unsigned long calls = futex_calls();
+    unsigned long start = vdso_clock_ns();
+
+    for (int i = 0; i < NR_THREADS; i++) {
+        if (clone(worker, run_stacks[i] + THREAD_STACK_SIZE, CLONE_VM, 0) < 0) {
+            die("futex_bench: clone failed\r\n");
+        }
+    }
+    wait_threads();
+
+    unsigned long ns = vdso_clock_ns() - start;
+    report(name, ns, NR_THREADS * ITERATIONS, futex_calls() - calls);
+}
+
+int main() {
+    call_sys_write("futex_bench: ");
+    print_number(NR_THREADS);
+    call_sys_write(" threads, ");
+    print_number(ITERATIONS);
+    call_sys_write(" iterations each\r\n");
+
+    // Baseline: a single thread never sleeps, so this is just the atomics.
+    counter = 0;
+    unsigned long calls = futex_calls();
+    unsigned long start = vdso_clock_ns();
+    for (int i = 0; i < ITERATIONS; i++) {
+        mutex_lock(&mutex);
+        counter++;
+        mutex_unlock(&mutex);
+    }
+    report("uncontended mutex", vdso_clock_ns() - start, ITERATIONS,
+           futex_calls() - calls);
+
+    run("contended mutex", mutex_worker, stacks[0]);
+    run("contended spinlock", spin_worker, stacks[1]);
+    return 0;
+}
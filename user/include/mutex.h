@@ -0,0 +1,23 @@
+#ifndef _MUTEX_H
+#define _MUTEX_H
+
+// A mutex for threads (or processes sharing memory) built on futexes (see
+// lib/mutex.c). Locking and unlocking an uncontended mutex is a single atomic
+// instruction sequence; only contended ones make syscalls.
+struct mutex {
+    // 0: unlocked, 1: locked, 2: locked and somebody may be waiting.
+    unsigned int state;
+};
+
+#define MUTEX_INIT \
+    { 0 }
+
+void mutex_lock(struct mutex *m);
+int mutex_trylock(struct mutex *m);
+void mutex_unlock(struct mutex *m);
+
+// Number of futex syscalls made so far by every task (from the kernel's
+// syscall_stats), to check that uncontended locking stays in user space.
+unsigned long futex_calls(void);
+
+#endif /*_MUTEX_H */
@@ -0,0 +1,9 @@
+#ifndef _PRINT_H
+#define _PRINT_H
+
+// Output helpers on top of call_sys_write (see lib/print.c).
+void print_number(unsigned long n);
+// Prints msg and exits.
+void die(char *msg);
+
+#endif /*_PRINT_H */
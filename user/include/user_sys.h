@@ -0,0 +1,50 @@
+#ifndef _USER_SYS_H
+#define _USER_SYS_H
+
+#include "sys.h"
+
+void call_sys_write(char* buf);
+int call_sys_fork();
+void call_sys_exit();
+int call_sys_getpid();
+int call_sys_syscall_stats(struct syscall_stat *buf, unsigned long count);
+long call_sys_nanosleep(unsigned long ns);
+int call_sys_sched_stats(struct sched_stats *buf);
+int call_sys_exec(const char *path);
+int call_sys_clone(unsigned long flags, void *stack);
+int call_sys_futex(unsigned int *uaddr, int op, unsigned int val);
+int call_sys_pipe(int *fds);
+long call_sys_read(int fd, char *buf, unsigned long count);
+long call_sys_write_fd(int fd, const char *buf, unsigned long count);
+int call_sys_close(int fd);
+// Returns the address of the mapping or MAP_FAILED.
+void *call_sys_mmap(void *addr, unsigned long len, int prot, int flags, int fd,
+                    unsigned long offset);
+int call_sys_munmap(void *addr, unsigned long len);
+int call_sys_shm_open(const char *name, unsigned long size);
+int call_sys_shm_unlink(const char *name);
+int call_sys_sched_setscheduler(int pid, int policy, int priority);
+int call_sys_setpriority(int pid, int priority);
+int call_sys_getrusage(int who, struct rusage *buf);
+int call_sys_open(const char *path, int flags);
+long call_sys_lseek(int fd, long offset, int whence);
+
+#define MAP_FAILED ((void *)-1)
+
+// Starts fn(arg) in a new task running on stack (the top of it, it grows
+// down). With CLONE_VM, the task is a thread sharing our address space. The
+// task exits when fn returns. stack must be 16 byte aligned. Returns the pid
+// of the task or -1.
+int clone(int (*fn)(void *), void *stack, unsigned long flags, void *arg);
+
+// vDSO helpers (see lib/vdso.c). These don't trap into the kernel.
+int vdso_getpid(void);
+int vdso_getcpu(void);
+unsigned long vdso_ticks(void);
+unsigned long vdso_clock_ns(void);
+
+extern void user_delay(unsigned long);
+extern unsigned long get_sp(void);
+extern unsigned long get_pc(void);
+
+#endif /*_USER_SYS_H */
\ No newline at end of file
@@ -0,0 +1,98 @@
+#include "print.h"
+#include "user_sys.h"
+
+void print_pid() {
+    char msg[] = {'0' + vdso_getpid(), '\0'};
+    call_sys_write(msg);
+}
+
+// Every 5 seconds, prints the percentage of time in which the CPU had nothing
+// else to run and how many times it went to sleep waiting for an interrupt.
+// Since the other processes sleep between characters instead of spinning, the
+// percentage should stay close to 100%.
+void idle_monitor() {
+    struct sched_stats prev, now;
+    call_sys_sched_stats(&prev);
+    unsigned long prev_ns = vdso_clock_ns();
+
+    while (1) {
+        call_sys_nanosleep(5000000000UL);
+        call_sys_sched_stats(&now);
+        unsigned long now_ns = vdso_clock_ns();
+
+        unsigned long total = now_ns - prev_ns;
+        unsigned long idle = now.idle_ns - prev.idle_ns;
+        call_sys_write("\r\nidle: ");
+        print_number(total ? idle * 100 / total : 0);
+        call_sys_write("%, ");
+        print_number(now.idle_sleeps - prev.idle_sleeps);
+        call_sys_write(" sleeps\r\n");
+
+        prev = now;
+        prev_ns = now_ns;
+    }
+}
+
+void loop(char *str) {
+    call_sys_write("\r\nStarting up process with pid: ");
+    print_pid();
+    call_sys_write("\r\n");
+
+    char buf[2];
+    while (1) {
+        char c;
+        int i = 0;
+        while ((c = str[i++]) != '\0') {
+            buf[0] = c;
+            buf[1] = '\0';
+            call_sys_write(buf);
+            // Sleep instead of spinning in user_delay so that the CPU is free
+            // for the other processes (or idle) in the meantime.
+            call_sys_nanosleep(100000000 / vdso_getpid());
+        }
+    }
+}
+
+int fork_or_exit() {
+    int pid = call_sys_fork();
+    if (pid < 0) {
+        call_sys_write("Error calling sys_fork\r\n");
+        call_sys_exit();
+        return -1;
+    }
+    return pid;
+}
+
+void fork_and_run_loop(char *str) {
+    int pid = fork_or_exit();
+    if (pid == 0) {
+        loop(str);
+    }
+}
+
+// The first user program. The kernel runs it as /init (see kernel_process).
+int main() {
+    call_sys_write("User process started\n\r");
+
+    fork_and_run_loop("abcde");
+    fork_and_run_loop("12345");
+    fork_and_run_loop("!@#$^&");
+    fork_and_run_loop("wxyz");
+
+    if (fork_or_exit() == 0) {
+        idle_monitor();
+    }
+
+    // Let the parent live and let the newly created process fall through to the
+    // call_sys_exit
+    int pid = fork_or_exit();
+    if (pid > 0) {
+        loop("mnopqr");
+    }
+
+    call_sys_write("\n\r\n\rExiting! pid: ");
+    print_pid();
+    call_sys_write("\n\r\n\r");
+    // Returning from main makes crt0 call call_sys_exit.
+    return 0;
+}
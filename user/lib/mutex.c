@@ -0,0 +1,45 @@
+#include "mutex.h"
+#include "user_sys.h"
+
+// The three state mutex from Ulrich Drepper's "Futexes Are Tricky". The state
+// is 2 whenever there may be sleepers, so unlock only has to call FUTEX_WAKE
+// when it sees a 2.
+
+int mutex_trylock(struct mutex *m) {
+    unsigned int c = 0;
+    return __atomic_compare_exchange_n(&m->state, &c, 1, 0, __ATOMIC_ACQUIRE,
+                                       __ATOMIC_RELAXED);
+}
+
+void mutex_lock(struct mutex *m) {
+    unsigned int c = 0;
+    if (__atomic_compare_exchange_n(&m->state, &c, 1, 0, __ATOMIC_ACQUIRE,
+                                    __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    // Contended: mark it (so the owner wakes us up) and sleep until we are
+    // the ones who find it unlocked. Since we can't tell whether there are
+    // other sleepers, we always take it in the contended state.
+    if (c != 2) {
+        c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+    }
+    while (c != 0) {
+        call_sys_futex(&m->state, FUTEX_WAIT, 2);
+        c = __atomic_exchange_n(&m->state, 2, __ATOMIC_ACQUIRE);
+    }
+}
+
+void mutex_unlock(struct mutex *m) {
+    if (__atomic_exchange_n(&m->state, 0, __ATOMIC_RELEASE) == 2) {
+        call_sys_futex(&m->state, FUTEX_WAKE, 1);
+    }
+}
+
+unsigned long futex_calls(void) {
+    struct syscall_stat stats[__NR_syscalls];
+    if (call_sys_syscall_stats(stats, __NR_syscalls) <= SYS_FUTEX_NUMBER) {
+        return 0;
+    }
+    return stats[SYS_FUTEX_NUMBER].count;
+}
@@ -0,0 +1,18 @@
+#include "print.h"
+#include "user_sys.h"
+
+void print_number(unsigned long n) {
+    char buf[21];
+    int i = sizeof(buf) - 1;
+    buf[i] = '\0';
+    do {
+        buf[--i] = '0' + n % 10;
+        n /= 10;
+    } while (n > 0);
+    call_sys_write(&buf[i]);
+}
+
+void die(char *msg) {
+    call_sys_write(msg);
+    call_sys_exit();
+}
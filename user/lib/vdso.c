@@ -0,0 +1,41 @@
+#include "user_sys.h"
+#include "vdso.h"
+
+// These helpers are part of the user runtime and read the vDSO data page
+// directly, so they cost a load instead of an svc.
+
+static inline volatile struct vdso_data *vdso_data(void) {
+    return (volatile struct vdso_data *)VDSO_DATA_ADDR;
+}
+
+int vdso_getpid(void) { return vdso_data()->pid; }
+
+// tpidrro_el0 is read-only at EL0 and holds the number of the CPU (see
+// percpu_init), so this is right even for threads sharing the vDSO page.
+int vdso_getcpu(void) {
+    unsigned long cpu;
+    asm volatile("mrs %0, tpidrro_el0" : "=r"(cpu));
+    return cpu;
+}
+
+unsigned long vdso_ticks(void) {
+    unsigned long ticks;
+    asm volatile("isb; mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+}
+
+// Monotonic time in nanoseconds since the kernel booted. Whole seconds and the
+// remainder are converted separately so that the multiplication can't
+// overflow: rem < clock_freq, so rem * clock_mult < NSEC_PER_SEC << SHIFT.
+unsigned long vdso_clock_ns(void) {
+    volatile struct vdso_data *data = vdso_data();
+    unsigned long freq = data->clock_freq;
+    if (!freq) {
+        return 0;
+    }
+
+    unsigned long delta = vdso_ticks() - data->clock_base;
+    unsigned long sec = delta / freq;
+    unsigned long rem = delta - sec * freq;
+    return sec * NSEC_PER_SEC + ((rem * data->clock_mult) >> VDSO_CLOCK_SHIFT);
+}
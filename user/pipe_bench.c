@@ -0,0 +1,92 @@
+#include "print.h"
+#include "user_sys.h"
+
+// Pipe throughput benchmark. Run it with the "init=/pipe_bench" boot option.
+// For every buffer size, a child reads TOTAL_BYTES from a pipe while the parent
+// writes them, and the parent prints the throughput once the child confirms
+// that it got everything. Each size runs twice: with page aligned buffers,
+// where whole pages move between the processes without being copied (see
+// src/pipe.c), and with buffers that are off by a few bytes, which are always
+// copied in and out of the pipe.
+
+#define PAGE_SIZE 4096
+#define TOTAL_BYTES (1024 * 1024)
+#define MISALIGN 64
+
+static unsigned long sizes[] = {64, 512, PAGE_SIZE, 4 * PAGE_SIZE};
+#define NR_SIZES (sizeof(sizes) / sizeof(sizes[0]))
+
+// Used by both the writer and the reader (each one has its own copy after
+// fork). One extra page for the misaligned runs.
+static char buf[4 * PAGE_SIZE + PAGE_SIZE] __attribute__((aligned(PAGE_SIZE)));
+
+static void reader(int data_fd, int ack_fd, char *dst, unsigned long size) {
+    unsigned long total = 0;
+    while (total < TOTAL_BYTES) {
+        long n = call_sys_read(data_fd, dst, size);
+        if (n <= 0) {
+            die("pipe_bench: read failed\r\n");
+        }
+        total += n;
+    }
+    call_sys_write_fd(ack_fd, "k", 1);
+    call_sys_exit();
+}
+
+static void run(unsigned long size, int aligned) {
+    char *data = aligned ? buf : buf + MISALIGN;
+    int data_fds[2], ack_fds[2];
+    if (call_sys_pipe(data_fds) < 0 || call_sys_pipe(ack_fds) < 0) {
+        die("pipe_bench: pipe failed\r\n");
+    }
+
+    int pid = call_sys_fork();
+    if (pid < 0) {
+        die("pipe_bench: fork failed\r\n");
+    }
+    if (pid == 0) {
+        call_sys_close(data_fds[1]);
+        call_sys_close(ack_fds[0]);
+        reader(data_fds[0], ack_fds[1], data, size);
+    }
+    call_sys_close(data_fds[0]);
+    call_sys_close(ack_fds[1]);
+
+    unsigned long start = vdso_clock_ns();
+    for (unsigned long sent = 0; sent < TOTAL_BYTES; sent += size) {
+        if (call_sys_write_fd(data_fds[1], data, size) != size) {
+            die("pipe_bench: write failed\r\n");
+        }
+    }
+    char ack;
+    if (call_sys_read(ack_fds[0], &ack, 1) != 1) {
+        die("pipe_bench: no ack from the reader\r\n");
+    }
+    unsigned long ns = vdso_clock_ns() - start;
+
+    call_sys_close(data_fds[1]);
+    call_sys_close(ack_fds[0]);
+
+    print_number(size);
+    call_sys_write(aligned ? " bytes, aligned: " : " bytes, misaligned: ");
+    // bytes / ns * 1000 = MB/s
+    print_number(ns ? TOTAL_BYTES * 1000UL / ns : 0);
+    call_sys_write(" MB/s\r\n");
+}
+
+int main() {
+    call_sys_write("pipe_bench: ");
+    print_number(TOTAL_BYTES);
+    call_sys_write(" bytes per run\r\n");
+
+    // Fault the buffer in once, so the first run doesn't pay for it.
+    for (unsigned long i = 0; i < sizeof(buf); i += PAGE_SIZE) {
+        buf[i] = 1;
+    }
+
+    for (int i = 0; i < NR_SIZES; i++) {
+        run(sizes[i], 1);
+        run(sizes[i], 0);
+    }
+    return 0;
+}
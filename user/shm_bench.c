@@ -0,0 +1,237 @@
+#include "mutex.h"
+#include "print.h"
+#include "user_sys.h"
+
+// Producer/consumer benchmark over shared memory. Run it with the
+// "init=/shm_bench" boot option. The parent sends NR_MESSAGES messages of
+// MSG_SIZE bytes to a forked child through a ring that lives in a shared
+// mapping. Neither side makes a syscall per message: they only sleep on a
+// futex when the ring is empty (consumer) or full (producer). The ring is set
+// up in two ways:
+//   - anonymous: MAP_SHARED | MAP_ANONYMOUS, inherited through fork.
+//   - named: a shm_open object that the child maps again by name after
+//     dropping the mapping it inherited.
+// For reference, the same messages are also sent through a pipe, which takes
+// two syscalls per message.
+
+#define NR_MESSAGES 100000
+#define MSG_SIZE 64
+#define RING_SLOTS 64
+#define SHM_NAME "/shm_bench"
+
+struct message {
+    unsigned long seq;
+    char payload[MSG_SIZE - sizeof(unsigned long)];
+};
+
+// head is only written by the producer and tail by the consumer, so they live
+// in different cache lines. A side that goes to sleep sets its waiting flag
+// first, so the other side knows that it has to call futex.
+struct ring {
+    unsigned int head;
+    unsigned int consumer_waiting;
+    char pad0[56];
+    unsigned int tail;
+    unsigned int producer_waiting;
+    char pad1[56];
+    // done is set by the consumer once it checked every message, error if
+    // one of them was wrong.
+    unsigned int done;
+    unsigned int error;
+    char pad2[56];
+    struct message slots[RING_SLOTS];
+};
+
+// Sleeps until *word is no longer val. *waiting tells the other side to wake
+// us up; it's checked after it publishes a new value, and we check the value
+// after setting the flag (both sequentially consistent), so one of the two
+// always sees the other.
+static void wait_change(unsigned int *word, unsigned int val,
+                        unsigned int *waiting) {
+    __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(word, __ATOMIC_SEQ_CST) == val) {
+        call_sys_futex(word, FUTEX_WAIT, val);
+    }
+    __atomic_store_n(waiting, 0, __ATOMIC_RELAXED);
+}
+
+static void publish(unsigned int *word, unsigned int val,
+                    unsigned int *waiting) {
+    __atomic_store_n(word, val, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(waiting, __ATOMIC_SEQ_CST)) {
+        call_sys_futex(word, FUTEX_WAKE, 1);
+    }
+}
+
+static void fill(struct message *msg, unsigned long seq) {
+    msg->seq = seq;
+    for (int i = 0; i < sizeof(msg->payload); i++) {
+        msg->payload[i] = (char)(seq + i);
+    }
+}
+
+static int check(struct message *msg, unsigned long seq) {
+    if (msg->seq != seq) {
+        return 0;
+    }
+    for (int i = 0; i < sizeof(msg->payload); i++) {
+        if (msg->payload[i] != (char)(seq + i)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static void producer(struct ring *ring) {
+    unsigned int head = 0;
+    for (unsigned long seq = 0; seq < NR_MESSAGES; seq++) {
+        unsigned int tail;
+        while (head - (tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE)) ==
+               RING_SLOTS) {
+            wait_change(&ring->tail, tail, &ring->producer_waiting);
+        }
+        fill(&ring->slots[head % RING_SLOTS], seq);
+        publish(&ring->head, ++head, &ring->consumer_waiting);
+    }
+}
+
+static void consumer(struct ring *ring) {
+    unsigned int tail = 0;
+    unsigned int error = 0;
+    for (unsigned long seq = 0; seq < NR_MESSAGES; seq++) {
+        while (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail) {
+            wait_change(&ring->head, tail, &ring->consumer_waiting);
+        }
+        if (!check(&ring->slots[tail % RING_SLOTS], seq)) {
+            error = 1;
+        }
+        publish(&ring->tail, ++tail, &ring->producer_waiting);
+    }
+    ring->error = error;
+    __atomic_store_n(&ring->done, 1, __ATOMIC_RELEASE);
+    call_sys_futex(&ring->done, FUTEX_WAKE, 1);
+}
+
+static void report(char *name, unsigned long ns, unsigned long calls,
+                   int error) {
+    call_sys_write(name);
+    call_sys_write(": ");
+    print_number(ns / NR_MESSAGES);
+    call_sys_write(" ns/message, futex calls ");
+    print_number(calls);
+    call_sys_write(error ? ", BAD DATA\r\n" : "\r\n");
+}
+
+// The parent produces, the child consumes. named says whether the ring comes
+// from the shared memory object SHM_NAME (fd) or an anonymous mapping.
+static void run_ring(char *name, struct ring *ring, int named, int fd) {
+    unsigned long calls = futex_calls();
+    unsigned long start = vdso_clock_ns();
+
+    int pid = call_sys_fork();
+    if (pid < 0) {
+        die("shm_bench: fork failed\r\n");
+    }
+    if (pid == 0) {
+        if (named) {
+            // Drop what fork gave us and find the object by its name, like an
+            // unrelated process would.
+            call_sys_munmap(ring, sizeof(*ring));
+            call_sys_close(fd);
+            fd = call_sys_shm_open(SHM_NAME, 0);
+            ring = call_sys_mmap(0, sizeof(*ring), PROT_READ | PROT_WRITE,
+                                 MAP_SHARED, fd, 0);
+            if (fd < 0 || ring == MAP_FAILED) {
+                die("shm_bench: can't map " SHM_NAME " in the child\r\n");
+            }
+        }
+        consumer(ring);
+        call_sys_exit();
+    }
+
+    producer(ring);
+    while (!__atomic_load_n(&ring->done, __ATOMIC_ACQUIRE)) {
+        call_sys_futex(&ring->done, FUTEX_WAIT, 0);
+    }
+    report(name, vdso_clock_ns() - start, futex_calls() - calls, ring->error);
+}
+
+static void run_pipe(void) {
+    int fds[2], ack_fds[2];
+    if (call_sys_pipe(fds) < 0 || call_sys_pipe(ack_fds) < 0) {
+        die("shm_bench: pipe failed\r\n");
+    }
+    unsigned long start = vdso_clock_ns();
+
+    struct message msg;
+    int pid = call_sys_fork();
+    if (pid < 0) {
+        die("shm_bench: fork failed\r\n");
+    }
+    if (pid == 0) {
+        call_sys_close(fds[1]);
+        call_sys_close(ack_fds[0]);
+        char ok = 1;
+        for (unsigned long seq = 0; seq < NR_MESSAGES; seq++) {
+            if (call_sys_read(fds[0], (char *)&msg, sizeof(msg)) !=
+                    sizeof(msg) ||
+                !check(&msg, seq)) {
+                ok = 0;
+                break;
+            }
+        }
+        call_sys_write_fd(ack_fds[1], &ok, 1);
+        call_sys_exit();
+    }
+    call_sys_close(fds[0]);
+    call_sys_close(ack_fds[1]);
+
+    for (unsigned long seq = 0; seq < NR_MESSAGES; seq++) {
+        fill(&msg, seq);
+        if (call_sys_write_fd(fds[1], (char *)&msg, sizeof(msg)) !=
+            sizeof(msg)) {
+            die("shm_bench: write failed\r\n");
+        }
+    }
+    // Wait for the reader to check the last messages, like with the ring.
+    char ok = 0;
+    call_sys_read(ack_fds[0], &ok, 1);
+    report("pipe", vdso_clock_ns() - start, 0, !ok);
+
+    call_sys_close(fds[1]);
+    call_sys_close(ack_fds[0]);
+}
+
+int main() {
+    call_sys_write("shm_bench: ");
+    print_number(NR_MESSAGES);
+    call_sys_write(" messages of ");
+    print_number(MSG_SIZE);
+    call_sys_write(" bytes\r\n");
+
+    struct ring *ring =
+        call_sys_mmap(0, sizeof(*ring), PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) {
+        die("shm_bench: anonymous mmap failed\r\n");
+    }
+    run_ring("anonymous shared ring", ring, 0, -1);
+    call_sys_munmap(ring, sizeof(*ring));
+
+    int fd = call_sys_shm_open(SHM_NAME, sizeof(*ring));
+    if (fd < 0) {
+        die("shm_bench: shm_open failed\r\n");
+    }
+    ring = call_sys_mmap(0, sizeof(*ring), PROT_READ | PROT_WRITE, MAP_SHARED,
+                         fd, 0);
+    if (ring == MAP_FAILED) {
+        die("shm_bench: mmap of " SHM_NAME " failed\r\n");
+    }
+    run_ring("named shared ring", ring, 1, fd);
+    call_sys_munmap(ring, sizeof(*ring));
+    call_sys_close(fd);
+    call_sys_shm_unlink(SHM_NAME);
+
+    run_pipe();
+    return 0;
+}